@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+#include <dbus/dbus.h>
+
+#include <libngf/client.h>
+
+/*
+ * Plays a single event and waits for it to finish, driving libngf from a
+ * plain epoll loop without GLib:
+ *
+ *   ngf-epoll-client EVENT [KEY=VALUE]...
+ */
+
+typedef struct _EpollClient
+{
+    int             epfd;
+    int             fd;
+    uint32_t        event_id;
+    int             done;
+    int             return_value;
+} EpollClient;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void
+interrupt_cb (int signum)
+{
+    (void) signum;
+    interrupted = 1;
+}
+
+static void
+client_callback_cb (NgfClient *client, uint32_t event_id, NgfEventState state, void *userdata)
+{
+    EpollClient *c = (EpollClient*) userdata;
+
+    (void) client;
+
+    switch (state) {
+        case NGF_EVENT_FAILED:
+            printf ("Failed (event_id=%u)\n", event_id);
+            c->return_value = 1;
+            c->done = 1;
+            break;
+        case NGF_EVENT_COMPLETED:
+            printf ("Completed (event_id=%u)\n", event_id);
+            c->done = 1;
+            break;
+        case NGF_EVENT_PLAYING:
+            printf ("Playing (event_id=%u)\n", event_id);
+            break;
+        case NGF_EVENT_PAUSED:
+            printf ("Paused (event_id=%u)\n", event_id);
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+update_events (EpollClient *c, NgfClient *client, int op)
+{
+    struct epoll_event ev;
+    int events = 0;
+
+    memset (&ev, 0, sizeof (ev));
+    c->fd = ngf_client_get_fd (client, &events);
+    ev.events = events;
+    epoll_ctl (c->epfd, op, c->fd, &ev);
+}
+
+static NgfProplist*
+parse_properties (int argc, char *argv[])
+{
+    NgfProplist *p = ngf_proplist_new ();
+    char *key = NULL, *value = NULL;
+    int i;
+
+    for (i = 2; i < argc; i++) {
+        key = strdup (argv[i]);
+        if ((value = strchr (key, '=')) != NULL) {
+            *value++ = '\0';
+            ngf_proplist_sets (p, key, value);
+        }
+        free (key);
+    }
+
+    return p;
+}
+
+int
+main (int argc, char *argv[])
+{
+    EpollClient c;
+    DBusConnection *connection = NULL;
+    NgfClient *client = NULL;
+    NgfProplist *p = NULL;
+    struct epoll_event ev;
+
+    if (argc < 2) {
+        fprintf (stderr, "Usage: %s EVENT [KEY=VALUE]...\n", argv[0]);
+        return 1;
+    }
+
+    memset (&c, 0, sizeof (c));
+    signal (SIGINT, interrupt_cb);
+
+    if ((connection = dbus_bus_get (DBUS_BUS_SYSTEM, NULL)) == NULL)
+        return 1;
+
+    if ((client = ngf_client_create (NGF_TRANSPORT_DBUS, connection)) == NULL)
+        return 1;
+
+    ngf_client_set_callback (client, client_callback_cb, &c);
+
+    c.epfd = epoll_create1 (0);
+    update_events (&c, client, EPOLL_CTL_ADD);
+
+    p = parse_properties (argc, argv);
+    c.event_id = ngf_client_play_event (client, argv[1], p);
+    ngf_proplist_free (p);
+
+    printf ("PLAY (event=%s, event_id=%u)\n", argv[1], c.event_id);
+    if (c.event_id == 0)
+        c.done = 1;
+
+    while (!c.done) {
+        if (interrupted) {
+            ngf_client_stop_event (client, c.event_id);
+            interrupted = 0;
+        }
+
+        if (epoll_wait (c.epfd, &ev, 1, ngf_client_get_timeout (client)) < 0 && !interrupted)
+            break;
+
+        if (!ngf_client_dispatch (client))
+            break;
+
+        update_events (&c, client, EPOLL_CTL_MOD);
+    }
+
+    close (c.epfd);
+    ngf_client_destroy (client);
+    dbus_connection_unref (connection);
+
+    return c.return_value;
+}
@@ -0,0 +1,162 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <poll.h>
+#include <glib.h>
+
+#include "client.h"
+#include "client-glib.h"
+
+typedef struct _NgfSource
+{
+    GSource     source;
+    NgfClient   *client;
+    GPollFD     poll_fd;
+    guint       max_callbacks;
+} NgfSource;
+
+static gushort
+_poll_condition (int events)
+{
+    gushort condition = G_IO_HUP | G_IO_ERR;
+
+    if (events & POLLIN)
+        condition |= G_IO_IN;
+
+    if (events & POLLOUT)
+        condition |= G_IO_OUT;
+
+    return condition;
+}
+
+static gboolean
+_source_prepare (GSource *source,
+                 gint *timeout)
+{
+    NgfSource *s = (NgfSource*) source;
+    int events = 0;
+
+    /* Wanted events change with the outgoing queue, GLib picks up the
+       GPollFD contents after prepare. */
+
+    s->poll_fd.fd = ngf_client_get_fd (s->client, &events);
+    s->poll_fd.events = _poll_condition (events);
+
+    if (ngf_client_get_pending_callbacks (s->client) > 0) {
+        *timeout = 0;
+        return TRUE;
+    }
+
+    *timeout = ngf_client_get_timeout (s->client);
+    return *timeout == 0;
+}
+
+static gboolean
+_source_check (GSource *source)
+{
+    NgfSource *s = (NgfSource*) source;
+
+    return s->poll_fd.revents != 0 ||
+           ngf_client_get_pending_callbacks (s->client) > 0 ||
+           ngf_client_get_timeout (s->client) == 0;
+}
+
+static gboolean
+_source_dispatch (GSource *source,
+                  GSourceFunc callback,
+                  gpointer userdata)
+{
+    NgfSource *s = (NgfSource*) source;
+    int connected = 1;
+
+    (void) callback;
+    (void) userdata;
+
+    /* Only touch the connection when there is something to do for it,
+       iterations that just drain the queue stay syscall free. */
+
+    if (s->poll_fd.revents != 0 || ngf_client_get_timeout (s->client) == 0) {
+        s->poll_fd.revents = 0;
+        connected = ngf_client_dispatch (s->client);
+    }
+
+    ngf_client_deliver_callbacks (s->client, s->max_callbacks);
+
+    if (!connected && ngf_client_get_pending_callbacks (s->client) == 0)
+        return FALSE;
+
+    return TRUE;
+}
+
+static void
+_source_finalize (GSource *source)
+{
+    NgfSource *s = (NgfSource*) source;
+
+    ngf_client_set_deferred_callbacks (s->client, 0);
+}
+
+static GSourceFuncs ngf_source_funcs = {
+    _source_prepare,
+    _source_check,
+    _source_dispatch,
+    _source_finalize,
+    NULL,
+    NULL
+};
+
+GSource*
+ngf_client_source_new (NgfClient *client,
+                       gint priority,
+                       guint max_callbacks)
+{
+    NgfSource *s = NULL;
+
+    if (client == NULL)
+        return NULL;
+
+    if (ngf_client_get_fd (client, NULL) < 0)
+        return NULL;
+
+    s = (NgfSource*) g_source_new (&ngf_source_funcs, sizeof (NgfSource));
+    s->client = client;
+    s->poll_fd.fd = -1;
+    s->max_callbacks = max_callbacks;
+
+    ngf_client_set_deferred_callbacks (client, 1);
+
+    g_source_set_priority ((GSource*) s, priority);
+    g_source_add_poll ((GSource*) s, &s->poll_fd);
+
+    return (GSource*) s;
+}
+
+void
+ngf_client_source_set_max_callbacks (GSource *source,
+                                     guint max_callbacks)
+{
+    NgfSource *s = (NgfSource*) source;
+
+    if (s == NULL || source->source_funcs != &ngf_source_funcs)
+        return;
+
+    s->max_callbacks = max_callbacks;
+}
@@ -0,0 +1,78 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef NGF_CLIENT_GLIB_H
+#define NGF_CLIENT_GLIB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <glib.h>
+#include <libngf/client.h>
+
+/**
+ * Create a GSource that drives the client from a GLib main loop. The source
+ * polls the client's connection through ngf_client_get_fd and defers state
+ * callbacks, invoking at most max_callbacks of them per main loop iteration
+ * and carrying the rest over to the next one. Give it a priority below
+ * rendering (e.g. G_PRIORITY_DEFAULT_IDLE) to keep a burst of state updates
+ * from stalling a frame.
+ *
+ * The source takes over the main loop integration of the client's
+ * DBusConnection, so the connection must not also be set up with
+ * dbus_connection_setup_with_g_main. Destroy the source before the client;
+ * callbacks still queued at that point are delivered on finalization.
+ *
+ * @param client NgfClient instance
+ * @param priority Source priority, e.g. G_PRIORITY_DEFAULT.
+ * @param max_callbacks State callbacks per iteration, 0 for no limit.
+ * @return New GSource, attach it with g_source_attach. NULL on error.
+ *
+ * @code
+ * GSource *source = ngf_client_source_new (client, G_PRIORITY_LOW, 8);
+ * g_source_attach (source, NULL);
+ * g_source_unref (source);
+ * ...
+ * g_source_destroy (source);
+ * ngf_client_destroy (client);
+ * @endcode
+ */
+
+GSource* ngf_client_source_new (NgfClient *client,
+                                gint priority,
+                                guint max_callbacks);
+
+/**
+ * Change the number of state callbacks invoked per main loop iteration.
+ *
+ * @param source GSource returned by ngf_client_source_new
+ * @param max_callbacks State callbacks per iteration, 0 for no limit.
+ */
+
+void ngf_client_source_set_max_callbacks (GSource *source,
+                                          guint max_callbacks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NGF_CLIENT_GLIB_H */
@@ -21,509 +21,4672 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dbus/dbus.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "list_p.h"
+#include "clock_p.h"
+#include "protocol_p.h"
+#include "worker_p.h"
+#include "ring_p.h"
+#include "timers_p.h"
+#include "transport_p.h"
 #include "proplist.h"
 #include "client.h"
 
-/** DBus name for NGF */
-#define NGF_DBUS_NAME               "com.nokia.NonGraphicFeedback1.Backend"
+/** Default time match and filter are kept after the last event finishes */
+#define NGF_DEFAULT_IDLE_TIMEOUT    5000
 
-/** DBus path for NGF */
-#define NGF_DBUS_PATH               "/com/nokia/NonGraphicFeedback1"
+/** Initial size of the deferred state change queue, power of two */
+#define NGF_QUEUE_INITIAL_SIZE      16
 
-/** DBus interface for NGF */
-#define NGF_DBUS_IFACE              "com.nokia.NonGraphicFeedback1"
+/** Maximum number of lanes per client, the default lane included */
+#define NGF_MAX_LANES               4
 
-/** DBus method for playing event */
-#define NGF_DBUS_METHOD_PLAY        "Play"
+/** Minimum period between sweeps for expired active events */
+#define NGF_SWEEP_INTERVAL          1000
 
-/** DBus method for stopping event */
-#define NGF_DBUS_METHOD_STOP        "Stop"
+#define NGF_INDEX_INITIAL_SIZE      16
 
-/** DBus method for pausing/resuming event */
-#define NGF_DBUS_METHOD_PAUSE       "Pause"
+/** Default capacity of the status ring, power of two */
+#define NGF_STATUS_RING_DEFAULT_SIZE 256
 
-/** DBus method call that is sent to us when the event state changes */
-#define NGF_DBUS_INTERNAL_STATUS    "Status"
+/* How soon to retry handing spilled state changes to a full status ring. */
+#define NGF_RING_RETRY_INTERVAL     10
 
-#define NGF_DBUS_MATCH "type='signal',interface='" NGF_DBUS_IFACE "',member='" NGF_DBUS_INTERNAL_STATUS "', path='" NGF_DBUS_PATH "'"
+/* Plays held back while the backend is away with NGF_BACKEND_POLICY_QUEUE. */
+#define NGF_MAX_QUEUED_PLAYS        64
 
+/* How often to look at every lane while blocked on a full window. */
+
+typedef struct _NgfLane NgfLane;
+typedef struct _NgfLaneRule NgfLaneRule;
 typedef struct _NgfReply NgfReply;
 typedef struct _NgfEvent NgfEvent;
+typedef struct _NgfCommand NgfCommand;
+typedef struct _NgfCommandArgs NgfCommandArgs;
+typedef struct _NgfPlayParams NgfPlayParams;
+typedef struct _NgfQueuedPlay NgfQueuedPlay;
+typedef struct _NgfBulkCall NgfBulkCall;
+typedef struct _NgfGroupLimit NgfGroupLimit;
+typedef struct _NgfListener NgfListener;
+typedef struct _NgfPlayKey NgfPlayKey;
+typedef struct _NgfLink NgfLink;
+typedef struct _NgfRateLimit NgfRateLimit;
+typedef struct _NgfRoute NgfRoute;
+typedef struct _NgfScheduled NgfScheduled;
+typedef struct _NgfUnicast NgfUnicast;
+
+typedef enum _NgfCommandType
+{
+    NGF_COMMAND_PLAY,
+    NGF_COMMAND_STOP,
+    NGF_COMMAND_PAUSE,
+    NGF_COMMAND_RESUME,
+    NGF_COMMAND_BACKEND_POLICY,
+    NGF_COMMAND_STOP_GROUP,
+    NGF_COMMAND_PAUSE_GROUP,
+    NGF_COMMAND_RESUME_GROUP,
+    NGF_COMMAND_GROUP_LIMIT,
+    NGF_COMMAND_DEDUP,
+    NGF_COMMAND_RATE_LIMIT,
+    NGF_COMMAND_SEND_WINDOW,
+    NGF_COMMAND_ROUTE,
+    NGF_COMMAND_PLAY_AT,
+    NGF_COMMAND_DESTROY,
+    NGF_COMMAND_CALLBACK,
+    NGF_COMMAND_BATCH_CALLBACK,
+    NGF_COMMAND_SCHEDULE_CALLBACK,
+    NGF_COMMAND_READY_CALLBACK,
+    NGF_COMMAND_REPLY_TIMEOUT,
+    NGF_COMMAND_EVENT_TIMEOUT,
+    NGF_COMMAND_IDLE_TIMEOUT
+} NgfCommandType;
+
+/* Control of an active event held for the send window. */
+typedef enum _NgfHeld
+{
+    NGF_HELD_NONE,
+    NGF_HELD_STOP,
+    NGF_HELD_PAUSE,
+    NGF_HELD_RESUME
+} NgfHeld;
+
+/* A connection of its own, so that events routed to it do not queue up
+   behind other traffic of the client. Lane 0 is the connection the client
+   was created with. */
+struct _NgfLane
+{
+    const NgfTransportOps *transport;
+    NgfConnection   *connection;
+    NgfDispatcher   *dispatcher;
+    NgfLoop         *loop;
+    uint32_t        num_events;
+};
+
+struct _NgfLaneRule
+{
+    LIST_INIT (NgfLaneRule)
+
+    char            *pattern;
+    int             lane;
+};
+
+/* Callback of a single event, takes the place of the client callback. */
+struct _NgfListener
+{
+    NgfCallback     callback;
+    void            *userdata;
+    uint32_t        state_mask;     /* 0 for every state */
+};
+
+/* Event name and properties of a play, kept while deduplicating to find
+   identical plays. */
+struct _NgfPlayKey
+{
+    char            *event;
+    NgfProplist     *proplist;
+    uint32_t        hash;
+};
+
+/* Id handed out for a play deduplicated into one already in flight. */
+struct _NgfLink
+{
+    LIST_INIT (NgfLink)
+
+    uint32_t        client_event_id;
+    uint32_t        primary_id;     /* the play actually sent */
+    NgfListener     listener;
+};
 
 struct _NgfReply
 {
     LIST_INIT (NgfReply)
 
-    DBusPendingCall *pending;
+    NgfLane         *lane;
+    const char      *service;       /* backend name of the route, NULL for the default */
+    int             matched;        /* holds the Status match of service */
+    NgfTransportCall *pending;
+    NgfGroupLimit   *limit;
+    NgfListener     listener;
+    NgfPlayKey      *key;
     uint32_t        client_event_id;
+    char            *group;
     int             stop_set;
+    int             windowed;       /* holds a slot of the window */
+    int             finished;       /* final state already reported */
 };
 
 struct _NgfEvent
 {
     LIST_INIT (NgfEvent)
 
+    NgfClient   *client;
+    NgfLane     *lane;
+    const char  *service;   /* as in NgfReply */
+    int         matched;
+    NgfEvent    *index_next;
+    NgfGroupLimit *limit;   /* while it counts against the limit */
+    NgfListener listener;
+    NgfPlayKey  *key;       /* while deduplicating */
+    char        *group;
     uint32_t    client_event_id;
     uint32_t    server_event_id;
+    int         state;      /* last status, -1 until the first one */
+    int         paused;     /* last pause requested or reported */
     int         stopping;
+    NgfHeld     held;       /* not sent yet, see ngf_client_set_send_window */
+    int64_t     expires;
+};
+
+/* Per play options, shared by the play variants and the I/O thread. */
+struct _NgfPlayParams
+{
+    int             lane;           /* -1 to route by event name */
+    int             reply_timeout;  /* -1 for the client default */
+    const char      *group;         /* NULL if not in any group */
+    int             priority;       /* order in a queueing group limit */
+    NgfListener     listener;
+    int             window_slot;    /* taken by the caller of a threaded client */
+    int64_t         stop_at;        /* end of the max duration in us, 0 for none */
+    int             unicast;        /* the prebuilt play asked for unicast status */
+};
+
+#define NGF_PLAY_PARAMS_INIT { .lane = -1, .reply_timeout = -1 }
+
+struct _NgfQueuedPlay
+{
+    LIST_INIT (NgfQueuedPlay)
+
+    NgfPlayParams   params;
+    uint32_t        client_event_id;
+    char            *event;
+    char            *group;
+    NgfProplist     *proplist;
+};
+
+/* Play waiting for its deadline, in microseconds of CLOCK_MONOTONIC. The
+   message is built by the caller, event and proplist are kept for the
+   paths that queue the play rather than send it. */
+struct _NgfScheduled
+{
+    LIST_INIT (NgfScheduled)
+
+    uint32_t        client_event_id;
+    int64_t         deadline;
+    int64_t         late;
+    char            *event;
+    NgfProplist     *proplist;
+    NgfTransportPlay *play;
+    int             unicast;
+};
+
+/* Routed backend seen addressing status to us, see
+   ngf_client_set_unicast_status. */
+struct _NgfUnicast
+{
+    LIST_INIT (NgfUnicast)
+
+    char            *service;
+};
+
+/* Concurrency limit of a group. Plays and active events of the group that
+   are not being stopped count against it. */
+struct _NgfGroupLimit
+{
+    LIST_INIT (NgfGroupLimit)
+
+    char            *group;
+    uint32_t        max_running;    /* 0 for no limit */
+    NgfLimitPolicy  policy;
+    uint32_t        num_running;
+    NgfQueuedPlay   *waiting;       /* highest priority first */
+    uint32_t        num_waiting;
+};
+
+/* Token bucket of an event name, refilled with rate tokens per second up
+   to burst. Counted in thousandths of a token. */
+struct _NgfRateLimit
+{
+    LIST_INIT (NgfRateLimit)
+
+    char            *event;
+    uint32_t        rate;           /* 0 for no limit */
+    uint32_t        burst;
+    NgfRatePolicy   policy;
+    int64_t         tokens;
+    int64_t         refilled;       /* ms of the last refill */
+    uint32_t        last_id;        /* last play let through */
+    uint32_t        num_rejected;
+    uint32_t        num_coalesced;
+};
+
+/* Backend name of the events matching pattern. While service is known to
+   be absent, plays go to fallback instead. */
+struct _NgfRoute
+{
+    LIST_INIT (NgfRoute)
+
+    NgfClient       *client;
+    char            *pattern;
+    char            *service;
+    char            *fallback;      /* NULL for none */
+    NgfDispatcher   *presence;      /* tracks both names if there is a fallback */
+};
+
+/* StopMany or PauseMany in flight. Should the backend not know them, the
+   operation is repeated one event at a time. */
+struct _NgfBulkCall
+{
+    LIST_INIT (NgfBulkCall)
+
+    NgfClient       *client;
+    NgfLane         *lane;
+    const char      *service;
+    NgfTransportCall *pending;
+    int             pause;          /* -1 for stop */
+    uint32_t        num_ids;
+    uint32_t        *server_event_ids;
+};
+
+/* Arguments of the commands that take more than an id, an event name
+   and a proplist. Copied by _client_submit, strings and play included. */
+struct _NgfCommandArgs
+{
+    const char      *group;         /* group commands, service of NGF_COMMAND_ROUTE */
+    uint32_t        max_running;    /* NGF_COMMAND_GROUP_LIMIT */
+    NgfLimitPolicy  limit_policy;
+    uint32_t        rate;           /* NGF_COMMAND_RATE_LIMIT */
+    uint32_t        burst;
+    NgfRatePolicy   rate_policy;
+    const char      *fallback;      /* NGF_COMMAND_ROUTE */
+    NgfTransportPlay *play;         /* NGF_COMMAND_PLAY_AT */
+    int64_t         deadline;
+    NgfCallback     callback;       /* the callback commands */
+    NgfBatchCallback batch_callback;
+    NgfScheduleCallback schedule_callback;
+    NgfReadyCallback ready_callback;
+    void            *userdata;
+};
+
+/* Request submitted to the I/O thread of a threaded client. */
+struct _NgfCommand
+{
+    NgfWorkerNode   node;
+    NgfCommandType  type;
+    NgfPlayParams   params;
+    NgfCommandArgs  args;
+    uint32_t        client_event_id;
+    char            *event;
+    char            *group;
+    char            *fallback;
+    NgfProplist     *proplist;
 };
 
 struct _NgfClient
 {
-    DBusConnection  *connection;
+    NgfLane         lanes[NGF_MAX_LANES];
+    int             num_lanes;
+    NgfLaneRule     *lane_rules;
+    NgfRoute        *routes;
+    NgfWorker       *worker;
+    int             owns_connection;
+    NgfConnectCallback connect_callback;
+    void            *connect_userdata;
     NgfCallback     callback;
     void            *userdata;
     uint32_t        play_id;
+    int             unicast_status;
+    int             unicast_default;    /* the default backend sent unicast status */
+    NgfUnicast      *unicast_routes;
+    uint32_t        idle_timeout;
+    int             reply_timeout;
+    uint32_t        event_timeout;
+    int64_t         sweep_deadline;
+
+    NgfDestroyCallback destroy_callback;
+    void            *destroy_userdata;
+    int             destroy_pending;
+    int             destroy_flushed;
+    int             destroying;     /* torn down, the I/O thread is winding up */
 
     NgfReply        *pending_replies;
     NgfEvent        *active_events;
-};
 
-static void _free_active_event (NgfEvent *event, void *userdata);
+    /* Active events by client event id, chained through index_next. */
+    NgfEvent        **event_index;
+    uint32_t        event_index_size;
+    uint32_t        num_active;
 
-static void
-_send_stop_event (DBusConnection *connection,
-                  uint32_t server_event_id)
-{
-    DBusMessage *msg = NULL;
-    DBusMessageIter sub;
+    /* Backend presence, tracked on lane 0 unless the policy is NONE. */
+    NgfBackendPolicy backend_policy;
+    NgfDispatcher   *presence;
+    int             backend_state;  /* NgfOwnerState, read from any thread */
+    NgfQueuedPlay   *queued_plays;
+    uint32_t        num_queued;
 
-    if ((msg = dbus_message_new_method_call (NGF_DBUS_NAME,
-                                             NGF_DBUS_PATH,
-                                             NGF_DBUS_IFACE,
-                                             NGF_DBUS_METHOD_STOP)) == NULL)
-    {
-        return;
-    }
+    /* Bulk control calls, until the backend turns out not to have them. */
+    NgfBulkCall     *bulk_calls;
+    int             bulk_unsupported;
 
-    dbus_message_iter_init_append (msg, &sub);
-    dbus_message_iter_append_basic (&sub, DBUS_TYPE_UINT32, &server_event_id);
+    /* Group limits, waiting plays are sent when limits_dirty is set. */
+    NgfGroupLimit   *group_limits;
+    int             limits_dirty;
 
-    dbus_connection_send (connection, msg, NULL);
-    dbus_message_unref (msg);
-}
+    /* Identical plays linked to one in flight, see ngf_client_set_dedup. */
+    int             dedup;
+    NgfLink         *links;
 
-static void
-_pending_play_reply (DBusPendingCall *pending,
-                     void *userdata)
-{
-    NgfClient *client = (NgfClient*) userdata;
+    /* Token buckets by event name, they stay around once set. */
+    NgfRateLimit    *rate_limits;
 
-    NgfReply *reply_iter = NULL, *reply = NULL;
-    NgfEvent *event = NULL;
+    /* Window of plays awaiting their reply. Callers of a threaded client
+       take slots on their own thread, so the count is atomic and they wait
+       for one on window_cond. reservation is the slot of the play the I/O
+       thread is running, window_blocked owes the ready callback. */
+    uint32_t        max_pending;
+    NgfWindowPolicy window_policy;
+    int             window_timeout;
+    uint32_t        num_window;
+    int             window_waiters;
+    int             window_blocked;
+    int             reservation;
+    NgfReadyCallback ready_callback;
+    void            *ready_userdata;
+    pthread_mutex_t window_lock;
+    pthread_cond_t  window_cond;
 
-    DBusMessage *msg = NULL;
-    DBusMessageIter iter;
+    /* Inside a state callback, the connection is being dispatched. */
+    int             notifying;
 
-    for (reply_iter = client->pending_replies; reply_iter; reply_iter = reply_iter->next) {
-        if (reply_iter->pending == pending) {
-            reply = reply_iter;
-            break;
-        }
-    }
+    /* Send window, see ngf_client_set_send_window. Plays and controls of
+       active events are held until flush_deadline, in microseconds. */
+    uint32_t        send_window;
+    int64_t         flush_deadline;
+    int             flushing;
+    NgfQueuedPlay   *held_plays;
+    uint32_t        num_held;
 
-    if (reply == NULL)
-        goto done;
+    /* Plays scheduled with ngf_client_play_event_at, earliest first. The
+       I/O thread of a threaded client has its timer armed for armed. */
+    NgfScheduled    *scheduled;
+    int64_t         armed;
+    NgfScheduleCallback schedule_callback;
+    void            *schedule_userdata;
 
-    msg = dbus_pending_call_steal_reply (pending);
+    /* Ends of the max durations of plays, by client event id. */
+    NgfTimers       *durations;
 
-    if (dbus_message_is_error (msg, DBUS_ERROR_FAILED)) {
-        client->callback (client, reply->client_event_id, NGF_EVENT_FAILED, client->userdata);
-        goto done;
-    }
+    /* Batches are flushed at the end of a pass, dispatching is set during
+       one. Threaded clients only flush after each I/O thread iteration. */
+    NgfBatchCallback batch_callback;
+    void            *batch_userdata;
+    int             dispatching;
 
-    event = (NgfEvent*) malloc (sizeof (NgfEvent));
-    memset (event, 0, sizeof (NgfEvent));
-    event->client_event_id = reply->client_event_id;
+    /* State changes for a consumer thread, see
+       ngf_client_enable_status_ring. Set once, read from any thread. */
+    NgfRing         *ring;
 
-    dbus_message_iter_init (msg, &iter);
-    if (dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_UINT32) {
-        if (client->callback)
-            client->callback (client, event->client_event_id, NGF_EVENT_FAILED, client->userdata);
-        free (event);
+    /* Ring buffer of state changes waiting for ngf_client_deliver_callbacks
+       or the end of the batch, or spilled from a full status ring. */
+    int             deferred;
+    NgfStateChange  *queue;
+    uint32_t        queue_size;
+    uint32_t        queue_head;
+    uint32_t        queue_length;
+};
 
-        goto done;
-    }
+static void _free_active_event (NgfEvent *event, void *userdata);
+static void _free_pending_reply (NgfReply *reply, void *userdata);
+static void _free_play_key (NgfPlayKey *key);
+static void _stop_active_event (NgfEvent *event, void *userdata);
+static void _client_run_command (NgfWorkerNode *node, void *userdata);
+static int _client_tick (void *userdata);
+static void _client_sweep (NgfClient *client);
+static void _client_pump_limits (NgfClient *client);
+static uint32_t _client_resolve_link (NgfClient *client, uint32_t client_event_id);
+static void _client_flush_sends (NgfClient *client);
+static void _client_flush_due (NgfClient *client);
+static void _client_fire_scheduled (NgfClient *client);
+static void _client_expire_durations (NgfClient *client);
+static int _client_play_event (NgfClient *client, const NgfPlayParams *params, uint32_t client_event_id, const char *event, NgfProplist *proplist);
+static int _client_submit (NgfClient *client, NgfCommandType type, const NgfPlayParams *params, uint32_t client_event_id, const char *event, NgfProplist *proplist, const NgfCommandArgs *args);
 
-    dbus_message_iter_get_basic (&iter, &event->server_event_id);
+/* State of a threaded client belongs to its I/O thread, other threads
+   submit their changes to it. */
 
-    if (event->server_event_id > 0) {
-        if (reply->stop_set) {
-            _send_stop_event (client->connection, event->server_event_id);
-            free (event);
+static int
+_client_foreign (NgfClient *client)
+{
+    return client->worker && !ngf_worker_is_current (client->worker);
+}
 
-            goto done;
-        }
+static NgfEvent**
+_event_index_bucket (NgfClient *client,
+                     uint32_t client_event_id)
+{
+    return &client->event_index[client_event_id & (client->event_index_size - 1)];
+}
 
-        LIST_APPEND (client->active_events, event);
-    } else {
-        if (client->callback)
-            client->callback (client, event->client_event_id, NGF_EVENT_FAILED, client->userdata);
-        free (event);
-        goto done;
-    }
+static NgfEvent*
+_event_index_lookup (NgfClient *client,
+                     uint32_t client_event_id)
+{
+    NgfEvent *event = NULL;
 
-done:
-    if (msg)
-        dbus_message_unref (msg);
+    if (client->event_index == NULL)
+        return NULL;
 
-    if (reply) {
-        LIST_REMOVE (client->pending_replies, reply);
-        free (reply);
+    for (event = *_event_index_bucket (client, client_event_id); event; event = event->index_next) {
+        if (event->client_event_id == client_event_id)
+            return event;
     }
 
-    dbus_pending_call_unref (pending);
+    return NULL;
 }
 
-static DBusHandlerResult
-_message_filter_cb (DBusConnection *connection,
-                    DBusMessage *msg,
-                    void *userdata)
+static int
+_event_index_grow (NgfClient *client)
 {
-    NgfClient *client = (NgfClient*) userdata;
-
-    DBusError error;
-    NgfEvent *event = NULL;
-    uint32_t server_event_id = 0;
-    uint32_t state = 0;
-    int success = 0;
+    NgfEvent **old_index = client->event_index, **bucket = NULL;
+    NgfEvent *event = NULL, *next = NULL;
+    uint32_t old_size = client->event_index_size, i;
+    uint32_t size = old_size ? old_size * 2 : NGF_INDEX_INITIAL_SIZE;
 
-    if (!dbus_message_is_signal (msg, NGF_DBUS_IFACE, NGF_DBUS_INTERNAL_STATUS)) {
-        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    if ((client->event_index = (NgfEvent**) calloc (size, sizeof (NgfEvent*))) == NULL) {
+        client->event_index = old_index;
+        return old_index != NULL;
     }
 
-    dbus_error_init (&error);
-    success = dbus_message_get_args (msg, &error,
-        DBUS_TYPE_UINT32, &server_event_id, DBUS_TYPE_UINT32, &state, DBUS_TYPE_INVALID);
+    client->event_index_size = size;
 
-    if (!success) {
-        dbus_error_free (&error);
-        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    for (i = 0; i < old_size; i++) {
+        for (event = old_index[i]; event; event = next) {
+            next = event->index_next;
+            bucket = _event_index_bucket (client, event->client_event_id);
+            event->index_next = *bucket;
+            *bucket = event;
+        }
     }
 
-    /* Try to find a matching server event id from the active events. */
+    free (old_index);
+    return 1;
+}
 
-    for (event = client->active_events; event; event = event->next) {
-        if (event->server_event_id == server_event_id) {
+static int
+_event_index_add (NgfClient *client,
+                  NgfEvent *event)
+{
+    NgfEvent **bucket = NULL;
+
+    if (client->num_active >= client->event_index_size * 2 && !_event_index_grow (client))
+        return 0;
 
-            /* Trigger the callback, if specified, and remove the event from
-               active events. */
+    bucket = _event_index_bucket (client, event->client_event_id);
+    event->index_next = *bucket;
+    *bucket = event;
+    client->num_active++;
 
-            if (client->callback)
-                client->callback (client, event->client_event_id, state, client->userdata);
+    return 1;
+}
 
-            if (state == NGF_EVENT_COMPLETED || state == NGF_EVENT_FAILED) {
-                LIST_REMOVE (client->active_events, event);
-                _free_active_event (event, NULL);
-            }
+static void
+_event_index_remove (NgfClient *client,
+                     NgfEvent *event)
+{
+    NgfEvent **link = NULL;
+
+    for (link = _event_index_bucket (client, event->client_event_id); *link; link = &(*link)->index_next) {
+        if (*link == event) {
+            *link = event->index_next;
+            client->num_active--;
             break;
         }
     }
-
-    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
-NgfClient*
-ngf_client_create (NgfTransport transport,
-                   ...)
+static NgfGroupLimit*
+_client_find_limit (NgfClient *client,
+                    const char *group)
 {
-    NgfClient *c = NULL;
-    va_list transport_args;
+    NgfGroupLimit *limit = NULL;
 
-    c = (NgfClient*) malloc (sizeof (NgfClient));
-    if (c == NULL)
-        goto failed;
+    if (group == NULL)
+        return NULL;
 
-    memset (c, 0, sizeof (NgfClient));
+    for (limit = client->group_limits; limit; limit = limit->next) {
+        if (strcmp (limit->group, group) == 0)
+            return limit;
+    }
 
-    va_start (transport_args, transport);
-    c->connection = va_arg (transport_args, DBusConnection*);
-    va_end (transport_args);
+    return NULL;
+}
 
-    if (!c->connection)
-        goto failed;
+/* Give back the slot held by an event or play, e.g. when it finishes or
+   is stopped. Waiting plays are sent by _client_pump_limits. */
 
-    dbus_connection_ref (c->connection);
+static void
+_limit_release (NgfClient *client,
+                NgfGroupLimit **limit)
+{
+    if (*limit == NULL)
+        return;
 
-    dbus_bus_add_match (c->connection, NGF_DBUS_MATCH, NULL);
-    dbus_connection_add_filter (c->connection, _message_filter_cb, c, NULL);
-    return c;
+    (*limit)->num_running--;
+    *limit = NULL;
+    client->limits_dirty = 1;
+}
 
-failed:
-    ngf_client_destroy (c);
-    return NULL;
+/* Match and filter are only set up while the client has something to
+   track, see ngf_client_set_idle_timeout. */
+
+static int
+_client_subscribe (NgfClient *client,
+                   NgfLane *lane)
+{
+    if (lane->dispatcher)
+        return 1;
+
+    if ((lane->dispatcher = lane->transport->dispatcher_acquire (lane->connection)) == NULL)
+        return 0;
+
+    return 1;
 }
 
 static void
-_stop_active_event (NgfEvent *event, void *userdata)
+_client_unsubscribe (NgfClient *client,
+                     NgfLane *lane,
+                     uint32_t linger_ms)
 {
-    NgfClient *client = (NgfClient*) userdata;
-    if (event->stopping)
+    (void) client;
+
+    if (lane->dispatcher == NULL)
         return;
 
-    event->stopping = 1;
-    _send_stop_event (client->connection, event->server_event_id);
+    lane->transport->dispatcher_release (lane->dispatcher, linger_ms);
+    lane->dispatcher = NULL;
 }
 
-static void
-_free_active_event (NgfEvent *event, void *userdata)
+/* Unicast status is only trusted once the backend has been seen sending
+   it, until then plays asking for it still subscribe to the broadcast. */
+
+static int
+_client_unicast_seen (NgfClient *client,
+                      const char *service)
 {
-    free (event);
+    NgfUnicast *entry = NULL;
+
+    if (service == NULL)
+        return client->unicast_default;
+
+    for (entry = client->unicast_routes; entry; entry = entry->next) {
+        if (strcmp (entry->service, service) == 0)
+            return 1;
+    }
+
+    return 0;
 }
 
 static void
-_free_pending_reply (NgfReply *reply, void *userdata)
+_client_unicast_confirm (NgfClient *client,
+                         const char *service)
 {
-    if (reply->pending) {
-        dbus_pending_call_cancel (reply->pending);
-        dbus_pending_call_unref (reply->pending);
-        reply->pending = NULL;
+    NgfUnicast *entry = NULL;
+
+    if (_client_unicast_seen (client, service))
+        return;
+
+    if (service == NULL) {
+        client->unicast_default = 1;
+        return;
     }
 
-    free (reply);
+    /* Not knowing merely keeps the broadcast subscription. */
+    if ((entry = (NgfUnicast*) calloc (1, sizeof (NgfUnicast))) == NULL)
+        return;
+
+    if ((entry->service = strdup (service)) == NULL) {
+        free (entry);
+        return;
+    }
+
+    LIST_APPEND (client->unicast_routes, entry);
 }
 
-void
-ngf_client_destroy (NgfClient *client)
+static void
+_free_unicast (NgfUnicast *entry, void *userdata)
 {
-    if (client == NULL)
-        return;
+    (void) userdata;
 
-    /* Stop any active events. */
-    LIST_FOREACH (client->active_events, _stop_active_event, client);
+    free (entry->service);
+    free (entry);
+}
 
-    /* Free any pending replies. */
-    LIST_FOREACH (client->pending_replies, _free_pending_reply, client);
+/* Whoever owns the name next may not honour unicast status. */
 
+static void
+_client_unicast_forget (NgfClient *client,
+                        const char *service)
+{
+    NgfUnicast *entry = NULL;
 
-    if (client->connection) {
-        dbus_connection_flush (client->connection);
-        dbus_connection_remove_filter (client->connection, _message_filter_cb, client);
-        dbus_bus_remove_match (client->connection, NGF_DBUS_MATCH, NULL);
-        dbus_connection_unref (client->connection);
-        client->connection = NULL;
+    if (service == NULL) {
+        client->unicast_default = 0;
+        return;
     }
 
-    LIST_FOREACH (client->active_events, _free_active_event, client);
-
-    free (client);
+    for (entry = client->unicast_routes; entry; entry = entry->next) {
+        if (strcmp (entry->service, service) == 0) {
+            LIST_REMOVE (client->unicast_routes, entry);
+            _free_unicast (entry, client);
+            return;
+        }
+    }
 }
 
-void
-ngf_client_set_callback (NgfClient *client,
-                         NgfCallback callback,
-                         void *userdata)
+/* Every play holds the Status match of its backend name until its event is
+   done, unless the backend is known to address status to us. */
+
+static void
+_client_add_match (NgfClient *client,
+                   NgfLane *lane,
+                   const char *service,
+                   int unicast,
+                   int *matched)
 {
-    client->callback = callback;
-    client->userdata = userdata;
+    if (unicast && _client_unicast_seen (client, service))
+        return;
+
+    lane->transport->add_match (lane->dispatcher, service);
+    *matched = 1;
 }
 
 static void
-_append_property (const char *key,
-                  const void *value,
-                  NgfProplistType type,
-                  void *userdata)
+_client_release_match (NgfClient *client,
+                       NgfLane *lane,
+                       const char *service,
+                       int *matched)
 {
-    DBusMessageIter *iter       = (DBusMessageIter*) userdata;
-    const char*      string_value = NULL;
-    int              boolean_value = 0;
-    int32_t          integer_value = 0;
-    uint32_t         unsigned_value = 0;
+    if (!*matched)
+        return;
 
-    DBusMessageIter sub, ssub;
+    *matched = 0;
+    if (lane->dispatcher)
+        lane->transport->remove_match (lane->dispatcher, service, client->idle_timeout);
+}
 
-    dbus_message_iter_open_container (iter, DBUS_TYPE_DICT_ENTRY, 0, &sub);
-    dbus_message_iter_append_basic (&sub, DBUS_TYPE_STRING, &key);
+static void
+_client_check_idle (NgfClient *client,
+                    NgfLane *lane)
+{
+    if (lane->num_events == 0)
+        _client_unsubscribe (client, lane, client->idle_timeout);
+}
 
-    switch (type) {
-        case NGF_PROPLIST_VALUE_TYPE_STRING:
-            string_value = (const char*) value;
-            dbus_message_iter_open_container (&sub, DBUS_TYPE_VARIANT, DBUS_TYPE_STRING_AS_STRING, &ssub);
-            dbus_message_iter_append_basic (&ssub, DBUS_TYPE_STRING, &string_value);
-            dbus_message_iter_close_container (&sub, &ssub);
-            break;
+static NgfRing*
+_client_ring (NgfClient *client)
+{
+    return __atomic_load_n (&client->ring, __ATOMIC_ACQUIRE);
+}
 
-        case NGF_PROPLIST_VALUE_TYPE_INTEGER:
-            integer_value = *(int32_t*) value;
-            dbus_message_iter_open_container (&sub, DBUS_TYPE_VARIANT, DBUS_TYPE_INT32_AS_STRING, &ssub);
-            dbus_message_iter_append_basic (&ssub, DBUS_TYPE_INT32, &integer_value);
-            dbus_message_iter_close_container (&sub, &ssub);
-            break;
+static int
+_client_queue_push (NgfClient *client,
+                    uint32_t client_event_id,
+                    NgfEventState state)
+{
+    NgfStateChange *queue = NULL;
+    uint32_t size = 0, i = 0;
 
-        case NGF_PROPLIST_VALUE_TYPE_UNSIGNED:
-            unsigned_value = *(uint32_t*) value;
-            dbus_message_iter_open_container (&sub, DBUS_TYPE_VARIANT, DBUS_TYPE_UINT32_AS_STRING, &ssub);
-            dbus_message_iter_append_basic (&ssub, DBUS_TYPE_UINT32, &unsigned_value);
-            dbus_message_iter_close_container (&sub, &ssub);
-            break;
+    if (client->queue_length == client->queue_size) {
+        size = client->queue_size ? client->queue_size * 2 : NGF_QUEUE_INITIAL_SIZE;
+        if ((queue = (NgfStateChange*) malloc (size * sizeof (NgfStateChange))) == NULL)
+            return 0;
 
-        case NGF_PROPLIST_VALUE_TYPE_BOOLEAN:
-            boolean_value = *(int*) value;
-            dbus_message_iter_open_container (&sub, DBUS_TYPE_VARIANT, DBUS_TYPE_BOOLEAN_AS_STRING, &ssub);
-            dbus_message_iter_append_basic (&ssub, DBUS_TYPE_BOOLEAN, &boolean_value);
-            dbus_message_iter_close_container (&sub, &ssub);
-            break;
+        for (i = 0; i < client->queue_length; i++)
+            queue[i] = client->queue[(client->queue_head + i) & (client->queue_size - 1)];
 
-        default:
-            break;
+        free (client->queue);
+        client->queue = queue;
+        client->queue_size = size;
+        client->queue_head = 0;
     }
 
-    dbus_message_iter_close_container (iter, &sub);
+    i = (client->queue_head + client->queue_length) & (client->queue_size - 1);
+    client->queue[i].id = client_event_id;
+    client->queue[i].state = state;
+    client->queue_length++;
+
+    return 1;
 }
 
-uint32_t
-ngf_client_play_event (NgfClient *client,
-                       const char *event,
-                       NgfProplist *proplist)
-{
-    DBusPendingCall *pending = NULL;
-    DBusMessage *msg = NULL;
-    NgfReply *reply = NULL;
+/* Events played with their own callback bypass the client wide delivery,
+   deferred, batched or not, and only hear about the states they asked for. */
 
-    DBusMessageIter iter, sub;
-    uint32_t client_event_id = 0;
+static void
+_client_deliver (NgfClient *client,
+                 const NgfListener *listener,
+                 uint32_t client_event_id,
+                 NgfEventState state)
+{
+    NgfStateChange change;
+    NgfRing *ring = NULL;
 
-    if (client == NULL || event == NULL)
-        return 0;
+    if (listener && listener->callback) {
+        if (listener->state_mask == 0 || (listener->state_mask & NGF_EVENT_STATE_MASK (state))) {
+            client->notifying++;
+            listener->callback (client, client_event_id, state, listener->userdata);
+            client->notifying--;
+        }
+        return;
+    }
 
-    client_event_id = ++client->play_id;
+    if ((ring = _client_ring (client)) != NULL) {
+        change.id = client_event_id;
+        change.state = state;
 
-    /* Send the actual message to the service. */
+        /* Keep the order, nothing overtakes what has been spilled. */
+        if (client->queue_length == 0 && ngf_ring_push (ring, &change))
+            return;
 
-    if ((msg = dbus_message_new_method_call (NGF_DBUS_NAME,
-                                             NGF_DBUS_PATH,
-                                             NGF_DBUS_IFACE,
-                                             NGF_DBUS_METHOD_PLAY)) == NULL)
-    {
-        return 0;
+        _client_queue_push (client, client_event_id, state);
+        return;
     }
 
-    dbus_message_iter_init_append (msg, &iter);
-    dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &event);
+    if (client->deferred || client->batch_callback) {
+        if (_client_queue_push (client, client_event_id, state))
+            return;
 
-    /* Append all properties from the property list */
-    dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "{sv}", &sub);
-    ngf_proplist_foreach_extended (proplist, _append_property, &sub);
-    dbus_message_iter_close_container (&iter, &sub);
+        /* Out of memory, keep the order at least. */
+        ngf_client_deliver_callbacks (client, 0);
+    }
 
-    dbus_connection_send_with_reply (client->connection, msg, &pending, -1);
-    dbus_message_unref (msg);
+    client->notifying++;
 
-    if (pending == NULL)
+    if (client->batch_callback) {
+        change.id = client_event_id;
+        change.state = state;
+        client->batch_callback (client, &change, 1, client->batch_userdata);
+    } else if (client->callback) {
+        client->callback (client, client_event_id, state, client->userdata);
+    }
+
+    client->notifying--;
+}
+
+/* Linked plays share the states of the play they are linked to, and end
+   with it. The links are copied first, callbacks may stop them. */
+
+static void
+_client_notify_links (NgfClient *client,
+                      uint32_t primary_id,
+                      NgfEventState state)
+{
+    NgfLink *link = NULL, *next = NULL, *copies = NULL;
+    int final = (state == NGF_EVENT_FAILED || state == NGF_EVENT_COMPLETED);
+    uint32_t num = 0, i = 0;
+
+    for (link = client->links; link; link = link->next) {
+        if (link->primary_id == primary_id)
+            num++;
+    }
+
+    if (num == 0 || (copies = (NgfLink*) malloc (num * sizeof (NgfLink))) == NULL)
+        return;
+
+    for (link = client->links; link; link = next) {
+        next = link->next;
+        if (link->primary_id != primary_id)
+            continue;
+
+        copies[i++] = *link;
+        if (final) {
+            LIST_REMOVE (client->links, link);
+            free (link);
+        }
+    }
+
+    for (i = 0; i < num; i++)
+        _client_deliver (client, &copies[i].listener, copies[i].client_event_id, state);
+
+    free (copies);
+}
+
+static void
+_client_notify (NgfClient *client,
+                const NgfListener *listener,
+                uint32_t client_event_id,
+                NgfEventState state)
+{
+    _client_deliver (client, listener, client_event_id, state);
+
+    if (client->links)
+        _client_notify_links (client, client_event_id, state);
+}
+
+/* Hand up to max_changes queued changes to the batch callback in one call.
+   The callback may cause new changes, so they are moved out of the queue
+   first: the whole buffer if possible, a copy otherwise. */
+
+static uint32_t
+_client_deliver_batch (NgfClient *client,
+                       uint32_t max_changes)
+{
+    NgfStateChange *changes = NULL, *buffer = NULL;
+    uint32_t num = client->queue_length, size = client->queue_size, i;
+
+    if (num == 0)
+        return 0;
+
+    if (max_changes > 0 && num > max_changes)
+        num = max_changes;
+
+    if (num == client->queue_length && client->queue_head + num <= size) {
+        buffer = client->queue;
+        changes = &buffer[client->queue_head];
+        client->queue = NULL;
+        client->queue_size = 0;
+    } else {
+        if ((buffer = (NgfStateChange*) malloc (num * sizeof (NgfStateChange))) == NULL)
+            return 0;
+
+        for (i = 0; i < num; i++)
+            buffer[i] = client->queue[(client->queue_head + i) & (size - 1)];
+
+        changes = buffer;
+    }
+
+    client->queue_head = client->queue ? (client->queue_head + num) & (size - 1) : 0;
+    client->queue_length -= num;
+
+    client->notifying++;
+    client->batch_callback (client, changes, num, client->batch_userdata);
+    client->notifying--;
+
+    /* Keep the buffer around unless the callback has queued into a new one. */
+
+    if (changes != buffer && client->queue == NULL) {
+        client->queue = buffer;
+        client->queue_size = size;
+        client->queue_head = 0;
+    } else {
+        free (buffer);
+    }
+
+    return num;
+}
+
+/* Move spilled changes into the status ring as far as it has room. */
+
+static void
+_client_flush_ring (NgfClient *client,
+                    NgfRing *ring)
+{
+    while (client->queue_length > 0 && ngf_ring_push (ring, &client->queue[client->queue_head])) {
+        client->queue_head = (client->queue_head + 1) & (client->queue_size - 1);
+        client->queue_length--;
+    }
+}
+
+/* The window may be set from any thread, the size is published last, see
+   ngf_client_set_max_pending. */
+
+static uint32_t
+_window_max (NgfClient *client)
+{
+    return __atomic_load_n (&client->max_pending, __ATOMIC_ACQUIRE);
+}
+
+static NgfWindowPolicy
+_window_policy (NgfClient *client)
+{
+    return __atomic_load_n (&client->window_policy, __ATOMIC_RELAXED);
+}
+
+static int
+_window_timeout (NgfClient *client)
+{
+    return __atomic_load_n (&client->window_timeout, __ATOMIC_RELAXED);
+}
+
+static int
+_window_full (NgfClient *client)
+{
+    uint32_t max_pending = _window_max (client);
+
+    return max_pending > 0
+        && __atomic_load_n (&client->num_window, __ATOMIC_SEQ_CST) >= max_pending;
+}
+
+static void
+_window_release (NgfClient *client)
+{
+    __atomic_sub_fetch (&client->num_window, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n (&client->window_waiters, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock (&client->window_lock);
+        pthread_cond_broadcast (&client->window_cond);
+        pthread_mutex_unlock (&client->window_lock);
+    }
+}
+
+/* Invoke the ready callback once the window has room again after a play
+   was turned away or waited. */
+
+static void
+_client_flush_ready (NgfClient *client)
+{
+    if (client->ready_callback == NULL || _window_full (client))
+        return;
+
+    if (__atomic_exchange_n (&client->window_blocked, 0, __ATOMIC_ACQ_REL))
+        client->ready_callback (client, client->ready_userdata);
+}
+
+static void
+_client_flush_batch (NgfClient *client)
+{
+    NgfRing *ring = NULL;
+
+    _client_flush_ready (client);
+
+    if ((ring = _client_ring (client)) != NULL) {
+        _client_flush_ring (client, ring);
+        return;
+    }
+
+    if (client->batch_callback && !client->deferred && !client->dispatching)
+        _client_deliver_batch (client, 0);
+}
+
+static void
+_send_stop_event (NgfLane *lane,
+                  const char *service,
+                  uint32_t server_event_id)
+{
+    lane->transport->send_control (lane->connection, service, server_event_id, -1);
+}
+
+static void
+_send_pause_event (NgfLane *lane,
+                   const char *service,
+                   uint32_t server_event_id,
+                   int pause)
+{
+    lane->transport->send_control (lane->connection, service, server_event_id, pause);
+}
+
+static void
+_event_status_cb (void *target,
+                  uint32_t state,
+                  int unicast)
+{
+    NgfEvent *event = (NgfEvent*) target;
+    NgfClient *client = event->client;
+    NgfLane *lane = NULL;
+
+    if (unicast)
+        _client_unicast_confirm (client, event->service);
+
+    /* Trigger the callback, if specified, and remove the event from
+       active events. */
+
+    event->state = state;
+    if (state == NGF_EVENT_PAUSED || state == NGF_EVENT_PLAYING)
+        event->paused = (state == NGF_EVENT_PAUSED);
+
+    _client_notify (client, &event->listener, event->client_event_id, state);
+
+    if (state == NGF_EVENT_COMPLETED || state == NGF_EVENT_FAILED) {
+        lane = event->lane;
+        LIST_REMOVE (client->active_events, event);
+        _free_active_event (event, client);
+        _client_check_idle (client, lane);
+        _client_pump_limits (client);
+    }
+
+    _client_flush_batch (client);
+}
+
+static void
+_pending_play_reply (NgfTransportCall *pending,
+                     NgfReplyStatus status,
+                     uint32_t server_event_id,
+                     const char *sender,
+                     void *userdata)
+{
+    NgfClient *client = (NgfClient*) userdata;
+    NgfLane *lane = NULL;
+
+    NgfReply *reply_iter = NULL, *reply = NULL;
+    NgfEvent *event = NULL;
+
+    for (reply_iter = client->pending_replies; reply_iter; reply_iter = reply_iter->next) {
+        if (reply_iter->pending == pending) {
+            reply = reply_iter;
+            break;
+        }
+    }
+
+    if (reply == NULL)
+        goto done;
+
+    /* Any error, reply timeouts included, fails the event. */
+
+    if (status != NGF_REPLY_OK) {
+        if (!reply->finished)
+            _client_notify (client, &reply->listener, reply->client_event_id, NGF_EVENT_FAILED);
+        goto done;
+    }
+
+    event = (NgfEvent*) malloc (sizeof (NgfEvent));
+    memset (event, 0, sizeof (NgfEvent));
+    event->client = client;
+    event->lane = reply->lane;
+    event->service = reply->service;
+    event->client_event_id = reply->client_event_id;
+    event->listener = reply->listener;
+    event->state = -1;
+    event->server_event_id = server_event_id;
+
+    if (event->server_event_id > 0) {
+        /* Stopped or preempted before it started, it still gets its
+           final state. */
+
+        if (reply->stop_set) {
+            _send_stop_event (event->lane, event->service, event->server_event_id);
+            if (!reply->finished)
+                _client_notify (client, &event->listener, event->client_event_id, NGF_EVENT_COMPLETED);
+            free (event);
+
+            goto done;
+        }
+
+        if (!_event_index_add (client, event)) {
+            _send_stop_event (event->lane, event->service, event->server_event_id);
+            _client_notify (client, &event->listener, event->client_event_id, NGF_EVENT_FAILED);
+            free (event);
+            goto done;
+        }
+
+        if (!event->lane->transport->add_event (event->lane->dispatcher, event->server_event_id,
+                                                sender, _event_status_cb, event))
+        {
+            _event_index_remove (client, event);
+            _send_stop_event (event->lane, event->service, event->server_event_id);
+            _client_notify (client, &event->listener, event->client_event_id, NGF_EVENT_FAILED);
+            free (event);
+            goto done;
+        }
+
+        event->group = reply->group;
+        reply->group = NULL;
+        event->key = reply->key;
+        reply->key = NULL;
+        event->limit = reply->limit;
+        reply->limit = NULL;
+        event->matched = reply->matched;
+        reply->matched = 0;
+
+        LIST_APPEND (client->active_events, event);
+        event->lane->num_events++;
+
+        if (client->event_timeout > 0) {
+            event->expires = ngf_clock_now_ms () + client->event_timeout;
+            if (client->sweep_deadline == 0 || event->expires < client->sweep_deadline)
+                client->sweep_deadline = event->expires;
+        }
+    } else {
+        _client_notify (client, &event->listener, event->client_event_id, NGF_EVENT_FAILED);
+        free (event);
+        goto done;
+    }
+
+done:
+    if (reply) {
+        lane = reply->lane;
+        _client_release_match (client, lane, reply->service, &reply->matched);
+        lane->num_events--;
+        LIST_REMOVE (client->pending_replies, reply);
+        _limit_release (client, &reply->limit);
+        if (reply->windowed)
+            _window_release (client);
+        _free_play_key (reply->key);
+        free (reply->group);
+        free (reply);
+    }
+
+    if (lane)
+        _client_check_idle (client, lane);
+
+    _client_sweep (client);
+    _client_pump_limits (client);
+    _client_flush_batch (client);
+}
+
+/* Fail active events that never got a terminal status, e.g. because the
+   backend lost them. Expiries are batched to at most one walk over the
+   active events per sweep interval. */
+
+static void
+_client_sweep (NgfClient *client)
+{
+    NgfEvent *event = NULL, *next = NULL;
+    NgfLane *lane = NULL;
+    int64_t now = 0, deadline = 0;
+
+    if (client->sweep_deadline == 0)
+        return;
+
+    now = ngf_clock_now_ms ();
+    if (now < client->sweep_deadline)
+        return;
+
+    for (event = client->active_events; event; event = next) {
+        next = event->next;
+
+        if (event->expires == 0)
+            continue;
+
+        if (event->expires > now) {
+            if (deadline == 0 || event->expires < deadline)
+                deadline = event->expires;
+            continue;
+        }
+
+        /* The event is freed right away, a stop held back for the send
+           window would be lost with it. */
+
+        if (!event->stopping || event->held == NGF_HELD_STOP) {
+            event->stopping = 1;
+            event->held = NGF_HELD_NONE;
+            _send_stop_event (event->lane, event->service, event->server_event_id);
+        }
+
+        _client_notify (client, &event->listener, event->client_event_id, NGF_EVENT_FAILED);
+
+        lane = event->lane;
+        LIST_REMOVE (client->active_events, event);
+        _free_active_event (event, client);
+        _client_check_idle (client, lane);
+    }
+
+    if (deadline > 0 && deadline < now + NGF_SWEEP_INTERVAL)
+        deadline = now + NGF_SWEEP_INTERVAL;
+
+    client->sweep_deadline = deadline;
+    _client_pump_limits (client);
+}
+
+static void
+_free_queued_play (NgfQueuedPlay *play, void *userdata)
+{
+    (void) userdata;
+
+    free (play->event);
+    free (play->group);
+    if (play->proplist)
+        ngf_proplist_free (play->proplist);
+    free (play);
+}
+
+static void
+_free_scheduled (NgfScheduled *entry, void *userdata)
+{
+    NgfClient *client = (NgfClient*) userdata;
+
+    free (entry->event);
+    if (entry->proplist)
+        ngf_proplist_free (entry->proplist);
+    if (entry->play)
+        client->lanes[0].transport->unref_play (entry->play);
+    free (entry);
+}
+
+/* Plays stopped before they were sent end as completed, the same as
+   plays stopped while running. They are off every list already, the
+   callbacks may play and stop freely. */
+
+static void
+_client_drop_plays (NgfClient *client,
+                    NgfQueuedPlay *plays)
+{
+    NgfQueuedPlay *play = NULL, *next = NULL;
+
+    for (play = plays; play; play = next) {
+        next = play->next;
+        _client_notify (client, &play->params.listener, play->client_event_id, NGF_EVENT_COMPLETED);
+        _free_queued_play (play, client);
+    }
+}
+
+static void
+_client_drop_scheduled (NgfClient *client,
+                        NgfScheduled *entries)
+{
+    NgfScheduled *entry = NULL, *next = NULL;
+
+    for (entry = entries; entry; entry = next) {
+        next = entry->next;
+        _client_notify (client, NULL, entry->client_event_id, NGF_EVENT_COMPLETED);
+        _free_scheduled (entry, client);
+    }
+}
+
+static NgfQueuedPlay*
+_queued_play_new (const NgfPlayParams *params,
+                  uint32_t client_event_id,
+                  const char *event,
+                  NgfProplist *proplist)
+{
+    NgfQueuedPlay *play = NULL;
+
+    if ((play = (NgfQueuedPlay*) calloc (1, sizeof (NgfQueuedPlay))) == NULL)
+        return NULL;
+
+    play->params = *params;
+    play->client_event_id = client_event_id;
+
+    if (params->group && (play->group = strdup (params->group)) == NULL) {
+        _free_queued_play (play, NULL);
+        return NULL;
+    }
+
+    play->params.group = play->group;
+
+    if ((play->event = strdup (event)) == NULL ||
+        (proplist && (play->proplist = ngf_proplist_copy (proplist)) == NULL))
+    {
+        _free_queued_play (play, NULL);
+        return NULL;
+    }
+
+    return play;
+}
+
+static int
+_client_queue_play (NgfClient *client,
+                    const NgfPlayParams *params,
+                    uint32_t client_event_id,
+                    const char *event,
+                    NgfProplist *proplist)
+{
+    NgfQueuedPlay *play = NULL;
+
+    if (client->num_queued >= NGF_MAX_QUEUED_PLAYS)
+        return 0;
+
+    if ((play = _queued_play_new (params, client_event_id, event, proplist)) == NULL)
+        return 0;
+
+    LIST_APPEND (client->queued_plays, play);
+    client->num_queued++;
+
+    return 1;
+}
+
+/* Hold a play back until the group has a free slot, behind the waiting
+   plays of the same or higher priority. */
+
+static int
+_limit_enqueue (NgfGroupLimit *limit,
+                const NgfPlayParams *params,
+                uint32_t client_event_id,
+                const char *event,
+                NgfProplist *proplist)
+{
+    NgfQueuedPlay *play = NULL, **link = NULL;
+
+    if (limit->num_waiting >= NGF_MAX_QUEUED_PLAYS)
+        return 0;
+
+    if ((play = _queued_play_new (params, client_event_id, event, proplist)) == NULL)
+        return 0;
+
+    for (link = &limit->waiting; *link && (*link)->params.priority >= params->priority; link = &(*link)->next)
+        ;
+
+    play->next = *link;
+    *link = play;
+    limit->num_waiting++;
+
+    return 1;
+}
+
+/* Make room in a full group by stopping its oldest event or play. */
+
+static void
+_limit_preempt (NgfClient *client,
+                NgfGroupLimit *limit)
+{
+    NgfEvent *event = NULL;
+    NgfReply *reply = NULL;
+
+    for (event = client->active_events; event; event = event->next) {
+        if (event->limit == limit) {
+            _stop_active_event (event, client);
+            return;
+        }
+    }
+
+    for (reply = client->pending_replies; reply; reply = reply->next) {
+        if (reply->limit == limit) {
+            reply->stop_set = 1;
+            _limit_release (client, &reply->limit);
+            return;
+        }
+    }
+}
+
+/* Send waiting plays of groups that have slots free again. Called at the
+   end of every path that may release a slot, never from within one. */
+
+static void
+_client_pump_limits (NgfClient *client)
+{
+    NgfGroupLimit *limit = NULL;
+    NgfQueuedPlay *play = NULL;
+
+    if (!client->limits_dirty)
+        return;
+
+    client->limits_dirty = 0;
+
+    for (limit = client->group_limits; limit; limit = limit->next) {
+        while (limit->waiting && (limit->max_running == 0 || limit->num_running < limit->max_running)) {
+            play = limit->waiting;
+            limit->waiting = play->next;
+            limit->num_waiting--;
+
+            if (!_client_play_event (client, &play->params, play->client_event_id, play->event, play->proplist))
+                _client_notify (client, &play->params.listener, play->client_event_id, NGF_EVENT_FAILED);
+
+            _free_queued_play (play, client);
+        }
+    }
+}
+
+static void
+_free_group_limit (NgfGroupLimit *limit, void *userdata)
+{
+    LIST_FOREACH (limit->waiting, _free_queued_play, userdata);
+    free (limit->group);
+    free (limit);
+}
+
+static void
+_client_set_group_limit (NgfClient *client,
+                         const char *group,
+                         uint32_t max_running,
+                         NgfLimitPolicy policy)
+{
+    NgfGroupLimit *limit = NULL;
+
+    /* Limits stay around once set, events may point to them. */
+
+    if ((limit = _client_find_limit (client, group)) == NULL) {
+        if ((limit = (NgfGroupLimit*) calloc (1, sizeof (NgfGroupLimit))) == NULL)
+            return;
+
+        if ((limit->group = strdup (group)) == NULL) {
+            free (limit);
+            return;
+        }
+
+        LIST_APPEND (client->group_limits, limit);
+    }
+
+    limit->max_running = max_running;
+    limit->policy = policy;
+
+    client->limits_dirty = 1;
+    _client_pump_limits (client);
+}
+
+/* Send the queued plays again, they are queued anew if the backend has
+   gone away in the meantime or fail if the policy no longer queues. */
+
+static void
+_client_flush_queued (NgfClient *client)
+{
+    NgfQueuedPlay *plays = client->queued_plays, *play = NULL, *next = NULL;
+
+    client->queued_plays = NULL;
+    client->num_queued = 0;
+
+    for (play = plays; play; play = next) {
+        next = play->next;
+
+        if (!_client_play_event (client, &play->params, play->client_event_id, play->event, play->proplist))
+            _client_notify (client, &play->params.listener, play->client_event_id, NGF_EVENT_FAILED);
+
+        _free_queued_play (play, client);
+    }
+}
+
+static int
+_same_service (const char *a,
+               const char *b)
+{
+    return a == b || (a && b && strcmp (a, b) == 0);
+}
+
+/* The backend went away, and with it every event it knew about. Replies
+   and statuses for them will never come, so fail them all at once. Its
+   events are detached first, callbacks may play or stop events. */
+
+static void
+_client_fail_all (NgfClient *client,
+                  const char *service)
+{
+    NgfReply *replies = NULL, *reply = NULL, *next_reply = NULL;
+    NgfReply **reply_link = &client->pending_replies, **reply_tail = &replies;
+    NgfEvent *events = NULL, *event = NULL, *next_event = NULL;
+    NgfEvent **event_link = &client->active_events, **event_tail = &events;
+    uint32_t client_event_id = 0;
+    NgfListener listener;
+    int finished = 0, i;
+
+    _client_unicast_forget (client, service);
+
+    while ((reply = *reply_link) != NULL) {
+        if (!_same_service (reply->service, service)) {
+            reply_link = &reply->next;
+            continue;
+        }
+
+        *reply_link = reply->next;
+        reply->next = NULL;
+        *reply_tail = reply;
+        reply_tail = &reply->next;
+    }
+
+    while ((event = *event_link) != NULL) {
+        if (!_same_service (event->service, service)) {
+            event_link = &event->next;
+            continue;
+        }
+
+        *event_link = event->next;
+        event->next = NULL;
+        *event_tail = event;
+        event_tail = &event->next;
+    }
+
+    for (reply = replies; reply; reply = next_reply) {
+        next_reply = reply->next;
+        client_event_id = reply->client_event_id;
+        listener = reply->listener;
+        finished = reply->finished;
+        _free_pending_reply (reply, client);
+        if (!finished)
+            _client_notify (client, &listener, client_event_id, NGF_EVENT_FAILED);
+    }
+
+    for (event = events; event; event = next_event) {
+        next_event = event->next;
+        client_event_id = event->client_event_id;
+        listener = event->listener;
+        _free_active_event (event, client);
+        _client_notify (client, &listener, client_event_id, NGF_EVENT_FAILED);
+    }
+
+    for (i = 0; i < client->num_lanes; i++)
+        _client_check_idle (client, &client->lanes[i]);
+
+    _client_pump_limits (client);
+}
+
+static void
+_client_owner_cb (void *target,
+                  const char *name,
+                  NgfOwnerState state,
+                  int lost)
+{
+    NgfClient *client = (NgfClient*) target;
+
+    (void) name;
+
+    __atomic_store_n (&client->backend_state, (int) state, __ATOMIC_RELAXED);
+
+    if (lost)
+        _client_fail_all (client, NULL);
+
+    if (state == NGF_OWNER_PRESENT && client->queued_plays)
+        _client_flush_queued (client);
+
+    _client_flush_batch (client);
+}
+
+static void
+_client_set_backend_policy (NgfClient *client,
+                            NgfBackendPolicy policy)
+{
+    const NgfTransportOps *transport = client->lanes[0].transport;
+
+    client->backend_policy = policy;
+
+    if (policy == NGF_BACKEND_POLICY_NONE && client->presence) {
+        transport->unwatch_owner (client->presence, NULL, client);
+        transport->dispatcher_release (client->presence, 0);
+        client->presence = NULL;
+        __atomic_store_n (&client->backend_state, NGF_OWNER_UNKNOWN, __ATOMIC_RELAXED);
+    } else if (policy != NGF_BACKEND_POLICY_NONE && client->presence == NULL) {
+        if ((client->presence = transport->dispatcher_acquire (client->lanes[0].connection)) == NULL)
+            return;
+
+        if (!transport->watch_owner (client->presence, NULL, _client_owner_cb, client)) {
+            transport->dispatcher_release (client->presence, 0);
+            client->presence = NULL;
+            return;
+        }
+
+        /* Known already if another client shares the connection. */
+        __atomic_store_n (&client->backend_state, (int) transport->get_owner_state (client->presence, NULL), __ATOMIC_RELAXED);
+    }
+
+    if (policy != NGF_BACKEND_POLICY_QUEUE && client->queued_plays)
+        _client_flush_queued (client);
+}
+
+/* Earliest scheduled play or end of a max duration, 0 if none. */
+
+static int64_t
+_client_next_timer (NgfClient *client)
+{
+    int64_t next = ngf_timers_next (client->durations);
+
+    if (client->scheduled && (next == 0 || client->scheduled->deadline < next))
+        next = client->scheduled->deadline;
+
+    return next;
+}
+
+static int
+_client_sweep_timeout (NgfClient *client)
+{
+    int64_t flush = 0, next = 0;
+    int timeout = -1;
+
+    if (client->sweep_deadline > 0)
+        timeout = ngf_clock_timeout_ms (client->sweep_deadline, ngf_clock_now_ms ());
+
+    /* Spilled changes need another go once the consumer made room. */
+    if (_client_ring (client) && client->queue_length > 0 && (timeout < 0 || timeout > NGF_RING_RETRY_INTERVAL))
+        timeout = NGF_RING_RETRY_INTERVAL;
+
+    /* Held sends, rounded up to whole milliseconds. */
+    if (client->flush_deadline > 0) {
+        flush = (client->flush_deadline - ngf_clock_now_us () + 999) / 1000;
+        if (flush < 0)
+            flush = 0;
+        if (timeout < 0 || flush < timeout)
+            timeout = (int) flush;
+    }
+
+    /* Scheduled plays and max durations, likewise. The I/O thread has its
+       timer for them. */
+    if ((next = _client_next_timer (client)) > 0) {
+        flush = (next - ngf_clock_now_us () + 999) / 1000;
+        if (flush < 0)
+            flush = 0;
+        if (timeout < 0 || flush < timeout)
+            timeout = (int) flush;
+    }
+
+    return timeout;
+}
+
+static void
+_client_init_window (NgfClient *client)
+{
+    pthread_condattr_t attr;
+
+    pthread_mutex_init (&client->window_lock, NULL);
+
+    pthread_condattr_init (&attr);
+    pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+    pthread_cond_init (&client->window_cond, &attr);
+    pthread_condattr_destroy (&attr);
+
+    client->window_timeout = -1;
+}
+
+static void
+_client_free (NgfClient *client)
+{
+    pthread_cond_destroy (&client->window_cond);
+    pthread_mutex_destroy (&client->window_lock);
+    free (client);
+}
+
+static NgfClient*
+_client_new (void)
+{
+    NgfClient *c = NULL;
+
+    c = (NgfClient*) malloc (sizeof (NgfClient));
+    if (c == NULL)
+        return NULL;
+
+    memset (c, 0, sizeof (NgfClient));
+    _client_init_window (c);
+
+    c->num_lanes = 1;
+    c->idle_timeout = NGF_DEFAULT_IDLE_TIMEOUT;
+    c->reply_timeout = -1;
+
+    return c;
+}
+
+NgfClient*
+ngf_client_create (NgfTransport transport,
+                   ...)
+{
+    NgfClient *c = NULL;
+    va_list transport_args;
+
+    if ((c = _client_new ()) == NULL)
+        goto failed;
+
+    if ((c->lanes[0].transport = ngf_transport_lookup (transport)) == NULL)
+        goto failed;
+
+    va_start (transport_args, transport);
+    c->lanes[0].connection = c->lanes[0].transport->connect (transport_args);
+    va_end (transport_args);
+
+    if (!c->lanes[0].connection)
+        goto failed;
+
+    return c;
+
+failed:
+    ngf_client_destroy (c);
+    return NULL;
+}
+
+NgfClient*
+ngf_client_create_threaded (const char *address)
+{
+    NgfClient *c = NULL;
+    NgfLane *lane = NULL;
+
+    if ((c = _client_new ()) == NULL)
+        return NULL;
+
+    lane = &c->lanes[0];
+    lane->transport = ngf_transport_lookup (NGF_TRANSPORT_DBUS);
+    c->owns_connection = 1;
+
+    if ((lane->connection = lane->transport->open (address)) == NULL) {
+        ngf_client_destroy (c);
+        return NULL;
+    }
+
+    /* Batches end with an I/O thread iteration, see _client_tick. */
+    c->dispatching = 1;
+
+    c->worker = ngf_worker_start (lane->transport, lane->connection, _client_run_command, _client_tick, c);
+    if (c->worker == NULL) {
+        ngf_client_destroy (c);
+        return NULL;
+    }
+
+    return c;
+}
+
+static void
+_client_connected (NgfConnection *connection,
+                   void *userdata)
+{
+    NgfClient *client = (NgfClient*) userdata;
+
+    /* The worker's reference becomes ours. */
+    client->lanes[0].connection = connection;
+
+    if (client->connect_callback)
+        client->connect_callback (client, connection != NULL, client->connect_userdata);
+}
+
+NgfClient*
+ngf_client_create_async (const char *address,
+                         NgfConnectCallback callback,
+                         void *userdata)
+{
+    NgfClient *c = NULL;
+
+    if ((c = _client_new ()) == NULL)
+        return NULL;
+
+    c->lanes[0].transport = ngf_transport_lookup (NGF_TRANSPORT_DBUS);
+    c->owns_connection = 1;
+    c->dispatching = 1;
+    c->connect_callback = callback;
+    c->connect_userdata = userdata;
+
+    c->worker = ngf_worker_start_async (c->lanes[0].transport, address, _client_connected,
+                                        _client_run_command, _client_tick, c);
+    if (c->worker == NULL) {
+        ngf_client_destroy (c);
+        return NULL;
+    }
+
+    return c;
+}
+
+static void
+_free_play_key (NgfPlayKey *key)
+{
+    if (key == NULL)
+        return;
+
+    free (key->event);
+    if (key->proplist)
+        ngf_proplist_free (key->proplist);
+    free (key);
+}
+
+static void
+_free_link (NgfLink *link, void *userdata)
+{
+    (void) userdata;
+
+    free (link);
+}
+
+static void
+_free_rate_limit (NgfRateLimit *limit, void *userdata)
+{
+    (void) userdata;
+
+    free (limit->event);
+    free (limit);
+}
+
+/* Sends are held only while something will wake the client up to flush
+   them: its own loop or I/O thread. */
+
+/* Something wakes the client up for its deadlines: the I/O thread, or the
+   application dispatching it once ngf_client_get_fd has been called. */
+
+static int
+_client_timed (NgfClient *client)
+{
+    return client->worker || client->lanes[0].loop;
+}
+
+static int
+_client_holding (NgfClient *client)
+{
+    return client->send_window > 0
+        && !client->flushing
+        && _client_timed (client);
+}
+
+static void
+_client_schedule_flush (NgfClient *client)
+{
+    if (client->flush_deadline == 0)
+        client->flush_deadline = ngf_clock_now_us () + client->send_window;
+}
+
+static void
+_stop_active_event (NgfEvent *event, void *userdata)
+{
+    (void) userdata;
+
+    if (event->stopping)
+        return;
+
+    event->stopping = 1;
+    _limit_release (event->client, &event->limit);
+
+    if (_client_holding (event->client)) {
+        event->held = NGF_HELD_STOP;
+        _client_schedule_flush (event->client);
+        return;
+    }
+
+    _send_stop_event (event->lane, event->service, event->server_event_id);
+}
+
+static void
+_free_active_event (NgfEvent *event, void *userdata)
+{
+    (void) userdata;
+
+    if (event->lane->dispatcher)
+        event->lane->transport->remove_event (event->lane->dispatcher, event->server_event_id, event);
+
+    _client_release_match (event->client, event->lane, event->service, &event->matched);
+    _event_index_remove (event->client, event);
+    _limit_release (event->client, &event->limit);
+    _free_play_key (event->key);
+    event->lane->num_events--;
+    free (event->group);
+    free (event);
+}
+
+static void
+_free_pending_reply (NgfReply *reply, void *userdata)
+{
+    if (reply->pending) {
+        reply->lane->transport->cancel (reply->pending);
+        reply->pending = NULL;
+    }
+
+    _limit_release ((NgfClient*) userdata, &reply->limit);
+    if (reply->windowed)
+        _window_release ((NgfClient*) userdata);
+    _client_release_match ((NgfClient*) userdata, reply->lane, reply->service, &reply->matched);
+    _free_play_key (reply->key);
+    reply->lane->num_events--;
+    free (reply->group);
+    free (reply);
+}
+
+static void
+_free_bulk_call (NgfBulkCall *call, void *userdata)
+{
+    (void) userdata;
+
+    if (call->pending)
+        call->lane->transport->cancel (call->pending);
+
+    free (call->server_event_ids);
+    free (call);
+}
+
+static void
+_free_lane_rule (NgfLaneRule *rule, void *userdata)
+{
+    (void) userdata;
+
+    free (rule->pattern);
+    free (rule);
+}
+
+static void
+_free_route (NgfRoute *route, void *userdata)
+{
+    const NgfTransportOps *transport = route->client->lanes[0].transport;
+
+    (void) userdata;
+
+    if (route->presence) {
+        transport->unwatch_owner (route->presence, route->service, route);
+        if (route->fallback)
+            transport->unwatch_owner (route->presence, route->fallback, route);
+        transport->dispatcher_release (route->presence, 0);
+    }
+
+    free (route->pattern);
+    free (route->service);
+    free (route->fallback);
+    free (route);
+}
+
+static void
+_client_teardown (NgfClient *client)
+{
+    int i;
+
+    /* Held plays are dropped, held controls sent along with the stops. */
+    LIST_FOREACH (client->held_plays, _free_queued_play, client);
+    client->held_plays = NULL;
+    client->num_held = 0;
+    client->send_window = 0;
+    _client_flush_sends (client);
+
+    /* Scheduled plays never happened. */
+    LIST_FOREACH (client->scheduled, _free_scheduled, client);
+    client->scheduled = NULL;
+
+    ngf_timers_free (client->durations);
+    client->durations = NULL;
+
+    /* Stop any active events. */
+    LIST_FOREACH (client->active_events, _stop_active_event, client);
+
+    /* Free any pending replies. */
+    LIST_FOREACH (client->pending_replies, _free_pending_reply, client);
+    client->pending_replies = NULL;
+
+    LIST_FOREACH (client->active_events, _free_active_event, client);
+    client->active_events = NULL;
+
+    free (client->event_index);
+    client->event_index = NULL;
+    client->event_index_size = 0;
+
+    LIST_FOREACH (client->lane_rules, _free_lane_rule, client);
+    client->lane_rules = NULL;
+
+    LIST_FOREACH (client->bulk_calls, _free_bulk_call, client);
+    client->bulk_calls = NULL;
+
+    LIST_FOREACH (client->group_limits, _free_group_limit, client);
+    client->group_limits = NULL;
+
+    LIST_FOREACH (client->queued_plays, _free_queued_play, client);
+    client->queued_plays = NULL;
+    client->num_queued = 0;
+
+    LIST_FOREACH (client->links, _free_link, client);
+    client->links = NULL;
+
+    LIST_FOREACH (client->rate_limits, _free_rate_limit, client);
+    client->rate_limits = NULL;
+
+    LIST_FOREACH (client->routes, _free_route, client);
+    client->routes = NULL;
+
+    LIST_FOREACH (client->unicast_routes, _free_unicast, client);
+    client->unicast_routes = NULL;
+
+    if (client->presence) {
+        client->lanes[0].transport->unwatch_owner (client->presence, NULL, client);
+        client->lanes[0].transport->dispatcher_release (client->presence, 0);
+        client->presence = NULL;
+    }
+
+    for (i = 0; i < client->num_lanes; i++) {
+        _client_unsubscribe (client, &client->lanes[i], 0);
+
+        if (client->lanes[i].loop) {
+            client->lanes[i].transport->loop_release (client->lanes[i].loop);
+            client->lanes[i].loop = NULL;
+        }
+    }
+
+    free (client->queue);
+    client->queue = NULL;
+    client->queue_size = 0;
+    client->queue_head = 0;
+    client->queue_length = 0;
+
+    ngf_ring_free (client->ring);
+    client->ring = NULL;
+}
+
+void
+ngf_client_destroy (NgfClient *client)
+{
+    NgfLane *lane = NULL;
+    int i;
+
+    if (client == NULL)
+        return;
+
+    /* Let the I/O thread finish submitted work, the connection is ours
+       again once it has been joined. */
+
+    if (client->worker) {
+        ngf_worker_stop (client->worker);
+        client->worker = NULL;
+    }
+
+    _client_teardown (client);
+
+    for (i = 0; i < client->num_lanes; i++) {
+        if ((lane = &client->lanes[i])->connection == NULL)
+            continue;
+
+        lane->transport->flush (lane->connection);
+        if (i == 0 && client->owns_connection)
+            lane->transport->close (lane->connection);
+        lane->transport->unref (lane->connection);
+        lane->connection = NULL;
+    }
+
+    _client_free (client);
+}
+
+static void
+_destroy_free (void *userdata)
+{
+    NgfClient *client = (NgfClient*) userdata;
+    NgfLane *lane = NULL;
+    int i;
+
+    for (i = 0; i < client->num_lanes; i++) {
+        if ((lane = &client->lanes[i])->connection == NULL)
+            continue;
+
+        if (i == 0 && client->owns_connection)
+            lane->transport->close (lane->connection);
+        lane->transport->unref (lane->connection);
+    }
+
+    _client_free (client);
+}
+
+static void
+_destroy_finish (NgfClient *client)
+{
+    if (client->destroy_callback)
+        client->destroy_callback (client->destroy_flushed, client->destroy_userdata);
+
+    /* On the I/O thread of a threaded client, which frees it once it has
+       wound up, the caller of ngf_client_destroy_async never joins it. */
+
+    if (client->worker) {
+        ngf_worker_detach (client->worker, _destroy_free);
+        return;
+    }
+
+    _destroy_free (client);
+}
+
+static void
+_pending_destroy_reply (NgfTransportCall *pending,
+                        NgfReplyStatus status,
+                        uint32_t value,
+                        const char *sender,
+                        void *userdata)
+{
+    NgfClient *client = (NgfClient*) userdata;
+
+    (void) pending;
+    (void) value;
+    (void) sender;
+
+    /* Messages are delivered in order, so any reply to the ping means
+       everything queued before it, Stop messages included, was written. */
+
+    if (status == NGF_REPLY_NO_REPLY)
+        client->destroy_flushed = 0;
+
+    if (--client->destroy_pending == 0)
+        _destroy_finish (client);
+}
+
+/* Ping the bus behind the messages queued on a lane instead of flushing. */
+
+static int
+_destroy_ping (NgfClient *client,
+               NgfLane *lane,
+               int timeout_ms)
+{
+    return lane->transport->ping (lane->connection, timeout_ms, _pending_destroy_reply, client) != NULL;
+}
+
+static void
+_client_destroy_async (NgfClient *client,
+                       int timeout_ms)
+{
+    NgfLane *lane = NULL;
+    int driven[NGF_MAX_LANES];
+    int i;
+
+    client->destroying = 1;
+    client->destroy_flushed = 1;
+
+    for (i = 0; i < client->num_lanes; i++)
+        driven[i] = client->lanes[i].loop != NULL;
+
+    _client_teardown (client);
+
+    /* One ping per lane with queued messages, the extra count keeps a
+       ping answered early from finishing the teardown. A connection that
+       was driven by this client's loop alone is dispatched by nobody once
+       it is gone, it is flushed instead. */
+
+    client->destroy_pending = 1;
+    for (i = 0; i < client->num_lanes; i++) {
+        lane = &client->lanes[i];
+
+        if (lane->connection == NULL || !lane->transport->has_output (lane->connection))
+            continue;
+
+        if (driven[i] && !lane->transport->loop_attached (lane->connection)) {
+            lane->transport->flush (lane->connection);
+            continue;
+        }
+
+        if (_destroy_ping (client, lane, timeout_ms))
+            client->destroy_pending++;
+        else
+            client->destroy_flushed = 0;
+    }
+
+    if (--client->destroy_pending == 0)
+        _destroy_finish (client);
+}
+
+void
+ngf_client_destroy_async (NgfClient *client,
+                          NgfDestroyCallback callback,
+                          void *userdata,
+                          int timeout_ms)
+{
+    if (client == NULL)
+        return;
+
+    client->destroy_callback = callback;
+    client->destroy_userdata = userdata;
+
+    /* A threaded client is torn down by its I/O thread, which keeps
+       dispatching the connection until the stops are out. */
+
+    if (client->worker) {
+        if (_client_submit (client, NGF_COMMAND_DESTROY, NULL, (uint32_t) timeout_ms, NULL, NULL, NULL))
+            return;
+
+        ngf_client_destroy (client);
+        if (callback)
+            callback (1, userdata);
+        return;
+    }
+
+    _client_destroy_async (client, timeout_ms);
+}
+
+static NgfLoop*
+_client_loop (NgfClient *client,
+              int lane)
+{
+    if (client->worker || lane < 0 || lane >= client->num_lanes)
+        return NULL;
+
+    if (client->lanes[lane].loop == NULL)
+        client->lanes[lane].loop = client->lanes[lane].transport->loop_acquire (client->lanes[lane].connection);
+
+    return client->lanes[lane].loop;
+}
+
+int
+ngf_client_get_fd (NgfClient *client,
+                   int *events)
+{
+    return ngf_client_get_lane_fd (client, 0, events);
+}
+
+int
+ngf_client_get_lane_fd (NgfClient *client,
+                        int lane,
+                        int *events)
+{
+    NgfLoop *loop = NULL;
+
+    if (events)
+        *events = 0;
+
+    if (client == NULL || (loop = _client_loop (client, lane)) == NULL)
+        return -1;
+
+    return client->lanes[lane].transport->loop_get_fd (loop, events);
+}
+
+int
+ngf_client_get_timeout (NgfClient *client)
+{
+    NgfLoop *loop = NULL;
+    int timeout = -1, lane_timeout = -1, i;
+
+    if (client == NULL || client->worker)
+        return -1;
+
+    timeout = _client_sweep_timeout (client);
+
+    for (i = 0; i < client->num_lanes; i++) {
+        if ((loop = _client_loop (client, i)) == NULL)
+            continue;
+
+        lane_timeout = client->lanes[i].transport->loop_get_timeout (loop);
+        if (lane_timeout >= 0 && (timeout < 0 || lane_timeout < timeout))
+            timeout = lane_timeout;
+    }
+
+    return timeout;
+}
+
+int
+ngf_client_dispatch (NgfClient *client)
+{
+    NgfLoop *loop = NULL;
+    int connected = 1, i;
+
+    if (client == NULL || _client_loop (client, 0) == NULL)
+        return 0;
+
+    client->dispatching++;
+
+    _client_fire_scheduled (client);
+    _client_expire_durations (client);
+
+    for (i = 0; i < client->num_lanes; i++) {
+        if ((loop = _client_loop (client, i)) == NULL || !client->lanes[i].transport->loop_dispatch (loop))
+            connected = 0;
+    }
+
+    _client_flush_due (client);
+    _client_sweep (client);
+
+    client->dispatching--;
+    _client_flush_batch (client);
+
+    return connected;
+}
+
+int
+ngf_client_add_lane (NgfClient *client,
+                     NgfTransport transport,
+                     ...)
+{
+    NgfConnection *connection = NULL;
+    NgfLane *lane = NULL;
+    va_list transport_args;
+
+    if (client == NULL || client->worker)
+        return -1;
+
+    if (ngf_transport_lookup (transport) != client->lanes[0].transport || client->num_lanes == NGF_MAX_LANES)
+        return -1;
+
+    va_start (transport_args, transport);
+    connection = client->lanes[0].transport->connect (transport_args);
+    va_end (transport_args);
+
+    if (connection == NULL)
+        return -1;
+
+    lane = &client->lanes[client->num_lanes];
+    memset (lane, 0, sizeof (NgfLane));
+    lane->transport = client->lanes[0].transport;
+    lane->connection = connection;
+
+    return client->num_lanes++;
+}
+
+int
+ngf_client_add_lane_rule (NgfClient *client,
+                          const char *pattern,
+                          int lane)
+{
+    NgfLaneRule *rule = NULL;
+
+    if (client == NULL || pattern == NULL || lane < 0 || lane >= client->num_lanes)
+        return 0;
+
+    if ((rule = (NgfLaneRule*) calloc (1, sizeof (NgfLaneRule))) == NULL)
+        return 0;
+
+    if ((rule->pattern = strdup (pattern)) == NULL) {
+        free (rule);
+        return 0;
+    }
+
+    rule->lane = lane;
+    LIST_APPEND (client->lane_rules, rule);
+
+    return 1;
+}
+
+static int
+_client_route (NgfClient *client,
+               const char *event)
+{
+    NgfLaneRule *rule = NULL;
+
+    for (rule = client->lane_rules; rule; rule = rule->next) {
+        if (fnmatch (rule->pattern, event, 0) == 0)
+            return rule->lane;
+    }
+
+    return 0;
+}
+
+static NgfRoute*
+_client_find_route (NgfClient *client,
+                    const char *event)
+{
+    NgfRoute *route = NULL;
+
+    for (route = client->routes; route; route = route->next) {
+        if (fnmatch (route->pattern, event, 0) == 0)
+            return route;
+    }
+
+    return NULL;
+}
+
+/* The fallback takes over while the service is known to be absent, unless
+   it is known to be absent as well. */
+
+static const char*
+_route_service (NgfRoute *route)
+{
+    const NgfTransportOps *transport = route->client->lanes[0].transport;
+
+    if (route->fallback &&
+        transport->get_owner_state (route->presence, route->service) == NGF_OWNER_ABSENT &&
+        transport->get_owner_state (route->presence, route->fallback) != NGF_OWNER_ABSENT)
+    {
+        return route->fallback;
+    }
+
+    return route->service;
+}
+
+static void
+_route_owner_cb (void *target,
+                 const char *name,
+                 NgfOwnerState state,
+                 int lost)
+{
+    NgfRoute *route = (NgfRoute*) target;
+
+    (void) state;
+
+    /* Like the default backend, a backend that went away took every event
+       routed to it along. */
+
+    if (lost)
+        _client_fail_all (route->client, name);
+
+    _client_flush_batch (route->client);
+}
+
+static int
+_client_add_route (NgfClient *client,
+                   const char *pattern,
+                   const char *service,
+                   const char *fallback)
+{
+    const NgfTransportOps *transport = client->lanes[0].transport;
+    NgfRoute *route = NULL;
+
+    if ((route = (NgfRoute*) calloc (1, sizeof (NgfRoute))) == NULL)
+        return 0;
+
+    route->client = client;
+
+    if ((route->pattern = strdup (pattern)) == NULL ||
+        (route->service = strdup (service)) == NULL ||
+        (fallback && (route->fallback = strdup (fallback)) == NULL))
+    {
+        goto failed;
+    }
+
+    if ((route->presence = transport->dispatcher_acquire (client->lanes[0].connection)) == NULL)
+        goto failed;
+
+    if (!transport->watch_owner (route->presence, route->service, _route_owner_cb, route) ||
+        (route->fallback && !transport->watch_owner (route->presence, route->fallback, _route_owner_cb, route)))
+    {
+        goto failed;
+    }
+
+    LIST_APPEND (client->routes, route);
+    return 1;
+
+failed:
+    _free_route (route, client);
+    return 0;
+}
+
+int
+ngf_client_add_route (NgfClient *client,
+                      const char *pattern,
+                      const char *service,
+                      const char *fallback)
+{
+    NgfCommandArgs args = { .group = service, .fallback = fallback };
+
+    if (client == NULL || pattern == NULL || service == NULL)
+        return 0;
+
+    if (client->worker == NULL)
+        return _client_add_route (client, pattern, service, fallback);
+
+    return _client_submit (client, NGF_COMMAND_ROUTE, NULL, 0, pattern, NULL, &args);
+}
+
+void
+ngf_client_set_deferred_callbacks (NgfClient *client,
+                                   int enabled)
+{
+    if (client == NULL)
+        return;
+
+    client->deferred = enabled ? 1 : 0;
+
+    if (!client->deferred)
+        ngf_client_deliver_callbacks (client, 0);
+}
+
+uint32_t
+ngf_client_get_pending_callbacks (NgfClient *client)
+{
+    return client ? client->queue_length : 0;
+}
+
+uint32_t
+ngf_client_deliver_callbacks (NgfClient *client,
+                              uint32_t max_callbacks)
+{
+    NgfStateChange change;
+    uint32_t delivered = 0;
+
+    if (client == NULL)
+        return 0;
+
+    if (client->batch_callback)
+        return _client_deliver_batch (client, max_callbacks);
+
+    while (client->queue_length > 0 && (max_callbacks == 0 || delivered < max_callbacks)) {
+        change = client->queue[client->queue_head];
+        client->queue_head = (client->queue_head + 1) & (client->queue_size - 1);
+        client->queue_length--;
+        delivered++;
+
+        if (client->callback)
+            client->callback (client, change.id, change.state, client->userdata);
+    }
+
+    return delivered;
+}
+
+static void
+_client_set_batch_callback (NgfClient *client,
+                            NgfBatchCallback callback,
+                            void *userdata)
+{
+    /* Changes collected for the previous callback go to it. */
+    if (client->batch_callback && !client->deferred)
+        _client_deliver_batch (client, 0);
+
+    client->batch_callback = callback;
+    client->batch_userdata = userdata;
+}
+
+void
+ngf_client_set_batch_callback (NgfClient *client,
+                               NgfBatchCallback callback,
+                               void *userdata)
+{
+    NgfCommandArgs args = { .batch_callback = callback, .userdata = userdata };
+
+    if (client == NULL)
+        return;
+
+    if (_client_foreign (client))
+        _client_submit (client, NGF_COMMAND_BATCH_CALLBACK, NULL, 0, NULL, NULL, &args);
+    else
+        _client_set_batch_callback (client, callback, userdata);
+}
+
+void
+ngf_client_set_callback (NgfClient *client,
+                         NgfCallback callback,
+                         void *userdata)
+{
+    NgfCommandArgs args = { .callback = callback, .userdata = userdata };
+
+    if (client == NULL)
+        return;
+
+    if (_client_foreign (client)) {
+        _client_submit (client, NGF_COMMAND_CALLBACK, NULL, 0, NULL, NULL, &args);
+        return;
+    }
+
+    client->callback = callback;
+    client->userdata = userdata;
+}
+
+void
+ngf_client_set_unicast_status (NgfClient *client,
+                               int enabled)
+{
+    if (client == NULL)
+        return;
+
+    /* Takes effect from the next play on, plays already sent keep the
+       subscription they were sent with. */
+
+    __atomic_store_n (&client->unicast_status, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+void
+ngf_client_set_reply_timeout (NgfClient *client,
+                              int timeout_ms)
+{
+    if (client == NULL)
+        return;
+
+    timeout_ms = timeout_ms > 0 ? timeout_ms : -1;
+
+    if (_client_foreign (client))
+        _client_submit (client, NGF_COMMAND_REPLY_TIMEOUT, NULL, (uint32_t) timeout_ms, NULL, NULL, NULL);
+    else
+        client->reply_timeout = timeout_ms;
+}
+
+void
+ngf_client_set_event_timeout (NgfClient *client,
+                              uint32_t timeout_ms)
+{
+    if (client == NULL)
+        return;
+
+    if (_client_foreign (client))
+        _client_submit (client, NGF_COMMAND_EVENT_TIMEOUT, NULL, timeout_ms, NULL, NULL, NULL);
+    else
+        client->event_timeout = timeout_ms;
+}
+
+void
+ngf_client_set_backend_policy (NgfClient *client,
+                               NgfBackendPolicy policy)
+{
+    if (client == NULL)
+        return;
+
+    if (client->worker) {
+        _client_submit (client, NGF_COMMAND_BACKEND_POLICY, NULL, (uint32_t) policy, NULL, NULL, NULL);
+    } else {
+        _client_set_backend_policy (client, policy);
+        _client_flush_batch (client);
+    }
+}
+
+int
+ngf_client_get_backend_present (NgfClient *client)
+{
+    if (client == NULL)
+        return -1;
+
+    switch (__atomic_load_n (&client->backend_state, __ATOMIC_RELAXED)) {
+        case NGF_OWNER_PRESENT:
+            return 1;
+        case NGF_OWNER_ABSENT:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+int
+ngf_client_get_event_state (NgfClient *client,
+                            uint32_t id)
+{
+    NgfEvent *event = NULL;
+
+    if (client == NULL || _client_foreign (client))
+        return -1;
+
+    if (client->links)
+        id = _client_resolve_link (client, id);
+
+    if ((event = _event_index_lookup (client, id)) == NULL)
+        return -1;
+
+    return event->state;
+}
+
+void
+ngf_client_set_idle_timeout (NgfClient *client,
+                             uint32_t timeout_ms)
+{
+    if (client == NULL)
+        return;
+
+    if (_client_foreign (client))
+        _client_submit (client, NGF_COMMAND_IDLE_TIMEOUT, NULL, timeout_ms, NULL, NULL, NULL);
+    else
+        client->idle_timeout = timeout_ms;
+}
+
+static uint32_t
+_play_key_hash (const char *event,
+                NgfProplist *proplist)
+{
+    uint32_t hash = 2166136261U;
+    const char *p = NULL;
+
+    for (p = event; *p; p++) {
+        hash ^= (unsigned char) *p;
+        hash *= 16777619U;
+    }
+
+    return hash ^ ngf_proplist_hash (proplist);
+}
+
+static NgfPlayKey*
+_play_key_new (const char *event,
+               NgfProplist *proplist,
+               uint32_t hash)
+{
+    NgfPlayKey *key = NULL;
+
+    if ((key = (NgfPlayKey*) calloc (1, sizeof (NgfPlayKey))) == NULL)
+        return NULL;
+
+    key->hash = hash;
+
+    if ((key->event = strdup (event)) == NULL)
+        goto failed;
+
+    if (proplist && (key->proplist = ngf_proplist_copy (proplist)) == NULL)
+        goto failed;
+
+    return key;
+
+failed:
+    _free_play_key (key);
+    return NULL;
+}
+
+static int
+_play_key_match (const NgfPlayKey *key,
+                 const char *event,
+                 NgfProplist *proplist,
+                 uint32_t hash)
+{
+    return key
+        && key->hash == hash
+        && strcmp (key->event, event) == 0
+        && ngf_proplist_equal (key->proplist, proplist);
+}
+
+/* Find a pending or active play identical to this one, that is not being
+   stopped. Returns its id and last state, -1 if it has not reported one. */
+
+static uint32_t
+_client_find_identical (NgfClient *client,
+                        const char *event,
+                        NgfProplist *proplist,
+                        uint32_t hash,
+                        int *state)
+{
+    NgfReply *reply = NULL;
+    NgfEvent *active = NULL;
+
+    for (reply = client->pending_replies; reply; reply = reply->next) {
+        if (!reply->stop_set && _play_key_match (reply->key, event, proplist, hash)) {
+            *state = -1;
+            return reply->client_event_id;
+        }
+    }
+
+    for (active = client->active_events; active; active = active->next) {
+        if (!active->stopping && _play_key_match (active->key, event, proplist, hash)) {
+            *state = active->state;
+            return active->client_event_id;
+        }
+    }
+
+    return 0;
+}
+
+/* Link a play to an identical one in flight, instead of sending it. It
+   catches up with the state the other one is in right away. */
+
+static int
+_client_link (NgfClient *client,
+              const NgfPlayParams *params,
+              uint32_t client_event_id,
+              uint32_t primary_id,
+              int state)
+{
+    NgfLink *link = NULL;
+
+    if ((link = (NgfLink*) calloc (1, sizeof (NgfLink))) == NULL)
+        return 0;
+
+    link->client_event_id = client_event_id;
+    link->primary_id = primary_id;
+    link->listener = params->listener;
+
+    LIST_APPEND (client->links, link);
+
+    if (state >= 0)
+        _client_deliver (client, &link->listener, client_event_id, (NgfEventState) state);
+
+    return 1;
+}
+
+static uint32_t
+_client_resolve_link (NgfClient *client,
+                      uint32_t client_event_id)
+{
+    NgfLink *link = NULL;
+
+    for (link = client->links; link; link = link->next) {
+        if (link->client_event_id == client_event_id)
+            return link->primary_id;
+    }
+
+    return client_event_id;
+}
+
+/* Stopping a linked play only lets go of the event it shares. Stopping
+   the play that was sent while others are linked to it hands the event
+   over to the first of them. Either way the stopped id is completed
+   locally. Returns 1 if the stop was handled here. */
+
+static int
+_client_stop_link (NgfClient *client,
+                   uint32_t client_event_id)
+{
+    NgfLink *link = NULL, *heir = NULL;
+    NgfEvent *event = NULL;
+    NgfReply *reply = NULL;
+    NgfListener listener;
+
+    for (link = client->links; link; link = link->next) {
+        if (link->client_event_id == client_event_id) {
+            listener = link->listener;
+            LIST_REMOVE (client->links, link);
+            free (link);
+            _client_deliver (client, &listener, client_event_id, NGF_EVENT_COMPLETED);
+            return 1;
+        }
+
+        if (heir == NULL && link->primary_id == client_event_id)
+            heir = link;
+    }
+
+    if (heir == NULL)
+        return 0;
+
+    if ((event = _event_index_lookup (client, client_event_id)) != NULL) {
+        listener = event->listener;
+        _event_index_remove (client, event);
+        event->client_event_id = heir->client_event_id;
+        event->listener = heir->listener;
+        if (!_event_index_add (client, event))
+            return 0;
+    } else {
+        for (reply = client->pending_replies; reply; reply = reply->next) {
+            if (reply->client_event_id == client_event_id && !reply->stop_set)
+                break;
+        }
+
+        if (reply == NULL)
+            return 0;
+
+        listener = reply->listener;
+        reply->client_event_id = heir->client_event_id;
+        reply->listener = heir->listener;
+    }
+
+    for (link = client->links; link; link = link->next) {
+        if (link->primary_id == client_event_id)
+            link->primary_id = heir->client_event_id;
+    }
+
+    LIST_REMOVE (client->links, heir);
+    free (heir);
+
+    _client_deliver (client, &listener, client_event_id, NGF_EVENT_COMPLETED);
+    return 1;
+}
+
+static NgfRateLimit*
+_client_find_rate_limit (NgfClient *client,
+                         const char *event)
+{
+    NgfRateLimit *limit = NULL;
+
+    for (limit = client->rate_limits; limit; limit = limit->next) {
+        if (strcmp (limit->event, event) == 0)
+            return limit;
+    }
+
+    return NULL;
+}
+
+static void
+_client_set_rate_limit (NgfClient *client,
+                        const char *event,
+                        uint32_t rate,
+                        uint32_t burst,
+                        NgfRatePolicy policy)
+{
+    NgfRateLimit *limit = NULL;
+
+    if (burst == 0)
+        burst = 1;
+
+    if ((limit = _client_find_rate_limit (client, event)) == NULL) {
+        if ((limit = (NgfRateLimit*) calloc (1, sizeof (NgfRateLimit))) == NULL)
+            return;
+
+        if ((limit->event = strdup (event)) == NULL) {
+            free (limit);
+            return;
+        }
+
+        limit->tokens = (int64_t) burst * 1000;
+        limit->refilled = ngf_clock_now_ms ();
+        LIST_APPEND (client->rate_limits, limit);
+    }
+
+    limit->rate = rate;
+    limit->burst = burst;
+    limit->policy = policy;
+
+    if (limit->tokens > (int64_t) burst * 1000)
+        limit->tokens = (int64_t) burst * 1000;
+}
+
+/* Take a token for a play of the event, 0 if there is none left. */
+
+static int
+_rate_limit_available (NgfRateLimit *limit)
+{
+    int64_t now = ngf_clock_now_ms ();
+    int64_t max = (int64_t) limit->burst * 1000;
+
+    if (now > limit->refilled) {
+        limit->tokens += (now - limit->refilled) * limit->rate;
+        if (limit->tokens > max)
+            limit->tokens = max;
+        limit->refilled = now;
+    }
+
+    return limit->tokens >= 1000;
+}
+
+static int
+_rate_limit_take (NgfRateLimit *limit)
+{
+    if (!_rate_limit_available (limit))
+        return 0;
+
+    limit->tokens -= 1000;
+    return 1;
+}
+
+/* State of a play still in flight and not being stopped, -1 if it has not
+   reported one yet. Returns 0 if there is no such play. */
+
+static int
+_client_in_flight (NgfClient *client,
+                   uint32_t client_event_id,
+                   int *state)
+{
+    NgfEvent *event = NULL;
+    NgfReply *reply = NULL;
+
+    if (client_event_id == 0)
+        return 0;
+
+    if ((event = _event_index_lookup (client, client_event_id)) != NULL) {
+        *state = event->state;
+        return !event->stopping;
+    }
+
+    for (reply = client->pending_replies; reply; reply = reply->next) {
+        if (reply->client_event_id == client_event_id) {
+            *state = -1;
+            return !reply->stop_set;
+        }
+    }
+
+    return 0;
+}
+
+/* Take a slot of the window for a play of a threaded client, on the
+   calling thread. The I/O thread hands it over to the reply. */
+
+static int
+_window_reserve (NgfClient *client)
+{
+    struct timespec deadline;
+    uint32_t num = 0, max_pending = _window_max (client);
+    NgfWindowPolicy policy = _window_policy (client);
+    int timeout = _window_timeout (client);
+    int timed_out = 0;
+
+    if (timeout >= 0) {
+        clock_gettime (CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long) (timeout % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    for (;;) {
+        num = __atomic_load_n (&client->num_window, __ATOMIC_SEQ_CST);
+
+        /* Dropping makes room on the I/O thread. */
+        if (num < max_pending || policy == NGF_WINDOW_DROP_OLDEST) {
+            if (__atomic_compare_exchange_n (&client->num_window, &num, num + 1, 0,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                return 1;
+            continue;
+        }
+
+        __atomic_store_n (&client->window_blocked, 1, __ATOMIC_RELEASE);
+
+        if (policy != NGF_WINDOW_BLOCK || timed_out)
+            return 0;
+
+        /* Announce the wait before looking again, a release in between
+           then broadcasts. */
+
+        pthread_mutex_lock (&client->window_lock);
+        __atomic_add_fetch (&client->window_waiters, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n (&client->num_window, __ATOMIC_SEQ_CST) >= max_pending) {
+            if (timeout < 0)
+                pthread_cond_wait (&client->window_cond, &client->window_lock);
+            else if (pthread_cond_timedwait (&client->window_cond, &client->window_lock, &deadline) != 0)
+                timed_out = 1;
+        }
+
+        __atomic_sub_fetch (&client->window_waiters, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock (&client->window_lock);
+    }
+}
+
+/* Fail the oldest play awaiting its reply to make room in the window. The
+   reply is still waited for, only to stop the event should the backend
+   have started it, and reports nothing more. */
+
+static int
+_window_drop_oldest (NgfClient *client,
+                     NgfReply *keep)
+{
+    NgfReply *reply = NULL;
+
+    for (reply = client->pending_replies; reply; reply = reply->next) {
+        if (reply->windowed && reply != keep)
+            break;
+    }
+
+    if (reply == NULL)
+        return 0;
+
+    reply->windowed = 0;
+    reply->stop_set = 1;
+    reply->finished = 1;
+    _limit_release (client, &reply->limit);
+    _window_release (client);
+
+    _client_notify (client, &reply->listener, reply->client_event_id, NGF_EVENT_FAILED);
+    return 1;
+}
+
+/* Restarting an event about to be stopped cancels the stop, the event
+   carries on under the new id. The old id is completed locally. */
+
+static int
+_client_revive (NgfClient *client,
+                const NgfPlayParams *params,
+                uint32_t client_event_id,
+                const char *event,
+                NgfProplist *proplist)
+{
+    NgfEvent *active = NULL;
+    NgfListener listener;
+    uint32_t hash = _play_key_hash (event, proplist);
+    uint32_t old_id = 0;
+
+    for (active = client->active_events; active; active = active->next) {
+        if (active->held == NGF_HELD_STOP && !active->paused && active->group == NULL &&
+            _play_key_match (active->key, event, proplist, hash))
+            break;
+    }
+
+    if (active == NULL)
+        return 0;
+
+    listener = active->listener;
+    old_id = active->client_event_id;
+
+    _event_index_remove (client, active);
+    active->client_event_id = client_event_id;
+    if (!_event_index_add (client, active)) {
+        active->client_event_id = old_id;
+        _event_index_add (client, active);
+        return 0;
+    }
+
+    active->listener = params->listener;
+    active->stopping = 0;
+    active->held = NGF_HELD_NONE;
+
+    if (client->event_timeout > 0)
+        active->expires = ngf_clock_now_ms () + client->event_timeout;
+
+    _client_deliver (client, &listener, old_id, NGF_EVENT_COMPLETED);
+    if (active->state >= 0)
+        _client_deliver (client, &active->listener, client_event_id, (NgfEventState) active->state);
+
+    return 1;
+}
+
+/* Hold a play for the send window. A full hold flushes early. */
+
+static int
+_client_hold_play (NgfClient *client,
+                   const NgfPlayParams *params,
+                   uint32_t client_event_id,
+                   const char *event,
+                   NgfProplist *proplist)
+{
+    NgfQueuedPlay *play = NULL;
+
+    if (params->group == NULL && _client_revive (client, params, client_event_id, event, proplist))
+        return 1;
+
+    if (client->num_held >= NGF_MAX_QUEUED_PLAYS)
+        _client_flush_sends (client);
+
+    if ((play = _queued_play_new (params, client_event_id, event, proplist)) == NULL)
+        return 0;
+
+    /* The slot of a threaded play stays with it. */
+    play->params.window_slot = client->reservation;
+    client->reservation = 0;
+
+    LIST_APPEND (client->held_plays, play);
+    client->num_held++;
+    _client_schedule_flush (client);
+
+    return 1;
+}
+
+static int
+_client_send_play (NgfClient *client,
+                   const NgfPlayParams *params,
+                   uint32_t client_event_id,
+                   const char *event,
+                   NgfProplist *proplist,
+                   NgfTransportPlay *prebuilt)
+{
+    NgfTransportCall *pending = NULL;
+    NgfTransportPlay *play = NULL;
+    NgfReply *reply = NULL;
+    NgfLane *lane = NULL;
+    NgfGroupLimit *limit = NULL;
+    NgfRateLimit *rate = NULL;
+    NgfRoute *route = NULL;
+    const char *service = NULL;
+
+    int lane_index = params->lane;
+    int timeout = params->reply_timeout;
+    int dedup = client->dedup && params->group == NULL;
+    int keyed = params->group == NULL && (client->dedup || client->send_window > 0);
+    int state = -1, matched = 0;
+    int unicast = prebuilt ? params->unicast : __atomic_load_n (&client->unicast_status, __ATOMIC_RELAXED);
+    uint32_t hash = 0, primary_id = 0;
+
+    _client_sweep (client);
+
+    /* A prebuilt play is already late, it does not wait for the window. */
+    if (prebuilt == NULL && _client_holding (client))
+        return _client_hold_play (client, params, client_event_id, event, proplist);
+
+    if (keyed)
+        hash = _play_key_hash (event, proplist);
+
+    /* An identical play in flight stands in for this one. */
+
+    if (dedup) {
+        primary_id = _client_find_identical (client, event, proplist, hash, &state);
+        if (primary_id != 0)
+            return _client_link (client, params, client_event_id, primary_id, state);
+    }
+
+    /* Plays beyond the rate of their event never reach the bus. Coalesced
+       ones share the last play let through, if it is still in flight. The
+       token itself is only taken once nothing else turns the play away. */
+
+    if (client->rate_limits && (rate = _client_find_rate_limit (client, event)) != NULL && rate->rate > 0) {
+        if (!_rate_limit_available (rate)) {
+            if (rate->policy == NGF_RATE_COALESCE && _client_in_flight (client, rate->last_id, &state)) {
+                rate->num_coalesced++;
+                return _client_link (client, params, client_event_id, rate->last_id, state);
+            }
+
+            rate->num_rejected++;
+            return 0;
+        }
+    } else {
+        rate = NULL;
+    }
+
+    /* Routed events go to a backend of their own, the backend policy is
+       about the default one. */
+
+    if (client->routes && (route = _client_find_route (client, event)) != NULL)
+        service = _route_service (route);
+
+    if (route == NULL && client->presence &&
+        client->lanes[0].transport->get_owner_state (client->presence, NULL) == NGF_OWNER_ABSENT)
+    {
+        if (client->backend_policy == NGF_BACKEND_POLICY_QUEUE)
+            return _client_queue_play (client, params, client_event_id, event, proplist);
+
+        return 0;
+    }
+
+    /* Plays that would exceed the limit of their group never reach the
+       bus, unless an older one makes room for them. */
+
+    limit = _client_find_limit (client, params->group);
+    if (limit && limit->max_running > 0 && limit->num_running >= limit->max_running) {
+        switch (limit->policy) {
+            case NGF_LIMIT_PREEMPT_OLDEST:
+                _limit_preempt (client, limit);
+                break;
+
+            case NGF_LIMIT_QUEUE:
+                return _limit_enqueue (limit, params, client_event_id, event, proplist);
+
+            default:
+                return 0;
+        }
+    }
+
+    if (lane_index < 0)
+        lane_index = _client_route (client, event);
+
+    if (timeout < 0)
+        timeout = client->reply_timeout;
+
+    if (lane_index >= client->num_lanes)
+        return 0;
+
+    lane = &client->lanes[lane_index];
+
+    /* Plays of a threaded client come with their slot of the window,
+       waiting for one is done by its callers. A regular client has no
+       other thread to wait on, blocking refuses the play like rejecting. */
+
+    if (!client->reservation && _window_full (client) &&
+        _window_policy (client) != NGF_WINDOW_DROP_OLDEST)
+    {
+        __atomic_store_n (&client->window_blocked, 1, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    if (!_client_subscribe (client, lane))
+        return 0;
+
+    /* A callback run by a preempted or dropped play may have used it up. */
+
+    if (rate && !_rate_limit_take (rate)) {
+        rate->num_rejected++;
+        _client_check_idle (client, lane);
+        return 0;
+    }
+
+    _client_add_match (client, lane, service, unicast, &matched);
+
+    /* Send the actual message to the service, the reply is looked up among
+       the pending ones. */
+
+    if (prebuilt)
+        play = lane->transport->ref_play (prebuilt);
+    else
+        play = lane->transport->new_play (event, proplist, unicast);
+
+    if (play) {
+        pending = lane->transport->send_play (lane->connection, play, service, timeout, _pending_play_reply, client);
+        lane->transport->unref_play (play);
+    }
+
+    if (pending == NULL) {
+        if (rate)
+            rate->tokens += 1000;
+        _client_release_match (client, lane, service, &matched);
+        _client_check_idle (client, lane);
+        return 0;
+    }
+
+    reply = (NgfReply*) malloc (sizeof (NgfReply));
+    memset (reply, 0, sizeof (NgfReply));
+
+    reply->lane = lane;
+    reply->service = service;
+    reply->matched = matched;
+    reply->pending = pending;
+    reply->client_event_id = client_event_id;
+    reply->listener = params->listener;
+
+    /* Without a key the play is merely not deduplicated or revived. */
+    if (keyed)
+        reply->key = _play_key_new (event, proplist, hash);
+
+    if (params->group && (reply->group = strdup (params->group)) == NULL) {
+        if (rate)
+            rate->tokens += 1000;
+        lane->transport->cancel (pending);
+        _client_release_match (client, lane, service, &reply->matched);
+        _free_play_key (reply->key);
+        free (reply);
+        _client_check_idle (client, lane);
+        return 0;
+    }
+
+    LIST_APPEND (client->pending_replies, reply);
+    lane->num_events++;
+
+    if (rate)
+        rate->last_id = client_event_id;
+
+    reply->windowed = 1;
+    if (client->reservation)
+        client->reservation = 0;
+    else
+        __atomic_add_fetch (&client->num_window, 1, __ATOMIC_SEQ_CST);
+
+    if (limit) {
+        reply->limit = limit;
+        limit->num_running++;
+    }
+
+    while (_window_max (client) > 0 && _window_policy (client) == NGF_WINDOW_DROP_OLDEST
+           && __atomic_load_n (&client->num_window, __ATOMIC_SEQ_CST) > _window_max (client)
+           && _window_drop_oldest (client, reply))
+        ;
+
+    return 1;
+}
+
+static int
+_client_play_event (NgfClient *client,
+                    const NgfPlayParams *params,
+                    uint32_t client_event_id,
+                    const char *event,
+                    NgfProplist *proplist)
+{
+    return _client_send_play (client, params, client_event_id, event, proplist, NULL);
+}
+
+static NgfScheduled*
+_scheduled_new (NgfClient *client,
+                uint32_t client_event_id,
+                int64_t deadline,
+                const char *event,
+                NgfProplist *proplist,
+                NgfTransportPlay *play,
+                int unicast)
+{
+    NgfScheduled *entry = NULL;
+
+    if ((entry = (NgfScheduled*) calloc (1, sizeof (NgfScheduled))) == NULL)
+        return NULL;
+
+    entry->client_event_id = client_event_id;
+    entry->deadline = deadline;
+
+    if ((entry->event = strdup (event)) == NULL ||
+        (proplist && (entry->proplist = ngf_proplist_copy (proplist)) == NULL))
+    {
+        _free_scheduled (entry, client);
+        return NULL;
+    }
+
+    entry->play = client->lanes[0].transport->ref_play (play);
+    entry->unicast = unicast;
+    return entry;
+}
+
+/* The I/O thread sleeps on its timer until the earliest deadline. */
+
+static void
+_client_arm_timer (NgfClient *client)
+{
+    int64_t deadline = _client_next_timer (client);
+
+    if (deadline != client->armed && client->worker) {
+        ngf_worker_arm (client->worker, deadline);
+        client->armed = deadline;
+    }
+}
+
+/* Plays with the same deadline go out in the order they were scheduled. */
+
+static void
+_client_schedule (NgfClient *client,
+                  NgfScheduled *entry)
+{
+    NgfScheduled **link = NULL;
+
+    for (link = &client->scheduled; *link && (*link)->deadline <= entry->deadline; link = &(*link)->next)
+        ;
+
+    entry->next = *link;
+    *link = entry;
+}
+
+static int
+_client_unschedule (NgfClient *client,
+                    uint32_t client_event_id)
+{
+    NgfScheduled **link = NULL, *entry = NULL;
+
+    for (link = &client->scheduled; (entry = *link) != NULL; link = &entry->next) {
+        if (entry->client_event_id == client_event_id) {
+            *link = entry->next;
+            entry->next = NULL;
+            _client_arm_timer (client);
+            _client_drop_scheduled (client, entry);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Send the plays that are due, then tell how late each one went out. The
+   callbacks come after all of them, so a slow one delays none. */
+
+static void
+_client_fire_scheduled (NgfClient *client)
+{
+    NgfPlayParams params = NGF_PLAY_PARAMS_INIT;
+    NgfScheduled *entry = NULL, *fired = NULL, **tail = &fired;
+
+    while ((entry = client->scheduled) != NULL && entry->deadline <= ngf_clock_now_us ()) {
+        client->scheduled = entry->next;
+        entry->next = NULL;
+        *tail = entry;
+        tail = &entry->next;
+
+        params.unicast = entry->unicast;
+        if (!_client_send_play (client, &params, entry->client_event_id, entry->event, entry->proplist, entry->play))
+            _client_notify (client, NULL, entry->client_event_id, NGF_EVENT_FAILED);
+
+        entry->late = ngf_clock_now_us () - entry->deadline;
+    }
+
+    if (fired && client->schedule_callback) {
+        client->notifying++;
+        for (entry = fired; entry; entry = entry->next)
+            client->schedule_callback (client, entry->client_event_id, entry->late, client->schedule_userdata);
+        client->notifying--;
+    }
+
+    LIST_FOREACH (fired, _free_scheduled, client);
+    _client_arm_timer (client);
+}
+
+static int
+_client_play_at (NgfClient *client,
+                 uint32_t client_event_id,
+                 const char *event,
+                 NgfProplist *proplist,
+                 NgfTransportPlay *play,
+                 int unicast,
+                 int64_t deadline)
+{
+    NgfScheduled *entry = NULL;
+
+    if ((entry = _scheduled_new (client, client_event_id, deadline, event, proplist, play, unicast)) == NULL)
+        return 0;
+
+    _client_schedule (client, entry);
+    return 1;
+}
+
+static void
+_client_stop_event (NgfClient *client,
+                    uint32_t client_event_id)
+{
+    NgfEvent *event = NULL;
+    NgfReply *reply = NULL;
+    NgfQueuedPlay *play = NULL;
+    NgfGroupLimit *limit = NULL;
+
+    if (client->links && _client_stop_link (client, client_event_id))
+        return;
+
+    /* A play stopped before its deadline is never sent. */
+    if (client->scheduled && _client_unschedule (client, client_event_id))
+        return;
+
+    /* Stopping a held play cancels it, nothing is sent for either. */
+
+    for (play = client->held_plays; play; play = play->next) {
+        if (play->client_event_id == client_event_id) {
+            LIST_REMOVE (client->held_plays, play);
+            client->num_held--;
+            if (play->params.window_slot)
+                _window_release (client);
+            play->next = NULL;
+            _client_drop_plays (client, play);
+            return;
+        }
+    }
+
+    /* Plays still waiting for the backend or for a slot in their group
+       are dropped without being sent */
+
+    for (play = client->queued_plays; play; play = play->next) {
+        if (play->client_event_id == client_event_id) {
+            LIST_REMOVE (client->queued_plays, play);
+            client->num_queued--;
+            play->next = NULL;
+            _client_drop_plays (client, play);
+            return;
+        }
+    }
+
+    for (limit = client->group_limits; limit; limit = limit->next) {
+        for (play = limit->waiting; play; play = play->next) {
+            if (play->client_event_id == client_event_id) {
+                LIST_REMOVE (limit->waiting, play);
+                limit->num_waiting--;
+                play->next = NULL;
+                _client_drop_plays (client, play);
+                return;
+            }
+        }
+    }
+
+    /* First, go through the active events, stopping one twice is a no-op */
+
+    if ((event = _event_index_lookup (client, client_event_id)) != NULL) {
+        _stop_active_event (event, client);
+        _client_pump_limits (client);
+        return;
+    }
+
+    /* Look the event id from the pending replies */
+
+    reply = client->pending_replies;
+    while (reply) {
+        if (reply->client_event_id == client_event_id) {
+            reply->stop_set = 1;
+            _limit_release (client, &reply->limit);
+            break;
+        }
+
+        reply = reply->next;
+    }
+
+    _client_pump_limits (client);
+}
+
+/* Stop plays whose max duration is over, whatever state they are in. The
+   ones that ended already are no longer found and left alone. */
+
+static void
+_client_expire_durations (NgfClient *client)
+{
+    uint32_t client_event_id = 0;
+    int64_t now = 0;
+
+    if (client->durations == NULL)
+        return;
+
+    now = ngf_clock_now_us ();
+    while (ngf_timers_pop (client->durations, now, &client_event_id))
+        _client_stop_event (client, client_event_id);
+
+    _client_arm_timer (client);
+}
+
+static void
+_client_add_duration (NgfClient *client,
+                      uint32_t client_event_id,
+                      int64_t stop_at)
+{
+    if (client->durations == NULL && (client->durations = ngf_timers_new ()) == NULL)
+        return;
+
+    if (ngf_timers_add (client->durations, stop_at, client_event_id))
+        _client_arm_timer (client);
+}
+
+static void
+_pause_active_event (NgfClient *client,
+                     NgfEvent *event,
+                     int pause)
+{
+    if (_client_holding (client)) {
+        /* A pause and a resume within the window cancel out. */
+        if (event->held == (pause ? NGF_HELD_RESUME : NGF_HELD_PAUSE))
+            event->held = NGF_HELD_NONE;
+        else
+            event->held = pause ? NGF_HELD_PAUSE : NGF_HELD_RESUME;
+
+        _client_schedule_flush (client);
+        return;
+    }
+
+    _send_pause_event (event->lane, event->service, event->server_event_id, pause);
+}
+
+static void
+_client_pause_event (NgfClient *client,
+                     uint32_t client_event_id,
+                     int pause)
+{
+    NgfEvent *event = NULL;
+
+    /* Nothing to send if the event is already, or about to be, in the
+       requested state. */
+
+    if (client->links)
+        client_event_id = _client_resolve_link (client, client_event_id);
+
+    if ((event = _event_index_lookup (client, client_event_id)) == NULL)
+        return;
+
+    if (event->stopping || event->paused == pause)
+        return;
+
+    event->paused = pause;
+    _pause_active_event (client, event, pause);
+}
+
+static int
+_in_group (const char *event_group,
+           const char *group)
+{
+    return group == NULL || (event_group && strcmp (event_group, group) == 0);
+}
+
+static void
+_send_control_each (NgfLane *lane,
+                    const char *service,
+                    int pause,
+                    const uint32_t *server_event_ids,
+                    uint32_t num_ids)
+{
+    uint32_t i;
+
+    for (i = 0; i < num_ids; i++) {
+        if (pause < 0)
+            _send_stop_event (lane, service, server_event_ids[i]);
+        else
+            _send_pause_event (lane, service, server_event_ids[i], pause);
+    }
+}
+
+static void
+_bulk_call_reply (NgfTransportCall *pending,
+                  NgfReplyStatus status,
+                  uint32_t value,
+                  const char *sender,
+                  void *userdata)
+{
+    NgfBulkCall *call = (NgfBulkCall*) userdata;
+    NgfClient *client = call->client;
+
+    (void) pending;
+    (void) value;
+    (void) sender;
+
+    /* Repeating a stop or pause is harmless, so fall back on any error. */
+
+    if (status != NGF_REPLY_OK) {
+        if (status == NGF_REPLY_UNKNOWN_METHOD)
+            client->bulk_unsupported = 1;
+
+        _send_control_each (call->lane, call->service, call->pause, call->server_event_ids, call->num_ids);
+    }
+
+    /* Released by the transport once this returns. */
+    LIST_REMOVE (client->bulk_calls, call);
+    call->pending = NULL;
+    _free_bulk_call (call, client);
+}
+
+/* Stop (pause < 0), pause or resume the given events of a lane and
+   backend with a single message. Takes ownership of server_event_ids. */
+
+static void
+_send_control_bulk (NgfClient *client,
+                    NgfLane *lane,
+                    const char *service,
+                    int pause,
+                    uint32_t *server_event_ids,
+                    uint32_t num_ids)
+{
+    NgfBulkCall *call = NULL;
+
+    if (num_ids == 1 || client->bulk_unsupported)
+        goto fallback;
+
+    if ((call = (NgfBulkCall*) calloc (1, sizeof (NgfBulkCall))) == NULL)
+        goto fallback;
+
+    call->client = client;
+    call->lane = lane;
+    call->service = service;
+    call->pause = pause;
+    call->server_event_ids = server_event_ids;
+    call->num_ids = num_ids;
+
+    call->pending = lane->transport->send_control_bulk (lane->connection, service, server_event_ids, num_ids,
+                                                        pause, client->reply_timeout, _bulk_call_reply, call);
+    if (call->pending == NULL)
+        goto fallback;
+
+    LIST_APPEND (client->bulk_calls, call);
+    return;
+
+fallback:
+    free (call);
+    _send_control_each (lane, service, pause, server_event_ids, num_ids);
+    free (server_event_ids);
+}
+
+/* One message for the events of a lane in group that go to the backend of
+   the first one found. Handled events are in the requested state
+   afterwards, returns 1 if events of another backend are left. */
+
+static int
+_control_group_lane (NgfClient *client,
+                     NgfLane *lane,
+                     const char *group,
+                     int pause)
+{
+    NgfEvent *event = NULL;
+    const char *service = NULL;
+    uint32_t *server_event_ids = NULL;
+    uint32_t num_ids = 0;
+    int first = 1, more = 0;
+
+    for (event = client->active_events; event; event = event->next) {
+        if (event->lane != lane || !_in_group (event->group, group))
+            continue;
+
+        if (event->stopping || (pause >= 0 && event->paused == pause))
+            continue;
+
+        if (first) {
+            service = event->service;
+            first = 0;
+        } else if (event->service != service) {
+            more = 1;
+            continue;
+        }
+
+        /* The group message supersedes anything held for the event. */
+        event->held = NGF_HELD_NONE;
+
+        if (server_event_ids == NULL &&
+            (server_event_ids = (uint32_t*) malloc (client->num_active * sizeof (uint32_t))) == NULL)
+        {
+            if (pause < 0)
+                _stop_active_event (event, client);
+            else
+                _client_pause_event (client, event->client_event_id, pause);
+            continue;
+        }
+
+        if (pause < 0) {
+            event->stopping = 1;
+            _limit_release (client, &event->limit);
+        } else {
+            event->paused = pause;
+        }
+
+        server_event_ids[num_ids++] = event->server_event_id;
+    }
+
+    if (num_ids > 0)
+        _send_control_bulk (client, lane, service, pause, server_event_ids, num_ids);
+    else
+        free (server_event_ids);
+
+    return more;
+}
+
+/* Stop (pause < 0), pause or resume every event in group, or every event
+   of the client if group is NULL, with one message per lane and backend.
+   Events already in the requested state are left out. */
+
+static void
+_client_control_group (NgfClient *client,
+                       const char *group,
+                       int pause)
+{
+    NgfQueuedPlay *play = NULL, *next = NULL, *dropped = NULL, **tail = &dropped;
+    NgfScheduled *scheduled = NULL;
+    NgfGroupLimit *limit = NULL;
+    NgfReply *reply = NULL;
+    int i;
+
+    /* The plays not sent yet are collected first and end as completed
+       once the lists are consistent again. */
+
+    if (pause < 0) {
+        for (play = client->held_plays; play; play = next) {
+            next = play->next;
+            if (_in_group (play->group, group)) {
+                LIST_REMOVE (client->held_plays, play);
+                client->num_held--;
+                if (play->params.window_slot)
+                    _window_release (client);
+                play->next = NULL;
+                *tail = play;
+                tail = &play->next;
+            }
+        }
+
+        for (play = client->queued_plays; play; play = next) {
+            next = play->next;
+            if (_in_group (play->group, group)) {
+                LIST_REMOVE (client->queued_plays, play);
+                client->num_queued--;
+                play->next = NULL;
+                *tail = play;
+                tail = &play->next;
+            }
+        }
+
+        /* Scheduled plays are in no group. */
+        if (group == NULL && client->scheduled) {
+            scheduled = client->scheduled;
+            client->scheduled = NULL;
+            _client_arm_timer (client);
+        }
+
+        for (limit = client->group_limits; limit; limit = limit->next) {
+            if (_in_group (limit->group, group) && limit->waiting) {
+                *tail = limit->waiting;
+                while (*tail)
+                    tail = &(*tail)->next;
+                limit->waiting = NULL;
+                limit->num_waiting = 0;
+            }
+        }
+
+        for (reply = client->pending_replies; reply; reply = reply->next) {
+            if (_in_group (reply->group, group)) {
+                reply->stop_set = 1;
+                _limit_release (client, &reply->limit);
+            }
+        }
+    }
+
+    for (i = 0; i < client->num_lanes && client->num_active > 0; i++) {
+        while (_control_group_lane (client, &client->lanes[i], group, pause))
+            ;
+    }
+
+    _client_drop_plays (client, dropped);
+    _client_drop_scheduled (client, scheduled);
+    _client_pump_limits (client);
+}
+
+/* Send the controls held for the events of a lane that go to the backend
+   of the first one found, one message per kind where the backend allows.
+   Returns 1 if held controls for another backend are left. */
+
+static int
+_flush_held_lane (NgfClient *client,
+                  NgfLane *lane)
+{
+    NgfEvent *event = NULL;
+    const char *service = NULL;
+    uint32_t *ids[3];
+    uint32_t num_ids[3];
+    int k, first = 1, more = 0;
+
+    for (k = 0; k < 3; k++) {
+        ids[k] = NULL;
+        num_ids[k] = 0;
+    }
+
+    for (event = client->active_events; event; event = event->next) {
+        if (event->lane != lane || event->held == NGF_HELD_NONE)
+            continue;
+
+        if (first) {
+            service = event->service;
+            first = 0;
+        } else if (event->service != service) {
+            more = 1;
+            continue;
+        }
+
+        k = event->held - NGF_HELD_STOP;
+        event->held = NGF_HELD_NONE;
+
+        if (ids[k] == NULL && (ids[k] = (uint32_t*) malloc (client->num_active * sizeof (uint32_t))) == NULL) {
+            _send_control_each (lane, service, k == 0 ? -1 : k == 1, &event->server_event_id, 1);
+            continue;
+        }
+
+        ids[k][num_ids[k]++] = event->server_event_id;
+    }
+
+    for (k = 0; k < 3; k++) {
+        if (num_ids[k] > 0)
+            _send_control_bulk (client, lane, service, k == 0 ? -1 : k == 1, ids[k], num_ids[k]);
+        else
+            free (ids[k]);
+    }
+
+    return more;
+}
+
+/* Send everything held for the send window: controls first, then the
+   plays. */
+
+static void
+_client_flush_sends (NgfClient *client)
+{
+    NgfQueuedPlay *plays = client->held_plays, *play = NULL, *next = NULL;
+    int i;
+
+    client->flush_deadline = 0;
+    client->held_plays = NULL;
+    client->num_held = 0;
+    client->flushing++;
+
+    for (i = 0; i < client->num_lanes && client->num_active > 0; i++) {
+        while (_flush_held_lane (client, &client->lanes[i]))
+            ;
+    }
+
+    for (play = plays; play; play = next) {
+        next = play->next;
+
+        client->reservation = play->params.window_slot;
+        if (!_client_play_event (client, &play->params, play->client_event_id, play->event, play->proplist))
+            _client_notify (client, &play->params.listener, play->client_event_id, NGF_EVENT_FAILED);
+
+        if (client->reservation) {
+            client->reservation = 0;
+            _window_release (client);
+        }
+
+        _free_queued_play (play, client);
+    }
+
+    client->flushing--;
+}
+
+static void
+_client_flush_due (NgfClient *client)
+{
+    if (client->flush_deadline > 0 && ngf_clock_now_us () >= client->flush_deadline) {
+        _client_flush_sends (client);
+        _client_pump_limits (client);
+    }
+}
+
+static void
+_client_set_send_window (NgfClient *client,
+                         uint32_t window_us)
+{
+    client->send_window = window_us;
+
+    if (window_us == 0 && client->flush_deadline > 0)
+        _client_flush_sends (client);
+}
+
+static void
+_client_run_command (NgfWorkerNode *node,
+                     void *userdata)
+{
+    NgfClient *client = (NgfClient*) userdata;
+    NgfCommand *command = (NgfCommand*) node;
+
+    /* ngf_client_create_async failed to connect, nothing can be sent or
+       watched. Settings still apply, to the failures if nothing else. */
+
+    if (client->lanes[0].connection == NULL) {
+        switch (command->type) {
+            case NGF_COMMAND_PLAY:
+            case NGF_COMMAND_PLAY_AT:
+                _client_notify (client, &command->params.listener, command->client_event_id, NGF_EVENT_FAILED);
+                if (command->params.window_slot)
+                    _window_release (client);
+                goto done;
+
+            case NGF_COMMAND_BACKEND_POLICY:
+            case NGF_COMMAND_ROUTE:
+                goto done;
+
+            default:
+                break;
+        }
+    }
+
+    switch (command->type) {
+        case NGF_COMMAND_PLAY:
+            client->reservation = command->params.window_slot;
+            if (!_client_play_event (client, &command->params, command->client_event_id, command->event, command->proplist))
+                _client_notify (client, &command->params.listener, command->client_event_id, NGF_EVENT_FAILED);
+            else if (command->params.stop_at > 0)
+                _client_add_duration (client, command->client_event_id, command->params.stop_at);
+
+            /* Not sent after all, or queued until it can be. */
+            if (client->reservation) {
+                client->reservation = 0;
+                _window_release (client);
+            }
+            break;
+
+        case NGF_COMMAND_PLAY_AT:
+            if (!_client_play_at (client, command->client_event_id, command->event, command->proplist,
+                                  command->args.play, command->params.unicast, command->args.deadline))
+                _client_notify (client, NULL, command->client_event_id, NGF_EVENT_FAILED);
+
+            /* Due already if the deadline passed while it was queued. */
+            _client_fire_scheduled (client);
+            break;
+
+        case NGF_COMMAND_STOP:
+            _client_stop_event (client, command->client_event_id);
+            break;
+
+        case NGF_COMMAND_PAUSE:
+            _client_pause_event (client, command->client_event_id, 1);
+            break;
+
+        case NGF_COMMAND_RESUME:
+            _client_pause_event (client, command->client_event_id, 0);
+            break;
+
+        case NGF_COMMAND_BACKEND_POLICY:
+            _client_set_backend_policy (client, (NgfBackendPolicy) command->client_event_id);
+            break;
+
+        case NGF_COMMAND_STOP_GROUP:
+            _client_control_group (client, command->group, -1);
+            break;
+
+        case NGF_COMMAND_PAUSE_GROUP:
+            _client_control_group (client, command->group, 1);
+            break;
+
+        case NGF_COMMAND_RESUME_GROUP:
+            _client_control_group (client, command->group, 0);
+            break;
+
+        case NGF_COMMAND_GROUP_LIMIT:
+            _client_set_group_limit (client, command->group, command->args.max_running, command->args.limit_policy);
+            break;
+
+        case NGF_COMMAND_DEDUP:
+            client->dedup = command->client_event_id;
+            break;
+
+        case NGF_COMMAND_RATE_LIMIT:
+            _client_set_rate_limit (client, command->event, command->args.rate, command->args.burst,
+                                    command->args.rate_policy);
+            break;
+
+        case NGF_COMMAND_SEND_WINDOW:
+            _client_set_send_window (client, command->client_event_id);
+            break;
+
+        case NGF_COMMAND_ROUTE:
+            _client_add_route (client, command->event, command->group, command->fallback);
+            break;
+
+        case NGF_COMMAND_DESTROY:
+            _client_destroy_async (client, (int) command->client_event_id);
+            break;
+
+        case NGF_COMMAND_CALLBACK:
+            client->callback = command->args.callback;
+            client->userdata = command->args.userdata;
+            break;
+
+        case NGF_COMMAND_BATCH_CALLBACK:
+            _client_set_batch_callback (client, command->args.batch_callback, command->args.userdata);
+            break;
+
+        case NGF_COMMAND_SCHEDULE_CALLBACK:
+            client->schedule_callback = command->args.schedule_callback;
+            client->schedule_userdata = command->args.userdata;
+            break;
+
+        case NGF_COMMAND_READY_CALLBACK:
+            client->ready_callback = command->args.ready_callback;
+            client->ready_userdata = command->args.userdata;
+            break;
+
+        case NGF_COMMAND_REPLY_TIMEOUT:
+            client->reply_timeout = (int) command->client_event_id;
+            break;
+
+        case NGF_COMMAND_EVENT_TIMEOUT:
+            client->event_timeout = command->client_event_id;
+            break;
+
+        case NGF_COMMAND_IDLE_TIMEOUT:
+            client->idle_timeout = command->client_event_id;
+            break;
+
+        default:
+            break;
+    }
+
+done:
+    free (command->event);
+    free (command->group);
+    free (command->fallback);
+    if (command->proplist)
+        ngf_proplist_free (command->proplist);
+    if (command->args.play)
+        client->lanes[0].transport->unref_play (command->args.play);
+    free (command);
+}
+
+static int
+_client_tick (void *userdata)
+{
+    NgfClient *client = (NgfClient*) userdata;
+
+    NgfRing *ring = NULL;
+
+    /* Between ngf_client_destroy_async and the thread exiting. */
+    if (client->destroying)
+        return -1;
+
+    _client_fire_scheduled (client);
+    _client_expire_durations (client);
+    _client_flush_due (client);
+    _client_sweep (client);
+
+    if ((ring = _client_ring (client)) != NULL)
+        _client_flush_ring (client, ring);
+    else if (client->batch_callback && !client->deferred)
+        _client_deliver_batch (client, 0);
+
+    _client_flush_ready (client);
+
+    return _client_sweep_timeout (client);
+}
+
+static int
+_client_submit (NgfClient *client,
+                NgfCommandType type,
+                const NgfPlayParams *params,
+                uint32_t client_event_id,
+                const char *event,
+                NgfProplist *proplist,
+                const NgfCommandArgs *args)
+{
+    NgfCommand *command = NULL;
+    const char *group = NULL;
+
+    if ((command = (NgfCommand*) calloc (1, sizeof (NgfCommand))) == NULL)
         return 0;
 
-    reply = (NgfReply*) malloc (sizeof (NgfReply));
-    memset (reply, 0, sizeof (NgfReply));
+    command->type = type;
+    if (params)
+        command->params = *params;
+    if (args)
+        command->args = *args;
+    command->client_event_id = client_event_id;
 
-    reply->pending = pending;
-    reply->client_event_id = client_event_id;
+    /* Plays are grouped through their params, other commands name the
+       group they act on in args. */
 
-    LIST_APPEND (client->pending_replies, reply);
+    group = params ? params->group : command->args.group;
+    if (group && (command->group = strdup (group)) == NULL)
+        goto failed;
+
+    if (params)
+        command->params.group = command->group;
+    else
+        command->args.group = command->group;
+
+    if (command->args.fallback && (command->fallback = strdup (command->args.fallback)) == NULL)
+        goto failed;
+
+    command->args.fallback = command->fallback;
+
+    if (event && (command->event = strdup (event)) == NULL)
+        goto failed;
+
+    if (proplist && (command->proplist = ngf_proplist_copy (proplist)) == NULL)
+        goto failed;
+
+    if (command->args.play)
+        client->lanes[0].transport->ref_play (command->args.play);
+
+    ngf_worker_submit (client->worker, &command->node);
+    return 1;
+
+failed:
+    free (command->event);
+    free (command->group);
+    free (command->fallback);
+    free (command);
+    return 0;
+}
+
+static uint32_t
+_client_play (NgfClient *client,
+              const NgfPlayParams *params,
+              const char *event,
+              NgfProplist *proplist)
+{
+    NgfPlayParams reserved;
+    uint32_t client_event_id = 0;
+
+    if (client == NULL || event == NULL)
+        return 0;
+
+    if (client->worker) {
+        reserved = *params;
+        if (_window_max (client) > 0) {
+            if (!_window_reserve (client))
+                return 0;
+            reserved.window_slot = 1;
+        }
 
-    dbus_pending_call_set_notify (pending, _pending_play_reply, client, NULL);
+        client_event_id = __atomic_add_fetch (&client->play_id, 1, __ATOMIC_RELAXED);
+        if (!_client_submit (client, NGF_COMMAND_PLAY, &reserved, client_event_id, event, proplist, NULL)) {
+            if (reserved.window_slot)
+                _window_release (client);
+            return 0;
+        }
+
+        return client_event_id;
+    }
+
+    client_event_id = ++client->play_id;
+    if (!_client_play_event (client, params, client_event_id, event, proplist))
+        client_event_id = 0;
+    else if (params->stop_at > 0)
+        _client_add_duration (client, client_event_id, params->stop_at);
+
+    _client_flush_batch (client);
+    return client_event_id;
+}
+
+/* Send a play at deadline, see ngf_client_play_event_at. */
+
+static uint32_t
+_client_play_scheduled (NgfClient *client,
+                        const char *event,
+                        NgfProplist *proplist,
+                        const struct timespec *deadline)
+{
+    const NgfTransportOps *transport = NULL;
+    NgfPlayParams params = NGF_PLAY_PARAMS_INIT;
+    NgfCommandArgs args = { .play = NULL };
+    NgfTransportPlay *play = NULL;
+    uint32_t client_event_id = 0;
+    int64_t at = 0;
+
+    /* With nothing to wake it up the play would never go out. */
+    if (!_client_timed (client))
+        return 0;
+
+    /* Built on the calling thread, only the send is left for later. */
+    transport = client->lanes[0].transport;
+    params.unicast = __atomic_load_n (&client->unicast_status, __ATOMIC_RELAXED);
+    if ((play = transport->new_play (event, proplist, params.unicast)) == NULL)
+        return 0;
 
+    at = (int64_t) deadline->tv_sec * 1000000 + (deadline->tv_nsec + 999) / 1000;
+
+    if (client->worker) {
+        args.play = play;
+        args.deadline = at;
+
+        client_event_id = __atomic_add_fetch (&client->play_id, 1, __ATOMIC_RELAXED);
+        if (!_client_submit (client, NGF_COMMAND_PLAY_AT, &params, client_event_id, event, proplist, &args))
+            client_event_id = 0;
+
+        transport->unref_play (play);
+        return client_event_id;
+    }
+
+    client_event_id = ++client->play_id;
+    if (!_client_play_at (client, client_event_id, event, proplist, play, params.unicast, at))
+        client_event_id = 0;
+
+    transport->unref_play (play);
+    _client_flush_batch (client);
     return client_event_id;
 }
 
+uint32_t
+ngf_client_play_event_with_options (NgfClient *client,
+                                    const char *event,
+                                    NgfProplist *proplist,
+                                    const NgfPlayOptions *options)
+{
+    NgfPlayOptions defaults = NGF_PLAY_OPTIONS_INIT;
+    NgfPlayParams params = NGF_PLAY_PARAMS_INIT;
+
+    if (client == NULL || event == NULL)
+        return 0;
+
+    if (options == NULL)
+        options = &defaults;
+
+    if (options->lane < -1)
+        return 0;
+
+    /* The Play message of a scheduled play is built without any of them. */
+    if (options->deadline) {
+        if (options->lane >= 0 || options->timeout_ms > 0 || options->group || options->priority ||
+            options->max_duration_ms > 0 || options->callback || options->state_mask)
+        {
+            return 0;
+        }
+
+        return _client_play_scheduled (client, event, proplist, options->deadline);
+    }
+
+    /* With nothing to wake it up the event would never be stopped. */
+    if (options->max_duration_ms > 0 && !_client_timed (client))
+        return 0;
+
+    params.lane = options->lane;
+    params.reply_timeout = options->timeout_ms > 0 ? options->timeout_ms : -1;
+    params.group = options->group;
+    params.priority = options->priority;
+    params.listener.callback = options->callback;
+    params.listener.userdata = options->userdata;
+    params.listener.state_mask = options->state_mask;
+
+    /* Counted from now, not from when the play reaches the bus. */
+    if (options->max_duration_ms > 0)
+        params.stop_at = ngf_clock_now_us () + (int64_t) options->max_duration_ms * 1000;
+
+    return _client_play (client, &params, event, proplist);
+}
+
+uint32_t
+ngf_client_play_event (NgfClient *client,
+                       const char *event,
+                       NgfProplist *proplist)
+{
+    return ngf_client_play_event_with_options (client, event, proplist, NULL);
+}
+
+uint32_t
+ngf_client_play_event_in_group (NgfClient *client,
+                                const char *group,
+                                const char *event,
+                                NgfProplist *proplist)
+{
+    NgfPlayOptions options = NGF_PLAY_OPTIONS_INIT;
+
+    options.group = group;
+    return ngf_client_play_event_with_options (client, event, proplist, &options);
+}
+
+uint32_t
+ngf_client_play_event_with_priority (NgfClient *client,
+                                     const char *group,
+                                     int priority,
+                                     const char *event,
+                                     NgfProplist *proplist)
+{
+    NgfPlayOptions options = NGF_PLAY_OPTIONS_INIT;
+
+    options.group = group;
+    options.priority = priority;
+    return ngf_client_play_event_with_options (client, event, proplist, &options);
+}
+
+uint32_t
+ngf_client_play_event_full (NgfClient *client,
+                            const char *event,
+                            NgfProplist *proplist,
+                            NgfCallback callback,
+                            void *userdata,
+                            uint32_t state_mask)
+{
+    NgfPlayOptions options = NGF_PLAY_OPTIONS_INIT;
+
+    options.callback = callback;
+    options.userdata = userdata;
+    options.state_mask = state_mask;
+    return ngf_client_play_event_with_options (client, event, proplist, &options);
+}
+
+uint32_t
+ngf_client_play_event_on_lane (NgfClient *client,
+                               int lane,
+                               const char *event,
+                               NgfProplist *proplist)
+{
+    NgfPlayOptions options = NGF_PLAY_OPTIONS_INIT;
+
+    if (lane < 0)
+        return 0;
+
+    options.lane = lane;
+    return ngf_client_play_event_with_options (client, event, proplist, &options);
+}
+
+uint32_t
+ngf_client_play_event_with_timeout (NgfClient *client,
+                                    const char *event,
+                                    NgfProplist *proplist,
+                                    int timeout_ms)
+{
+    NgfPlayOptions options = NGF_PLAY_OPTIONS_INIT;
+
+    options.timeout_ms = timeout_ms;
+    return ngf_client_play_event_with_options (client, event, proplist, &options);
+}
+
+uint32_t
+ngf_client_play_event_with_duration (NgfClient *client,
+                                     const char *event,
+                                     NgfProplist *proplist,
+                                     uint32_t max_duration_ms)
+{
+    NgfPlayOptions options = NGF_PLAY_OPTIONS_INIT;
+
+    options.max_duration_ms = max_duration_ms;
+    return ngf_client_play_event_with_options (client, event, proplist, &options);
+}
+
+uint32_t
+ngf_client_play_event_at (NgfClient *client,
+                          const char *event,
+                          NgfProplist *proplist,
+                          const struct timespec *deadline)
+{
+    NgfPlayOptions options = NGF_PLAY_OPTIONS_INIT;
+
+    if (deadline == NULL)
+        return 0;
+
+    options.deadline = deadline;
+    return ngf_client_play_event_with_options (client, event, proplist, &options);
+}
+
+void
+ngf_client_set_schedule_callback (NgfClient *client,
+                                  NgfScheduleCallback callback,
+                                  void *userdata)
+{
+    NgfCommandArgs args = { .schedule_callback = callback, .userdata = userdata };
+
+    if (client == NULL)
+        return;
+
+    if (_client_foreign (client)) {
+        _client_submit (client, NGF_COMMAND_SCHEDULE_CALLBACK, NULL, 0, NULL, NULL, &args);
+        return;
+    }
+
+    client->schedule_callback = callback;
+    client->schedule_userdata = userdata;
+}
+
 void
 ngf_client_stop_event (NgfClient *client,
                        uint32_t client_event_id)
 {
-    NgfEvent *event = NULL;
-    NgfReply *reply = NULL;
+    if (client == NULL)
+        return;
+
+    if (client->worker) {
+        _client_submit (client, NGF_COMMAND_STOP, NULL, client_event_id, NULL, NULL, NULL);
+    } else {
+        _client_stop_event (client, client_event_id);
+        _client_flush_batch (client);
+    }
+}
+
+void
+ngf_client_pause_event (NgfClient *client,
+                        uint32_t client_event_id)
+{
+    if (client == NULL)
+        return;
+
+    if (client->worker)
+        _client_submit (client, NGF_COMMAND_PAUSE, NULL, client_event_id, NULL, NULL, NULL);
+    else
+        _client_pause_event (client, client_event_id, 1);
+}
 
+void
+ngf_client_resume_event (NgfClient *client,
+                         uint32_t client_event_id)
+{
     if (client == NULL)
         return;
 
-    /* First, go through the active events */
+    if (client->worker)
+        _client_submit (client, NGF_COMMAND_RESUME, NULL, client_event_id, NULL, NULL, NULL);
+    else
+        _client_pause_event (client, client_event_id, 0);
+}
 
-    event = client->active_events;
-    while (event) {
-        if (event->client_event_id == client_event_id) {
-            _stop_active_event (event, client);
-            break;
-        }
 
-        event = event->next;
+static void
+_client_group_command (NgfClient *client,
+                       NgfCommandType type,
+                       const char *group,
+                       int pause)
+{
+    NgfCommandArgs args = { .group = group };
+
+    if (client->worker) {
+        _client_submit (client, type, NULL, 0, NULL, NULL, &args);
+    } else {
+        _client_control_group (client, group, pause);
+        _client_flush_batch (client);
     }
+}
 
-    /* Look the event id from the pending replies */
+void
+ngf_client_stop_group (NgfClient *client,
+                       const char *group)
+{
+    if (client == NULL || group == NULL)
+        return;
 
-    reply = client->pending_replies;
-    while (reply) {
-        if (reply->client_event_id == client_event_id) {
-            reply->stop_set = TRUE;
-            break;
-        }
+    _client_group_command (client, NGF_COMMAND_STOP_GROUP, group, -1);
+}
 
-        reply = reply->next;
+void
+ngf_client_pause_group (NgfClient *client,
+                        const char *group)
+{
+    if (client == NULL || group == NULL)
+        return;
+
+    _client_group_command (client, NGF_COMMAND_PAUSE_GROUP, group, 1);
+}
+
+void
+ngf_client_resume_group (NgfClient *client,
+                         const char *group)
+{
+    if (client == NULL || group == NULL)
+        return;
+
+    _client_group_command (client, NGF_COMMAND_RESUME_GROUP, group, 0);
+}
+
+void
+ngf_client_stop_all (NgfClient *client)
+{
+    if (client == NULL)
+        return;
+
+    _client_group_command (client, NGF_COMMAND_STOP_GROUP, NULL, -1);
+}
+
+void
+ngf_client_set_group_limit (NgfClient *client,
+                            const char *group,
+                            uint32_t max_running,
+                            NgfLimitPolicy policy)
+{
+    NgfCommandArgs args = { .group = group, .max_running = max_running, .limit_policy = policy };
+
+    if (client == NULL || group == NULL)
+        return;
+
+    if (client->worker == NULL) {
+        _client_set_group_limit (client, group, max_running, policy);
+        _client_flush_batch (client);
+        return;
     }
+
+    _client_submit (client, NGF_COMMAND_GROUP_LIMIT, NULL, 0, NULL, NULL, &args);
 }
 
-static void
-_pause_active_event (NgfClient *client,
-                     NgfEvent *event,
-                     int pause)
+void
+ngf_client_set_rate_limit (NgfClient *client,
+                           const char *event,
+                           uint32_t rate,
+                           uint32_t burst,
+                           NgfRatePolicy policy)
 {
-    DBusMessage *msg = NULL;
-    DBusMessageIter iter;
+    NgfCommandArgs args = { .rate = rate, .burst = burst, .rate_policy = policy };
 
-    if ((msg = dbus_message_new_method_call (NGF_DBUS_NAME,
-                                             NGF_DBUS_PATH,
-                                             NGF_DBUS_IFACE,
-                                             NGF_DBUS_METHOD_PAUSE)) == NULL)
-    {
+    if (client == NULL || event == NULL)
+        return;
+
+    if (client->worker == NULL) {
+        _client_set_rate_limit (client, event, rate, burst, policy);
         return;
     }
 
-    dbus_message_iter_init_append (msg, &iter);
-    dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT32, &event->server_event_id);
-    dbus_message_iter_append_basic (&iter, DBUS_TYPE_BOOLEAN, &pause);
+    _client_submit (client, NGF_COMMAND_RATE_LIMIT, NULL, 0, event, NULL, &args);
+}
+
+int
+ngf_client_get_rate_limit_stats (NgfClient *client,
+                                 const char *event,
+                                 uint32_t *rejected,
+                                 uint32_t *coalesced)
+{
+    NgfRateLimit *limit = NULL;
+
+    if (client == NULL || event == NULL || _client_foreign (client))
+        return 0;
+
+    if ((limit = _client_find_rate_limit (client, event)) == NULL)
+        return 0;
+
+    if (rejected)
+        *rejected = limit->num_rejected;
+    if (coalesced)
+        *coalesced = limit->num_coalesced;
 
-    dbus_connection_send (client->connection, msg, NULL);
-    dbus_message_unref (msg);
+    return 1;
 }
 
 void
-ngf_client_pause_event (NgfClient *client,
-                        uint32_t client_event_id)
+ngf_client_set_max_pending (NgfClient *client,
+                            uint32_t max_pending,
+                            NgfWindowPolicy policy,
+                            int timeout_ms)
 {
-    NgfEvent *event = NULL;
-
     if (client == NULL)
         return;
 
-    event = client->active_events;
-    while (event) {
-        if (event->client_event_id == client_event_id) {
-            _pause_active_event (client, event, 1);
-            break;
-        }
+    __atomic_store_n (&client->window_policy, policy, __ATOMIC_RELAXED);
+    __atomic_store_n (&client->window_timeout, timeout_ms, __ATOMIC_RELAXED);
+    __atomic_store_n (&client->max_pending, max_pending, __ATOMIC_RELEASE);
+}
+
+void
+ngf_client_set_ready_callback (NgfClient *client,
+                               NgfReadyCallback callback,
+                               void *userdata)
+{
+    NgfCommandArgs args = { .ready_callback = callback, .userdata = userdata };
+
+    if (client == NULL)
+        return;
 
-        event = event->next;
+    if (_client_foreign (client)) {
+        _client_submit (client, NGF_COMMAND_READY_CALLBACK, NULL, 0, NULL, NULL, &args);
+        return;
     }
+
+    client->ready_callback = callback;
+    client->ready_userdata = userdata;
 }
 
 void
-ngf_client_resume_event (NgfClient *client,
-                         uint32_t client_event_id)
+ngf_client_set_send_window (NgfClient *client,
+                            uint32_t window_us)
 {
-    NgfEvent *event = NULL;
+    if (client == NULL)
+        return;
+
+    if (client->worker) {
+        _client_submit (client, NGF_COMMAND_SEND_WINDOW, NULL, window_us, NULL, NULL, NULL);
+    } else {
+        _client_set_send_window (client, window_us);
+        _client_flush_batch (client);
+    }
+}
 
+void
+ngf_client_set_dedup (NgfClient *client,
+                      int enabled)
+{
     if (client == NULL)
         return;
 
-    event = client->active_events;
-    while (event) {
-        if (event->client_event_id == client_event_id) {
-            _pause_active_event (client, event, 0);
-            break;
-        }
+    if (client->worker)
+        _client_submit (client, NGF_COMMAND_DEDUP, NULL, enabled ? 1 : 0, NULL, NULL, NULL);
+    else
+        client->dedup = enabled ? 1 : 0;
+}
+
+int
+ngf_client_enable_status_ring (NgfClient *client,
+                               uint32_t size)
+{
+    NgfRing *ring = NULL;
+
+    if (client == NULL)
+        return -1;
 
-        event = event->next;
+    if ((ring = _client_ring (client)) == NULL) {
+        if ((ring = ngf_ring_new (size > 0 ? size : NGF_STATUS_RING_DEFAULT_SIZE)) == NULL)
+            return -1;
+
+        __atomic_store_n (&client->ring, ring, __ATOMIC_RELEASE);
     }
+
+    return ngf_ring_get_fd (ring);
 }
 
+uint32_t
+ngf_client_read_states (NgfClient *client,
+                        NgfStateChange *changes,
+                        uint32_t max_changes)
+{
+    NgfRing *ring = NULL;
+
+    if (client == NULL || changes == NULL || (ring = _client_ring (client)) == NULL)
+        return 0;
+
+    return ngf_ring_pop (ring, changes, max_changes);
+}
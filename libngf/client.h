@@ -26,15 +26,20 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <time.h>
 #include <libngf/proplist.h>
 
 typedef enum _NgfTransport
 {
-    /** DBus transport is the only supported transport currently. */
+    /** D-Bus through libdbus, connections are DBusConnection*. */
     NGF_TRANSPORT_DBUS,
 
     /** Reserved for internal use. */
-    NGF_TRANSPORT_INTERNAL
+    NGF_TRANSPORT_INTERNAL,
+
+    /** D-Bus through sd-bus, connections are sd_bus*. Only available if
+        libngf was configured with --enable-sdbus. */
+    NGF_TRANSPORT_SDBUS
 } NgfTransport;
 
 typedef enum _NgfEventState
@@ -53,16 +58,130 @@ typedef enum _NgfEventState
 
 } NgfEventState;
 
+/** Bit of a state in the state mask of ngf_client_play_event_full. */
+#define NGF_EVENT_STATE_MASK(state) (1U << (state))
+
+/** Final states, after which an event reports nothing more. */
+#define NGF_EVENT_STATE_MASK_FINAL \
+    (NGF_EVENT_STATE_MASK (NGF_EVENT_FAILED) | NGF_EVENT_STATE_MASK (NGF_EVENT_COMPLETED))
+
+/** Every state. */
+#define NGF_EVENT_STATE_MASK_ALL \
+    (NGF_EVENT_STATE_MASK_FINAL | NGF_EVENT_STATE_MASK (NGF_EVENT_PLAYING) | NGF_EVENT_STATE_MASK (NGF_EVENT_PAUSED))
+
+typedef enum _NgfBackendPolicy
+{
+    /** Backend presence is not tracked, plays are always sent (default). */
+    NGF_BACKEND_POLICY_NONE,
+
+    /** Plays fail right away while the backend is not on the bus. */
+    NGF_BACKEND_POLICY_FAIL,
+
+    /** Plays are held back while the backend is not on the bus and sent once it appears. */
+    NGF_BACKEND_POLICY_QUEUE
+} NgfBackendPolicy;
+
+typedef enum _NgfLimitPolicy
+{
+    /** Stop the oldest event of the group to make room for the new one. */
+    NGF_LIMIT_PREEMPT_OLDEST,
+
+    /** Fail the new play, ngf_client_play_event returns 0. */
+    NGF_LIMIT_DROP_NEW,
+
+    /** Hold the new play back until the group has room, highest priority first. */
+    NGF_LIMIT_QUEUE
+} NgfLimitPolicy;
+
+typedef enum _NgfRatePolicy
+{
+    /** Fail plays beyond the rate, ngf_client_play_event returns 0. */
+    NGF_RATE_REJECT,
+
+    /** Link plays beyond the rate to the last play of the event let through, while it is in flight, see ngf_client_set_dedup. Rejected otherwise. */
+    NGF_RATE_COALESCE
+} NgfRatePolicy;
+
+typedef enum _NgfWindowPolicy
+{
+    /** Fail the new play, ngf_client_play_event returns 0. */
+    NGF_WINDOW_REJECT,
+
+    /** Fail the oldest play still awaiting its reply to make room. */
+    NGF_WINDOW_DROP_OLDEST,
+
+    /** Wait for room up to the timeout, then fail the new play. Threaded clients only, others reject. */
+    NGF_WINDOW_BLOCK
+} NgfWindowPolicy;
+
 /** Internal client structure. */
 typedef struct _NgfClient NgfClient;
 
 /** Event state callback for receiving event completion status (failed, completed) */
 typedef void (*NgfCallback) (NgfClient *client, uint32_t id, NgfEventState state, void *userdata);
 
+/** State change of one event, as passed to NgfBatchCallback. */
+typedef struct _NgfStateChange
+{
+    uint32_t        id;
+    NgfEventState   state;
+} NgfStateChange;
+
+/** Batch state callback, changes are in the order they happened and only valid during the call. */
+typedef void (*NgfBatchCallback) (NgfClient *client, const NgfStateChange *changes, uint32_t num_changes, void *userdata);
+
+/** Called when the window of ngf_client_set_max_pending has room again after a play was turned away or had to wait. */
+typedef void (*NgfReadyCallback) (NgfClient *client, void *userdata);
+
+/** Called once ngf_client_create_async has connected, connected is 0 if it could not. */
+typedef void (*NgfConnectCallback) (NgfClient *client, int connected, void *userdata);
+
+/** Called once a play of ngf_client_play_event_at has been sent, late_us microseconds after its deadline. */
+typedef void (*NgfScheduleCallback) (NgfClient *client, uint32_t id, int64_t late_us, void *userdata);
+
+/** Completion callback for ngf_client_destroy_async, flushed is 0 if the timeout hit first. */
+typedef void (*NgfDestroyCallback) (int flushed, void *userdata);
+
+/**
+ * Options of ngf_client_play_event_with_options. Start from
+ * NGF_PLAY_OPTIONS_INIT, which plays like ngf_client_play_event, and set
+ * the fields that differ.
+ */
+typedef struct _NgfPlayOptions
+{
+    /** Lane index returned by ngf_client_add_lane or 0, -1 to route by event name. */
+    int             lane;
+
+    /** Reply timeout in milliseconds, -1 for the client default. */
+    int             timeout_ms;
+
+    /** Group name, NULL to play the event in no group. */
+    const char      *group;
+
+    /** Order among the plays waiting for a NGF_LIMIT_QUEUE group, higher first. */
+    int             priority;
+
+    /** Longest the event may last in milliseconds counted from the call, 0 for no limit. */
+    uint32_t        max_duration_ms;
+
+    /** Callback for this event alone, NULL to use the client callback. */
+    NgfCallback     callback;
+    void            *userdata;
+
+    /** NGF_EVENT_STATE_MASK bits of the states to report to callback, 0 for all. */
+    uint32_t        state_mask;
+
+    /** CLOCK_MONOTONIC time to send the play at, NULL to send it right away. */
+    const struct timespec *deadline;
+} NgfPlayOptions;
+
+#define NGF_PLAY_OPTIONS_INIT { -1, -1, NULL, 0, 0, NULL, NULL, 0, NULL }
+
 /**
  * Create a client instance to play events.
  *
- * @param transport NgfTransport. Currently only NGF_TRANSPORT_DBUS supported.
+ * @param transport NgfTransport, creating a client for one libngf was built
+ *                  without fails.
  * @param ... Variable arguments passed to transports.
  * @return NgfClient instance or NULL on error.
  *
@@ -79,6 +198,47 @@ typedef void (*NgfCallback) (NgfClient *client, uint32_t id, NgfEventState state
 
 NgfClient* ngf_client_create (NgfTransport transport, ...);
 
+/**
+ * Create a client that owns a private bus connection and drives it from
+ * its own I/O thread, independent of the application's main loop. The
+ * connection uses NGF_TRANSPORT_DBUS.
+ *
+ * ngf_client_play_event, ngf_client_stop_event, ngf_client_pause_event and
+ * ngf_client_resume_event may then be called from any thread. They only
+ * queue the request on a lock-free queue and wake the I/O thread, which
+ * sends it. A play that can not be sent is reported as NGF_EVENT_FAILED.
+ * State callbacks are invoked on the I/O thread. The setters may be called
+ * from any thread as well, the I/O thread applies them in order with the
+ * requests submitted before. Getters such as ngf_client_get_event_state
+ * only answer on the I/O thread, from within its callbacks, and fail on
+ * any other thread. The main loop and deferred callback functions are
+ * not available in this mode. ngf_client_destroy sends whatever was submitted before it and
+ * joins the thread.
+ *
+ * @param address Bus address to connect to, NULL for the system bus.
+ * @return NgfClient instance or NULL on error.
+ */
+
+NgfClient* ngf_client_create_threaded (const char *address);
+
+/**
+ * Create a threaded client without waiting for its connection. The I/O
+ * thread opens and registers the private bus connection itself, so the
+ * call returns right away and adds nothing to application startup.
+ * Plays made before the client is connected are queued and sent once it
+ * is; if connecting fails they are reported as NGF_EVENT_FAILED. Apart
+ * from that the client behaves as one from ngf_client_create_threaded.
+ *
+ * @param address Bus address to connect to, NULL for the system bus.
+ * @param callback Invoked on the I/O thread once connected or failed, may be NULL.
+ * @param userdata Userdata for callback.
+ * @return NgfClient instance or NULL on error.
+ */
+
+NgfClient* ngf_client_create_async (const char *address,
+                                    NgfConnectCallback callback,
+                                    void *userdata);
+
 /**
  * Free the clients resources.
  *
@@ -87,6 +247,180 @@ NgfClient* ngf_client_create (NgfTransport transport, ...);
 
 void ngf_client_destroy (NgfClient *client);
 
+/**
+ * Free the clients resources without blocking on the bus. Stop messages
+ * for active events are queued and pending plays are cancelled right
+ * away, no more state callbacks are delivered. The remaining resources
+ * are released once the queued messages have been written or the timeout
+ * expires, whichever comes first. The client must not be used after this
+ * call. When the connection is driven through ngf_client_dispatch the
+ * completion is noticed by whoever dispatches the connection next. If no
+ * other client dispatches it, the queued messages are flushed before this
+ * function returns. A threaded client leaves all of it to its I/O thread,
+ * after the requests submitted before; the thread runs the callback and
+ * exits on its own, nobody waits for it.
+ *
+ * @param client NgfClient instance
+ * @param callback Optional callback invoked when teardown completes, possibly before this function returns.
+ * @param userdata Userdata for callback
+ * @param timeout_ms Upper bound for waiting in milliseconds, -1 for the DBus default.
+ */
+
+void ngf_client_destroy_async (NgfClient *client,
+                               NgfDestroyCallback callback,
+                               void *userdata,
+                               int timeout_ms);
+
+/**
+ * Get the file descriptor to poll for driving the client from an external
+ * event loop (poll, epoll, libuv, io_uring, ...) instead of GLib.
+ *
+ * The first call to any of ngf_client_get_fd, ngf_client_get_timeout or
+ * ngf_client_dispatch takes over the main loop integration of the client's
+ * DBusConnection, so the connection must not also be set up with another
+ * main loop. Clients sharing a connection share the integration as well.
+ *
+ * @param client NgfClient instance
+ * @param events If not NULL, set to the poll(2) events to wait for: POLLIN,
+ *               plus POLLOUT while outgoing data is waiting for the socket.
+ *               Query again after each dispatch.
+ * @return File descriptor or -1 on error.
+ *
+ * @code
+ * int fd = ngf_client_get_fd (client, &events);
+ * struct epoll_event ev = { .events = events, .data.ptr = client };
+ * epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev);
+ *
+ * while (running) {
+ *     epoll_wait (epfd, &ev, 1, ngf_client_get_timeout (client));
+ *     ngf_client_dispatch (client);
+ *
+ *     ngf_client_get_fd (client, &events);
+ *     ev.events = events;
+ *     epoll_ctl (epfd, EPOLL_CTL_MOD, fd, &ev);
+ * }
+ * @endcode
+ */
+
+int ngf_client_get_fd (NgfClient *client,
+                       int *events);
+
+/**
+ * Get the file descriptor of an additional lane, see ngf_client_add_lane.
+ * Lanes are separate connections and need to be polled as well when the
+ * client is driven through ngf_client_dispatch.
+ *
+ * @param client NgfClient instance
+ * @param lane Lane index, 0 for the connection the client was created with.
+ * @param events If not NULL, set to the poll(2) events to wait for.
+ * @return File descriptor or -1 on error.
+ */
+
+int ngf_client_get_lane_fd (NgfClient *client,
+                            int lane,
+                            int *events);
+
+/**
+ * Get the time until ngf_client_dispatch must be called even if the file
+ * descriptor did not become ready, for DBus reply timeouts and the
+ * client's own timers.
+ *
+ * @param client NgfClient instance
+ * @return Timeout in milliseconds, 0 to dispatch right away or -1 for none.
+ */
+
+int ngf_client_get_timeout (NgfClient *client);
+
+/**
+ * Perform pending I/O, handle expired timeouts and dispatch incoming
+ * messages on every lane of the client. State callbacks are invoked from
+ * within this call unless they are deferred, see
+ * ngf_client_set_deferred_callbacks. Never blocks.
+ *
+ * @param client NgfClient instance
+ * @return 1 on success, 0 if the connection has been closed.
+ */
+
+int ngf_client_dispatch (NgfClient *client);
+
+/**
+ * Add a lane: a separate connection with its own send queue that events
+ * can be routed to, so that latency critical feedback (key clicks, touch
+ * haptics) does not wait behind large Play messages of bulk events
+ * (ringtones, notifications) queued on the same socket. The connection is
+ * referenced by the client and must be integrated with the application's
+ * main loop like the client's own connection, or driven through
+ * ngf_client_get_lane_fd and ngf_client_dispatch. Not available for
+ * threaded clients.
+ *
+ * @param client NgfClient instance
+ * @param transport NgfTransport, must match the one the client was created with.
+ * @param ... Private DBusConnection to the bus the backend is on.
+ * @return Lane index for ngf_client_play_event_on_lane and
+ *         ngf_client_add_lane_rule, or -1 on error or if the maximum of
+ *         four lanes per client has been reached.
+ *
+ * @code
+ * DBusConnection *fast = dbus_bus_get_private (DBUS_BUS_SYSTEM, NULL);
+ * dbus_connection_setup_with_g_main (fast, NULL);
+ *
+ * int lane = ngf_client_add_lane (client, NGF_TRANSPORT_DBUS, fast);
+ * ngf_client_add_lane_rule (client, "feedback_*", lane);
+ * dbus_connection_unref (fast);
+ * @endcode
+ */
+
+int ngf_client_add_lane (NgfClient *client,
+                         NgfTransport transport,
+                         ...);
+
+/**
+ * Route events by name. ngf_client_play_event sends an event on the lane
+ * of the first rule whose pattern matches the event name, or on lane 0 if
+ * none matches.
+ *
+ * @param client NgfClient instance
+ * @param pattern Shell wildcard pattern, see fnmatch(3).
+ * @param lane Lane index returned by ngf_client_add_lane, or 0.
+ * @return 1 on success, 0 on error.
+ */
+
+int ngf_client_add_lane_rule (NgfClient *client,
+                              const char *pattern,
+                              int lane);
+
+/**
+ * Send events to another backend by name, e.g. haptics-only events to a
+ * backend instance of their own. Play, Stop and Pause of an event go to
+ * the service of the first route whose pattern matches the event name,
+ * or to the default backend if none matches; routing between lanes is
+ * unaffected. Status of routed events is tracked per backend, through a
+ * match for the Status of each service in use and by telling apart the
+ * events of different backends by the unique name that answered the
+ * Play. The owners of the route's names are tracked: while the service
+ * is known to be absent, new plays go to the fallback instead, and
+ * whenever the owner of either name goes away, the events routed to it
+ * are reported as NGF_EVENT_FAILED. The backend policy only applies to
+ * the default backend. For a threaded client add routes before the
+ * first play.
+ *
+ * @param client NgfClient instance
+ * @param pattern Shell wildcard pattern, see fnmatch(3).
+ * @param service Bus name of the backend for matching events.
+ * @param fallback Bus name to fail over to while service is absent, or NULL.
+ * @return 1 on success, 0 on error.
+ *
+ * @code
+ * ngf_client_add_route (client, "touch_*", "com.example.Haptics", NULL);
+ * ngf_client_add_route (client, "ringtone", "com.example.Audio", "com.example.AudioFallback");
+ * @endcode
+ */
+
+int ngf_client_add_route (NgfClient *client,
+                          const char *pattern,
+                          const char *service,
+                          const char *fallback);
+
 /**
  * Set a callback to receive event completion updates.
  *
@@ -99,6 +433,182 @@ void ngf_client_set_callback (NgfClient *client,
                               NgfCallback callback,
                               void *userdata);
 
+/**
+ * Receive state changes in batches instead of one callback per change.
+ * Changes are collected while the client is dispatched and delivered in
+ * one call at the end of the pass: of ngf_client_dispatch, of an I/O
+ * thread iteration for threaded clients, or of each message handled when
+ * the connection is dispatched by someone else. With deferred callbacks,
+ * ngf_client_deliver_callbacks delivers one batch. The per event callback
+ * is not invoked while a batch callback is set.
+ *
+ * @param client NgfClient instance
+ * @param callback Batch callback, NULL to go back to the per event callback.
+ * @param userdata Userdata
+ */
+
+void ngf_client_set_batch_callback (NgfClient *client,
+                                    NgfBatchCallback callback,
+                                    void *userdata);
+
+/**
+ * Hand state changes to another thread instead of invoking callbacks.
+ * Changes go into a lock-free single-producer single-consumer ring, the
+ * producer being the thread that dispatches the client (its I/O thread
+ * for threaded clients), the consumer the thread calling
+ * ngf_client_read_states. The returned eventfd becomes readable when the
+ * ring turns non-empty, and is written at most once until the consumer has
+ * read. Changes that do not fit are kept in order by the producer and
+ * moved into the ring as it drains, ngf_client_get_timeout accounts for
+ * that. Callbacks are not invoked once the ring is enabled, which cannot
+ * be undone. The consumer must stop reading before the client is
+ * destroyed.
+ *
+ * @param client NgfClient instance
+ * @param size Ring capacity in state changes, rounded up to a power of two. 0 for the default of 256.
+ * @return Eventfd to poll for POLLIN, owned by the client, or -1 on error. Calling this again returns the same descriptor.
+ */
+
+int ngf_client_enable_status_ring (NgfClient *client,
+                                   uint32_t size);
+
+/**
+ * Take state changes out of the status ring, oldest first. Call from the
+ * consumer thread only, see ngf_client_enable_status_ring. Clears the
+ * eventfd unless changes are left over.
+ *
+ * @param client NgfClient instance
+ * @param changes Array to fill.
+ * @param max_changes Size of the array.
+ * @return Number of changes stored in changes.
+ */
+
+uint32_t ngf_client_read_states (NgfClient *client,
+                                 NgfStateChange *changes,
+                                 uint32_t max_changes);
+
+/**
+ * Queue state changes instead of invoking the callback while messages are
+ * dispatched, so the application decides when and how many callbacks run.
+ * Queued changes are delivered in order with ngf_client_deliver_callbacks.
+ * Disabling delivers everything still queued. Used by the GLib source in
+ * libngf/client-glib.h to spread bursts over several main loop iterations.
+ *
+ * @param client NgfClient instance
+ * @param enabled 1 to defer callbacks, 0 to invoke them right away (default).
+ */
+
+void ngf_client_set_deferred_callbacks (NgfClient *client,
+                                        int enabled);
+
+/**
+ * Get the number of queued state changes.
+ *
+ * @param client NgfClient instance
+ * @return Number of callbacks ngf_client_deliver_callbacks would invoke without a limit.
+ */
+
+uint32_t ngf_client_get_pending_callbacks (NgfClient *client);
+
+/**
+ * Invoke the callback for queued state changes, oldest first.
+ *
+ * @param client NgfClient instance
+ * @param max_callbacks Maximum number of callbacks to invoke, 0 for all.
+ * @return Number of state changes delivered.
+ */
+
+uint32_t ngf_client_deliver_callbacks (NgfClient *client,
+                                       uint32_t max_callbacks);
+
+/**
+ * Ask the backend to address event state updates only to this client
+ * instead of broadcasting them to every libngf user on the bus.
+ *
+ * Plays then carry the boolean property "dbus.status.unicast". A backend
+ * honouring it sends the Status of that event, as a signal or a method
+ * call, with the destination set to the unique name that called Play. A
+ * backend ignoring it keeps broadcasting, so the client stays subscribed
+ * to the broadcast of each backend name until a Status addressed to it
+ * has arrived from that backend, and again once the name lost its owner.
+ * Takes effect from the next play on.
+ *
+ * @param client NgfClient instance
+ * @param enabled 1 to request unicast status, 0 for broadcast (default).
+ */
+
+void ngf_client_set_unicast_status (NgfClient *client,
+                                    int enabled);
+
+/**
+ * Set how long to wait for the backend to answer a play before the event
+ * is reported as NGF_EVENT_FAILED, instead of the DBus default of 25
+ * seconds. Expiry needs the connection to be dispatched, by the main loop
+ * it is set up with or through ngf_client_dispatch.
+ *
+ * @param client NgfClient instance
+ * @param timeout_ms Reply timeout in milliseconds, -1 for the DBus default.
+ */
+
+void ngf_client_set_reply_timeout (NgfClient *client,
+                                   int timeout_ms);
+
+/**
+ * Set the longest time an event may stay active without reaching a final
+ * state. Events past it are stopped and reported as NGF_EVENT_FAILED, so
+ * that events lost by a misbehaving backend do not pile up. Expired events
+ * are swept at most once per second: when the client is dispatched
+ * (ngf_client_get_timeout accounts for the next sweep), on every play and
+ * on every play reply.
+ *
+ * @param client NgfClient instance
+ * @param timeout_ms Maximum lifetime in milliseconds, 0 to disable (default).
+ */
+
+void ngf_client_set_event_timeout (NgfClient *client,
+                                   uint32_t timeout_ms);
+
+/**
+ * Track whether the backend is on the bus, through a single match on the
+ * owner changes of its name shared by all clients on the connection of
+ * lane 0. While it is known to be absent, plays fail or are queued as the
+ * policy says instead of waiting for a reply that never comes; up to 64
+ * plays are queued, stopping a queued play completes it unsent. Whenever the
+ * owner goes away or is replaced, all pending and active events of the
+ * client not routed elsewhere (see ngf_client_add_route) are reported as
+ * NGF_EVENT_FAILED at once. Until the bus has
+ * answered the first owner query plays are sent as usual.
+ *
+ * @param client NgfClient instance
+ * @param policy NgfBackendPolicy, NGF_BACKEND_POLICY_NONE stops tracking.
+ */
+
+void ngf_client_set_backend_policy (NgfClient *client,
+                                    NgfBackendPolicy policy);
+
+/**
+ * Get the last known backend presence, see ngf_client_set_backend_policy.
+ *
+ * @param client NgfClient instance
+ * @return 1 if the backend is on the bus, 0 if not, -1 if unknown or not tracked.
+ */
+
+int ngf_client_get_backend_present (NgfClient *client);
+
+/**
+ * Set how long the Status match rule and message filter are kept after
+ * the last active event has finished. They are registered on the first
+ * play and dropped once the client has been idle this long, so clients
+ * that never play anything cost the bus nothing. Expiry is noticed the
+ * next time a message is dispatched on the connection.
+ *
+ * @param client NgfClient instance
+ * @param timeout_ms Idle period in milliseconds, 0 to drop immediately. Defaults to 5000.
+ */
+
+void ngf_client_set_idle_timeout (NgfClient *client,
+                                  uint32_t timeout_ms);
+
 /**
  * Play event with optional properties.
  *
@@ -127,6 +637,347 @@ uint32_t ngf_client_play_event (NgfClient *client,
                                 const char *event,
                                 NgfProplist *proplist);
 
+/**
+ * Play event with any combination of the options the other play functions
+ * take one at a time, which all come down to this one. Each option behaves
+ * as described for its own function: ngf_client_play_event_on_lane,
+ * ngf_client_play_event_with_timeout, ngf_client_play_event_with_priority,
+ * ngf_client_play_event_with_duration, ngf_client_play_event_full and
+ * ngf_client_play_event_at. A play with a deadline takes none of the
+ * other options and fails if any is set.
+ *
+ * @param client NgfClient instance
+ * @param event Event name
+ * @param proplist NgfProplist or NULL.
+ * @param options Options initialized with NGF_PLAY_OPTIONS_INIT, or NULL for none.
+ * @return Event id or 0 if failed. If 0, the callback is not invoked.
+ *
+ * @code
+ * NgfPlayOptions options = NGF_PLAY_OPTIONS_INIT;
+ *
+ * options.group = "alerts";
+ * options.max_duration_ms = 3000;
+ * options.callback = done_cb;
+ * options.userdata = self;
+ * options.state_mask = NGF_EVENT_STATE_MASK_FINAL;
+ * ngf_client_play_event_with_options (client, "ringtone", NULL, &options);
+ * @endcode
+ */
+
+uint32_t ngf_client_play_event_with_options (NgfClient *client,
+                                             const char *event,
+                                             NgfProplist *proplist,
+                                             const NgfPlayOptions *options);
+
+/**
+ * Play event with its own reply timeout, overriding the one set with
+ * ngf_client_set_reply_timeout.
+ *
+ * @param client NgfClient instance
+ * @param event Event identifier
+ * @param proplist NgfProplist or NULL.
+ * @param timeout_ms Reply timeout in milliseconds, -1 for the client default.
+ * @return Id of the event, 0 on error.
+ */
+
+uint32_t ngf_client_play_event_with_timeout (NgfClient *client,
+                                             const char *event,
+                                             NgfProplist *proplist,
+                                             int timeout_ms);
+
+/**
+ * Play event that must not last longer than max_duration_ms, counted from
+ * the call. Once it is over the client stops the event itself, as with
+ * ngf_client_stop_event, whether it is playing, still awaiting its reply
+ * or not sent yet. The ends of all such plays are kept in one heap and
+ * wait on a single timer: the I/O thread's timerfd for a threaded client,
+ * ngf_client_get_timeout and ngf_client_dispatch for any other. With a
+ * limit it fails unless the client is threaded or ngf_client_get_fd has
+ * been called, as nothing would stop the event otherwise.
+ *
+ * @param client NgfClient instance
+ * @param event Event identifier
+ * @param proplist NgfProplist or NULL.
+ * @param max_duration_ms Longest the event may last, 0 for no limit.
+ * @return Id of the event, 0 on error.
+ */
+
+uint32_t ngf_client_play_event_with_duration (NgfClient *client,
+                                              const char *event,
+                                              NgfProplist *proplist,
+                                              uint32_t max_duration_ms);
+
+/**
+ * Play event on the given lane, bypassing the lane rules.
+ *
+ * @param client NgfClient instance
+ * @param lane Lane index returned by ngf_client_add_lane, or 0.
+ * @param event Event identifier
+ * @param proplist NgfProplist or NULL.
+ * @return Id of the event, 0 on error.
+ */
+
+uint32_t ngf_client_play_event_on_lane (NgfClient *client,
+                                        int lane,
+                                        const char *event,
+                                        NgfProplist *proplist);
+
+/**
+ * Play event tagged with a group name, so that it can be stopped, paused
+ * and resumed together with the other events of the group, see
+ * ngf_client_stop_group.
+ *
+ * @param client NgfClient instance
+ * @param group Group name, e.g. "alerts". NULL plays the event in no group.
+ * @param event Event name
+ * @param proplist Proplist
+ * @return Event id or 0 if failed.
+ */
+
+uint32_t ngf_client_play_event_in_group (NgfClient *client,
+                                         const char *group,
+                                         const char *event,
+                                         NgfProplist *proplist);
+
+/**
+ * Play event in a group with a priority, which orders the plays waiting
+ * for a group limited with NGF_LIMIT_QUEUE, see ngf_client_set_group_limit.
+ * Plays of the same priority are sent in the order they were made.
+ *
+ * @param client NgfClient instance
+ * @param group Group name.
+ * @param priority Higher values are sent first, ngf_client_play_event_in_group uses 0.
+ * @param event Event name
+ * @param proplist Proplist
+ * @return Event id or 0 if failed.
+ */
+
+uint32_t ngf_client_play_event_with_priority (NgfClient *client,
+                                              const char *group,
+                                              int priority,
+                                              const char *event,
+                                              NgfProplist *proplist);
+
+/**
+ * Play event with its own state callback. The callback takes the place of
+ * the client callback for this event: only it is invoked, only for the
+ * states in the mask, and always straight from dispatch (or the I/O thread
+ * of a threaded client), bypassing deferred, batched and ring delivery.
+ *
+ * @param client NgfClient instance
+ * @param event Event name
+ * @param proplist Proplist
+ * @param callback Callback for this event, NULL to use the client callback.
+ * @param userdata Userdata passed to the callback.
+ * @param state_mask NGF_EVENT_STATE_MASK bits of the states to report, 0 for all.
+ * @return Event id or 0 if failed. If 0, callback is not invoked.
+ *
+ * @code
+ * ngf_client_play_event_full (client, "ringtone", NULL, done_cb, self,
+ *                             NGF_EVENT_STATE_MASK_FINAL);
+ * @endcode
+ */
+
+uint32_t ngf_client_play_event_full (NgfClient *client,
+                                     const char *event,
+                                     NgfProplist *proplist,
+                                     NgfCallback callback,
+                                     void *userdata,
+                                     uint32_t state_mask);
+
+/**
+ * Play event at a given time, e.g. in step with an animation frame or an
+ * audio beat. The Play message is built right away and only sent when the
+ * deadline is reached, so that nothing but the send itself happens late.
+ * A threaded client sends it from its I/O thread woken by a timerfd, any
+ * other client when dispatched once ngf_client_get_timeout has run out,
+ * which is rounded up to whole milliseconds. Plays are never sent early,
+ * one whose deadline has passed is sent at the next opportunity; how late
+ * each actually went out is reported through
+ * ngf_client_set_schedule_callback. Stopping the event before it is sent
+ * reports it as NGF_EVENT_COMPLETED without sending it. Otherwise the play
+ * is handled like one of ngf_client_play_event at the time it is sent,
+ * except that a play turned away then is reported as NGF_EVENT_FAILED.
+ * The client's properties (unicast status) are those at the time of the
+ * call. Fails unless the client is threaded or ngf_client_get_fd has been
+ * called, as nothing would send the play otherwise.
+ *
+ * @param client NgfClient instance
+ * @param event Event name
+ * @param proplist Proplist
+ * @param deadline CLOCK_MONOTONIC time to send the play at.
+ * @return Event id or 0 if failed.
+ *
+ * @code
+ * struct timespec at;
+ * clock_gettime (CLOCK_MONOTONIC, &at);
+ * at.tv_nsec += 16666667;
+ * if (at.tv_nsec >= 1000000000) {
+ *     at.tv_sec++;
+ *     at.tv_nsec -= 1000000000;
+ * }
+ * ngf_client_play_event_at (client, "touch_bounce", NULL, &at);
+ * @endcode
+ */
+
+uint32_t ngf_client_play_event_at (NgfClient *client,
+                                   const char *event,
+                                   NgfProplist *proplist,
+                                   const struct timespec *deadline);
+
+/**
+ * Set a callback for the lateness of plays of ngf_client_play_event_at.
+ * It is invoked once per play right after the plays due at the same time
+ * have been sent, on the I/O thread for a threaded client.
+ *
+ * @param client NgfClient instance
+ * @param callback Callback, NULL to remove.
+ * @param userdata Userdata
+ */
+
+void ngf_client_set_schedule_callback (NgfClient *client,
+                                       NgfScheduleCallback callback,
+                                       void *userdata);
+
+/**
+ * Limit how many events of a group may be playing at once, e.g. one key
+ * click at a time. The limit is enforced before anything is sent, plays
+ * beyond it never reach the bus. Events count from the play until they
+ * finish or are stopped. Preempted events are stopped like with
+ * ngf_client_stop_event, queued plays are sent when a slot frees up and
+ * up to 64 plays are queued per group.
+ *
+ * @param client NgfClient instance
+ * @param group Group name given to the play functions.
+ * @param max_running Maximum number of events playing at once, 0 for no limit.
+ * @param policy What to do with plays beyond the limit.
+ *
+ * @code
+ * ngf_client_set_group_limit (client, "keyboard", 1, NGF_LIMIT_PREEMPT_OLDEST);
+ * ngf_client_play_event_in_group (client, "keyboard", "key_press", NULL);
+ * @endcode
+ */
+
+void ngf_client_set_group_limit (NgfClient *client,
+                                 const char *group,
+                                 uint32_t max_running,
+                                 NgfLimitPolicy policy);
+
+/**
+ * Bound the number of plays awaiting their reply from the backend, so
+ * that memory and queueing latency stay bounded while it is slow. Plays
+ * that would exceed the window are handled according to the policy.
+ * Callers of a threaded client block on their own thread while its I/O
+ * thread goes on; a regular client, which would have to dispatch a
+ * connection possibly shared with others, rejects the play instead. Plays
+ * sent on the application's behalf later, such as queued or scheduled
+ * ones, fail rather than wait. A play dropped to make room is reported as NGF_EVENT_FAILED and stopped should
+ * the backend have started it. For a threaded client set the window
+ * before the first play.
+ *
+ * @param client NgfClient instance
+ * @param max_pending Most plays awaiting their reply, 0 for no limit (default).
+ * @param policy What to do with plays beyond the window.
+ * @param timeout_ms Longest wait with NGF_WINDOW_BLOCK, -1 to wait for as long as it takes.
+ */
+
+void ngf_client_set_max_pending (NgfClient *client,
+                                 uint32_t max_pending,
+                                 NgfWindowPolicy policy,
+                                 int timeout_ms);
+
+/**
+ * Set a callback for when the window of ngf_client_set_max_pending has
+ * room again, after a play was turned away or had to wait. It is invoked
+ * once per such episode, when the client is dispatched (on the I/O thread
+ * for a threaded client).
+ *
+ * @param client NgfClient instance
+ * @param callback Callback, NULL to remove.
+ * @param userdata Userdata
+ */
+
+void ngf_client_set_ready_callback (NgfClient *client,
+                                    NgfReadyCallback callback,
+                                    void *userdata);
+
+/**
+ * Hold outgoing messages for a short window and send them together, to
+ * save wakeups of the bus and the backend during bursts. Plays, stops,
+ * pauses and resumes are held from the first one until the window has
+ * passed; stops, pauses and resumes of a lane then go out as one message
+ * each where the backend supports it. Within the window a play that is
+ * stopped again, or a pause and a resume of the same event, are cancelled
+ * without any traffic, and replaying an identical event that is being
+ * stopped keeps it playing under the new id. Only clients driven through
+ * ngf_client_get_fd and ngf_client_dispatch (the GLib source included)
+ * or threaded clients hold messages, others send right away. The window
+ * is honoured to the millisecond of ngf_client_get_timeout.
+ *
+ * @param client NgfClient instance
+ * @param window_us Window in microseconds, 0 to send right away (default).
+ */
+
+void ngf_client_set_send_window (NgfClient *client,
+                                 uint32_t window_us);
+
+/**
+ * Deduplicate identical plays, e.g. a chat replaying its history. While
+ * enabled, a play of the same event with an equal proplist as one still
+ * pending or playing is not sent: the returned id is linked to the event
+ * in flight and gets its state changes, starting with its current state.
+ * Stopping a linked id completes it without touching the event, which is
+ * stopped only once no id refers to it anymore. Pause and resume act on
+ * the shared event. Plays in a group are never deduplicated. Disabled by
+ * default.
+ *
+ * @param client NgfClient instance
+ * @param enabled 1 to deduplicate subsequent plays, 0 to stop doing so.
+ */
+
+void ngf_client_set_dedup (NgfClient *client,
+                           int enabled);
+
+/**
+ * Limit the rate of plays of an event with a token bucket, to protect the
+ * backend from a flooding caller. Each play takes a token, tokens come back
+ * at rate per second up to burst. Plays without a token never reach the
+ * bus. The limit can be changed at any time, counters are kept.
+ *
+ * @param client NgfClient instance
+ * @param event Event name, matched exactly.
+ * @param rate Tokens per second, 0 for no limit.
+ * @param burst Most plays let through at once, at least 1.
+ * @param policy What to do with plays beyond the rate.
+ *
+ * @code
+ * ngf_client_set_rate_limit (client, "sms", 2, 5, NGF_RATE_COALESCE);
+ * @endcode
+ */
+
+void ngf_client_set_rate_limit (NgfClient *client,
+                                const char *event,
+                                uint32_t rate,
+                                uint32_t burst,
+                                NgfRatePolicy policy);
+
+/**
+ * Get the number of plays of an event held back by its rate limit. For a
+ * threaded client this only works from its callbacks, it fails on any
+ * other thread.
+ *
+ * @param client NgfClient instance
+ * @param event Event name given to ngf_client_set_rate_limit.
+ * @param rejected Number of rejected plays, or NULL.
+ * @param coalesced Number of coalesced plays, or NULL.
+ * @return 1 if the event has a rate limit, 0 otherwise.
+ */
+
+int ngf_client_get_rate_limit_stats (NgfClient *client,
+                                     const char *event,
+                                     uint32_t *rejected,
+                                     uint32_t *coalesced);
+
 /**
  * Stop an active event.
  *
@@ -137,6 +988,21 @@ uint32_t ngf_client_play_event (NgfClient *client,
 void ngf_client_stop_event (NgfClient *client,
                             uint32_t id);
 
+/**
+ * Get the last state reported for an active event, without any bus
+ * traffic. Pause, resume and stop calls that would not change the state
+ * of an event are not sent to the backend at all. For a threaded client
+ * this only works from its callbacks, which run on the I/O thread, and
+ * returns -1 on any other thread.
+ *
+ * @param client NgfClient instance
+ * @param id Event id.
+ * @return NgfEventState of the event, or -1 if it has not reported a state yet or is not active (anymore).
+ */
+
+int ngf_client_get_event_state (NgfClient *client,
+                                uint32_t id);
+
 /**
  * Pause active event.
  *
@@ -157,6 +1023,49 @@ void ngf_client_pause_event (NgfClient *client,
 void ngf_client_resume_event (NgfClient *client,
                               uint32_t id);
 
+/**
+ * Stop every event played in group. Active events are stopped with a
+ * single message per lane; backends that do not support that get one
+ * Stop per event instead, which the client notices and remembers. Plays
+ * in the group still waiting for their reply are stopped as soon as it
+ * arrives.
+ *
+ * @param client NgfClient instance
+ * @param group Group name given to ngf_client_play_event_in_group.
+ */
+
+void ngf_client_stop_group (NgfClient *client,
+                            const char *group);
+
+/**
+ * Pause every active event played in group, see ngf_client_stop_group.
+ *
+ * @param client NgfClient instance
+ * @param group Group name given to ngf_client_play_event_in_group.
+ */
+
+void ngf_client_pause_group (NgfClient *client,
+                             const char *group);
+
+/**
+ * Resume every paused event played in group, see ngf_client_stop_group.
+ *
+ * @param client NgfClient instance
+ * @param group Group name given to ngf_client_play_event_in_group.
+ */
+
+void ngf_client_resume_group (NgfClient *client,
+                              const char *group);
+
+/**
+ * Stop every event of the client, grouped or not, see
+ * ngf_client_stop_group.
+ *
+ * @param client NgfClient instance
+ */
+
+void ngf_client_stop_all (NgfClient *client);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,60 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NGF_CLOCK_H
+#define NGF_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+/** Current CLOCK_MONOTONIC time in milliseconds. */
+static inline int64_t
+ngf_clock_now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** Current CLOCK_MONOTONIC time in microseconds. */
+static inline int64_t
+ngf_clock_now_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** Milliseconds from now until deadline, clamped to the range of a poll timeout. */
+static inline int
+ngf_clock_timeout_ms (int64_t deadline, int64_t now)
+{
+    if (deadline <= now)
+        return 0;
+
+    if (deadline - now > INT32_MAX)
+        return INT32_MAX;
+
+    return (int) (deadline - now);
+}
+
+#endif /* NGF_CLOCK_H */
@@ -0,0 +1,785 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dbus/dbus.h>
+
+#include "list_p.h"
+#include "clock_p.h"
+#include "dispatcher_p.h"
+
+#define INDEX_INITIAL_SIZE 16
+
+typedef struct _IndexEntry IndexEntry;
+typedef struct _StatusMatch StatusMatch;
+typedef struct _OwnerName OwnerName;
+typedef struct _OwnerWatch OwnerWatch;
+
+struct _IndexEntry
+{
+    LIST_INIT (IndexEntry)
+
+    uint32_t        server_event_id;
+    const char      *sender;        /* stored right after the entry, NULL for any */
+    NgfStatusFunc   func;
+    void            *target;
+};
+
+/* Status match rule of one backend name, kept for the linger period once
+   unreferenced. */
+struct _StatusMatch
+{
+    LIST_INIT (StatusMatch)
+
+    char            *name;
+    int             refcount;
+    int             added;
+};
+
+/* Owner of one backend name, tracked while anybody watches it. */
+struct _OwnerName
+{
+    LIST_INIT (OwnerName)
+
+    NgfDispatcher   *dispatcher;
+    char            *name;
+    NgfOwnerState   state;
+    DBusPendingCall *pending;
+    int             num_watches;
+};
+
+struct _OwnerWatch
+{
+    LIST_INIT (OwnerWatch)
+
+    OwnerName       *owner;
+    NgfOwnerFunc    func;
+    void            *target;
+};
+
+struct _NgfDispatcher
+{
+    DBusConnection  *connection;
+    int             refcount;
+    int64_t         linger_deadline;
+
+    StatusMatch     *matches;
+
+    IndexEntry      **index;
+    uint32_t        index_size;
+    uint32_t        num_events;
+
+    OwnerName       *owners;
+    OwnerWatch      *owner_watches;
+};
+
+/* Data slot holding the dispatcher of a connection. Allocated once per
+   dispatcher, libdbus refcounts the slot itself. */
+static dbus_int32_t dispatcher_slot = -1;
+
+static void _dispatcher_free (NgfDispatcher *dispatcher);
+static void _dispatcher_destroy_cb (void *userdata);
+
+static const char*
+_backend_name (const char *name)
+{
+    return name ? name : NGF_DBUS_NAME;
+}
+
+static void
+_dispatcher_rule (NgfDispatcher *dispatcher,
+                  const char *format,
+                  const char *name,
+                  int add)
+{
+    char rule[NGF_DBUS_MATCH_MAX];
+
+    snprintf (rule, sizeof (rule), format, name);
+
+    if (add)
+        dbus_bus_add_match (dispatcher->connection, rule, NULL);
+    else
+        dbus_bus_remove_match (dispatcher->connection, rule, NULL);
+}
+
+static void
+_dispatcher_linger (NgfDispatcher *dispatcher,
+                    uint32_t linger_ms)
+{
+    int64_t deadline = 0;
+
+    if (linger_ms == 0)
+        return;
+
+    deadline = ngf_clock_now_ms () + linger_ms;
+    if (deadline > dispatcher->linger_deadline)
+        dispatcher->linger_deadline = deadline;
+}
+
+static int
+_dispatcher_lingering (NgfDispatcher *dispatcher)
+{
+    return dispatcher->linger_deadline > 0 &&
+           ngf_clock_now_ms () < dispatcher->linger_deadline;
+}
+
+/* Drop whatever outlived its linger period. Returns 1 if the dispatcher
+   itself was freed. */
+static int
+_dispatcher_expire (NgfDispatcher *dispatcher)
+{
+    StatusMatch *match = NULL;
+
+    if (dispatcher->linger_deadline == 0 || _dispatcher_lingering (dispatcher))
+        return 0;
+
+    dispatcher->linger_deadline = 0;
+
+    if (dispatcher->refcount == 0) {
+        _dispatcher_free (dispatcher);
+        return 1;
+    }
+
+    for (match = dispatcher->matches; match; match = match->next) {
+        if (match->refcount == 0 && match->added) {
+            _dispatcher_rule (dispatcher, NGF_DBUS_MATCH_FORMAT, match->name, 0);
+            match->added = 0;
+        }
+    }
+
+    return 0;
+}
+
+static StatusMatch*
+_dispatcher_find_match (NgfDispatcher *dispatcher,
+                        const char *name)
+{
+    StatusMatch *match = NULL;
+
+    for (match = dispatcher->matches; match; match = match->next) {
+        if (strcmp (match->name, name) == 0)
+            return match;
+    }
+
+    return NULL;
+}
+
+static IndexEntry**
+_index_bucket (NgfDispatcher *dispatcher, uint32_t server_event_id)
+{
+    /* Server ids are sequential, so the low bits spread well. */
+    return &dispatcher->index[server_event_id & (dispatcher->index_size - 1)];
+}
+
+/* Backends number their events independently, the sender tells apart
+   equal ids of different backends. */
+
+static IndexEntry*
+_index_lookup (NgfDispatcher *dispatcher, uint32_t server_event_id, const char *sender)
+{
+    IndexEntry *entry = NULL;
+
+    for (entry = *_index_bucket (dispatcher, server_event_id); entry; entry = entry->next) {
+        if (entry->server_event_id != server_event_id)
+            continue;
+
+        if (entry->sender == NULL || sender == NULL || strcmp (entry->sender, sender) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static int
+_index_grow (NgfDispatcher *dispatcher)
+{
+    IndexEntry **old_index = dispatcher->index;
+    uint32_t old_size = dispatcher->index_size;
+    IndexEntry *entry = NULL, *next = NULL, **bucket = NULL;
+    uint32_t i;
+
+    dispatcher->index = (IndexEntry**) calloc (old_size * 2, sizeof (IndexEntry*));
+    if (dispatcher->index == NULL) {
+        dispatcher->index = old_index;
+        return 0;
+    }
+
+    dispatcher->index_size = old_size * 2;
+
+    for (i = 0; i < old_size; i++) {
+        for (entry = old_index[i]; entry; entry = next) {
+            next = entry->next;
+            bucket = _index_bucket (dispatcher, entry->server_event_id);
+            entry->next = *bucket;
+            *bucket = entry;
+        }
+    }
+
+    free (old_index);
+    return 1;
+}
+
+static OwnerName*
+_dispatcher_find_owner (NgfDispatcher *dispatcher,
+                        const char *name)
+{
+    OwnerName *owner = NULL;
+
+    for (owner = dispatcher->owners; owner; owner = owner->next) {
+        if (strcmp (owner->name, name) == 0)
+            return owner;
+    }
+
+    return NULL;
+}
+
+static void
+_dispatcher_set_owner (OwnerName *owner,
+                       NgfOwnerState state,
+                       int lost)
+{
+    NgfDispatcher *dispatcher = owner->dispatcher;
+    OwnerWatch *watch = NULL, *next = NULL;
+
+    if (owner->state == state && !lost)
+        return;
+
+    owner->state = state;
+
+    /* Watchers may unwatch, or drop their dispatcher reference, from
+       within the callback. */
+
+    dispatcher->refcount++;
+    for (watch = dispatcher->owner_watches; watch; watch = next) {
+        next = watch->next;
+        if (watch->owner == owner)
+            watch->func (watch->target, owner->name, state, lost);
+    }
+    ngf_dispatcher_release (dispatcher, 0);
+}
+
+static void
+_dispatcher_owner_changed (NgfDispatcher *dispatcher,
+                           DBusMessage *msg)
+{
+    const char *name = NULL, *old_owner = NULL, *new_owner = NULL;
+    OwnerName *owner = NULL;
+
+    if (!dbus_message_get_args (msg, NULL,
+                                DBUS_TYPE_STRING, &name,
+                                DBUS_TYPE_STRING, &old_owner,
+                                DBUS_TYPE_STRING, &new_owner,
+                                DBUS_TYPE_INVALID))
+    {
+        return;
+    }
+
+    if ((owner = _dispatcher_find_owner (dispatcher, name)) == NULL)
+        return;
+
+    _dispatcher_set_owner (owner,
+                           new_owner[0] ? NGF_OWNER_PRESENT : NGF_OWNER_ABSENT,
+                           old_owner[0] != '\0');
+}
+
+static void
+_dispatcher_owner_reply (DBusPendingCall *pending,
+                         void *userdata)
+{
+    OwnerName *owner = (OwnerName*) userdata;
+    DBusMessage *msg = NULL;
+    NgfOwnerState state = NGF_OWNER_UNKNOWN;
+
+    msg = dbus_pending_call_steal_reply (pending);
+
+    if (msg && dbus_message_get_type (msg) == DBUS_MESSAGE_TYPE_METHOD_RETURN)
+        state = NGF_OWNER_PRESENT;
+    else if (msg && dbus_message_is_error (msg, DBUS_ERROR_NAME_HAS_NO_OWNER))
+        state = NGF_OWNER_ABSENT;
+
+    if (msg)
+        dbus_message_unref (msg);
+
+    dbus_pending_call_unref (owner->pending);
+    owner->pending = NULL;
+
+    /* Owner changes signalled while the query was in flight happened
+       before the bus answered it, the answer is the newer state. */
+
+    if (state != NGF_OWNER_UNKNOWN)
+        _dispatcher_set_owner (owner, state, 0);
+}
+
+static void
+_dispatcher_query_owner (OwnerName *owner)
+{
+    DBusMessage *msg = NULL;
+    const char *name = owner->name;
+
+    msg = dbus_message_new_method_call (DBUS_SERVICE_DBUS,
+                                        DBUS_PATH_DBUS,
+                                        DBUS_INTERFACE_DBUS,
+                                        "GetNameOwner");
+    if (msg == NULL)
+        return;
+
+    dbus_message_append_args (msg, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID);
+    dbus_connection_send_with_reply (owner->dispatcher->connection, msg, &owner->pending, -1);
+    dbus_message_unref (msg);
+
+    if (owner->pending &&
+        !dbus_pending_call_set_notify (owner->pending, _dispatcher_owner_reply, owner, NULL))
+    {
+        dbus_pending_call_cancel (owner->pending);
+        dbus_pending_call_unref (owner->pending);
+        owner->pending = NULL;
+    }
+}
+
+static void
+_dispatcher_stop_owner_tracking (NgfDispatcher *dispatcher,
+                                 OwnerName *owner)
+{
+    if (owner->pending) {
+        dbus_pending_call_cancel (owner->pending);
+        dbus_pending_call_unref (owner->pending);
+        owner->pending = NULL;
+    }
+
+    _dispatcher_rule (dispatcher, NGF_DBUS_OWNER_MATCH_FORMAT, owner->name, 0);
+
+    LIST_REMOVE (dispatcher->owners, owner);
+    free (owner->name);
+    free (owner);
+}
+
+static void
+_dispatcher_ack (DBusConnection *connection,
+                 DBusMessage *msg)
+{
+    DBusMessage *reply = NULL;
+
+    if (dbus_message_get_no_reply (msg))
+        return;
+
+    if ((reply = dbus_message_new_method_return (msg)) == NULL)
+        return;
+
+    dbus_connection_send (connection, reply, NULL);
+    dbus_message_unref (reply);
+}
+
+static DBusHandlerResult
+_dispatcher_filter_cb (DBusConnection *connection,
+                       DBusMessage *msg,
+                       void *userdata)
+{
+    NgfDispatcher *dispatcher = (NgfDispatcher*) userdata;
+
+    IndexEntry *entry = NULL;
+    DBusMessageIter iter;
+    uint32_t server_event_id = 0;
+    uint32_t state = 0;
+    int type = 0;
+
+    if (dispatcher->linger_deadline > 0 && _dispatcher_expire (dispatcher))
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    if (dispatcher->owners &&
+        dbus_message_is_signal (msg, DBUS_INTERFACE_DBUS, "NameOwnerChanged") &&
+        dbus_message_has_sender (msg, DBUS_SERVICE_DBUS))
+    {
+        _dispatcher_owner_changed (dispatcher, msg);
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    /* Fast path: the filter sees every message on the shared connection, so
+       reject anything that can't be ours before doing any string compares.
+       Status arrives either as a broadcast signal or, when the backend honours
+       unicast status, as a signal or method call addressed to us. */
+
+    if (dispatcher->num_events == 0)
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    type = dbus_message_get_type (msg);
+    if (type != DBUS_MESSAGE_TYPE_SIGNAL && type != DBUS_MESSAGE_TYPE_METHOD_CALL)
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    if (!dbus_message_has_member (msg, NGF_DBUS_INTERNAL_STATUS) ||
+        !dbus_message_has_interface (msg, NGF_DBUS_IFACE))
+    {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    if (!dbus_message_iter_init (msg, &iter) ||
+        dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_UINT32)
+    {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    dbus_message_iter_get_basic (&iter, &server_event_id);
+    if (!dbus_message_iter_next (&iter) ||
+        dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_UINT32)
+    {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    dbus_message_iter_get_basic (&iter, &state);
+
+    if ((entry = _index_lookup (dispatcher, server_event_id, dbus_message_get_sender (msg))) == NULL)
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    /* The owner may drop the entry, or even its last dispatcher reference,
+       from within the callback. */
+
+    dispatcher->refcount++;
+    entry->func (entry->target, state, dbus_message_get_destination (msg) != NULL);
+    ngf_dispatcher_release (dispatcher, 0);
+
+    /* A unicast status call is ours alone, answer it or libdbus replies
+       with UnknownMethod. Signals are left for other filters. */
+
+    if (type == DBUS_MESSAGE_TYPE_METHOD_CALL) {
+        _dispatcher_ack (connection, msg);
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+NgfDispatcher*
+ngf_dispatcher_acquire (DBusConnection *connection)
+{
+    NgfDispatcher *dispatcher = NULL;
+
+    if (!dbus_connection_allocate_data_slot (&dispatcher_slot))
+        return NULL;
+
+    dispatcher = (NgfDispatcher*) dbus_connection_get_data (connection, dispatcher_slot);
+    if (dispatcher) {
+        /* Only the first acquire keeps the slot allocated. A lingering
+           dispatcher is revived as is, filter and match included. */
+        dbus_connection_free_data_slot (&dispatcher_slot);
+        dispatcher->refcount++;
+        return dispatcher;
+    }
+
+    dispatcher = (NgfDispatcher*) calloc (1, sizeof (NgfDispatcher));
+    if (dispatcher == NULL)
+        goto failed;
+
+    dispatcher->index_size = INDEX_INITIAL_SIZE;
+    dispatcher->index = (IndexEntry**) calloc (dispatcher->index_size, sizeof (IndexEntry*));
+    if (dispatcher->index == NULL)
+        goto failed;
+
+    if (!dbus_connection_add_filter (connection, _dispatcher_filter_cb, dispatcher, NULL))
+        goto failed;
+
+    /* No connection reference is held: clients keep the connection alive,
+       and a lingering dispatcher is freed along with the connection. */
+
+    if (!dbus_connection_set_data (connection, dispatcher_slot, dispatcher, _dispatcher_destroy_cb)) {
+        dbus_connection_remove_filter (connection, _dispatcher_filter_cb, dispatcher);
+        goto failed;
+    }
+
+    dispatcher->connection = connection;
+    dispatcher->refcount = 1;
+    return dispatcher;
+
+failed:
+    if (dispatcher) {
+        free (dispatcher->index);
+        free (dispatcher);
+    }
+
+    dbus_connection_free_data_slot (&dispatcher_slot);
+    return NULL;
+}
+
+void
+ngf_dispatcher_release (NgfDispatcher *dispatcher,
+                        uint32_t linger_ms)
+{
+    if (dispatcher == NULL)
+        return;
+
+    _dispatcher_linger (dispatcher, linger_ms);
+
+    if (--dispatcher->refcount > 0 || _dispatcher_lingering (dispatcher))
+        return;
+
+    _dispatcher_free (dispatcher);
+}
+
+static void
+_dispatcher_free (NgfDispatcher *dispatcher)
+{
+    StatusMatch *match = NULL;
+
+    dbus_connection_remove_filter (dispatcher->connection, _dispatcher_filter_cb, dispatcher);
+
+    for (match = dispatcher->matches; match; match = match->next) {
+        if (match->added)
+            _dispatcher_rule (dispatcher, NGF_DBUS_MATCH_FORMAT, match->name, 0);
+    }
+
+    while (dispatcher->owners)
+        _dispatcher_stop_owner_tracking (dispatcher, dispatcher->owners);
+
+    /* Clearing the slot runs _dispatcher_destroy_cb on the dispatcher. */
+    dbus_connection_set_data (dispatcher->connection, dispatcher_slot, NULL, NULL);
+}
+
+static void
+_dispatcher_destroy_cb (void *userdata)
+{
+    NgfDispatcher *dispatcher = (NgfDispatcher*) userdata;
+    IndexEntry *entry = NULL, *next = NULL;
+    StatusMatch *match = NULL, *next_match = NULL;
+    OwnerWatch *watch = NULL, *next_watch = NULL;
+    uint32_t i;
+
+    for (watch = dispatcher->owner_watches; watch; watch = next_watch) {
+        next_watch = watch->next;
+        free (watch);
+    }
+
+    for (match = dispatcher->matches; match; match = next_match) {
+        next_match = match->next;
+        free (match->name);
+        free (match);
+    }
+
+    for (i = 0; i < dispatcher->index_size; i++) {
+        for (entry = dispatcher->index[i]; entry; entry = next) {
+            next = entry->next;
+            free (entry);
+        }
+    }
+
+    free (dispatcher->index);
+    free (dispatcher);
+
+    dbus_connection_free_data_slot (&dispatcher_slot);
+}
+
+void
+ngf_dispatcher_add_match (NgfDispatcher *dispatcher,
+                          const char *name)
+{
+    StatusMatch *match = NULL;
+
+    name = _backend_name (name);
+
+    if ((match = _dispatcher_find_match (dispatcher, name)) == NULL) {
+        if ((match = (StatusMatch*) calloc (1, sizeof (StatusMatch))) == NULL)
+            return;
+
+        if ((match->name = strdup (name)) == NULL) {
+            free (match);
+            return;
+        }
+
+        LIST_APPEND (dispatcher->matches, match);
+    }
+
+    match->refcount++;
+
+    if (!match->added) {
+        _dispatcher_rule (dispatcher, NGF_DBUS_MATCH_FORMAT, name, 1);
+        match->added = 1;
+    }
+}
+
+void
+ngf_dispatcher_remove_match (NgfDispatcher *dispatcher,
+                             const char *name,
+                             uint32_t linger_ms)
+{
+    StatusMatch *match = NULL;
+
+    match = _dispatcher_find_match (dispatcher, _backend_name (name));
+    if (match == NULL || match->refcount == 0)
+        return;
+
+    _dispatcher_linger (dispatcher, linger_ms);
+
+    if (--match->refcount > 0 || _dispatcher_lingering (dispatcher))
+        return;
+
+    _dispatcher_rule (dispatcher, NGF_DBUS_MATCH_FORMAT, match->name, 0);
+    match->added = 0;
+}
+
+int
+ngf_dispatcher_add_event (NgfDispatcher *dispatcher,
+                          uint32_t server_event_id,
+                          const char *sender,
+                          NgfStatusFunc func,
+                          void *target)
+{
+    IndexEntry *entry = NULL, **bucket = NULL;
+    size_t sender_size = sender ? strlen (sender) + 1 : 0;
+
+    if (dispatcher->num_events >= dispatcher->index_size * 2)
+        _index_grow (dispatcher);
+
+    entry = (IndexEntry*) malloc (sizeof (IndexEntry) + sender_size);
+    if (entry == NULL)
+        return 0;
+
+    entry->server_event_id = server_event_id;
+    entry->sender = NULL;
+    entry->func = func;
+    entry->target = target;
+
+    if (sender) {
+        memcpy (entry + 1, sender, sender_size);
+        entry->sender = (const char*) (entry + 1);
+    }
+
+    bucket = _index_bucket (dispatcher, server_event_id);
+    entry->next = *bucket;
+    *bucket = entry;
+    dispatcher->num_events++;
+
+    return 1;
+}
+
+void
+ngf_dispatcher_remove_event (NgfDispatcher *dispatcher,
+                             uint32_t server_event_id,
+                             void *target)
+{
+    IndexEntry **bucket = NULL, *entry = NULL;
+
+    bucket = _index_bucket (dispatcher, server_event_id);
+    for (entry = *bucket; entry; entry = entry->next) {
+        if (entry->server_event_id == server_event_id && entry->target == target) {
+            LIST_REMOVE (*bucket, entry);
+            free (entry);
+            dispatcher->num_events--;
+            break;
+        }
+    }
+}
+
+int
+ngf_dispatcher_watch_owner (NgfDispatcher *dispatcher,
+                            const char *name,
+                            NgfOwnerFunc func,
+                            void *target)
+{
+    OwnerName *owner = NULL;
+    OwnerWatch *watch = NULL;
+
+    name = _backend_name (name);
+
+    if ((watch = (OwnerWatch*) calloc (1, sizeof (OwnerWatch))) == NULL)
+        return 0;
+
+    /* The first watch of a name adds a match for its owner changes and
+       asks the bus for the current owner. */
+
+    if ((owner = _dispatcher_find_owner (dispatcher, name)) == NULL) {
+        if ((owner = (OwnerName*) calloc (1, sizeof (OwnerName))) == NULL ||
+            (owner->name = strdup (name)) == NULL)
+        {
+            free (owner);
+            free (watch);
+            return 0;
+        }
+
+        owner->dispatcher = dispatcher;
+        LIST_APPEND (dispatcher->owners, owner);
+
+        _dispatcher_rule (dispatcher, NGF_DBUS_OWNER_MATCH_FORMAT, name, 1);
+        _dispatcher_query_owner (owner);
+    }
+
+    watch->owner = owner;
+    watch->func = func;
+    watch->target = target;
+    owner->num_watches++;
+    LIST_APPEND (dispatcher->owner_watches, watch);
+
+    return 1;
+}
+
+void
+ngf_dispatcher_unwatch_owner (NgfDispatcher *dispatcher,
+                              const char *name,
+                              void *target)
+{
+    OwnerName *owner = NULL;
+    OwnerWatch *watch = NULL;
+
+    if ((owner = _dispatcher_find_owner (dispatcher, _backend_name (name))) == NULL)
+        return;
+
+    for (watch = dispatcher->owner_watches; watch; watch = watch->next) {
+        if (watch->owner == owner && watch->target == target) {
+            LIST_REMOVE (dispatcher->owner_watches, watch);
+            free (watch);
+            break;
+        }
+    }
+
+    if (watch && --owner->num_watches == 0)
+        _dispatcher_stop_owner_tracking (dispatcher, owner);
+}
+
+NgfOwnerState
+ngf_dispatcher_get_owner_state (NgfDispatcher *dispatcher,
+                                const char *name)
+{
+    OwnerName *owner = _dispatcher_find_owner (dispatcher, _backend_name (name));
+
+    return owner ? owner->state : NGF_OWNER_UNKNOWN;
+}
+
+static NgfDispatcher*
+_dispatcher_lookup (DBusConnection *connection)
+{
+    if (dispatcher_slot < 0)
+        return NULL;
+
+    return (NgfDispatcher*) dbus_connection_get_data (connection, dispatcher_slot);
+}
+
+int64_t
+ngf_dispatcher_get_deadline (DBusConnection *connection)
+{
+    NgfDispatcher *dispatcher = _dispatcher_lookup (connection);
+
+    return dispatcher ? dispatcher->linger_deadline : 0;
+}
+
+void
+ngf_dispatcher_expire (DBusConnection *connection)
+{
+    NgfDispatcher *dispatcher = _dispatcher_lookup (connection);
+
+    if (dispatcher)
+        _dispatcher_expire (dispatcher);
+}
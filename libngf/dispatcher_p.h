@@ -0,0 +1,77 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NGF_DISPATCHER_H
+#define NGF_DISPATCHER_H
+
+#include <stdint.h>
+#include <dbus/dbus.h>
+
+#include "protocol_p.h"
+#include "transport_p.h"
+
+/**
+ * Connection level dispatcher shared by every client on the same
+ * DBusConnection. Owns the single message filter and one Status match
+ * rule per backend name, and routes Status updates to the owning event
+ * through an index keyed by server event id and sender. The NgfDispatcher
+ * of the D-Bus transport.
+ */
+
+/**
+ * Dropping the last reference to the dispatcher or to the match rule
+ * keeps it around for linger_ms, so that bursts of short activity don't
+ * churn AddMatch/RemoveMatch on the bus. Expiry is checked whenever a
+ * message passes the filter.
+ */
+NgfDispatcher*  ngf_dispatcher_acquire (DBusConnection *connection);
+void            ngf_dispatcher_release (NgfDispatcher *dispatcher, uint32_t linger_ms);
+
+/** Reference the broadcast Status match rule of a backend name, NULL for
+    the default backend, added on first reference. */
+void            ngf_dispatcher_add_match (NgfDispatcher *dispatcher, const char *name);
+void            ngf_dispatcher_remove_match (NgfDispatcher *dispatcher, const char *name, uint32_t linger_ms);
+
+/** Index target under the id the backend gave it. Only Status sent by
+    sender, the unique name that answered the Play, reaches it; NULL
+    accepts any sender. */
+int             ngf_dispatcher_add_event (NgfDispatcher *dispatcher, uint32_t server_event_id, const char *sender, NgfStatusFunc func, void *target);
+void            ngf_dispatcher_remove_event (NgfDispatcher *dispatcher, uint32_t server_event_id, void *target);
+
+/**
+ * Track the owner of a backend name, NULL for the default backend, for
+ * target. The first watch of a name on the connection adds a single
+ * NameOwnerChanged match for it and asks the bus for the current owner;
+ * the state is unknown until it answers. The last watch of the name
+ * removed drops the match again.
+ */
+int             ngf_dispatcher_watch_owner (NgfDispatcher *dispatcher, const char *name, NgfOwnerFunc func, void *target);
+void            ngf_dispatcher_unwatch_owner (NgfDispatcher *dispatcher, const char *name, void *target);
+NgfOwnerState   ngf_dispatcher_get_owner_state (NgfDispatcher *dispatcher, const char *name);
+
+/**
+ * Linger deadline of the dispatcher on the connection, in monotonic
+ * milliseconds, or 0 if nothing is lingering. Lets an event loop expire
+ * the linger period without waiting for traffic.
+ */
+int64_t         ngf_dispatcher_get_deadline (DBusConnection *connection);
+void            ngf_dispatcher_expire (DBusConnection *connection);
+
+#endif /* NGF_DISPATCHER_H */
@@ -0,0 +1,371 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <dbus/dbus.h>
+
+#include "list_p.h"
+#include "clock_p.h"
+#include "dispatcher_p.h"
+#include "loop_p.h"
+
+typedef struct _LoopWatch LoopWatch;
+typedef struct _LoopTimeout LoopTimeout;
+
+struct _LoopWatch
+{
+    LIST_INIT (LoopWatch)
+
+    DBusWatch       *watch;
+};
+
+struct _LoopTimeout
+{
+    LIST_INIT (LoopTimeout)
+
+    DBusTimeout     *timeout;
+    int64_t         deadline;
+};
+
+struct _NgfLoop
+{
+    DBusConnection  *connection;
+    int             refcount;
+
+    LoopWatch       *watches;
+    LoopTimeout     *timeouts;
+};
+
+/* libdbus uses one read and one write watch per connection. */
+#define LOOP_MAX_WATCHES 8
+
+static dbus_int32_t loop_slot = -1;
+
+static dbus_bool_t
+_add_watch_cb (DBusWatch *watch, void *userdata)
+{
+    NgfLoop *loop = (NgfLoop*) userdata;
+    LoopWatch *w = NULL;
+
+    if ((w = (LoopWatch*) calloc (1, sizeof (LoopWatch))) == NULL)
+        return FALSE;
+
+    w->watch = watch;
+    LIST_APPEND (loop->watches, w);
+    return TRUE;
+}
+
+static void
+_remove_watch_cb (DBusWatch *watch, void *userdata)
+{
+    NgfLoop *loop = (NgfLoop*) userdata;
+    LoopWatch *w = NULL;
+
+    for (w = loop->watches; w; w = w->next) {
+        if (w->watch == watch) {
+            LIST_REMOVE (loop->watches, w);
+            free (w);
+            break;
+        }
+    }
+}
+
+static void
+_toggle_watch_cb (DBusWatch *watch, void *userdata)
+{
+    /* Enabled state is queried whenever the loop polls. */
+    (void) watch;
+    (void) userdata;
+}
+
+static void
+_reset_timeout (LoopTimeout *t)
+{
+    t->deadline = ngf_clock_now_ms () + dbus_timeout_get_interval (t->timeout);
+}
+
+static dbus_bool_t
+_add_timeout_cb (DBusTimeout *timeout, void *userdata)
+{
+    NgfLoop *loop = (NgfLoop*) userdata;
+    LoopTimeout *t = NULL;
+
+    if ((t = (LoopTimeout*) calloc (1, sizeof (LoopTimeout))) == NULL)
+        return FALSE;
+
+    t->timeout = timeout;
+    _reset_timeout (t);
+    dbus_timeout_set_data (timeout, t, NULL);
+    LIST_APPEND (loop->timeouts, t);
+    return TRUE;
+}
+
+static void
+_remove_timeout_cb (DBusTimeout *timeout, void *userdata)
+{
+    NgfLoop *loop = (NgfLoop*) userdata;
+    LoopTimeout *t = (LoopTimeout*) dbus_timeout_get_data (timeout);
+
+    if (t == NULL)
+        return;
+
+    dbus_timeout_set_data (timeout, NULL, NULL);
+    LIST_REMOVE (loop->timeouts, t);
+    free (t);
+}
+
+static void
+_toggle_timeout_cb (DBusTimeout *timeout, void *userdata)
+{
+    LoopTimeout *t = (LoopTimeout*) dbus_timeout_get_data (timeout);
+
+    (void) userdata;
+
+    if (t && dbus_timeout_get_enabled (timeout))
+        _reset_timeout (t);
+}
+
+static void
+_loop_destroy_cb (void *userdata)
+{
+    free (userdata);
+    dbus_connection_free_data_slot (&loop_slot);
+}
+
+NgfLoop*
+ngf_loop_acquire (DBusConnection *connection)
+{
+    NgfLoop *loop = NULL;
+
+    if (!dbus_connection_allocate_data_slot (&loop_slot))
+        return NULL;
+
+    loop = (NgfLoop*) dbus_connection_get_data (connection, loop_slot);
+    if (loop) {
+        dbus_connection_free_data_slot (&loop_slot);
+        loop->refcount++;
+        return loop;
+    }
+
+    if ((loop = (NgfLoop*) calloc (1, sizeof (NgfLoop))) == NULL)
+        goto failed;
+
+    loop->connection = connection;
+    loop->refcount = 1;
+
+    if (!dbus_connection_set_data (connection, loop_slot, loop, _loop_destroy_cb))
+        goto failed;
+
+    /* Existing watches and timeouts are handed to us right away. */
+
+    if (!dbus_connection_set_watch_functions (connection, _add_watch_cb, _remove_watch_cb,
+                                              _toggle_watch_cb, loop, NULL) ||
+        !dbus_connection_set_timeout_functions (connection, _add_timeout_cb, _remove_timeout_cb,
+                                                _toggle_timeout_cb, loop, NULL))
+    {
+        ngf_loop_release (loop);
+        return NULL;
+    }
+
+    return loop;
+
+failed:
+    free (loop);
+    dbus_connection_free_data_slot (&loop_slot);
+    return NULL;
+}
+
+void
+ngf_loop_release (NgfLoop *loop)
+{
+    if (loop == NULL || --loop->refcount > 0)
+        return;
+
+    dbus_connection_set_watch_functions (loop->connection, NULL, NULL, NULL, NULL, NULL);
+    dbus_connection_set_timeout_functions (loop->connection, NULL, NULL, NULL, NULL, NULL);
+
+    /* Clearing the slot runs _loop_destroy_cb on the loop. */
+    dbus_connection_set_data (loop->connection, loop_slot, NULL, NULL);
+}
+
+int
+ngf_loop_attached (DBusConnection *connection)
+{
+    if (loop_slot < 0)
+        return 0;
+
+    return dbus_connection_get_data (connection, loop_slot) != NULL;
+}
+
+int
+ngf_loop_get_fd (NgfLoop *loop,
+                 int *events)
+{
+    LoopWatch *w = NULL;
+    unsigned int flags = 0;
+    int fd = -1;
+
+    for (w = loop->watches; w; w = w->next) {
+        if (fd < 0)
+            fd = dbus_watch_get_unix_fd (w->watch);
+
+        if (!dbus_watch_get_enabled (w->watch))
+            continue;
+
+        flags = dbus_watch_get_flags (w->watch);
+        if (events && (flags & DBUS_WATCH_READABLE))
+            *events |= POLLIN;
+        if (events && (flags & DBUS_WATCH_WRITABLE))
+            *events |= POLLOUT;
+    }
+
+    return fd;
+}
+
+int
+ngf_loop_get_timeout (NgfLoop *loop)
+{
+    LoopTimeout *t = NULL;
+    int64_t now = ngf_clock_now_ms ();
+    int64_t deadline = 0;
+    int timeout = -1, remaining = 0;
+
+    if (dbus_connection_get_dispatch_status (loop->connection) == DBUS_DISPATCH_DATA_REMAINS)
+        return 0;
+
+    for (t = loop->timeouts; t; t = t->next) {
+        if (!dbus_timeout_get_enabled (t->timeout))
+            continue;
+
+        remaining = ngf_clock_timeout_ms (t->deadline, now);
+        if (timeout < 0 || remaining < timeout)
+            timeout = remaining;
+    }
+
+    if ((deadline = ngf_dispatcher_get_deadline (loop->connection)) > 0) {
+        remaining = ngf_clock_timeout_ms (deadline, now);
+        if (timeout < 0 || remaining < timeout)
+            timeout = remaining;
+    }
+
+    return timeout;
+}
+
+static void
+_loop_handle_watches (NgfLoop *loop)
+{
+    DBusWatch *handled[LOOP_MAX_WATCHES];
+    LoopWatch *w = NULL;
+    struct pollfd pfd;
+    unsigned int flags = 0, ready = 0;
+    int num_handled = 0, i;
+
+    memset (&pfd, 0, sizeof (pfd));
+    if ((pfd.fd = ngf_loop_get_fd (loop, NULL)) < 0)
+        return;
+
+    pfd.events = POLLIN | POLLOUT;
+    if (poll (&pfd, 1, 0) <= 0)
+        return;
+
+    if (pfd.revents & POLLIN)
+        ready |= DBUS_WATCH_READABLE;
+    if (pfd.revents & POLLOUT)
+        ready |= DBUS_WATCH_WRITABLE;
+
+    /* Handling a watch may add or remove any watch, so rescan from the
+       start after each one and skip those already handled. */
+
+restart:
+    for (w = loop->watches; w && num_handled < LOOP_MAX_WATCHES; w = w->next) {
+        for (i = 0; i < num_handled; i++) {
+            if (handled[i] == w->watch)
+                break;
+        }
+
+        if (i < num_handled || !dbus_watch_get_enabled (w->watch))
+            continue;
+
+        flags = dbus_watch_get_flags (w->watch) & ready;
+        if (pfd.revents & POLLHUP)
+            flags |= DBUS_WATCH_HANGUP;
+        if (pfd.revents & POLLERR)
+            flags |= DBUS_WATCH_ERROR;
+
+        if (flags == 0)
+            continue;
+
+        handled[num_handled++] = w->watch;
+        dbus_watch_handle (w->watch, flags);
+        goto restart;
+    }
+}
+
+static void
+_loop_handle_timeouts (NgfLoop *loop)
+{
+    LoopTimeout *t = NULL;
+    int64_t now = ngf_clock_now_ms ();
+    int handled = 1;
+
+    /* Handling a timeout may remove any timeout, rescan after each one. */
+
+    while (handled) {
+        handled = 0;
+        for (t = loop->timeouts; t; t = t->next) {
+            if (!dbus_timeout_get_enabled (t->timeout) || t->deadline > now)
+                continue;
+
+            _reset_timeout (t);
+            dbus_timeout_handle (t->timeout);
+            handled = 1;
+            break;
+        }
+    }
+}
+
+int
+ngf_loop_dispatch (NgfLoop *loop)
+{
+    DBusConnection *connection = loop->connection;
+
+    /* The loop may go away while dispatching if a callback destroys the
+       last client, keep the connection alive until we are done. */
+
+    dbus_connection_ref (connection);
+
+    _loop_handle_watches (loop);
+    _loop_handle_timeouts (loop);
+
+    while (dbus_connection_dispatch (connection) == DBUS_DISPATCH_DATA_REMAINS)
+        ;
+
+    ngf_dispatcher_expire (connection);
+
+    if (!dbus_connection_get_is_connected (connection)) {
+        dbus_connection_unref (connection);
+        return 0;
+    }
+
+    dbus_connection_unref (connection);
+    return 1;
+}
@@ -0,0 +1,53 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NGF_LOOP_H
+#define NGF_LOOP_H
+
+#include <stdint.h>
+#include <dbus/dbus.h>
+
+#include "transport_p.h"
+
+/**
+ * Minimal main loop integration for a DBusConnection, shared by every
+ * client on the connection that is driven through ngf_client_get_fd and
+ * ngf_client_dispatch. Keeps track of the libdbus watches and timeouts
+ * so that any external poll, epoll or io_uring loop can drive the
+ * connection without GLib. The NgfLoop of the D-Bus transport.
+ */
+
+NgfLoop*        ngf_loop_acquire (DBusConnection *connection);
+void            ngf_loop_release (NgfLoop *loop);
+
+/** Whether any client still drives the connection through a loop. */
+int             ngf_loop_attached (DBusConnection *connection);
+
+/** Socket to poll and the poll(2) events to wait for on it. */
+int             ngf_loop_get_fd (NgfLoop *loop, int *events);
+
+/** Milliseconds until the loop must be dispatched, -1 if no deadline. */
+int             ngf_loop_get_timeout (NgfLoop *loop);
+
+/** Handle I/O and expired timeouts and dispatch incoming messages.
+    Returns 0 once the connection has been disconnected. */
+int             ngf_loop_dispatch (NgfLoop *loop);
+
+#endif /* NGF_LOOP_H */
@@ -55,6 +55,8 @@ struct _NgfProplist
 {
     PropEntry *entries;
     size_t num_entries;
+    uint32_t hash;      /* cached, until the next set */
+    int hash_valid;
 };
 
 NgfProplist*
@@ -154,6 +156,8 @@ ngf_proplist_sets (NgfProplist *proplist,
     item->next  = NULL;
 
     LIST_APPEND (proplist->entries, item);
+    proplist->num_entries++;
+    proplist->hash_valid = 0;
     return 1;
 
 error:
@@ -205,6 +209,8 @@ ngf_proplist_set_as_integer (NgfProplist *proplist,
     item->next  = NULL;
 
     LIST_APPEND (proplist->entries, item);
+    proplist->num_entries++;
+    proplist->hash_valid = 0;
     return 1;
 
 error:
@@ -236,6 +242,8 @@ ngf_proplist_set_as_unsigned (NgfProplist *proplist,
     item->next  = NULL;
 
     LIST_APPEND (proplist->entries, item);
+    proplist->num_entries++;
+    proplist->hash_valid = 0;
     return 1;
 
 error:
@@ -309,6 +317,8 @@ ngf_proplist_set_as_boolean (NgfProplist *proplist,
     item->next  = NULL;
 
     LIST_APPEND (proplist->entries, item);
+    proplist->num_entries++;
+    proplist->hash_valid = 0;
     return 1;
 
 error:
@@ -479,6 +489,123 @@ ngf_proplist_foreach_extended (NgfProplist *proplist,
     }
 }
 
+/* FNV-1a, continuing from hash. */
+
+static uint32_t
+_hash_bytes (uint32_t hash,
+             const void *data,
+             size_t length)
+{
+    const unsigned char *p = (const unsigned char*) data;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static uint32_t
+_hash_entry (const PropEntry *entry)
+{
+    uint32_t hash = 2166136261U;
+    uint32_t value;
+
+    hash = _hash_bytes (hash, entry->key, strlen (entry->key) + 1);
+    hash = _hash_bytes (hash, &entry->type, sizeof (entry->type));
+
+    if (entry->type == NGF_PROPLIST_VALUE_TYPE_STRING) {
+        hash = _hash_bytes (hash, entry->value, strlen ((const char*) entry->value));
+    } else {
+        value = PTR_TO_UINT32 (entry->value);
+        hash = _hash_bytes (hash, &value, sizeof (value));
+    }
+
+    /* Spread the bits, the entry hashes are summed up. */
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bU;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+static int
+_entry_equal (const PropEntry *a,
+              const PropEntry *b)
+{
+    if (a->type != b->type || strcmp (a->key, b->key) != 0)
+        return 0;
+
+    if (a->type == NGF_PROPLIST_VALUE_TYPE_STRING)
+        return strcmp ((const char*) a->value, (const char*) b->value) == 0;
+
+    return a->value == b->value;
+}
+
+static int
+_contains_all (NgfProplist *proplist,
+               NgfProplist *other)
+{
+    PropEntry *iter = NULL, *match = NULL;
+
+    for (iter = proplist->entries; iter; iter = iter->next) {
+        for (match = other->entries; match; match = match->next) {
+            if (_entry_equal (iter, match))
+                break;
+        }
+
+        if (match == NULL)
+            return 0;
+    }
+
+    return 1;
+}
+
+uint32_t
+ngf_proplist_hash (NgfProplist *proplist)
+{
+    PropEntry *iter = NULL;
+    uint32_t hash = 0;
+
+    if (proplist == NULL)
+        return 0;
+
+    if (proplist->hash_valid)
+        return proplist->hash;
+
+    for (iter = proplist->entries; iter; iter = iter->next)
+        hash += _hash_entry (iter);
+
+    proplist->hash = hash;
+    proplist->hash_valid = 1;
+
+    return hash;
+}
+
+int
+ngf_proplist_equal (NgfProplist *a,
+                    NgfProplist *b)
+{
+    size_t num_a = a ? a->num_entries : 0;
+    size_t num_b = b ? b->num_entries : 0;
+
+    if (a == b)
+        return 1;
+
+    if (num_a != num_b)
+        return 0;
+
+    if (num_a == 0)
+        return 1;
+
+    if (ngf_proplist_hash (a) != ngf_proplist_hash (b))
+        return 0;
+
+    return _contains_all (a, b) && _contains_all (b, a);
+}
+
 const char**
 ngf_proplist_get_keys (NgfProplist *proplist)
 {
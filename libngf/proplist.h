@@ -198,6 +198,25 @@ void            ngf_proplist_foreach (NgfProplist *proplist, NgfProplistCallback
 
 void            ngf_proplist_foreach_extended (NgfProplist *proplist, NgfProplistExtendedCallback callback, void *userdata);
 
+/**
+ * Hash of the entries of the property list, regardless of their order.
+ * The hash is cached until the property list is changed again.
+ * @param proplist NgfProplist
+ * @return Hash, 0 for NULL or an empty property list.
+ */
+
+uint32_t        ngf_proplist_hash (NgfProplist *proplist);
+
+/**
+ * Compare two property lists, regardless of the order of their entries.
+ * NULL equals an empty property list.
+ * @param a NgfProplist
+ * @param b NgfProplist
+ * @return 1 if both have the same keys with the same types and values, 0 otherwise.
+ */
+
+int             ngf_proplist_equal (NgfProplist *a, NgfProplist *b);
+
 /**
  * Get a list of all keys in the property list.
  * @param proplist NgfProplist
@@ -0,0 +1,63 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NGF_PROTOCOL_H
+#define NGF_PROTOCOL_H
+
+/** DBus name for NGF */
+#define NGF_DBUS_NAME               "com.nokia.NonGraphicFeedback1.Backend"
+
+/** DBus path for NGF */
+#define NGF_DBUS_PATH               "/com/nokia/NonGraphicFeedback1"
+
+/** DBus interface for NGF */
+#define NGF_DBUS_IFACE              "com.nokia.NonGraphicFeedback1"
+
+/** DBus method for playing event */
+#define NGF_DBUS_METHOD_PLAY        "Play"
+
+/** DBus method for stopping event */
+#define NGF_DBUS_METHOD_STOP        "Stop"
+
+/** DBus method for pausing/resuming event */
+#define NGF_DBUS_METHOD_PAUSE       "Pause"
+
+/** DBus method for stopping several events at once, not in older backends */
+#define NGF_DBUS_METHOD_STOP_MANY   "StopMany"
+
+/** DBus method for pausing/resuming several events at once, not in older backends */
+#define NGF_DBUS_METHOD_PAUSE_MANY  "PauseMany"
+
+/** DBus method call that is sent to us when the event state changes */
+#define NGF_DBUS_INTERNAL_STATUS    "Status"
+
+/** Play property asking the backend to address Status only to the caller */
+#define NGF_PROPERTY_UNICAST_STATUS "dbus.status.unicast"
+
+/** Status broadcast by the backend owning the name filled in for %s */
+#define NGF_DBUS_MATCH_FORMAT "type='signal',sender='%s',interface='" NGF_DBUS_IFACE "',member='" NGF_DBUS_INTERNAL_STATUS "', path='" NGF_DBUS_PATH "'"
+
+/** Owner changes of a single backend name, not of every name on the bus */
+#define NGF_DBUS_OWNER_MATCH_FORMAT "type='signal',sender='org.freedesktop.DBus',interface='org.freedesktop.DBus',member='NameOwnerChanged',arg0='%s'"
+
+/** Longest match rule built from the formats above, bus names are at most 255 bytes */
+#define NGF_DBUS_MATCH_MAX          512
+
+#endif /* NGF_PROTOCOL_H */
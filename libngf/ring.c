@@ -0,0 +1,143 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "ring_p.h"
+
+struct _NgfRing
+{
+    NgfStateChange  *slots;
+    uint32_t        mask;
+    int             event_fd;
+    int             wake_pending;
+
+    /* Free running counters, head written by the consumer only and tail
+       by the producer only. Kept on separate cache lines so the two
+       threads do not keep stealing the line from each other. */
+    uint32_t        head __attribute__ ((aligned (64)));
+    uint32_t        tail __attribute__ ((aligned (64)));
+};
+
+NgfRing*
+ngf_ring_new (uint32_t capacity)
+{
+    NgfRing *ring = NULL;
+    uint32_t size = 1;
+
+    while (size < capacity && size < (1U << 30))
+        size <<= 1;
+
+    if (posix_memalign ((void**) &ring, 64, sizeof (NgfRing)) != 0)
+        return NULL;
+
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = size - 1;
+    ring->wake_pending = 0;
+
+    if ((ring->slots = (NgfStateChange*) calloc (size, sizeof (NgfStateChange))) == NULL) {
+        free (ring);
+        return NULL;
+    }
+
+    if ((ring->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        free (ring->slots);
+        free (ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+void
+ngf_ring_free (NgfRing *ring)
+{
+    if (ring == NULL)
+        return;
+
+    close (ring->event_fd);
+    free (ring->slots);
+    free (ring);
+}
+
+int
+ngf_ring_push (NgfRing *ring,
+               const NgfStateChange *change)
+{
+    uint64_t value = 1;
+    uint32_t tail = ring->tail;
+
+    if (tail - __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE) > ring->mask)
+        return 0;
+
+    ring->slots[tail & ring->mask] = *change;
+    __atomic_store_n (&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    /* Only the first push after the consumer has looked writes to the
+       eventfd. */
+
+    if (!__atomic_exchange_n (&ring->wake_pending, 1, __ATOMIC_SEQ_CST)) {
+        if (write (ring->event_fd, &value, sizeof (value)) < 0)
+            __atomic_store_n (&ring->wake_pending, 0, __ATOMIC_SEQ_CST);
+    }
+
+    return 1;
+}
+
+uint32_t
+ngf_ring_pop (NgfRing *ring,
+              NgfStateChange *changes,
+              uint32_t max)
+{
+    uint64_t value = 0;
+    uint32_t head = ring->head, tail = 0, n = 0;
+
+    if (read (ring->event_fd, &value, sizeof (value)) < 0)
+        value = 0;
+
+    /* Clear before looking so that later pushes wake the consumer again. */
+    __atomic_store_n (&ring->wake_pending, 0, __ATOMIC_SEQ_CST);
+
+    tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail && n < max)
+        changes[n++] = ring->slots[head++ & ring->mask];
+
+    __atomic_store_n (&ring->head, head, __ATOMIC_RELEASE);
+
+    /* Stopped early, make sure the consumer comes back for the rest. */
+    if (head != tail && !__atomic_exchange_n (&ring->wake_pending, 1, __ATOMIC_SEQ_CST)) {
+        value = 1;
+        if (write (ring->event_fd, &value, sizeof (value)) < 0)
+            __atomic_store_n (&ring->wake_pending, 0, __ATOMIC_SEQ_CST);
+    }
+
+    return n;
+}
+
+int
+ngf_ring_get_fd (NgfRing *ring)
+{
+    return ring->event_fd;
+}
@@ -0,0 +1,48 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef NGF_RING_H
+#define NGF_RING_H
+
+#include <stdint.h>
+#include "client.h"
+
+/**
+ * Lock-free single-producer single-consumer ring of state changes with an
+ * eventfd that becomes readable when the ring turns non-empty. The
+ * producer is whoever dispatches the client, the consumer another thread.
+ */
+typedef struct _NgfRing NgfRing;
+
+/** Capacity is rounded up to a power of two. */
+NgfRing*        ngf_ring_new (uint32_t capacity);
+void            ngf_ring_free (NgfRing *ring);
+
+/** Producer side. Returns 0 if the ring is full. */
+int             ngf_ring_push (NgfRing *ring, const NgfStateChange *change);
+
+/** Consumer side. Clears the wakeup, then pops up to max changes. */
+uint32_t        ngf_ring_pop (NgfRing *ring, NgfStateChange *changes, uint32_t max);
+
+/** Readable while changes may be waiting. */
+int             ngf_ring_get_fd (NgfRing *ring);
+
+#endif /* NGF_RING_H */
@@ -0,0 +1,126 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <stdlib.h>
+
+#include "timers_p.h"
+
+#define NGF_TIMERS_INITIAL_SIZE 16
+
+typedef struct _NgfTimer
+{
+    int64_t         deadline;
+    uint32_t        id;
+} NgfTimer;
+
+struct _NgfTimers
+{
+    NgfTimer        *heap;
+    uint32_t        size;
+    uint32_t        length;
+};
+
+NgfTimers*
+ngf_timers_new (void)
+{
+    return (NgfTimers*) calloc (1, sizeof (NgfTimers));
+}
+
+void
+ngf_timers_free (NgfTimers *timers)
+{
+    if (timers == NULL)
+        return;
+
+    free (timers->heap);
+    free (timers);
+}
+
+int
+ngf_timers_add (NgfTimers *timers,
+                int64_t deadline,
+                uint32_t id)
+{
+    NgfTimer *heap = NULL;
+    uint32_t i = 0, parent = 0;
+
+    if (timers->length == timers->size) {
+        heap = (NgfTimer*) realloc (timers->heap, (timers->size ? timers->size * 2 : NGF_TIMERS_INITIAL_SIZE) * sizeof (NgfTimer));
+        if (heap == NULL)
+            return 0;
+
+        timers->heap = heap;
+        timers->size = timers->size ? timers->size * 2 : NGF_TIMERS_INITIAL_SIZE;
+    }
+
+    /* Sift up from the new leaf. */
+
+    for (i = timers->length++; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (timers->heap[parent].deadline <= deadline)
+            break;
+        timers->heap[i] = timers->heap[parent];
+    }
+
+    timers->heap[i].deadline = deadline;
+    timers->heap[i].id = id;
+
+    return 1;
+}
+
+int64_t
+ngf_timers_next (NgfTimers *timers)
+{
+    if (timers == NULL || timers->length == 0)
+        return 0;
+
+    return timers->heap[0].deadline;
+}
+
+int
+ngf_timers_pop (NgfTimers *timers,
+                int64_t now,
+                uint32_t *id)
+{
+    NgfTimer last;
+    uint32_t i = 0, child = 0;
+
+    if (timers == NULL || timers->length == 0 || timers->heap[0].deadline > now)
+        return 0;
+
+    *id = timers->heap[0].id;
+    last = timers->heap[--timers->length];
+
+    /* Sift the last leaf down from the root. */
+
+    while ((child = 2 * i + 1) < timers->length) {
+        if (child + 1 < timers->length && timers->heap[child + 1].deadline < timers->heap[child].deadline)
+            child++;
+        if (last.deadline <= timers->heap[child].deadline)
+            break;
+        timers->heap[i] = timers->heap[child];
+        i = child;
+    }
+
+    timers->heap[i] = last;
+
+    return 1;
+}
@@ -0,0 +1,48 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef NGF_TIMERS_H
+#define NGF_TIMERS_H
+
+#include <stdint.h>
+
+/**
+ * Binary min-heap of deadlines, one entry per event id, shared by all the
+ * events of a client so that a single timer covers them. Entries are not
+ * removed when their event ends early, whoever pops one checks whether
+ * the event is still around.
+ */
+typedef struct _NgfTimers NgfTimers;
+
+NgfTimers*      ngf_timers_new (void);
+void            ngf_timers_free (NgfTimers *timers);
+
+/** Returns 0 if out of memory. */
+int             ngf_timers_add (NgfTimers *timers, int64_t deadline, uint32_t id);
+
+/** Earliest deadline, 0 if there are no entries. */
+int64_t         ngf_timers_next (NgfTimers *timers);
+
+/** Pops the earliest entry if its deadline is not after now. Returns 0 if
+    there was none due. */
+int             ngf_timers_pop (NgfTimers *timers, int64_t now, uint32_t *id);
+
+#endif /* NGF_TIMERS_H */
@@ -0,0 +1,431 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <dbus/dbus.h>
+
+#include "protocol_p.h"
+#include "dispatcher_p.h"
+#include "loop_p.h"
+#include "transport_p.h"
+
+/* NgfConnection is the DBusConnection itself, NgfLoop and NgfDispatcher
+   are those of loop.c and dispatcher.c. */
+#define DBUS_CONNECTION(c) ((DBusConnection*) (c))
+
+typedef struct _ReplyClosure
+{
+    NgfReplyFunc    func;
+    void            *userdata;
+} ReplyClosure;
+
+static const char*
+_service_name (const char *service)
+{
+    return service ? service : NGF_DBUS_NAME;
+}
+
+static void
+_append_property (const char *key,
+                  const void *value,
+                  NgfProplistType type,
+                  void *userdata)
+{
+    DBusMessageIter *iter       = (DBusMessageIter*) userdata;
+    const char*      string_value = NULL;
+    int              boolean_value = 0;
+    int32_t          integer_value = 0;
+    uint32_t         unsigned_value = 0;
+
+    DBusMessageIter sub, ssub;
+
+    dbus_message_iter_open_container (iter, DBUS_TYPE_DICT_ENTRY, 0, &sub);
+    dbus_message_iter_append_basic (&sub, DBUS_TYPE_STRING, &key);
+
+    switch (type) {
+        case NGF_PROPLIST_VALUE_TYPE_STRING:
+            string_value = (const char*) value;
+            dbus_message_iter_open_container (&sub, DBUS_TYPE_VARIANT, DBUS_TYPE_STRING_AS_STRING, &ssub);
+            dbus_message_iter_append_basic (&ssub, DBUS_TYPE_STRING, &string_value);
+            dbus_message_iter_close_container (&sub, &ssub);
+            break;
+
+        case NGF_PROPLIST_VALUE_TYPE_INTEGER:
+            integer_value = *(int32_t*) value;
+            dbus_message_iter_open_container (&sub, DBUS_TYPE_VARIANT, DBUS_TYPE_INT32_AS_STRING, &ssub);
+            dbus_message_iter_append_basic (&ssub, DBUS_TYPE_INT32, &integer_value);
+            dbus_message_iter_close_container (&sub, &ssub);
+            break;
+
+        case NGF_PROPLIST_VALUE_TYPE_UNSIGNED:
+            unsigned_value = *(uint32_t*) value;
+            dbus_message_iter_open_container (&sub, DBUS_TYPE_VARIANT, DBUS_TYPE_UINT32_AS_STRING, &ssub);
+            dbus_message_iter_append_basic (&ssub, DBUS_TYPE_UINT32, &unsigned_value);
+            dbus_message_iter_close_container (&sub, &ssub);
+            break;
+
+        case NGF_PROPLIST_VALUE_TYPE_BOOLEAN:
+            boolean_value = *(int*) value;
+            dbus_message_iter_open_container (&sub, DBUS_TYPE_VARIANT, DBUS_TYPE_BOOLEAN_AS_STRING, &ssub);
+            dbus_message_iter_append_basic (&ssub, DBUS_TYPE_BOOLEAN, &boolean_value);
+            dbus_message_iter_close_container (&sub, &ssub);
+            break;
+
+        default:
+            break;
+    }
+
+    dbus_message_iter_close_container (iter, &sub);
+}
+
+static void
+_pending_reply (DBusPendingCall *pending,
+                void *userdata)
+{
+    ReplyClosure *closure = (ReplyClosure*) userdata;
+    NgfReplyStatus status = NGF_REPLY_OK;
+    DBusMessage *msg = NULL;
+    DBusMessageIter iter;
+    uint32_t value = 0;
+
+    msg = dbus_pending_call_steal_reply (pending);
+
+    if (msg == NULL || dbus_message_is_error (msg, DBUS_ERROR_NO_REPLY) ||
+        dbus_message_is_error (msg, DBUS_ERROR_DISCONNECTED))
+    {
+        status = NGF_REPLY_NO_REPLY;
+    }
+    else if (dbus_message_is_error (msg, DBUS_ERROR_UNKNOWN_METHOD)) {
+        status = NGF_REPLY_UNKNOWN_METHOD;
+    }
+    else if (dbus_message_get_type (msg) == DBUS_MESSAGE_TYPE_ERROR) {
+        status = NGF_REPLY_ERROR;
+    }
+    else if (dbus_message_iter_init (msg, &iter) && dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_UINT32) {
+        dbus_message_iter_get_basic (&iter, &value);
+    }
+
+    closure->func ((NgfTransportCall*) pending, status, value,
+                   msg ? dbus_message_get_sender (msg) : NULL, closure->userdata);
+
+    if (msg)
+        dbus_message_unref (msg);
+
+    /* The last reference, frees the closure. */
+    dbus_pending_call_unref (pending);
+}
+
+/* Sends msg and hands the reply to func. Takes the reference to msg. */
+
+static NgfTransportCall*
+_send_with_reply (DBusConnection *connection,
+                  DBusMessage *msg,
+                  int timeout_ms,
+                  NgfReplyFunc func,
+                  void *userdata)
+{
+    DBusPendingCall *pending = NULL;
+    ReplyClosure *closure = NULL;
+
+    if (msg == NULL)
+        return NULL;
+
+    dbus_connection_send_with_reply (connection, msg, &pending, timeout_ms);
+    dbus_message_unref (msg);
+
+    if (pending == NULL)
+        return NULL;
+
+    if ((closure = (ReplyClosure*) malloc (sizeof (ReplyClosure))) == NULL) {
+        dbus_pending_call_cancel (pending);
+        dbus_pending_call_unref (pending);
+        return NULL;
+    }
+
+    closure->func = func;
+    closure->userdata = userdata;
+
+    if (!dbus_pending_call_set_notify (pending, _pending_reply, closure, free)) {
+        free (closure);
+        dbus_pending_call_cancel (pending);
+        dbus_pending_call_unref (pending);
+        return NULL;
+    }
+
+    return (NgfTransportCall*) pending;
+}
+
+static DBusMessage*
+_new_method_call (const char *service,
+                  const char *method)
+{
+    return dbus_message_new_method_call (_service_name (service),
+                                         NGF_DBUS_PATH,
+                                         NGF_DBUS_IFACE,
+                                         method);
+}
+
+static NgfConnection*
+_dbus_connect (va_list args)
+{
+    DBusConnection *connection = va_arg (args, DBusConnection*);
+
+    if (connection == NULL)
+        return NULL;
+
+    return (NgfConnection*) dbus_connection_ref (connection);
+}
+
+static NgfConnection*
+_dbus_open (const char *address)
+{
+    DBusConnection *connection = NULL;
+
+    dbus_threads_init_default ();
+
+    if (address) {
+        if ((connection = dbus_connection_open_private (address, NULL)) == NULL)
+            return NULL;
+
+        if (!dbus_bus_register (connection, NULL)) {
+            dbus_connection_close (connection);
+            dbus_connection_unref (connection);
+            return NULL;
+        }
+    } else if ((connection = dbus_bus_get_private (DBUS_BUS_SYSTEM, NULL)) == NULL) {
+        return NULL;
+    }
+
+    dbus_connection_set_exit_on_disconnect (connection, FALSE);
+
+    return (NgfConnection*) connection;
+}
+
+static NgfConnection*
+_dbus_ref (NgfConnection *connection)
+{
+    return (NgfConnection*) dbus_connection_ref (DBUS_CONNECTION (connection));
+}
+
+static void
+_dbus_unref (NgfConnection *connection)
+{
+    dbus_connection_unref (DBUS_CONNECTION (connection));
+}
+
+static void
+_dbus_close (NgfConnection *connection)
+{
+    dbus_connection_close (DBUS_CONNECTION (connection));
+}
+
+static void
+_dbus_flush (NgfConnection *connection)
+{
+    dbus_connection_flush (DBUS_CONNECTION (connection));
+}
+
+static int
+_dbus_has_output (NgfConnection *connection)
+{
+    return dbus_connection_has_messages_to_send (DBUS_CONNECTION (connection));
+}
+
+static int
+_dbus_iterate (NgfConnection *connection,
+               int timeout_ms)
+{
+    return dbus_connection_read_write_dispatch (DBUS_CONNECTION (connection), timeout_ms);
+}
+
+static NgfLoop*
+_dbus_loop_acquire (NgfConnection *connection)
+{
+    return ngf_loop_acquire (DBUS_CONNECTION (connection));
+}
+
+static int
+_dbus_loop_attached (NgfConnection *connection)
+{
+    return ngf_loop_attached (DBUS_CONNECTION (connection));
+}
+
+static NgfDispatcher*
+_dbus_dispatcher_acquire (NgfConnection *connection)
+{
+    return ngf_dispatcher_acquire (DBUS_CONNECTION (connection));
+}
+
+static NgfTransportPlay*
+_dbus_new_play (const char *event,
+                NgfProplist *proplist,
+                int unicast)
+{
+    DBusMessage *msg = NULL;
+    DBusMessageIter iter, sub;
+    int enabled = 1;
+
+    if ((msg = _new_method_call (NULL, NGF_DBUS_METHOD_PLAY)) == NULL)
+        return NULL;
+
+    dbus_message_iter_init_append (msg, &iter);
+    dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &event);
+
+    /* Append all properties from the property list */
+    dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "{sv}", &sub);
+    ngf_proplist_foreach_extended (proplist, _append_property, &sub);
+    if (unicast)
+        _append_property (NGF_PROPERTY_UNICAST_STATUS, &enabled, NGF_PROPLIST_VALUE_TYPE_BOOLEAN, &sub);
+    dbus_message_iter_close_container (&iter, &sub);
+
+    return (NgfTransportPlay*) msg;
+}
+
+static NgfTransportPlay*
+_dbus_ref_play (NgfTransportPlay *play)
+{
+    return (NgfTransportPlay*) dbus_message_ref ((DBusMessage*) play);
+}
+
+static void
+_dbus_unref_play (NgfTransportPlay *play)
+{
+    dbus_message_unref ((DBusMessage*) play);
+}
+
+static NgfTransportCall*
+_dbus_send_play (NgfConnection *connection,
+                 NgfTransportPlay *play,
+                 const char *service,
+                 int timeout_ms,
+                 NgfReplyFunc func,
+                 void *userdata)
+{
+    DBusMessage *msg = (DBusMessage*) play;
+
+    if (service && !dbus_message_set_destination (msg, service))
+        return NULL;
+
+    return _send_with_reply (DBUS_CONNECTION (connection), dbus_message_ref (msg), timeout_ms, func, userdata);
+}
+
+static void
+_dbus_send_control (NgfConnection *connection,
+                    const char *service,
+                    uint32_t server_event_id,
+                    int pause)
+{
+    DBusMessage *msg = NULL;
+    dbus_bool_t pause_arg = pause > 0;
+
+    if ((msg = _new_method_call (service, pause < 0 ? NGF_DBUS_METHOD_STOP : NGF_DBUS_METHOD_PAUSE)) == NULL)
+        return;
+
+    dbus_message_append_args (msg, DBUS_TYPE_UINT32, &server_event_id, DBUS_TYPE_INVALID);
+    if (pause >= 0)
+        dbus_message_append_args (msg, DBUS_TYPE_BOOLEAN, &pause_arg, DBUS_TYPE_INVALID);
+
+    dbus_connection_send (DBUS_CONNECTION (connection), msg, NULL);
+    dbus_message_unref (msg);
+}
+
+static NgfTransportCall*
+_dbus_send_control_bulk (NgfConnection *connection,
+                         const char *service,
+                         const uint32_t *server_event_ids,
+                         uint32_t num_ids,
+                         int pause,
+                         int timeout_ms,
+                         NgfReplyFunc func,
+                         void *userdata)
+{
+    DBusMessage *msg = NULL;
+    dbus_bool_t pause_arg = pause > 0;
+
+    if ((msg = _new_method_call (service, pause < 0 ? NGF_DBUS_METHOD_STOP_MANY : NGF_DBUS_METHOD_PAUSE_MANY)) == NULL)
+        return NULL;
+
+    dbus_message_append_args (msg, DBUS_TYPE_ARRAY, DBUS_TYPE_UINT32, &server_event_ids, num_ids, DBUS_TYPE_INVALID);
+    if (pause >= 0)
+        dbus_message_append_args (msg, DBUS_TYPE_BOOLEAN, &pause_arg, DBUS_TYPE_INVALID);
+
+    return _send_with_reply (DBUS_CONNECTION (connection), msg, timeout_ms, func, userdata);
+}
+
+static NgfTransportCall*
+_dbus_ping (NgfConnection *connection,
+            int timeout_ms,
+            NgfReplyFunc func,
+            void *userdata)
+{
+    DBusMessage *msg = NULL;
+
+    msg = dbus_message_new_method_call (DBUS_SERVICE_DBUS,
+                                        DBUS_PATH_DBUS,
+                                        DBUS_INTERFACE_PEER,
+                                        "Ping");
+
+    return _send_with_reply (DBUS_CONNECTION (connection), msg, timeout_ms, func, userdata);
+}
+
+static void
+_dbus_cancel (NgfTransportCall *call)
+{
+    dbus_pending_call_cancel ((DBusPendingCall*) call);
+    dbus_pending_call_unref ((DBusPendingCall*) call);
+}
+
+const NgfTransportOps ngf_transport_dbus = {
+    NGF_TRANSPORT_DBUS,
+    "dbus",
+    _dbus_connect,
+    _dbus_open,
+    _dbus_ref,
+    _dbus_unref,
+    _dbus_close,
+    _dbus_flush,
+    _dbus_has_output,
+    _dbus_iterate,
+    _dbus_loop_acquire,
+    ngf_loop_release,
+    _dbus_loop_attached,
+    ngf_loop_get_fd,
+    ngf_loop_get_timeout,
+    ngf_loop_dispatch,
+    _dbus_dispatcher_acquire,
+    ngf_dispatcher_release,
+    ngf_dispatcher_add_match,
+    ngf_dispatcher_remove_match,
+    ngf_dispatcher_add_event,
+    ngf_dispatcher_remove_event,
+    ngf_dispatcher_watch_owner,
+    ngf_dispatcher_unwatch_owner,
+    ngf_dispatcher_get_owner_state,
+    _dbus_new_play,
+    _dbus_ref_play,
+    _dbus_unref_play,
+    _dbus_send_play,
+    _dbus_send_control,
+    _dbus_send_control_bulk,
+    _dbus_ping,
+    _dbus_cancel
+};
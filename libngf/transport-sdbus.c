@@ -0,0 +1,1314 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <pthread.h>
+#include <systemd/sd-bus.h>
+
+#include "list_p.h"
+#include "clock_p.h"
+#include "protocol_p.h"
+#include "transport_p.h"
+
+/*
+ * The same protocol as the D-Bus transport, spoken through sd-bus. sd-bus
+ * has no per connection data, so the connections clients were created
+ * with are kept in a list: clients on the same sd_bus share one
+ * NgfConnection, and with it the loop and the dispatcher. The loop is the
+ * connection itself, the dispatcher mirrors the one of dispatcher.c with
+ * a single filter, one Status match per backend name and the same index.
+ * sd-bus messages belong to a bus, a play is built when it is sent.
+ */
+
+#define INDEX_INITIAL_SIZE 16
+
+#define DBUS_SERVICE        "org.freedesktop.DBus"
+#define DBUS_OBJECT_PATH    "/org/freedesktop/DBus"
+#define DBUS_INTERFACE      "org.freedesktop.DBus"
+#define DBUS_PEER_INTERFACE "org.freedesktop.DBus.Peer"
+
+typedef struct _SdConnection SdConnection;
+typedef struct _SdDispatcher SdDispatcher;
+typedef struct _SdIndexEntry SdIndexEntry;
+typedef struct _SdMatch SdMatch;
+typedef struct _SdOwner SdOwner;
+typedef struct _SdOwnerWatch SdOwnerWatch;
+typedef struct _SdPlay SdPlay;
+typedef struct _SdCall SdCall;
+
+struct _SdConnection
+{
+    LIST_INIT (SdConnection)
+
+    sd_bus          *bus;
+    int             refcount;
+    int             num_loops;      /* loop references, the loop is the connection */
+    SdDispatcher    *dispatcher;    /* also while lingering unreferenced */
+};
+
+struct _SdIndexEntry
+{
+    LIST_INIT (SdIndexEntry)
+
+    uint32_t        server_event_id;
+    const char      *sender;        /* stored right after the entry, NULL for any */
+    NgfStatusFunc   func;
+    void            *target;
+};
+
+/* Status match rule of one backend name, added while slot is set. */
+struct _SdMatch
+{
+    LIST_INIT (SdMatch)
+
+    char            *name;
+    int             refcount;
+    sd_bus_slot     *slot;
+};
+
+struct _SdOwner
+{
+    LIST_INIT (SdOwner)
+
+    SdDispatcher    *dispatcher;
+    char            *name;
+    NgfOwnerState   state;
+    sd_bus_slot     *match;
+    sd_bus_slot     *pending;
+    int             num_watches;
+};
+
+struct _SdOwnerWatch
+{
+    LIST_INIT (SdOwnerWatch)
+
+    SdOwner         *owner;
+    NgfOwnerFunc    func;
+    void            *target;
+};
+
+struct _SdDispatcher
+{
+    SdConnection    *connection;
+    int             refcount;
+    int64_t         linger_deadline;
+    sd_bus_slot     *filter;
+
+    SdMatch         *matches;
+
+    SdIndexEntry    **index;
+    uint32_t        index_size;
+    uint32_t        num_events;
+
+    SdOwner         *owners;
+    SdOwnerWatch    *owner_watches;
+};
+
+/* Event and properties of a play, the message is built per send. */
+struct _SdPlay
+{
+    int             refcount;
+    char            *event;
+    NgfProplist     *proplist;
+    int             unicast;
+};
+
+struct _SdCall
+{
+    sd_bus_slot     *slot;
+    NgfReplyFunc    func;
+    void            *userdata;
+};
+
+typedef struct _SdAppend
+{
+    sd_bus_message  *msg;
+    int             failed;
+} SdAppend;
+
+#define SD_CONNECTION(c) ((SdConnection*) (c))
+#define SD_DISPATCHER(d) ((SdDispatcher*) (d))
+
+/* Connections are created and released from any thread. */
+static SdConnection *connections = NULL;
+static pthread_mutex_t connections_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void _dispatcher_free (SdDispatcher *dispatcher);
+static void _sdbus_dispatcher_release (NgfDispatcher *dispatcher, uint32_t linger_ms);
+
+static const char*
+_service_name (const char *service)
+{
+    return service ? service : NGF_DBUS_NAME;
+}
+
+static int
+_ignore_cb (sd_bus_message *msg,
+            void *userdata,
+            sd_bus_error *error)
+{
+    (void) msg;
+    (void) userdata;
+    (void) error;
+
+    return 0;
+}
+
+/* Matches are added without waiting for the bus, a failure is ignored
+   like with libdbus rather than closing the connection. */
+
+static sd_bus_slot*
+_add_rule (sd_bus *bus,
+           const char *format,
+           const char *name)
+{
+    char rule[NGF_DBUS_MATCH_MAX];
+    sd_bus_slot *slot = NULL;
+
+    snprintf (rule, sizeof (rule), format, name);
+
+    if (sd_bus_add_match_async (bus, &slot, rule, _ignore_cb, _ignore_cb, NULL) < 0)
+        return NULL;
+
+    return slot;
+}
+
+static SdConnection*
+_connection_ref (SdConnection *connection)
+{
+    pthread_mutex_lock (&connections_lock);
+    connection->refcount++;
+    pthread_mutex_unlock (&connections_lock);
+
+    return connection;
+}
+
+static void
+_connection_unref (SdConnection *connection)
+{
+    pthread_mutex_lock (&connections_lock);
+    if (--connection->refcount > 0) {
+        pthread_mutex_unlock (&connections_lock);
+        return;
+    }
+
+    LIST_REMOVE (connections, connection);
+    pthread_mutex_unlock (&connections_lock);
+
+    /* A lingering dispatcher goes along with the connection. */
+    if (connection->dispatcher)
+        _dispatcher_free (connection->dispatcher);
+
+    sd_bus_unref (connection->bus);
+    free (connection);
+}
+
+/* The connection of bus, made on first use. */
+
+static SdConnection*
+_connection_get (sd_bus *bus)
+{
+    SdConnection *connection = NULL;
+
+    pthread_mutex_lock (&connections_lock);
+
+    for (connection = connections; connection; connection = connection->next) {
+        if (connection->bus == bus) {
+            connection->refcount++;
+            pthread_mutex_unlock (&connections_lock);
+            return connection;
+        }
+    }
+
+    if ((connection = (SdConnection*) calloc (1, sizeof (SdConnection))) != NULL) {
+        connection->bus = sd_bus_ref (bus);
+        connection->refcount = 1;
+        LIST_APPEND (connections, connection);
+    }
+
+    pthread_mutex_unlock (&connections_lock);
+    return connection;
+}
+
+/* Dispatcher */
+
+static void
+_dispatcher_linger (SdDispatcher *dispatcher,
+                    uint32_t linger_ms)
+{
+    int64_t deadline = 0;
+
+    if (linger_ms == 0)
+        return;
+
+    deadline = ngf_clock_now_ms () + linger_ms;
+    if (deadline > dispatcher->linger_deadline)
+        dispatcher->linger_deadline = deadline;
+}
+
+static int
+_dispatcher_lingering (SdDispatcher *dispatcher)
+{
+    return dispatcher->linger_deadline > 0 &&
+           ngf_clock_now_ms () < dispatcher->linger_deadline;
+}
+
+/* Drop whatever outlived its linger period. Returns 1 if the dispatcher
+   itself was freed. */
+
+static int
+_dispatcher_expire (SdDispatcher *dispatcher)
+{
+    SdMatch *match = NULL;
+
+    if (dispatcher->linger_deadline == 0 || _dispatcher_lingering (dispatcher))
+        return 0;
+
+    dispatcher->linger_deadline = 0;
+
+    if (dispatcher->refcount == 0) {
+        _dispatcher_free (dispatcher);
+        return 1;
+    }
+
+    for (match = dispatcher->matches; match; match = match->next) {
+        if (match->refcount == 0 && match->slot)
+            match->slot = sd_bus_slot_unref (match->slot);
+    }
+
+    return 0;
+}
+
+static SdMatch*
+_dispatcher_find_match (SdDispatcher *dispatcher,
+                        const char *name)
+{
+    SdMatch *match = NULL;
+
+    for (match = dispatcher->matches; match; match = match->next) {
+        if (strcmp (match->name, name) == 0)
+            return match;
+    }
+
+    return NULL;
+}
+
+static SdIndexEntry**
+_index_bucket (SdDispatcher *dispatcher, uint32_t server_event_id)
+{
+    return &dispatcher->index[server_event_id & (dispatcher->index_size - 1)];
+}
+
+static SdIndexEntry*
+_index_lookup (SdDispatcher *dispatcher, uint32_t server_event_id, const char *sender)
+{
+    SdIndexEntry *entry = NULL;
+
+    for (entry = *_index_bucket (dispatcher, server_event_id); entry; entry = entry->next) {
+        if (entry->server_event_id != server_event_id)
+            continue;
+
+        if (entry->sender == NULL || sender == NULL || strcmp (entry->sender, sender) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static int
+_index_grow (SdDispatcher *dispatcher)
+{
+    SdIndexEntry **old_index = dispatcher->index;
+    uint32_t old_size = dispatcher->index_size;
+    SdIndexEntry *entry = NULL, *next = NULL, **bucket = NULL;
+    uint32_t i;
+
+    dispatcher->index = (SdIndexEntry**) calloc (old_size * 2, sizeof (SdIndexEntry*));
+    if (dispatcher->index == NULL) {
+        dispatcher->index = old_index;
+        return 0;
+    }
+
+    dispatcher->index_size = old_size * 2;
+
+    for (i = 0; i < old_size; i++) {
+        for (entry = old_index[i]; entry; entry = next) {
+            next = entry->next;
+            bucket = _index_bucket (dispatcher, entry->server_event_id);
+            entry->next = *bucket;
+            *bucket = entry;
+        }
+    }
+
+    free (old_index);
+    return 1;
+}
+
+static SdOwner*
+_dispatcher_find_owner (SdDispatcher *dispatcher,
+                        const char *name)
+{
+    SdOwner *owner = NULL;
+
+    for (owner = dispatcher->owners; owner; owner = owner->next) {
+        if (strcmp (owner->name, name) == 0)
+            return owner;
+    }
+
+    return NULL;
+}
+
+static void
+_dispatcher_set_owner (SdOwner *owner,
+                       NgfOwnerState state,
+                       int lost)
+{
+    SdDispatcher *dispatcher = owner->dispatcher;
+    SdOwnerWatch *watch = NULL, *next = NULL;
+
+    if (owner->state == state && !lost)
+        return;
+
+    owner->state = state;
+
+    /* Watchers may unwatch, or drop their dispatcher reference, from
+       within the callback. */
+
+    dispatcher->refcount++;
+    for (watch = dispatcher->owner_watches; watch; watch = next) {
+        next = watch->next;
+        if (watch->owner == owner)
+            watch->func (watch->target, owner->name, state, lost);
+    }
+    _sdbus_dispatcher_release ((NgfDispatcher*) dispatcher, 0);
+}
+
+static void
+_dispatcher_owner_changed (SdDispatcher *dispatcher,
+                           sd_bus_message *msg)
+{
+    const char *name = NULL, *old_owner = NULL, *new_owner = NULL;
+    SdOwner *owner = NULL;
+
+    if (sd_bus_message_read (msg, "sss", &name, &old_owner, &new_owner) < 0)
+        return;
+
+    if ((owner = _dispatcher_find_owner (dispatcher, name)) == NULL)
+        return;
+
+    _dispatcher_set_owner (owner,
+                           new_owner[0] ? NGF_OWNER_PRESENT : NGF_OWNER_ABSENT,
+                           old_owner[0] != '\0');
+}
+
+static int
+_dispatcher_owner_reply (sd_bus_message *msg,
+                         void *userdata,
+                         sd_bus_error *error)
+{
+    SdOwner *owner = (SdOwner*) userdata;
+    NgfOwnerState state = NGF_OWNER_UNKNOWN;
+
+    (void) error;
+
+    if (!sd_bus_message_is_method_error (msg, NULL))
+        state = NGF_OWNER_PRESENT;
+    else if (sd_bus_message_is_method_error (msg, SD_BUS_ERROR_NAME_HAS_NO_OWNER))
+        state = NGF_OWNER_ABSENT;
+
+    /* sd-bus holds the slot until the callback returns. */
+    owner->pending = sd_bus_slot_unref (owner->pending);
+
+    /* Owner changes signalled while the query was in flight happened
+       before the bus answered it, the answer is the newer state. */
+
+    if (state != NGF_OWNER_UNKNOWN)
+        _dispatcher_set_owner (owner, state, 0);
+
+    return 0;
+}
+
+static void
+_dispatcher_stop_owner_tracking (SdDispatcher *dispatcher,
+                                 SdOwner *owner)
+{
+    sd_bus_slot_unref (owner->pending);
+    sd_bus_slot_unref (owner->match);
+
+    LIST_REMOVE (dispatcher->owners, owner);
+    free (owner->name);
+    free (owner);
+}
+
+static int
+_dispatcher_filter_cb (sd_bus_message *msg,
+                       void *userdata,
+                       sd_bus_error *error)
+{
+    SdDispatcher *dispatcher = (SdDispatcher*) userdata;
+    SdIndexEntry *entry = NULL;
+    const char *member = NULL, *interface = NULL;
+    uint32_t server_event_id = 0;
+    uint32_t state = 0;
+    uint8_t type = 0;
+
+    (void) error;
+
+    if (dispatcher->linger_deadline > 0 && _dispatcher_expire (dispatcher))
+        return 0;
+
+    if (dispatcher->owners &&
+        sd_bus_message_is_signal (msg, DBUS_INTERFACE, "NameOwnerChanged") > 0 &&
+        sd_bus_message_get_sender (msg) &&
+        strcmp (sd_bus_message_get_sender (msg), DBUS_SERVICE) == 0)
+    {
+        _dispatcher_owner_changed (dispatcher, msg);
+        return 0;
+    }
+
+    /* The filter sees every message on the connection, reject what can't
+       be a Status before reading anything. */
+
+    if (dispatcher->num_events == 0 || sd_bus_message_get_type (msg, &type) < 0)
+        return 0;
+
+    if (type != SD_BUS_MESSAGE_SIGNAL && type != SD_BUS_MESSAGE_METHOD_CALL)
+        return 0;
+
+    if ((member = sd_bus_message_get_member (msg)) == NULL || strcmp (member, NGF_DBUS_INTERNAL_STATUS) != 0 ||
+        (interface = sd_bus_message_get_interface (msg)) == NULL || strcmp (interface, NGF_DBUS_IFACE) != 0)
+    {
+        return 0;
+    }
+
+    if (sd_bus_message_read (msg, "uu", &server_event_id, &state) < 0)
+        return 0;
+
+    if ((entry = _index_lookup (dispatcher, server_event_id, sd_bus_message_get_sender (msg))) == NULL)
+        return 0;
+
+    /* The owner may drop the entry, or even its last dispatcher reference,
+       from within the callback. */
+
+    dispatcher->refcount++;
+    entry->func (entry->target, state, sd_bus_message_get_destination (msg) != NULL);
+    _sdbus_dispatcher_release ((NgfDispatcher*) dispatcher, 0);
+
+    /* A unicast status call is ours alone, answer it or sd-bus replies
+       with UnknownMethod. Signals are left for other handlers. */
+
+    if (type == SD_BUS_MESSAGE_METHOD_CALL) {
+        if (sd_bus_message_get_expect_reply (msg) > 0)
+            sd_bus_reply_method_return (msg, NULL);
+        return 1;
+    }
+
+    return 0;
+}
+
+static NgfDispatcher*
+_sdbus_dispatcher_acquire (NgfConnection *c)
+{
+    SdConnection *connection = SD_CONNECTION (c);
+    SdDispatcher *dispatcher = NULL;
+
+    /* A lingering dispatcher is revived as is, filter and match included. */
+    if ((dispatcher = connection->dispatcher) != NULL) {
+        dispatcher->refcount++;
+        return (NgfDispatcher*) dispatcher;
+    }
+
+    if ((dispatcher = (SdDispatcher*) calloc (1, sizeof (SdDispatcher))) == NULL)
+        return NULL;
+
+    dispatcher->index_size = INDEX_INITIAL_SIZE;
+    dispatcher->index = (SdIndexEntry**) calloc (dispatcher->index_size, sizeof (SdIndexEntry*));
+
+    if (dispatcher->index == NULL ||
+        sd_bus_add_filter (connection->bus, &dispatcher->filter, _dispatcher_filter_cb, dispatcher) < 0)
+    {
+        free (dispatcher->index);
+        free (dispatcher);
+        return NULL;
+    }
+
+    /* No connection reference is held: clients keep the connection alive,
+       and a lingering dispatcher is freed along with the connection. */
+
+    dispatcher->connection = connection;
+    dispatcher->refcount = 1;
+    connection->dispatcher = dispatcher;
+
+    return (NgfDispatcher*) dispatcher;
+}
+
+static void
+_sdbus_dispatcher_release (NgfDispatcher *d,
+                           uint32_t linger_ms)
+{
+    SdDispatcher *dispatcher = SD_DISPATCHER (d);
+
+    if (dispatcher == NULL)
+        return;
+
+    _dispatcher_linger (dispatcher, linger_ms);
+
+    if (--dispatcher->refcount > 0 || _dispatcher_lingering (dispatcher))
+        return;
+
+    _dispatcher_free (dispatcher);
+}
+
+static void
+_dispatcher_free (SdDispatcher *dispatcher)
+{
+    SdIndexEntry *entry = NULL, *next = NULL;
+    SdMatch *match = NULL, *next_match = NULL;
+    SdOwnerWatch *watch = NULL, *next_watch = NULL;
+    uint32_t i;
+
+    dispatcher->connection->dispatcher = NULL;
+    sd_bus_slot_unref (dispatcher->filter);
+
+    while (dispatcher->owners)
+        _dispatcher_stop_owner_tracking (dispatcher, dispatcher->owners);
+
+    for (watch = dispatcher->owner_watches; watch; watch = next_watch) {
+        next_watch = watch->next;
+        free (watch);
+    }
+
+    /* Dropping the slot of a match removes the rule from the bus. */
+    for (match = dispatcher->matches; match; match = next_match) {
+        next_match = match->next;
+        sd_bus_slot_unref (match->slot);
+        free (match->name);
+        free (match);
+    }
+
+    for (i = 0; i < dispatcher->index_size; i++) {
+        for (entry = dispatcher->index[i]; entry; entry = next) {
+            next = entry->next;
+            free (entry);
+        }
+    }
+
+    free (dispatcher->index);
+    free (dispatcher);
+}
+
+static void
+_sdbus_add_match (NgfDispatcher *d,
+                  const char *name)
+{
+    SdDispatcher *dispatcher = SD_DISPATCHER (d);
+    SdMatch *match = NULL;
+
+    name = _service_name (name);
+
+    if ((match = _dispatcher_find_match (dispatcher, name)) == NULL) {
+        if ((match = (SdMatch*) calloc (1, sizeof (SdMatch))) == NULL)
+            return;
+
+        if ((match->name = strdup (name)) == NULL) {
+            free (match);
+            return;
+        }
+
+        LIST_APPEND (dispatcher->matches, match);
+    }
+
+    match->refcount++;
+
+    if (match->slot == NULL)
+        match->slot = _add_rule (dispatcher->connection->bus, NGF_DBUS_MATCH_FORMAT, name);
+}
+
+static void
+_sdbus_remove_match (NgfDispatcher *d,
+                     const char *name,
+                     uint32_t linger_ms)
+{
+    SdDispatcher *dispatcher = SD_DISPATCHER (d);
+    SdMatch *match = NULL;
+
+    match = _dispatcher_find_match (dispatcher, _service_name (name));
+    if (match == NULL || match->refcount == 0)
+        return;
+
+    _dispatcher_linger (dispatcher, linger_ms);
+
+    if (--match->refcount > 0 || _dispatcher_lingering (dispatcher))
+        return;
+
+    match->slot = sd_bus_slot_unref (match->slot);
+}
+
+static int
+_sdbus_add_event (NgfDispatcher *d,
+                  uint32_t server_event_id,
+                  const char *sender,
+                  NgfStatusFunc func,
+                  void *target)
+{
+    SdDispatcher *dispatcher = SD_DISPATCHER (d);
+    SdIndexEntry *entry = NULL, **bucket = NULL;
+    size_t sender_size = sender ? strlen (sender) + 1 : 0;
+
+    if (dispatcher->num_events >= dispatcher->index_size * 2)
+        _index_grow (dispatcher);
+
+    entry = (SdIndexEntry*) malloc (sizeof (SdIndexEntry) + sender_size);
+    if (entry == NULL)
+        return 0;
+
+    entry->server_event_id = server_event_id;
+    entry->sender = NULL;
+    entry->func = func;
+    entry->target = target;
+
+    if (sender) {
+        memcpy (entry + 1, sender, sender_size);
+        entry->sender = (const char*) (entry + 1);
+    }
+
+    bucket = _index_bucket (dispatcher, server_event_id);
+    entry->next = *bucket;
+    *bucket = entry;
+    dispatcher->num_events++;
+
+    return 1;
+}
+
+static void
+_sdbus_remove_event (NgfDispatcher *d,
+                     uint32_t server_event_id,
+                     void *target)
+{
+    SdDispatcher *dispatcher = SD_DISPATCHER (d);
+    SdIndexEntry **bucket = NULL, *entry = NULL;
+
+    bucket = _index_bucket (dispatcher, server_event_id);
+    for (entry = *bucket; entry; entry = entry->next) {
+        if (entry->server_event_id == server_event_id && entry->target == target) {
+            LIST_REMOVE (*bucket, entry);
+            free (entry);
+            dispatcher->num_events--;
+            break;
+        }
+    }
+}
+
+static int
+_sdbus_watch_owner (NgfDispatcher *d,
+                    const char *name,
+                    NgfOwnerFunc func,
+                    void *target)
+{
+    SdDispatcher *dispatcher = SD_DISPATCHER (d);
+    sd_bus *bus = dispatcher->connection->bus;
+    SdOwner *owner = NULL;
+    SdOwnerWatch *watch = NULL;
+
+    name = _service_name (name);
+
+    if ((watch = (SdOwnerWatch*) calloc (1, sizeof (SdOwnerWatch))) == NULL)
+        return 0;
+
+    /* The first watch of a name adds a match for its owner changes and
+       asks the bus for the current owner. */
+
+    if ((owner = _dispatcher_find_owner (dispatcher, name)) == NULL) {
+        if ((owner = (SdOwner*) calloc (1, sizeof (SdOwner))) == NULL ||
+            (owner->name = strdup (name)) == NULL)
+        {
+            free (owner);
+            free (watch);
+            return 0;
+        }
+
+        owner->dispatcher = dispatcher;
+        LIST_APPEND (dispatcher->owners, owner);
+
+        owner->match = _add_rule (bus, NGF_DBUS_OWNER_MATCH_FORMAT, name);
+        if (sd_bus_call_method_async (bus, &owner->pending, DBUS_SERVICE, DBUS_OBJECT_PATH, DBUS_INTERFACE,
+                                      "GetNameOwner", _dispatcher_owner_reply, owner, "s", name) < 0)
+        {
+            owner->pending = NULL;
+        }
+    }
+
+    watch->owner = owner;
+    watch->func = func;
+    watch->target = target;
+    owner->num_watches++;
+    LIST_APPEND (dispatcher->owner_watches, watch);
+
+    return 1;
+}
+
+static void
+_sdbus_unwatch_owner (NgfDispatcher *d,
+                      const char *name,
+                      void *target)
+{
+    SdDispatcher *dispatcher = SD_DISPATCHER (d);
+    SdOwner *owner = NULL;
+    SdOwnerWatch *watch = NULL;
+
+    if ((owner = _dispatcher_find_owner (dispatcher, _service_name (name))) == NULL)
+        return;
+
+    for (watch = dispatcher->owner_watches; watch; watch = watch->next) {
+        if (watch->owner == owner && watch->target == target) {
+            LIST_REMOVE (dispatcher->owner_watches, watch);
+            free (watch);
+            break;
+        }
+    }
+
+    if (watch && --owner->num_watches == 0)
+        _dispatcher_stop_owner_tracking (dispatcher, owner);
+}
+
+static NgfOwnerState
+_sdbus_get_owner_state (NgfDispatcher *d,
+                        const char *name)
+{
+    SdOwner *owner = _dispatcher_find_owner (SD_DISPATCHER (d), _service_name (name));
+
+    return owner ? owner->state : NGF_OWNER_UNKNOWN;
+}
+
+/* Connections */
+
+static NgfConnection*
+_sdbus_connect (va_list args)
+{
+    sd_bus *bus = va_arg (args, sd_bus*);
+
+    if (bus == NULL)
+        return NULL;
+
+    return (NgfConnection*) _connection_get (bus);
+}
+
+static NgfConnection*
+_sdbus_open (const char *address)
+{
+    SdConnection *connection = NULL;
+    sd_bus *bus = NULL;
+
+    if (address) {
+        if (sd_bus_new (&bus) < 0)
+            return NULL;
+
+        if (sd_bus_set_address (bus, address) < 0 ||
+            sd_bus_set_bus_client (bus, 1) < 0 ||
+            sd_bus_start (bus) < 0)
+        {
+            sd_bus_unref (bus);
+            return NULL;
+        }
+    } else if (sd_bus_open_system (&bus) < 0) {
+        return NULL;
+    }
+
+    connection = _connection_get (bus);
+    sd_bus_unref (bus);
+
+    return (NgfConnection*) connection;
+}
+
+static NgfConnection*
+_sdbus_ref (NgfConnection *connection)
+{
+    return (NgfConnection*) _connection_ref (SD_CONNECTION (connection));
+}
+
+static void
+_sdbus_unref (NgfConnection *connection)
+{
+    _connection_unref (SD_CONNECTION (connection));
+}
+
+static void
+_sdbus_close (NgfConnection *connection)
+{
+    sd_bus_close (SD_CONNECTION (connection)->bus);
+}
+
+static void
+_sdbus_flush (NgfConnection *connection)
+{
+    sd_bus_flush (SD_CONNECTION (connection)->bus);
+}
+
+static int
+_sdbus_has_output (NgfConnection *connection)
+{
+    int events = sd_bus_get_events (SD_CONNECTION (connection)->bus);
+
+    return events > 0 && (events & POLLOUT);
+}
+
+/* Process until nothing is left. Callbacks may release the last client
+   of the connection, it is kept alive until done. Returns 0 once
+   disconnected. */
+
+static int
+_connection_process (SdConnection *connection)
+{
+    int r, connected;
+
+    _connection_ref (connection);
+
+    while ((r = sd_bus_process (connection->bus, NULL)) > 0)
+        ;
+
+    if (connection->dispatcher)
+        _dispatcher_expire (connection->dispatcher);
+
+    connected = r >= 0 && sd_bus_is_open (connection->bus) > 0;
+    _connection_unref (connection);
+
+    return connected;
+}
+
+static int
+_sdbus_iterate (NgfConnection *c,
+                int timeout_ms)
+{
+    SdConnection *connection = SD_CONNECTION (c);
+
+    if (!_connection_process (connection))
+        return 0;
+
+    if (sd_bus_wait (connection->bus, timeout_ms < 0 ? UINT64_MAX : (uint64_t) timeout_ms * 1000) < 0)
+        return 0;
+
+    return _connection_process (connection);
+}
+
+/* Loop */
+
+static NgfLoop*
+_sdbus_loop_acquire (NgfConnection *connection)
+{
+    SD_CONNECTION (connection)->num_loops++;
+    return (NgfLoop*) connection;
+}
+
+static void
+_sdbus_loop_release (NgfLoop *loop)
+{
+    if (loop)
+        SD_CONNECTION (loop)->num_loops--;
+}
+
+static int
+_sdbus_loop_attached (NgfConnection *connection)
+{
+    return SD_CONNECTION (connection)->num_loops > 0;
+}
+
+static int
+_sdbus_loop_get_fd (NgfLoop *loop,
+                    int *events)
+{
+    sd_bus *bus = SD_CONNECTION (loop)->bus;
+    int wanted = 0;
+
+    if (events && (wanted = sd_bus_get_events (bus)) > 0)
+        *events |= wanted & (POLLIN | POLLOUT);
+
+    return sd_bus_get_fd (bus);
+}
+
+static int
+_sdbus_loop_get_timeout (NgfLoop *loop)
+{
+    SdConnection *connection = SD_CONNECTION (loop);
+    int64_t now = ngf_clock_now_ms ();
+    uint64_t usec = 0;
+    int timeout = -1, remaining = 0;
+
+    /* An absolute CLOCK_MONOTONIC time, 0 if messages are waiting. */
+    if (sd_bus_get_timeout (connection->bus, &usec) >= 0 && usec != UINT64_MAX)
+        timeout = ngf_clock_timeout_ms ((int64_t) ((usec + 999) / 1000), now);
+
+    if (connection->dispatcher && connection->dispatcher->linger_deadline > 0) {
+        remaining = ngf_clock_timeout_ms (connection->dispatcher->linger_deadline, now);
+        if (timeout < 0 || remaining < timeout)
+            timeout = remaining;
+    }
+
+    return timeout;
+}
+
+static int
+_sdbus_loop_dispatch (NgfLoop *loop)
+{
+    return _connection_process (SD_CONNECTION (loop));
+}
+
+/* Calls */
+
+static void
+_append_property (const char *key,
+                  const void *value,
+                  NgfProplistType type,
+                  void *userdata)
+{
+    SdAppend *append = (SdAppend*) userdata;
+    sd_bus_message *msg = append->msg;
+    int boolean_value = 0, r = 0;
+
+    r = sd_bus_message_open_container (msg, SD_BUS_TYPE_DICT_ENTRY, "sv");
+    if (r >= 0)
+        r = sd_bus_message_append_basic (msg, SD_BUS_TYPE_STRING, key);
+
+    switch (type) {
+        case NGF_PROPLIST_VALUE_TYPE_STRING:
+            if (r >= 0)
+                r = sd_bus_message_append (msg, "v", "s", (const char*) value);
+            break;
+
+        case NGF_PROPLIST_VALUE_TYPE_INTEGER:
+            if (r >= 0)
+                r = sd_bus_message_append (msg, "v", "i", *(int32_t*) value);
+            break;
+
+        case NGF_PROPLIST_VALUE_TYPE_UNSIGNED:
+            if (r >= 0)
+                r = sd_bus_message_append (msg, "v", "u", *(uint32_t*) value);
+            break;
+
+        case NGF_PROPLIST_VALUE_TYPE_BOOLEAN:
+            boolean_value = *(int*) value ? 1 : 0;
+            if (r >= 0)
+                r = sd_bus_message_append (msg, "v", "b", boolean_value);
+            break;
+
+        default:
+            break;
+    }
+
+    if (r >= 0)
+        r = sd_bus_message_close_container (msg);
+
+    if (r < 0)
+        append->failed = 1;
+}
+
+static int
+_reply_cb (sd_bus_message *msg,
+           void *userdata,
+           sd_bus_error *error)
+{
+    SdCall *call = (SdCall*) userdata;
+    NgfReplyStatus status = NGF_REPLY_OK;
+    const char *sender = NULL;
+    uint32_t value = 0;
+    char type = 0;
+
+    (void) error;
+
+    if (sd_bus_message_is_method_error (msg, SD_BUS_ERROR_NO_REPLY) ||
+        sd_bus_message_is_method_error (msg, SD_BUS_ERROR_TIMEOUT) ||
+        sd_bus_message_is_method_error (msg, SD_BUS_ERROR_DISCONNECTED))
+    {
+        status = NGF_REPLY_NO_REPLY;
+    }
+    else if (sd_bus_message_is_method_error (msg, SD_BUS_ERROR_UNKNOWN_METHOD)) {
+        status = NGF_REPLY_UNKNOWN_METHOD;
+    }
+    else if (sd_bus_message_is_method_error (msg, NULL)) {
+        status = NGF_REPLY_ERROR;
+    }
+    else if (sd_bus_message_peek_type (msg, &type, NULL) > 0 && type == SD_BUS_TYPE_UINT32) {
+        sd_bus_message_read_basic (msg, SD_BUS_TYPE_UINT32, &value);
+    }
+
+    /* Errors sd-bus made up itself have no sender of ours. */
+    if (status != NGF_REPLY_NO_REPLY)
+        sender = sd_bus_message_get_sender (msg);
+
+    call->func ((NgfTransportCall*) call, status, value, sender, call->userdata);
+
+    /* sd-bus holds the slot until the callback returns. */
+    sd_bus_slot_unref (call->slot);
+    free (call);
+
+    return 0;
+}
+
+/* Sends msg and hands the reply to func. Takes the reference to msg. */
+
+static NgfTransportCall*
+_send_with_reply (SdConnection *connection,
+                  sd_bus_message *msg,
+                  int timeout_ms,
+                  NgfReplyFunc func,
+                  void *userdata)
+{
+    SdCall *call = NULL;
+    int r;
+
+    if (msg == NULL)
+        return NULL;
+
+    if ((call = (SdCall*) calloc (1, sizeof (SdCall))) == NULL) {
+        sd_bus_message_unref (msg);
+        return NULL;
+    }
+
+    call->func = func;
+    call->userdata = userdata;
+
+    r = sd_bus_call_async (connection->bus, &call->slot, msg, _reply_cb, call,
+                           timeout_ms > 0 ? (uint64_t) timeout_ms * 1000 : 0);
+    sd_bus_message_unref (msg);
+
+    if (r < 0) {
+        free (call);
+        return NULL;
+    }
+
+    return (NgfTransportCall*) call;
+}
+
+static sd_bus_message*
+_new_method_call (SdConnection *connection,
+                  const char *service,
+                  const char *method)
+{
+    sd_bus_message *msg = NULL;
+
+    if (sd_bus_message_new_method_call (connection->bus, &msg, _service_name (service),
+                                        NGF_DBUS_PATH, NGF_DBUS_IFACE, method) < 0)
+    {
+        return NULL;
+    }
+
+    return msg;
+}
+
+static NgfTransportPlay*
+_sdbus_new_play (const char *event,
+                 NgfProplist *proplist,
+                 int unicast)
+{
+    SdPlay *play = NULL;
+
+    if ((play = (SdPlay*) calloc (1, sizeof (SdPlay))) == NULL)
+        return NULL;
+
+    play->refcount = 1;
+    play->unicast = unicast;
+
+    if ((play->event = strdup (event)) == NULL ||
+        (proplist && (play->proplist = ngf_proplist_copy (proplist)) == NULL))
+    {
+        free (play->event);
+        free (play);
+        return NULL;
+    }
+
+    return (NgfTransportPlay*) play;
+}
+
+static NgfTransportPlay*
+_sdbus_ref_play (NgfTransportPlay *play)
+{
+    __atomic_add_fetch (&((SdPlay*) play)->refcount, 1, __ATOMIC_RELAXED);
+    return play;
+}
+
+static void
+_sdbus_unref_play (NgfTransportPlay *p)
+{
+    SdPlay *play = (SdPlay*) p;
+
+    if (__atomic_sub_fetch (&play->refcount, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    if (play->proplist)
+        ngf_proplist_free (play->proplist);
+    free (play->event);
+    free (play);
+}
+
+static NgfTransportCall*
+_sdbus_send_play (NgfConnection *c,
+                  NgfTransportPlay *p,
+                  const char *service,
+                  int timeout_ms,
+                  NgfReplyFunc func,
+                  void *userdata)
+{
+    SdConnection *connection = SD_CONNECTION (c);
+    SdPlay *play = (SdPlay*) p;
+    SdAppend append = { NULL, 0 };
+    int enabled = 1;
+
+    if ((append.msg = _new_method_call (connection, service, NGF_DBUS_METHOD_PLAY)) == NULL)
+        return NULL;
+
+    /* Append all properties from the property list */
+    if (sd_bus_message_append_basic (append.msg, SD_BUS_TYPE_STRING, play->event) < 0 ||
+        sd_bus_message_open_container (append.msg, SD_BUS_TYPE_ARRAY, "{sv}") < 0)
+    {
+        append.failed = 1;
+    }
+
+    if (!append.failed && play->proplist)
+        ngf_proplist_foreach_extended (play->proplist, _append_property, &append);
+    if (!append.failed && play->unicast)
+        _append_property (NGF_PROPERTY_UNICAST_STATUS, &enabled, NGF_PROPLIST_VALUE_TYPE_BOOLEAN, &append);
+
+    if (append.failed || sd_bus_message_close_container (append.msg) < 0) {
+        sd_bus_message_unref (append.msg);
+        return NULL;
+    }
+
+    return _send_with_reply (connection, append.msg, timeout_ms, func, userdata);
+}
+
+static void
+_sdbus_send_control (NgfConnection *c,
+                     const char *service,
+                     uint32_t server_event_id,
+                     int pause)
+{
+    SdConnection *connection = SD_CONNECTION (c);
+    sd_bus_message *msg = NULL;
+    int r;
+
+    if ((msg = _new_method_call (connection, service, pause < 0 ? NGF_DBUS_METHOD_STOP : NGF_DBUS_METHOD_PAUSE)) == NULL)
+        return;
+
+    if (pause < 0)
+        r = sd_bus_message_append (msg, "u", server_event_id);
+    else
+        r = sd_bus_message_append (msg, "ub", server_event_id, pause > 0);
+
+    if (r >= 0 && sd_bus_message_set_expect_reply (msg, 0) >= 0)
+        sd_bus_send (connection->bus, msg, NULL);
+
+    sd_bus_message_unref (msg);
+}
+
+static NgfTransportCall*
+_sdbus_send_control_bulk (NgfConnection *c,
+                          const char *service,
+                          const uint32_t *server_event_ids,
+                          uint32_t num_ids,
+                          int pause,
+                          int timeout_ms,
+                          NgfReplyFunc func,
+                          void *userdata)
+{
+    SdConnection *connection = SD_CONNECTION (c);
+    sd_bus_message *msg = NULL;
+    int r;
+
+    if ((msg = _new_method_call (connection, service, pause < 0 ? NGF_DBUS_METHOD_STOP_MANY : NGF_DBUS_METHOD_PAUSE_MANY)) == NULL)
+        return NULL;
+
+    r = sd_bus_message_append_array (msg, SD_BUS_TYPE_UINT32, server_event_ids, num_ids * sizeof (uint32_t));
+    if (r >= 0 && pause >= 0)
+        r = sd_bus_message_append (msg, "b", pause > 0);
+
+    if (r < 0) {
+        sd_bus_message_unref (msg);
+        return NULL;
+    }
+
+    return _send_with_reply (connection, msg, timeout_ms, func, userdata);
+}
+
+static NgfTransportCall*
+_sdbus_ping (NgfConnection *c,
+             int timeout_ms,
+             NgfReplyFunc func,
+             void *userdata)
+{
+    SdConnection *connection = SD_CONNECTION (c);
+    sd_bus_message *msg = NULL;
+
+    if (sd_bus_message_new_method_call (connection->bus, &msg, DBUS_SERVICE, DBUS_OBJECT_PATH,
+                                        DBUS_PEER_INTERFACE, "Ping") < 0)
+    {
+        return NULL;
+    }
+
+    return _send_with_reply (connection, msg, timeout_ms, func, userdata);
+}
+
+static void
+_sdbus_cancel (NgfTransportCall *c)
+{
+    SdCall *call = (SdCall*) c;
+
+    sd_bus_slot_unref (call->slot);
+    free (call);
+}
+
+const NgfTransportOps ngf_transport_sdbus = {
+    NGF_TRANSPORT_SDBUS,
+    "sdbus",
+    _sdbus_connect,
+    _sdbus_open,
+    _sdbus_ref,
+    _sdbus_unref,
+    _sdbus_close,
+    _sdbus_flush,
+    _sdbus_has_output,
+    _sdbus_iterate,
+    _sdbus_loop_acquire,
+    _sdbus_loop_release,
+    _sdbus_loop_attached,
+    _sdbus_loop_get_fd,
+    _sdbus_loop_get_timeout,
+    _sdbus_loop_dispatch,
+    _sdbus_dispatcher_acquire,
+    _sdbus_dispatcher_release,
+    _sdbus_add_match,
+    _sdbus_remove_match,
+    _sdbus_add_event,
+    _sdbus_remove_event,
+    _sdbus_watch_owner,
+    _sdbus_unwatch_owner,
+    _sdbus_get_owner_state,
+    _sdbus_new_play,
+    _sdbus_ref_play,
+    _sdbus_unref_play,
+    _sdbus_send_play,
+    _sdbus_send_control,
+    _sdbus_send_control_bulk,
+    _sdbus_ping,
+    _sdbus_cancel
+};
@@ -0,0 +1,45 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <stddef.h>
+
+#include "transport_p.h"
+
+static const NgfTransportOps *transports[] = {
+    &ngf_transport_dbus,
+#ifdef HAVE_SDBUS
+    &ngf_transport_sdbus,
+#endif
+    NULL
+};
+
+const NgfTransportOps*
+ngf_transport_lookup (NgfTransport transport)
+{
+    int i;
+
+    for (i = 0; transports[i]; i++) {
+        if (transports[i]->transport == transport)
+            return transports[i];
+    }
+
+    return NULL;
+}
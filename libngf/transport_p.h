@@ -0,0 +1,165 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef NGF_TRANSPORT_H
+#define NGF_TRANSPORT_H
+
+#include <stdint.h>
+#include <stdarg.h>
+
+#include "client.h"
+#include "proplist.h"
+
+/**
+ * Everything the client does with the bus goes through the operations of
+ * its transport, looked up by NgfTransport: setting up connections,
+ * driving them from a main loop, talking to the backend and receiving the
+ * Status of its events. The client only ever holds the opaque handles
+ * below, each transport defines what is behind them. For D-Bus they are
+ * a DBusConnection, an NgfLoop of loop.c and an NgfDispatcher of
+ * dispatcher.c, for sd-bus the structures of transport-sdbus.c.
+ */
+
+/** Connection of a transport, reference counted. */
+typedef struct _NgfConnection NgfConnection;
+
+/** Main loop integration of a connection, shared by its users. */
+typedef struct _NgfLoop NgfLoop;
+
+/** Status routing and backend presence of a connection, shared by its
+    users. */
+typedef struct _NgfDispatcher NgfDispatcher;
+
+/** Play call built ahead of being sent, reference counted. */
+typedef struct _NgfTransportPlay NgfTransportPlay;
+
+/** Call awaiting its reply. */
+typedef struct _NgfTransportCall NgfTransportCall;
+
+typedef enum _NgfReplyStatus
+{
+    NGF_REPLY_OK = 0,
+    NGF_REPLY_ERROR,
+    NGF_REPLY_UNKNOWN_METHOD,
+    NGF_REPLY_NO_REPLY              /* timed out or disconnected */
+} NgfReplyStatus;
+
+/** Reply to a call. value is the first argument if it is a uint32, 0
+    otherwise, sender the unique name that replied or NULL. The call is
+    released once this returns. */
+typedef void (*NgfReplyFunc) (NgfTransportCall *call, NgfReplyStatus status,
+                              uint32_t value, const char *sender, void *userdata);
+
+/** Called with the indexed target when a Status for it arrives, unicast
+    if the backend addressed it to us rather than broadcasting it. */
+typedef void (*NgfStatusFunc) (void *target, uint32_t state, int unicast);
+
+typedef enum _NgfOwnerState
+{
+    NGF_OWNER_UNKNOWN,
+    NGF_OWNER_ABSENT,
+    NGF_OWNER_PRESENT
+} NgfOwnerState;
+
+/** Called when the owner of a watched backend name changes. lost is set
+    if a previous owner went away, along with every event it was playing. */
+typedef void (*NgfOwnerFunc) (void *target, const char *name, NgfOwnerState state, int lost);
+
+typedef struct _NgfTransportOps
+{
+    NgfTransport        transport;
+    const char          *name;
+
+    /* Connections. connect takes the connection handed to
+       ngf_client_create or ngf_client_add_lane out of args and references
+       it, open makes a private one to address, the system bus if NULL,
+       usable from any thread. */
+    NgfConnection*      (*connect) (va_list args);
+    NgfConnection*      (*open) (const char *address);
+    NgfConnection*      (*ref) (NgfConnection *connection);
+    void                (*unref) (NgfConnection *connection);
+    void                (*close) (NgfConnection *connection);
+
+    /* Block until everything queued has been written, or tell whether
+       anything is. */
+    void                (*flush) (NgfConnection *connection);
+    int                 (*has_output) (NgfConnection *connection);
+
+    /* Wait up to timeout_ms for I/O and dispatch what arrived, for those
+       who block without a main loop. Returns 0 once disconnected. */
+    int                 (*iterate) (NgfConnection *connection, int timeout_ms);
+
+    /* Main loop integration, see loop_p.h. attached tells whether anyone
+       still drives the connection through a loop. */
+    NgfLoop*            (*loop_acquire) (NgfConnection *connection);
+    void                (*loop_release) (NgfLoop *loop);
+    int                 (*loop_attached) (NgfConnection *connection);
+    int                 (*loop_get_fd) (NgfLoop *loop, int *events);
+    int                 (*loop_get_timeout) (NgfLoop *loop);
+    int                 (*loop_dispatch) (NgfLoop *loop);
+
+    /* Status delivery and backend presence, see dispatcher_p.h. */
+    NgfDispatcher*      (*dispatcher_acquire) (NgfConnection *connection);
+    void                (*dispatcher_release) (NgfDispatcher *dispatcher, uint32_t linger_ms);
+    void                (*add_match) (NgfDispatcher *dispatcher, const char *name);
+    void                (*remove_match) (NgfDispatcher *dispatcher, const char *name, uint32_t linger_ms);
+    int                 (*add_event) (NgfDispatcher *dispatcher, uint32_t server_event_id, const char *sender,
+                                      NgfStatusFunc func, void *target);
+    void                (*remove_event) (NgfDispatcher *dispatcher, uint32_t server_event_id, void *target);
+    int                 (*watch_owner) (NgfDispatcher *dispatcher, const char *name, NgfOwnerFunc func, void *target);
+    void                (*unwatch_owner) (NgfDispatcher *dispatcher, const char *name, void *target);
+    NgfOwnerState       (*get_owner_state) (NgfDispatcher *dispatcher, const char *name);
+
+    /* A NULL service is the default backend, NGF_DBUS_NAME. */
+    NgfTransportPlay*   (*new_play) (const char *event, NgfProplist *proplist, int unicast);
+    NgfTransportPlay*   (*ref_play) (NgfTransportPlay *play);
+    void                (*unref_play) (NgfTransportPlay *play);
+
+    /* Plays are sent once, to the service chosen at that point. Returns
+       NULL if the call could not be made. */
+    NgfTransportCall*   (*send_play) (NgfConnection *connection, NgfTransportPlay *play, const char *service,
+                                      int timeout_ms, NgfReplyFunc func, void *userdata);
+
+    /* Events are stopped (pause < 0), paused or resumed one at a time
+       without a reply, or in bulk with one. */
+    void                (*send_control) (NgfConnection *connection, const char *service,
+                                         uint32_t server_event_id, int pause);
+    NgfTransportCall*   (*send_control_bulk) (NgfConnection *connection, const char *service,
+                                              const uint32_t *server_event_ids, uint32_t num_ids, int pause,
+                                              int timeout_ms, NgfReplyFunc func, void *userdata);
+
+    /* Round trip to the bus behind everything sent before it. */
+    NgfTransportCall*   (*ping) (NgfConnection *connection, int timeout_ms, NgfReplyFunc func, void *userdata);
+
+    /* Drops the call, its function is not called. */
+    void                (*cancel) (NgfTransportCall *call);
+} NgfTransportOps;
+
+/** NULL if the transport is not supported. */
+const NgfTransportOps*  ngf_transport_lookup (NgfTransport transport);
+
+extern const NgfTransportOps ngf_transport_dbus;
+
+#ifdef HAVE_SDBUS
+extern const NgfTransportOps ngf_transport_sdbus;
+#endif
+
+#endif /* NGF_TRANSPORT_H */
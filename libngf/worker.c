@@ -0,0 +1,400 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "worker_p.h"
+
+/* Pause in microseconds before going through the loop again after poll
+   failed. */
+#define NGF_WORKER_RETRY_INTERVAL   10000
+
+/* Worker of the I/O thread running, NULL on any other thread. */
+static __thread NgfWorker *current_worker = NULL;
+
+struct _NgfWorker
+{
+    const NgfTransportOps *transport;
+    NgfConnection   *connection;
+    NgfLoop         *loop;
+    char            *address;
+    NgfWorkerConnectFunc connected;
+    NgfWorkerFunc   func;
+    NgfWorkerTickFunc tick;
+    NgfWorkerDoneFunc done;         /* set once detached */
+    void            *userdata;
+
+    pthread_t       thread;
+    int             event_fd;
+    int             timer_fd;       /* created on first ngf_worker_arm */
+    int             wake_pending;
+    int             quit;
+
+    /* Vyukov style intrusive MPSC queue: producers swap themselves into
+       head, the I/O thread consumes from tail. */
+    NgfWorkerNode   *head;
+    NgfWorkerNode   *tail;
+    NgfWorkerNode   stub;
+};
+
+static void
+_worker_push (NgfWorker *worker,
+              NgfWorkerNode *node)
+{
+    NgfWorkerNode *prev = NULL;
+
+    __atomic_store_n (&node->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n (&worker->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n (&prev->next, node, __ATOMIC_RELEASE);
+}
+
+/* Returns NULL when empty, or when a producer is between the exchange and
+   linking its node. That producer wakes the thread again right after. */
+
+static NgfWorkerNode*
+_worker_pop (NgfWorker *worker)
+{
+    NgfWorkerNode *tail = worker->tail;
+    NgfWorkerNode *next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &worker->stub) {
+        if (next == NULL)
+            return NULL;
+
+        worker->tail = next;
+        tail = next;
+        next = __atomic_load_n (&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+        worker->tail = next;
+        return tail;
+    }
+
+    if (tail != __atomic_load_n (&worker->head, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    _worker_push (worker, &worker->stub);
+
+    next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        worker->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+static void
+_worker_wake (NgfWorker *worker)
+{
+    uint64_t value = 1;
+
+    /* Only the first submission after the thread went to sleep pays
+       for the syscall. */
+
+    if (__atomic_exchange_n (&worker->wake_pending, 1, __ATOMIC_SEQ_CST))
+        return;
+
+    while (write (worker->event_fd, &value, sizeof (value)) < 0 && errno == EINTR)
+        ;
+}
+
+static void
+_worker_drain (NgfWorker *worker)
+{
+    NgfWorkerNode *node = NULL;
+
+    while ((node = _worker_pop (worker)) != NULL)
+        worker->func (node, worker->userdata);
+}
+
+static void
+_worker_connect (NgfWorker *worker)
+{
+    const NgfTransportOps *transport = worker->transport;
+    NgfConnection *connection = NULL;
+
+    if ((connection = transport->open (worker->address)) != NULL &&
+        (worker->loop = transport->loop_acquire (connection)) == NULL)
+    {
+        transport->close (connection);
+        transport->unref (connection);
+        connection = NULL;
+    }
+
+    worker->connection = connection;
+    worker->connected (connection, worker->userdata);
+}
+
+static void _worker_free (NgfWorker *worker);
+
+static void*
+_worker_thread (void *userdata)
+{
+    NgfWorker *worker = (NgfWorker*) userdata;
+    NgfWorkerDoneFunc done = NULL;
+    struct pollfd fds[3];
+    int connected = 1, events = 0, timeout = -1, tick_timeout = -1;
+    uint64_t value = 0;
+
+    current_worker = worker;
+
+    /* Nothing submitted is drained before this, so it all goes out on
+       the new connection. */
+
+    if (worker->connected) {
+        _worker_connect (worker);
+        connected = worker->loop != NULL;
+    }
+
+    while (1) {
+        memset (fds, 0, sizeof (fds));
+        fds[0].fd = worker->event_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = -1;
+        fds[2].fd = worker->timer_fd;
+        fds[2].events = POLLIN;
+        timeout = -1;
+
+        if (connected) {
+            fds[1].fd = worker->transport->loop_get_fd (worker->loop, &events);
+            fds[1].events = events;
+            timeout = worker->transport->loop_get_timeout (worker->loop);
+        }
+
+        if (tick_timeout >= 0 && (timeout < 0 || tick_timeout < timeout))
+            timeout = tick_timeout;
+
+        /* Should poll itself fail, nothing is known to be ready, but the
+           loop still goes through submissions, the connection and the
+           timers at a slow pace rather than leaving them to pile up. */
+
+        if (poll (fds, 3, timeout) < 0 && errno != EINTR)
+            usleep (NGF_WORKER_RETRY_INTERVAL);
+
+        /* Timed work goes first, before whatever else woke us up. */
+        if ((fds[2].revents & POLLIN) && read (worker->timer_fd, &value, sizeof (value)) > 0 && worker->tick)
+            worker->tick (worker->userdata);
+
+        if (fds[0].revents & POLLIN) {
+            if (read (worker->event_fd, &value, sizeof (value)) < 0)
+                value = 0;
+
+            /* Clear before draining so that anything submitted from
+               here on wakes us up again. */
+            __atomic_store_n (&worker->wake_pending, 0, __ATOMIC_SEQ_CST);
+        }
+
+        _worker_drain (worker);
+
+        if (connected)
+            connected = worker->transport->loop_dispatch (worker->loop);
+
+        tick_timeout = worker->tick ? worker->tick (worker->userdata) : -1;
+
+        if (__atomic_load_n (&worker->quit, __ATOMIC_ACQUIRE)) {
+            _worker_drain (worker);
+
+            /* Whatever that queued goes out before the thread is gone. */
+            if (connected)
+                worker->transport->flush (worker->connection);
+            break;
+        }
+    }
+
+    worker->transport->loop_release (worker->loop);
+    worker->loop = NULL;
+
+    /* Nobody joins a detached thread, it cleans up after itself. */
+    if ((done = worker->done) != NULL) {
+        userdata = worker->userdata;
+        _worker_free (worker);
+        done (userdata);
+    }
+
+    return NULL;
+}
+
+static NgfWorker*
+_worker_new (const NgfTransportOps *transport,
+             NgfWorkerFunc func,
+             NgfWorkerTickFunc tick,
+             void *userdata)
+{
+    NgfWorker *worker = NULL;
+
+    if ((worker = (NgfWorker*) calloc (1, sizeof (NgfWorker))) == NULL)
+        return NULL;
+
+    worker->transport = transport;
+    worker->func = func;
+    worker->tick = tick;
+    worker->userdata = userdata;
+    worker->head = &worker->stub;
+    worker->tail = &worker->stub;
+    worker->timer_fd = -1;
+
+    if ((worker->event_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        free (worker);
+        return NULL;
+    }
+
+    return worker;
+}
+
+static void
+_worker_free (NgfWorker *worker)
+{
+    close (worker->event_fd);
+    if (worker->timer_fd >= 0)
+        close (worker->timer_fd);
+    free (worker->address);
+    free (worker);
+}
+
+NgfWorker*
+ngf_worker_start (const NgfTransportOps *transport,
+                  NgfConnection *connection,
+                  NgfWorkerFunc func,
+                  NgfWorkerTickFunc tick,
+                  void *userdata)
+{
+    NgfWorker *worker = NULL;
+
+    if ((worker = _worker_new (transport, func, tick, userdata)) == NULL)
+        return NULL;
+
+    worker->connection = connection;
+
+    if ((worker->loop = transport->loop_acquire (connection)) == NULL)
+        goto failed;
+
+    if (pthread_create (&worker->thread, NULL, _worker_thread, worker) != 0)
+        goto failed;
+
+    return worker;
+
+failed:
+    if (worker->loop)
+        transport->loop_release (worker->loop);
+
+    _worker_free (worker);
+    return NULL;
+}
+
+NgfWorker*
+ngf_worker_start_async (const NgfTransportOps *transport,
+                        const char *address,
+                        NgfWorkerConnectFunc connected,
+                        NgfWorkerFunc func,
+                        NgfWorkerTickFunc tick,
+                        void *userdata)
+{
+    NgfWorker *worker = NULL;
+
+    if ((worker = _worker_new (transport, func, tick, userdata)) == NULL)
+        return NULL;
+
+    worker->connected = connected;
+
+    if (address && (worker->address = strdup (address)) == NULL)
+        goto failed;
+
+    if (pthread_create (&worker->thread, NULL, _worker_thread, worker) != 0)
+        goto failed;
+
+    return worker;
+
+failed:
+    _worker_free (worker);
+    return NULL;
+}
+
+void
+ngf_worker_stop (NgfWorker *worker)
+{
+    uint64_t value = 1;
+
+    if (worker == NULL)
+        return;
+
+    __atomic_store_n (&worker->quit, 1, __ATOMIC_RELEASE);
+    while (write (worker->event_fd, &value, sizeof (value)) < 0 && errno == EINTR)
+        ;
+
+    pthread_join (worker->thread, NULL);
+
+    _worker_free (worker);
+}
+
+void
+ngf_worker_detach (NgfWorker *worker,
+                   NgfWorkerDoneFunc done)
+{
+    pthread_detach (pthread_self ());
+
+    worker->done = done;
+    __atomic_store_n (&worker->quit, 1, __ATOMIC_RELEASE);
+}
+
+int
+ngf_worker_is_current (NgfWorker *worker)
+{
+    return current_worker == worker;
+}
+
+void
+ngf_worker_submit (NgfWorker *worker,
+                   NgfWorkerNode *node)
+{
+    _worker_push (worker, node);
+    _worker_wake (worker);
+}
+
+void
+ngf_worker_arm (NgfWorker *worker,
+                int64_t deadline)
+{
+    struct itimerspec spec;
+
+    if (worker->timer_fd < 0) {
+        if (deadline == 0)
+            return;
+
+        if ((worker->timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) < 0)
+            return;
+    }
+
+    /* An all zero value disarms, a deadline already passed fires at once. */
+    memset (&spec, 0, sizeof (spec));
+    spec.it_value.tv_sec = deadline / 1000000;
+    spec.it_value.tv_nsec = (deadline % 1000000) * 1000;
+
+    timerfd_settime (worker->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
@@ -0,0 +1,92 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef NGF_WORKER_H
+#define NGF_WORKER_H
+
+#include <stdint.h>
+
+#include "transport_p.h"
+
+/**
+ * I/O thread owning a connection of a transport. Other threads hand work
+ * to it through a lock-free multi-producer single-consumer queue; the
+ * thread is woken through an eventfd, at most once per batch of
+ * submissions, and runs each submitted node through the worker function
+ * before driving the connection through the loop of its transport.
+ */
+typedef struct _NgfWorker NgfWorker;
+typedef struct _NgfWorkerNode NgfWorkerNode;
+
+/** Intrusive queue link, embed as the first member of submitted items. */
+struct _NgfWorkerNode
+{
+    NgfWorkerNode *next;
+};
+
+/** Called on the I/O thread for every submitted node, in submission
+    order per producer. Owns the node afterwards. */
+typedef void (*NgfWorkerFunc) (NgfWorkerNode *node, void *userdata);
+
+/** Called on the I/O thread after every dispatch for the owner's own
+    timers. Returns milliseconds until it wants to run again, -1 for none. */
+typedef int (*NgfWorkerTickFunc) (void *userdata);
+
+/** Called on the I/O thread once ngf_worker_start_async has connected,
+    before any submitted node runs. Owns the connection afterwards, NULL
+    if connecting failed. */
+typedef void (*NgfWorkerConnectFunc) (NgfConnection *connection, void *userdata);
+
+/** Called on the I/O thread as the last thing it does after
+    ngf_worker_detach, the worker is already freed. */
+typedef void (*NgfWorkerDoneFunc) (void *userdata);
+
+NgfWorker*      ngf_worker_start (const NgfTransportOps *transport, NgfConnection *connection,
+                                  NgfWorkerFunc func, NgfWorkerTickFunc tick, void *userdata);
+
+/** Like ngf_worker_start, but the thread opens a private connection of
+    the transport to address (system bus if NULL) itself. Nodes submitted
+    meanwhile wait in the queue, after a failure they run unconnected. */
+NgfWorker*      ngf_worker_start_async (const NgfTransportOps *transport, const char *address,
+                                        NgfWorkerConnectFunc connected, NgfWorkerFunc func,
+                                        NgfWorkerTickFunc tick, void *userdata);
+
+/** Run everything submitted so far, then stop and join the thread. */
+void            ngf_worker_stop (NgfWorker *worker);
+
+/** Stop without anybody joining the thread: it finishes the current
+    iteration, runs what was submitted meanwhile, releases the loop and
+    frees the worker, then calls done. Only from the I/O thread. */
+void            ngf_worker_detach (NgfWorker *worker, NgfWorkerDoneFunc done);
+
+/** Whether the caller is the I/O thread of worker. */
+int             ngf_worker_is_current (NgfWorker *worker);
+
+/** Queue a node for the I/O thread. Safe from any thread, never blocks. */
+void            ngf_worker_submit (NgfWorker *worker, NgfWorkerNode *node);
+
+/** Run the tick function as soon as the CLOCK_MONOTONIC time in
+    microseconds reaches deadline, ahead of draining and dispatching,
+    through a timerfd instead of the millisecond poll timeout. 0 disarms.
+    Only from the I/O thread. */
+void            ngf_worker_arm (NgfWorker *worker, int64_t deadline);
+
+#endif /* NGF_WORKER_H */
@@ -73,9 +73,12 @@ install -m 644 doc/html/* %{buildroot}/usr/share/doc/libngf-doc/html/
 
 %files devel
 %{_libdir}/libngf0.so
+%{_libdir}/libngf0-glib.so
 %dir %{_includedir}/%{name}-1.0
 %dir %{_includedir}/%{name}-1.0/%{name}
 %{_includedir}/%{name}-1.0/%{name}/ngf.h
 %{_includedir}/%{name}-1.0/%{name}/proplist.h
 %{_includedir}/%{name}-1.0/%{name}/client.h
+%{_includedir}/%{name}-1.0/%{name}/client-glib.h
 %{_libdir}/pkgconfig/libngf0.pc
+%{_libdir}/pkgconfig/libngf0-glib.pc
@@ -0,0 +1,418 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include "backend-stub.h"
+
+#define STUB_DBUS_NAME      "com.nokia.NonGraphicFeedback1.Backend"
+#define STUB_DBUS_PATH      "/com/nokia/NonGraphicFeedback1"
+#define STUB_DBUS_IFACE     "com.nokia.NonGraphicFeedback1"
+#define STUB_UNICAST_KEY    "dbus.status.unicast"
+
+#define STUB_STATE_FAILED       0
+#define STUB_STATE_COMPLETED    1
+#define STUB_STATE_PLAYING      2
+#define STUB_STATE_PAUSED       3
+
+typedef struct _StubEvent StubEvent;
+
+struct _StubEvent
+{
+	StubEvent *next;
+	uint32_t id;
+	char *sender;
+	int unicast;
+};
+
+struct _BackendStub
+{
+	DBusConnection *connection;
+	char *name;
+	StubEvent *events;
+	uint32_t next_id;
+	int auto_complete;
+	int silent;
+	int bulk;
+	int broadcast_only;
+	int status_calls;
+	uint32_t num_status_errors;
+	uint32_t num_plays;
+	uint32_t num_stops;
+	uint32_t num_pauses;
+};
+
+static void
+stub_send_status (BackendStub *stub, StubEvent *event, uint32_t state)
+{
+	DBusMessage *msg = NULL;
+
+	if (event->unicast && stub->status_calls)
+		msg = dbus_message_new_method_call (event->sender, STUB_DBUS_PATH, STUB_DBUS_IFACE, "Status");
+	else
+		msg = dbus_message_new_signal (STUB_DBUS_PATH, STUB_DBUS_IFACE, "Status");
+	if (event->unicast)
+		dbus_message_set_destination (msg, event->sender);
+
+	dbus_message_append_args (msg,
+		DBUS_TYPE_UINT32, &event->id,
+		DBUS_TYPE_UINT32, &state,
+		DBUS_TYPE_INVALID);
+
+	dbus_connection_send (stub->connection, msg, NULL);
+	dbus_message_unref (msg);
+}
+
+static StubEvent*
+stub_find_event (BackendStub *stub, uint32_t id)
+{
+	StubEvent *event = NULL;
+
+	for (event = stub->events; event; event = event->next) {
+		if (event->id == id)
+			return event;
+	}
+
+	return NULL;
+}
+
+static void
+stub_remove_event (BackendStub *stub, StubEvent *event)
+{
+	StubEvent **iter = NULL;
+
+	for (iter = &stub->events; *iter; iter = &(*iter)->next) {
+		if (*iter == event) {
+			*iter = event->next;
+			break;
+		}
+	}
+
+	free (event->sender);
+	free (event);
+}
+
+static int
+stub_wants_unicast (DBusMessageIter *iter)
+{
+	DBusMessageIter array, entry, variant;
+	const char *key = NULL;
+	dbus_bool_t value = FALSE;
+
+	if (dbus_message_iter_get_arg_type (iter) != DBUS_TYPE_ARRAY)
+		return 0;
+
+	dbus_message_iter_recurse (iter, &array);
+	while (dbus_message_iter_get_arg_type (&array) == DBUS_TYPE_DICT_ENTRY) {
+		dbus_message_iter_recurse (&array, &entry);
+		dbus_message_iter_get_basic (&entry, &key);
+		dbus_message_iter_next (&entry);
+		dbus_message_iter_recurse (&entry, &variant);
+
+		if (strcmp (key, STUB_UNICAST_KEY) == 0 &&
+		    dbus_message_iter_get_arg_type (&variant) == DBUS_TYPE_BOOLEAN) {
+			dbus_message_iter_get_basic (&variant, &value);
+			return value ? 1 : 0;
+		}
+
+		dbus_message_iter_next (&array);
+	}
+
+	return 0;
+}
+
+static void
+stub_handle_play (BackendStub *stub, DBusMessage *msg)
+{
+	DBusMessage *reply = NULL;
+	DBusMessageIter iter;
+	StubEvent *event = NULL;
+
+	stub->num_plays++;
+
+	if (stub->silent)
+		return;
+
+	event = (StubEvent*) calloc (1, sizeof (StubEvent));
+	event->id = ++stub->next_id;
+	event->sender = strdup (dbus_message_get_sender (msg));
+
+	dbus_message_iter_init (msg, &iter);
+	dbus_message_iter_next (&iter);
+	event->unicast = !stub->broadcast_only && stub_wants_unicast (&iter);
+
+	reply = dbus_message_new_method_return (msg);
+	dbus_message_append_args (reply, DBUS_TYPE_UINT32, &event->id, DBUS_TYPE_INVALID);
+	dbus_connection_send (stub->connection, reply, NULL);
+	dbus_message_unref (reply);
+
+	stub_send_status (stub, event, STUB_STATE_PLAYING);
+
+	if (stub->auto_complete) {
+		stub_send_status (stub, event, STUB_STATE_COMPLETED);
+		free (event->sender);
+		free (event);
+		return;
+	}
+
+	event->next = stub->events;
+	stub->events = event;
+}
+
+static void
+stub_handle_stop (BackendStub *stub, DBusMessage *msg)
+{
+	StubEvent *event = NULL;
+	uint32_t id = 0;
+
+	stub->num_stops++;
+
+	if (!dbus_message_get_args (msg, NULL, DBUS_TYPE_UINT32, &id, DBUS_TYPE_INVALID))
+		return;
+
+	if ((event = stub_find_event (stub, id)) == NULL)
+		return;
+
+	stub_send_status (stub, event, STUB_STATE_COMPLETED);
+	stub_remove_event (stub, event);
+}
+
+static void
+stub_handle_pause (BackendStub *stub, DBusMessage *msg)
+{
+	StubEvent *event = NULL;
+	uint32_t id = 0;
+	dbus_bool_t pause = FALSE;
+
+	stub->num_pauses++;
+
+	if (!dbus_message_get_args (msg, NULL, DBUS_TYPE_UINT32, &id,
+	                            DBUS_TYPE_BOOLEAN, &pause, DBUS_TYPE_INVALID))
+		return;
+
+	if ((event = stub_find_event (stub, id)) == NULL)
+		return;
+
+	stub_send_status (stub, event, pause ? STUB_STATE_PAUSED : STUB_STATE_PLAYING);
+}
+
+static void
+stub_handle_many (BackendStub *stub, DBusMessage *msg, int pause)
+{
+	DBusMessage *reply = NULL;
+	StubEvent *event = NULL;
+	uint32_t *ids = NULL;
+	dbus_bool_t paused = FALSE;
+	int num_ids = 0, i;
+
+	if (pause)
+		stub->num_pauses++;
+	else
+		stub->num_stops++;
+
+	if (pause && !dbus_message_get_args (msg, NULL,
+	                                     DBUS_TYPE_ARRAY, DBUS_TYPE_UINT32, &ids, &num_ids,
+	                                     DBUS_TYPE_BOOLEAN, &paused, DBUS_TYPE_INVALID))
+		return;
+
+	if (!pause && !dbus_message_get_args (msg, NULL,
+	                                      DBUS_TYPE_ARRAY, DBUS_TYPE_UINT32, &ids, &num_ids,
+	                                      DBUS_TYPE_INVALID))
+		return;
+
+	for (i = 0; i < num_ids; i++) {
+		if ((event = stub_find_event (stub, ids[i])) == NULL)
+			continue;
+
+		if (pause) {
+			stub_send_status (stub, event, paused ? STUB_STATE_PAUSED : STUB_STATE_PLAYING);
+		} else {
+			stub_send_status (stub, event, STUB_STATE_COMPLETED);
+			stub_remove_event (stub, event);
+		}
+	}
+
+	reply = dbus_message_new_method_return (msg);
+	dbus_connection_send (stub->connection, reply, NULL);
+	dbus_message_unref (reply);
+}
+
+static DBusHandlerResult
+stub_filter_cb (DBusConnection *connection, DBusMessage *msg, void *userdata)
+{
+	BackendStub *stub = (BackendStub*) userdata;
+
+	(void) connection;
+
+	if (dbus_message_get_type (msg) == DBUS_MESSAGE_TYPE_ERROR) {
+		stub->num_status_errors += stub->status_calls ? 1 : 0;
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	}
+
+	if (dbus_message_is_method_call (msg, STUB_DBUS_IFACE, "Play"))
+		stub_handle_play (stub, msg);
+	else if (dbus_message_is_method_call (msg, STUB_DBUS_IFACE, "Stop"))
+		stub_handle_stop (stub, msg);
+	else if (dbus_message_is_method_call (msg, STUB_DBUS_IFACE, "Pause"))
+		stub_handle_pause (stub, msg);
+	else if (stub->bulk && dbus_message_is_method_call (msg, STUB_DBUS_IFACE, "StopMany"))
+		stub_handle_many (stub, msg, 0);
+	else if (stub->bulk && dbus_message_is_method_call (msg, STUB_DBUS_IFACE, "PauseMany"))
+		stub_handle_many (stub, msg, 1);
+	else
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+BackendStub*
+backend_stub_new (DBusConnection *connection)
+{
+	return backend_stub_new_named (connection, STUB_DBUS_NAME);
+}
+
+BackendStub*
+backend_stub_new_named (DBusConnection *connection, const char *name)
+{
+	BackendStub *stub = NULL;
+
+	if (dbus_bus_request_name (connection, name,
+	                           DBUS_NAME_FLAG_DO_NOT_QUEUE, NULL) != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER)
+		return NULL;
+
+	stub = (BackendStub*) calloc (1, sizeof (BackendStub));
+	stub->connection = dbus_connection_ref (connection);
+	stub->name = strdup (name);
+	dbus_connection_add_filter (connection, stub_filter_cb, stub, NULL);
+
+	return stub;
+}
+
+void
+backend_stub_free (BackendStub *stub)
+{
+	if (stub == NULL)
+		return;
+
+	while (stub->events)
+		stub_remove_event (stub, stub->events);
+
+	dbus_connection_remove_filter (stub->connection, stub_filter_cb, stub);
+	dbus_bus_release_name (stub->connection, stub->name, NULL);
+	dbus_connection_unref (stub->connection);
+	free (stub->name);
+	free (stub);
+}
+
+void
+backend_stub_set_auto_complete (BackendStub *stub, int auto_complete)
+{
+	stub->auto_complete = auto_complete;
+}
+
+void
+backend_stub_set_silent (BackendStub *stub, int silent)
+{
+	stub->silent = silent;
+}
+
+void
+backend_stub_set_bulk (BackendStub *stub, int bulk)
+{
+	stub->bulk = bulk;
+}
+
+void
+backend_stub_set_broadcast_only (BackendStub *stub, int broadcast_only)
+{
+	stub->broadcast_only = broadcast_only;
+}
+
+void
+backend_stub_set_status_calls (BackendStub *stub, int status_calls)
+{
+	stub->status_calls = status_calls;
+}
+
+uint32_t
+backend_stub_num_status_errors (BackendStub *stub)
+{
+	return stub->num_status_errors;
+}
+
+uint32_t
+backend_stub_num_plays (BackendStub *stub)
+{
+	return stub->num_plays;
+}
+
+uint32_t
+backend_stub_num_stops (BackendStub *stub)
+{
+	return stub->num_stops;
+}
+
+uint32_t
+backend_stub_num_pauses (BackendStub *stub)
+{
+	return stub->num_pauses;
+}
+
+int
+backend_stub_iterate (DBusConnection **connections, int num_connections, int timeout_ms)
+{
+	struct pollfd *fds = NULL;
+	int dispatched = 0;
+	int fd = -1;
+	int i;
+
+	fds = (struct pollfd*) calloc (num_connections, sizeof (struct pollfd));
+
+	for (i = 0; i < num_connections; i++) {
+		dbus_connection_flush (connections[i]);
+		fds[i].fd = dbus_connection_get_unix_fd (connections[i], &fd) ? fd : -1;
+		fds[i].events = POLLIN;
+
+		if (dbus_connection_get_dispatch_status (connections[i]) == DBUS_DISPATCH_DATA_REMAINS)
+			timeout_ms = 0;
+	}
+
+	poll (fds, num_connections, timeout_ms);
+
+	for (i = 0; i < num_connections; i++) {
+		dbus_connection_read_write (connections[i], 0);
+		while (dbus_connection_get_dispatch_status (connections[i]) == DBUS_DISPATCH_DATA_REMAINS) {
+			dbus_connection_dispatch (connections[i]);
+			dispatched++;
+		}
+	}
+
+	free (fds);
+	return dispatched;
+}
+
+void
+backend_stub_pump (DBusConnection **connections, int num_connections, int idle_ms)
+{
+	while (backend_stub_iterate (connections, num_connections, idle_ms) > 0)
+		;
+}
@@ -0,0 +1,74 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NGF_BACKEND_STUB_H
+#define NGF_BACKEND_STUB_H
+
+#include <stdint.h>
+#include <dbus/dbus.h>
+
+/*
+ * Minimal in-process stand-in for ngfd, used by tests and benchmarks that
+ * need a backend on a private or session bus. Play is answered with a new
+ * id followed by a PLAYING status, Stop and Pause emit the matching status.
+ * Status is broadcast unless the play asked for unicast status.
+ */
+
+typedef struct _BackendStub BackendStub;
+
+BackendStub*    backend_stub_new (DBusConnection *connection);
+
+/* Same, under another bus name, for routing to several backends. */
+BackendStub*    backend_stub_new_named (DBusConnection *connection, const char *name);
+void            backend_stub_free (BackendStub *stub);
+
+/* Complete every event right after it starts playing. */
+void            backend_stub_set_auto_complete (BackendStub *stub, int auto_complete);
+
+/* Swallow plays without ever replying, like a hung backend. */
+void            backend_stub_set_silent (BackendStub *stub, int silent);
+
+/* Handle StopMany and PauseMany, otherwise they are unknown methods like
+   in older backends. */
+void            backend_stub_set_bulk (BackendStub *stub, int bulk);
+
+/* Broadcast every status, ignoring the unicast status property like
+   backends predating it. */
+void            backend_stub_set_broadcast_only (BackendStub *stub, int broadcast_only);
+
+/* Send unicast status as method calls expecting a reply, as some
+   backends do, and count the error replies they get back. */
+void            backend_stub_set_status_calls (BackendStub *stub, int status_calls);
+uint32_t        backend_stub_num_status_errors (BackendStub *stub);
+
+/* Number of Play, Stop and Pause calls received so far, StopMany and
+   PauseMany count as one call each. */
+uint32_t        backend_stub_num_plays (BackendStub *stub);
+uint32_t        backend_stub_num_stops (BackendStub *stub);
+uint32_t        backend_stub_num_pauses (BackendStub *stub);
+
+/* Wait up to timeout_ms for traffic on any of the connections and dispatch
+   it. Returns the number of messages dispatched. */
+int             backend_stub_iterate (DBusConnection **connections, int num_connections, int timeout_ms);
+
+/* Dispatch all connections until the bus has been idle for idle_ms. */
+void            backend_stub_pump (DBusConnection **connections, int num_connections, int idle_ms);
+
+#endif /* NGF_BACKEND_STUB_H */
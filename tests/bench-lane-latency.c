@@ -0,0 +1,202 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+/*
+ * Measures key-click latency while bulk events with large proplists are
+ * being sent by the same client. The click is played right after a burst
+ * of bulk plays and timed until its PLAYING state arrives, either on the
+ * shared connection (behind the burst) or on a lane of its own. Run
+ * inside a throwaway bus:
+ *
+ *   dbus-run-session -- ./bench-lane-latency [rounds] [bulk] [bulk_kb]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <dbus/dbus.h>
+
+#include <libngf/client.h>
+#include "backend-stub.h"
+
+static uint32_t click_id = 0;
+static int click_playing = 0;
+static int completed = 0;
+
+static double
+now_ms (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+	double x = *(const double*) a, y = *(const double*) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+state_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	(void) client;
+	(void) userdata;
+
+	if (id == click_id && state == NGF_EVENT_PLAYING)
+		click_playing = 1;
+
+	if (state == NGF_EVENT_COMPLETED || state == NGF_EVENT_FAILED)
+		completed++;
+}
+
+/* The client side is driven without blocking, so queued messages are only
+   written as fast as the bus takes them, like from an application's main
+   loop. */
+
+static void
+iterate (NgfClient *client, int num_lanes, DBusConnection *backend)
+{
+	struct pollfd fds[3];
+	int events = 0, fd = -1, i;
+
+	memset (fds, 0, sizeof (fds));
+	for (i = 0; i < num_lanes; i++) {
+		fds[i].fd = ngf_client_get_lane_fd (client, i, &events);
+		fds[i].events = events;
+	}
+
+	fds[num_lanes].fd = dbus_connection_get_unix_fd (backend, &fd) ? fd : -1;
+	fds[num_lanes].events = POLLIN;
+
+	poll (fds, num_lanes + 1, 10);
+
+	ngf_client_dispatch (client);
+	backend_stub_iterate (&backend, 1, 0);
+}
+
+static void
+run (DBusConnection **connections, int lanes, int rounds, int num_bulk, NgfProplist *bulk)
+{
+	NgfClient *client = NULL;
+	double *latency = NULL, total = 0.0, start = 0.0;
+	int i, j;
+
+	latency = (double*) calloc (rounds, sizeof (double));
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, state_cb, NULL);
+	ngf_client_set_unicast_status (client, 1);
+
+	if (lanes) {
+		ngf_client_add_lane (client, NGF_TRANSPORT_DBUS, connections[2]);
+		ngf_client_add_lane_rule (client, "click", 1);
+	}
+
+	for (i = 0; i < rounds; i++) {
+		completed = 0;
+		click_playing = 0;
+
+		for (j = 0; j < num_bulk; j++)
+			ngf_client_play_event (client, "ringtone", bulk);
+
+		start = now_ms ();
+		click_id = ngf_client_play_event (client, "click", NULL);
+
+		while (!click_playing)
+			iterate (client, lanes + 1, connections[0]);
+
+		latency[i] = now_ms () - start;
+		total += latency[i];
+
+		/* Drain the burst before the next round. */
+		while (completed < num_bulk + 1)
+			iterate (client, lanes + 1, connections[0]);
+	}
+
+	qsort (latency, rounds, sizeof (double), compare_double);
+
+	printf ("%-7s rounds=%d bulk=%d  click latency: mean=%.2f p50=%.2f p90=%.2f max=%.2f ms\n",
+		lanes ? "lanes" : "shared", rounds, num_bulk,
+		total / rounds,
+		latency[rounds / 2],
+		latency[(rounds * 9) / 10],
+		latency[rounds - 1]);
+
+	ngf_client_destroy (client);
+	free (latency);
+}
+
+int
+main (int argc, char *argv[])
+{
+	DBusConnection *connections[3];
+	BackendStub *stub = NULL;
+	NgfProplist *bulk = NULL;
+	char *payload = NULL;
+	int rounds = argc > 1 ? atoi (argv[1]) : 20;
+	int num_bulk = argc > 2 ? atoi (argv[2]) : 50;
+	int bulk_kb = argc > 3 ? atoi (argv[3]) : 64;
+	int i;
+
+	if (rounds < 1 || num_bulk < 0 || bulk_kb < 1)
+		return EXIT_FAILURE;
+
+	/* Backend, client connection and the click lane. */
+	for (i = 0; i < 3; i++) {
+		if ((connections[i] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL)) == NULL) {
+			fprintf (stderr, "no session bus, run under dbus-run-session\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((stub = backend_stub_new (connections[0])) == NULL) {
+		fprintf (stderr, "failed to acquire backend name\n");
+		return EXIT_FAILURE;
+	}
+	backend_stub_set_auto_complete (stub, 1);
+
+	payload = (char*) malloc (bulk_kb * 1024);
+	memset (payload, 'x', bulk_kb * 1024 - 1);
+	payload[bulk_kb * 1024 - 1] = '\0';
+
+	bulk = ngf_proplist_new ();
+	ngf_proplist_sets (bulk, "payload", payload);
+
+	run (connections, 0, rounds, num_bulk, bulk);
+	run (connections, 1, rounds, num_bulk, bulk);
+
+	ngf_proplist_free (bulk);
+	free (payload);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 3; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Measures how many client connections are woken up per played event.
+ * N clients connect to the session bus, one of them plays events against
+ * the backend stub, and every message delivered to any client connection
+ * is counted as a wakeup. Bystanders are either active (played recently,
+ * so still subscribed) or idle. Run inside a throwaway bus:
+ *
+ *   dbus-run-session -- ./bench-status-wakeups [clients] [events]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <dbus/dbus.h>
+
+#include <libngf/client.h>
+#include "backend-stub.h"
+
+typedef struct _BenchClient
+{
+	DBusConnection *connection;
+	NgfClient *client;
+	uint32_t wakeups;
+} BenchClient;
+
+static int completed = 0;
+
+static DBusHandlerResult
+count_filter_cb (DBusConnection *connection, DBusMessage *msg, void *userdata)
+{
+	BenchClient *c = (BenchClient*) userdata;
+
+	(void) connection;
+	(void) msg;
+
+	c->wakeups++;
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+state_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	(void) client;
+	(void) id;
+	(void) userdata;
+
+	if (state == NGF_EVENT_COMPLETED || state == NGF_EVENT_FAILED)
+		completed++;
+}
+
+static void
+run (BenchClient *clients, DBusConnection **connections, int num_clients,
+     int num_events, int unicast, int subscribed)
+{
+	uint32_t player = 0, bystanders = 0;
+	int i;
+
+	for (i = 0; i < num_clients; i++) {
+		ngf_client_set_unicast_status (clients[i].client, unicast);
+		ngf_client_set_idle_timeout (clients[i].client, subscribed ? 60000 : 0);
+	}
+
+	/* Bystanders that played recently keep their status subscription. */
+	completed = 0;
+	for (i = 1; subscribed && i < num_clients; i++) {
+		ngf_client_play_event (clients[i].client, "bench", NULL);
+		while (completed < i)
+			backend_stub_iterate (connections, num_clients + 1, 100);
+	}
+
+	backend_stub_pump (connections, num_clients + 1, 50);
+	for (i = 0; i < num_clients; i++)
+		clients[i].wakeups = 0;
+
+	completed = 0;
+	for (i = 0; i < num_events; i++) {
+		ngf_client_play_event (clients[0].client, "bench", NULL);
+		while (completed <= i)
+			backend_stub_iterate (connections, num_clients + 1, 100);
+	}
+
+	backend_stub_pump (connections, num_clients + 1, 50);
+
+	player = clients[0].wakeups;
+	for (i = 1; i < num_clients; i++)
+		bystanders += clients[i].wakeups;
+
+	printf ("%-10s %-6s clients=%d events=%d  player=%.2f  bystanders=%.2f  total=%.2f wakeups/event\n",
+		unicast ? "unicast" : "broadcast", subscribed ? "active" : "idle",
+		num_clients, num_events,
+		(double) player / num_events,
+		(double) bystanders / num_events,
+		(double) (player + bystanders) / num_events);
+}
+
+int
+main (int argc, char *argv[])
+{
+	BenchClient *clients = NULL;
+	DBusConnection **connections = NULL;
+	BackendStub *stub = NULL;
+	int num_clients = argc > 1 ? atoi (argv[1]) : 30;
+	int num_events = argc > 2 ? atoi (argv[2]) : 100;
+	int i;
+
+	if (num_clients < 1 || num_events < 1)
+		return EXIT_FAILURE;
+
+	clients = (BenchClient*) calloc (num_clients, sizeof (BenchClient));
+	connections = (DBusConnection**) calloc (num_clients + 1, sizeof (DBusConnection*));
+
+	/* Last connection is the backend. */
+	connections[num_clients] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	if (connections[num_clients] == NULL) {
+		fprintf (stderr, "no session bus, run under dbus-run-session\n");
+		return EXIT_FAILURE;
+	}
+
+	if ((stub = backend_stub_new (connections[num_clients])) == NULL) {
+		fprintf (stderr, "failed to acquire backend name\n");
+		return EXIT_FAILURE;
+	}
+	backend_stub_set_auto_complete (stub, 1);
+
+	for (i = 0; i < num_clients; i++) {
+		clients[i].connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+		connections[i] = clients[i].connection;
+		dbus_connection_add_filter (clients[i].connection, count_filter_cb, &clients[i], NULL);
+		clients[i].client = ngf_client_create (NGF_TRANSPORT_DBUS, clients[i].connection);
+		ngf_client_set_callback (clients[i].client, state_cb, NULL);
+	}
+
+	/* Idle first, before any bystander has subscribed. */
+	run (clients, connections, num_clients, num_events, 0, 0);
+	run (clients, connections, num_clients, num_events, 0, 1);
+	run (clients, connections, num_clients, num_events, 1, 1);
+
+	for (i = 0; i < num_clients; i++) {
+		ngf_client_destroy (clients[i].client);
+		dbus_connection_close (clients[i].connection);
+		dbus_connection_unref (clients[i].connection);
+	}
+
+	backend_stub_free (stub);
+	dbus_connection_close (connections[num_clients]);
+	dbus_connection_unref (connections[num_clients]);
+
+	free (connections);
+	free (clients);
+
+	return EXIT_SUCCESS;
+}
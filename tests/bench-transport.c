@@ -0,0 +1,321 @@
+/*
+ * libngf - Non-graphical feedback library
+ *
+ * Copyright (C) 2010 Nokia Corporation. All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Measures plays per second, messages per second and client CPU time per
+ * play for every transport libngf can be created with. The backend stub
+ * runs in a child process on its own connection, so the CPU time of the
+ * benchmark process is the client's alone. Plays are made one at a time,
+ * each waiting for the previous one to complete, and then in a pipeline
+ * with up to depth plays in flight. Each transport gets a connection of
+ * its own, sd-bus when libngf was configured with --enable-sdbus. Run
+ * inside a throwaway bus:
+ *
+ *   dbus-run-session -- ./bench-transport [plays] [depth]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <dbus/dbus.h>
+#ifdef HAVE_SDBUS
+#include <systemd/sd-bus.h>
+#endif
+
+#include <libngf/client.h>
+#include "backend-stub.h"
+
+/* Opens a connection to the session bus counting the messages it
+   receives, the one clients of the transport are created with. */
+typedef struct _BenchTransport
+{
+	NgfTransport transport;
+	const char *name;
+	void* (*open) (void);
+	void (*close) (void *connection);
+} BenchTransport;
+
+static void* dbus_open (void);
+static void dbus_close (void *connection);
+#ifdef HAVE_SDBUS
+static void* sdbus_open (void);
+static void sdbus_close (void *connection);
+#endif
+
+static const BenchTransport transports[] = {
+	{ NGF_TRANSPORT_DBUS, "dbus", dbus_open, dbus_close },
+#ifdef HAVE_SDBUS
+	{ NGF_TRANSPORT_SDBUS, "sdbus", sdbus_open, sdbus_close },
+#endif
+};
+
+static volatile sig_atomic_t quit = 0;
+static uint32_t messages = 0;
+static int completed = 0;
+
+static void
+quit_cb (int signum)
+{
+	(void) signum;
+	quit = 1;
+}
+
+static double
+now_s (clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime (clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static DBusHandlerResult
+count_filter_cb (DBusConnection *connection, DBusMessage *msg, void *userdata)
+{
+	(void) connection;
+	(void) msg;
+	(void) userdata;
+
+	messages++;
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void*
+dbus_open (void)
+{
+	DBusConnection *connection = NULL;
+
+	if ((connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL)) == NULL)
+		return NULL;
+
+	dbus_connection_add_filter (connection, count_filter_cb, NULL, NULL);
+	return connection;
+}
+
+static void
+dbus_close (void *connection)
+{
+	dbus_connection_close ((DBusConnection*) connection);
+	dbus_connection_unref ((DBusConnection*) connection);
+}
+
+#ifdef HAVE_SDBUS
+static int
+sdbus_count_filter_cb (sd_bus_message *msg, void *userdata, sd_bus_error *error)
+{
+	uint8_t type = 0;
+
+	(void) userdata;
+	(void) error;
+
+	/* libdbus hands replies to their call before any filter sees them,
+	   leave them out here too so both count the same. */
+	if (sd_bus_message_get_type (msg, &type) >= 0 &&
+	    (type == SD_BUS_MESSAGE_METHOD_RETURN || type == SD_BUS_MESSAGE_METHOD_ERROR))
+		return 0;
+
+	messages++;
+	return 0;
+}
+
+static void*
+sdbus_open (void)
+{
+	sd_bus *bus = NULL;
+
+	if (sd_bus_new (&bus) < 0)
+		return NULL;
+
+	if (sd_bus_set_address (bus, getenv ("DBUS_SESSION_BUS_ADDRESS")) < 0 ||
+	    sd_bus_set_bus_client (bus, 1) < 0 ||
+	    sd_bus_start (bus) < 0 ||
+	    sd_bus_add_filter (bus, NULL, sdbus_count_filter_cb, NULL) < 0) {
+		sd_bus_unref (bus);
+		return NULL;
+	}
+
+	return bus;
+}
+
+static void
+sdbus_close (void *connection)
+{
+	sd_bus_flush_close_unref ((sd_bus*) connection);
+}
+#endif
+
+static void
+state_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	(void) client;
+	(void) id;
+	(void) userdata;
+
+	if (state == NGF_EVENT_COMPLETED || state == NGF_EVENT_FAILED)
+		completed++;
+}
+
+/* Stand-in backend, acknowledges once it owns the name. */
+
+static int
+run_backend (int ack_fd)
+{
+	DBusConnection *connection = NULL;
+	BackendStub *stub = NULL;
+	char ok = 1;
+
+	signal (SIGTERM, quit_cb);
+
+	if ((connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL)) == NULL)
+		return EXIT_FAILURE;
+
+	if ((stub = backend_stub_new (connection)) == NULL)
+		return EXIT_FAILURE;
+	backend_stub_set_auto_complete (stub, 1);
+
+	if (write (ack_fd, &ok, 1) != 1)
+		return EXIT_FAILURE;
+	close (ack_fd);
+
+	while (!quit)
+		backend_stub_iterate (&connection, 1, 100);
+
+	backend_stub_free (stub);
+	dbus_connection_close (connection);
+	dbus_connection_unref (connection);
+
+	return EXIT_SUCCESS;
+}
+
+static void
+iterate (NgfClient *client)
+{
+	struct pollfd pfd;
+	int events = 0;
+
+	pfd.fd = ngf_client_get_fd (client, &events);
+	pfd.events = events;
+	poll (&pfd, 1, ngf_client_get_timeout (client));
+
+	ngf_client_dispatch (client);
+}
+
+static void
+run (NgfClient *client, const char *name, int num_plays, int depth)
+{
+	double wall = 0.0, cpu = 0.0;
+	int sent = 0;
+
+	messages = 0;
+	completed = 0;
+	wall = now_s (CLOCK_MONOTONIC);
+	cpu = now_s (CLOCK_PROCESS_CPUTIME_ID);
+
+	while (completed < num_plays) {
+		while (sent < num_plays && sent - completed < depth) {
+			ngf_client_play_event (client, "bench", NULL);
+			sent++;
+		}
+
+		iterate (client);
+	}
+
+	wall = now_s (CLOCK_MONOTONIC) - wall;
+	cpu = now_s (CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+	/* Every play is one message out, the rest came in. */
+	printf ("%-9s depth=%-3d plays=%d  %.0f plays/s  %.0f msgs/s  %.1f us cpu/play  %.1f msgs/play\n",
+		name, depth, num_plays,
+		num_plays / wall,
+		(messages + num_plays) / wall,
+		cpu * 1e6 / num_plays,
+		(double) (messages + num_plays) / num_plays);
+}
+
+int
+main (int argc, char *argv[])
+{
+	void *connection = NULL;
+	NgfClient *client = NULL;
+	int num_plays = argc > 1 ? atoi (argv[1]) : 2000;
+	int depth = argc > 2 ? atoi (argv[2]) : 32;
+	int ack[2], status = 0;
+	pid_t backend = 0;
+	char ok = 0;
+	size_t i;
+
+	if (num_plays < 1 || depth < 1)
+		return EXIT_FAILURE;
+
+	/* Before libdbus is used at all, it does not survive a fork. */
+	if (pipe (ack) < 0 || (backend = fork ()) < 0)
+		return EXIT_FAILURE;
+
+	if (backend == 0) {
+		close (ack[0]);
+		return run_backend (ack[1]);
+	}
+
+	close (ack[1]);
+	if (read (ack[0], &ok, 1) != 1) {
+		fprintf (stderr, "backend failed, run under dbus-run-session\n");
+		waitpid (backend, &status, 0);
+		return EXIT_FAILURE;
+	}
+	close (ack[0]);
+
+	for (i = 0; i < sizeof (transports) / sizeof (transports[0]); i++) {
+		if ((connection = transports[i].open ()) == NULL) {
+			printf ("%-9s no connection\n", transports[i].name);
+			continue;
+		}
+
+		if ((client = ngf_client_create (transports[i].transport, connection)) == NULL) {
+			printf ("%-9s not available\n", transports[i].name);
+			transports[i].close (connection);
+			continue;
+		}
+
+		ngf_client_set_callback (client, state_cb, NULL);
+		ngf_client_set_unicast_status (client, 1);
+
+		/* Warm up, the first play subscribes to status signals. */
+		completed = 0;
+		ngf_client_play_event (client, "bench", NULL);
+		while (completed < 1)
+			iterate (client);
+
+		run (client, transports[i].name, num_plays, 1);
+		run (client, transports[i].name, num_plays, depth);
+
+		ngf_client_destroy (client);
+		transports[i].close (connection);
+	}
+
+	kill (backend, SIGTERM);
+	waitpid (backend, &status, 0);
+
+	return EXIT_SUCCESS;
+}
@@ -19,12 +19,37 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <check.h>
 #include <glib.h>
 #include <dbus/dbus.h>
 #include <dbus/dbus-glib-lowlevel.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#ifdef HAVE_SDBUS
+#include <systemd/sd-bus.h>
+#endif
 
 #include <libngf/client.h>
+#include <libngf/client-glib.h>
+#include "backend-stub.h"
+
+static NgfEventState last_state = -1;
+static uint32_t last_state_id = 0;
+
+static void
+state_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	(void) client;
+	(void) userdata;
+
+	last_state_id = id;
+	last_state = state;
+}
 
 START_TEST (test_create_client)
 {
@@ -49,6 +74,11 @@ START_TEST (test_failed_create_client)
 	client = ngf_client_create (NGF_TRANSPORT_DBUS, connection);
 	fail_unless (client == NULL);
 
+	/* No transport behind it. */
+	connection = dbus_bus_get (DBUS_BUS_SYSTEM, NULL);
+	client = ngf_client_create (NGF_TRANSPORT_INTERNAL, connection);
+	fail_unless (client == NULL);
+	dbus_connection_unref (connection);
 }
 END_TEST
 
@@ -123,45 +153,2622 @@ START_TEST (test_callback)
 }
 END_TEST
 
+START_TEST (test_unicast_status)
+{
+	DBusConnection *connections[3];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	NgfClient *bystander = NULL;
+	uint32_t id = 0;
+	int i;
 
-int
-main (int argc, char *argv[])
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[2] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	fail_unless (connections[0] && connections[1] && connections[2]);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	bystander = ngf_client_create (NGF_TRANSPORT_DBUS, connections[2]);
+	fail_unless (client != NULL && bystander != NULL);
+
+	ngf_client_set_unicast_status (client, 1);
+	ngf_client_set_unicast_status (bystander, 1);
+	ngf_client_set_callback (client, state_cb, NULL);
+	ngf_client_set_callback (bystander, state_cb, NULL);
+	backend_stub_pump (connections, 3, 50);
+
+	last_state = -1;
+	id = ngf_client_play_event (client, "sms", NULL);
+	fail_unless (id != 0);
+
+	for (i = 0; i < 50 && last_state != NGF_EVENT_COMPLETED; i++)
+		backend_stub_iterate (connections, 3, 100);
+
+	fail_unless (last_state == NGF_EVENT_COMPLETED);
+	fail_unless (last_state_id == id);
+
+	/* The bystander connection must not have seen the status at all. */
+	fail_unless (backend_stub_iterate (&connections[2], 1, 50) == 0);
+
+	ngf_client_destroy (bystander);
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 3; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+START_TEST (test_unicast_status_call)
 {
-	(void) argc;
-	(void) argv;
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	uint32_t id = 0;
+	int i;
 
-	int num_failed = 0;
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	fail_unless (connections[0] && connections[1]);
 
-	Suite *s = NULL;
-	TCase *tc = NULL;
-	SRunner *sr = NULL;
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+	backend_stub_set_status_calls (stub, 1);
 
-	g_type_init ();
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	fail_unless (client != NULL);
 
-	s = suite_create ("Client interface");
+	ngf_client_set_unicast_status (client, 1);
+	ngf_client_set_callback (client, state_cb, NULL);
+	backend_stub_pump (connections, 2, 50);
 
-	tc = tcase_create ("Create client");
-	tcase_add_test (tc, test_create_client);
-	suite_add_tcase (s, tc);
+	last_state = -1;
+	id = ngf_client_play_event (client, "sms", NULL);
+	fail_unless (id != 0);
 
-	tc = tcase_create ("Failed creation of client");
-	tcase_add_test (tc, test_failed_create_client);
-	suite_add_tcase (s, tc);
+	for (i = 0; i < 50 && last_state != NGF_EVENT_COMPLETED; i++)
+		backend_stub_iterate (connections, 2, 100);
 
-	tc = tcase_create ("Play with NULL event");
-	tcase_add_test (tc, test_play_event_NULL);
-	suite_add_tcase (s, tc);
+	fail_unless (last_state == NGF_EVENT_COMPLETED);
+	fail_unless (last_state_id == id);
 
-	tc = tcase_create ("Play with NULL client");
-	tcase_add_test (tc, test_play_client_NULL);
-	suite_add_tcase (s, tc);
+	/* Status calls are answered, not bounced as unknown methods. */
+	backend_stub_pump (connections, 2, 50);
+	fail_unless (backend_stub_num_status_errors (stub) == 0);
 
-	tc = tcase_create ("Play sms");
-	tcase_add_test (tc, test_play);
-	suite_add_tcase (s, tc);
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
 
-	tc = tcase_create ("Callback");
-	tcase_add_test (tc, test_callback);
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+START_TEST (test_unicast_status_fallback)
+{
+	DBusConnection *connections[3], *others[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	NgfClient *bystander = NULL;
+	uint32_t id = 0;
+	int i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[2] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	fail_unless (connections[0] && connections[1] && connections[2]);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+	backend_stub_set_broadcast_only (stub, 1);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	bystander = ngf_client_create (NGF_TRANSPORT_DBUS, connections[2]);
+	fail_unless (client != NULL && bystander != NULL);
+
+	ngf_client_set_unicast_status (client, 1);
+	ngf_client_set_idle_timeout (client, 0);
+	ngf_client_set_callback (client, state_cb, NULL);
+	backend_stub_pump (connections, 3, 50);
+
+	/* A backend ignoring the property still gets its status through. */
+
+	last_state = -1;
+	id = ngf_client_play_event (client, "sms", NULL);
+	fail_unless (id != 0);
+
+	for (i = 0; i < 50 && last_state != NGF_EVENT_COMPLETED; i++)
+		backend_stub_iterate (connections, 3, 100);
+
+	fail_unless (last_state == NGF_EVENT_COMPLETED);
+	fail_unless (last_state_id == id);
+
+	/* Once the backend has addressed status to the client, the broadcast
+	   of other plays no longer reaches it. */
+
+	backend_stub_set_broadcast_only (stub, 0);
+
+	last_state = -1;
+	id = ngf_client_play_event (client, "sms", NULL);
+	for (i = 0; i < 50 && last_state != NGF_EVENT_COMPLETED; i++)
+		backend_stub_iterate (connections, 3, 100);
+
+	fail_unless (last_state == NGF_EVENT_COMPLETED);
+	fail_unless (last_state_id == id);
+
+	backend_stub_set_auto_complete (stub, 0);
+	last_state = -1;
+	id = ngf_client_play_event (client, "sms", NULL);
+	for (i = 0; i < 50 && last_state != NGF_EVENT_PLAYING; i++)
+		backend_stub_iterate (connections, 3, 100);
+
+	fail_unless (last_state == NGF_EVENT_PLAYING);
+	backend_stub_pump (connections, 3, 50);
+
+	fail_unless (ngf_client_play_event (bystander, "sms", NULL) != 0);
+	others[0] = connections[0];
+	others[1] = connections[2];
+	backend_stub_pump (others, 2, 100);
+	fail_unless (backend_stub_iterate (&connections[1], 1, 50) == 0);
+
+	ngf_client_stop_event (client, id);
+	backend_stub_pump (connections, 3, 50);
+
+	ngf_client_destroy (bystander);
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 3; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+typedef struct _SharedState
+{
+	uint32_t id;
+	int num_states;
+	int num_foreign;
+} SharedState;
+
+static void
+shared_state_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	SharedState *shared = (SharedState*) userdata;
+
+	(void) client;
+	(void) state;
+
+	if (id == shared->id)
+		shared->num_states++;
+	else
+		shared->num_foreign++;
+}
+
+START_TEST (test_shared_connection)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *first = NULL, *second = NULL;
+	SharedState first_state, second_state;
+	int i;
+
+	memset (&first_state, 0, sizeof (first_state));
+	memset (&second_state, 0, sizeof (second_state));
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	fail_unless (connections[0] && connections[1]);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	/* Both clients share one connection and thus one dispatcher. */
+	first = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	second = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	fail_unless (first != NULL && second != NULL);
+
+	ngf_client_set_callback (first, shared_state_cb, &first_state);
+	ngf_client_set_callback (second, shared_state_cb, &second_state);
+
+	first_state.id = ngf_client_play_event (first, "sms", NULL);
+	second_state.id = ngf_client_play_event (second, "sms", NULL);
+
+	for (i = 0; i < 50 && (first_state.num_states < 2 || second_state.num_states < 2); i++)
+		backend_stub_iterate (connections, 2, 100);
+
+	/* PLAYING and COMPLETED, each delivered only to the owner. */
+	fail_unless (first_state.num_states == 2);
+	fail_unless (second_state.num_states == 2);
+	fail_unless (first_state.num_foreign == 0);
+	fail_unless (second_state.num_foreign == 0);
+
+	/* Dropping one client keeps the dispatcher alive for the other. */
+	ngf_client_destroy (first);
+
+	second_state.num_states = 0;
+	second_state.id = ngf_client_play_event (second, "sms", NULL);
+	for (i = 0; i < 50 && second_state.num_states < 2; i++)
+		backend_stub_iterate (connections, 2, 100);
+
+	fail_unless (second_state.num_states == 2);
+
+	ngf_client_destroy (second);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+static int status_signals = 0;
+
+static DBusHandlerResult
+count_status_cb (DBusConnection *connection, DBusMessage *msg, void *userdata)
+{
+	(void) connection;
+	(void) userdata;
+
+	if (dbus_message_get_type (msg) == DBUS_MESSAGE_TYPE_SIGNAL &&
+	    dbus_message_has_member (msg, "Status"))
+		status_signals++;
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+play_and_wait (NgfClient *client, DBusConnection **connections, int num_connections)
+{
+	int i;
+
+	last_state = -1;
+	fail_unless (ngf_client_play_event (client, "sms", NULL) != 0);
+	for (i = 0; i < 50 && last_state != NGF_EVENT_COMPLETED; i++)
+		backend_stub_iterate (connections, num_connections, 100);
+	fail_unless (last_state == NGF_EVENT_COMPLETED);
+
+	backend_stub_pump (connections, num_connections, 50);
+}
+
+START_TEST (test_lazy_subscription)
+{
+	DBusConnection *connections[3];
+	BackendStub *stub = NULL;
+	NgfClient *player = NULL, *observer = NULL;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		connections[i] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	player = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	observer = ngf_client_create (NGF_TRANSPORT_DBUS, connections[2]);
+	ngf_client_set_callback (player, state_cb, NULL);
+	ngf_client_set_callback (observer, state_cb, NULL);
+	dbus_connection_add_filter (connections[2], count_status_cb, NULL, NULL);
+
+	/* A client that never played has no match rule on the bus. */
+	status_signals = 0;
+	play_and_wait (player, connections, 3);
+	fail_unless (status_signals == 0);
+
+	/* While it lingers after playing, broadcasts reach it ... */
+	ngf_client_set_idle_timeout (observer, 60000);
+	play_and_wait (observer, connections, 3);
+	status_signals = 0;
+	play_and_wait (player, connections, 3);
+	fail_unless (status_signals > 0);
+
+	ngf_client_destroy (observer);
+	dbus_connection_remove_filter (connections[2], count_status_cb, NULL);
+	dbus_connection_close (connections[2]);
+	dbus_connection_unref (connections[2]);
+
+	/* ... but with no idle period the match goes with the last event. */
+	connections[2] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	observer = ngf_client_create (NGF_TRANSPORT_DBUS, connections[2]);
+	ngf_client_set_callback (observer, state_cb, NULL);
+	dbus_connection_add_filter (connections[2], count_status_cb, NULL, NULL);
+
+	ngf_client_set_idle_timeout (observer, 0);
+	play_and_wait (observer, connections, 3);
+	status_signals = 0;
+	play_and_wait (player, connections, 3);
+	fail_unless (status_signals == 0);
+
+	ngf_client_destroy (observer);
+	ngf_client_destroy (player);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 3; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+static int destroy_done = 0;
+static int destroy_flushed = 0;
+
+static void
+destroy_cb (int flushed, void *userdata)
+{
+	(void) userdata;
+
+	destroy_done++;
+	destroy_flushed = flushed;
+}
+
+START_TEST (test_destroy_async)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	int i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, state_cb, NULL);
+
+	last_state = -1;
+	fail_unless (ngf_client_play_event (client, "ringtone", NULL) != 0);
+	for (i = 0; i < 50 && last_state != NGF_EVENT_PLAYING; i++)
+		backend_stub_iterate (connections, 2, 100);
+	fail_unless (last_state == NGF_EVENT_PLAYING);
+
+	/* Completes right away if the Stop could be written without blocking. */
+	destroy_done = 0;
+	ngf_client_destroy_async (client, destroy_cb, NULL, 5000);
+
+	for (i = 0; i < 50 && destroy_done == 0; i++)
+		backend_stub_iterate (connections, 2, 100);
+
+	fail_unless (destroy_done == 1);
+	fail_unless (destroy_flushed == 1);
+
+	backend_stub_pump (connections, 2, 50);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+/* Pid of the bus daemon, so that a test can keep it from reading. */
+
+static pid_t
+bus_pid (DBusConnection *connection)
+{
+	DBusMessage *msg = NULL, *reply = NULL;
+	const char *name = DBUS_SERVICE_DBUS;
+	dbus_uint32_t pid = 0;
+
+	msg = dbus_message_new_method_call (DBUS_SERVICE_DBUS, DBUS_PATH_DBUS,
+		DBUS_INTERFACE_DBUS, "GetConnectionUnixProcessID");
+	dbus_message_append_args (msg, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID);
+	reply = dbus_connection_send_with_reply_and_block (connection, msg, -1, NULL);
+	dbus_message_unref (msg);
+
+	if (reply == NULL)
+		return 0;
+
+	dbus_message_get_args (reply, NULL, DBUS_TYPE_UINT32, &pid, DBUS_TYPE_INVALID);
+	dbus_message_unref (reply);
+	return (pid_t) pid;
+}
+
+static void*
+resume_bus_thread (void *userdata)
+{
+	pid_t pid = *(pid_t*) userdata;
+
+	usleep (300 * 1000);
+	kill (pid, SIGCONT);
+	return NULL;
+}
+
+/* Plays enough together to fill the socket towards the bus. */
+#define DESTROY_PLAYS       2000
+#define DESTROY_PROP_SIZE   512
+
+START_TEST (test_destroy_async_dispatched)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	NgfProplist *proplist = NULL;
+	pthread_t thread;
+	pid_t pid = 0;
+	char value[DESTROY_PROP_SIZE];
+	int i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	pid = bus_pid (connections[0]);
+	fail_unless (pid > 0);
+
+	/* Driven through its own loop only, by nothing once it is destroyed. */
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	fail_unless (ngf_client_get_fd (client, NULL) >= 0);
+	fail_unless (ngf_client_play_event (client, "sms", NULL) != 0);
+	for (i = 0; i < 20; i++) {
+		ngf_client_dispatch (client);
+		backend_stub_iterate (connections, 1, 5);
+	}
+
+	memset (value, 'x', DESTROY_PROP_SIZE - 1);
+	value[DESTROY_PROP_SIZE - 1] = '\0';
+	proplist = ngf_proplist_new ();
+	ngf_proplist_sets (proplist, "payload", value);
+
+	/* With the bus stopped for a while the plays pile up in the
+	   connection. */
+	kill (pid, SIGSTOP);
+	pthread_create (&thread, NULL, resume_bus_thread, &pid);
+	for (i = 0; i < DESTROY_PLAYS; i++)
+		fail_unless (ngf_client_play_event (client, "sms", proplist) != 0);
+	fail_unless (dbus_connection_has_messages_to_send (connections[1]));
+
+	/* Nobody is left to dispatch the connection, so they are written out
+	   before destroy returns, as soon as the bus reads again. */
+	destroy_done = 0;
+	ngf_client_destroy_async (client, destroy_cb, NULL, 5000);
+
+	for (i = 0; i < 100 && destroy_done == 0; i++)
+		backend_stub_iterate (connections, 1, 10);
+	pthread_join (thread, NULL);
+
+	fail_unless (destroy_done == 1);
+	fail_unless (destroy_flushed == 1);
+
+	backend_stub_pump (connections, 1, 50);
+	fail_unless (backend_stub_num_plays (stub) == DESTROY_PLAYS + 1);
+
+	ngf_proplist_free (proplist);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+START_TEST (test_epoll_dispatch)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	struct epoll_event ev;
+	int epfd = -1, fd = -1, events = 0, timeout = 0;
+	uint32_t id = 0;
+	int i;
+
+	/* The client connection has no main loop integration of its own. */
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, state_cb, NULL);
+
+	fd = ngf_client_get_fd (client, &events);
+	fail_unless (fd >= 0);
+	fail_unless (events & EPOLLIN);
+
+	epfd = epoll_create1 (0);
+	memset (&ev, 0, sizeof (ev));
+	ev.events = events;
+	fail_unless (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) == 0);
+
+	last_state = -1;
+	id = ngf_client_play_event (client, "sms", NULL);
+	fail_unless (id != 0);
+
+	/* The pending Play reply arms a DBus timeout. */
+	fail_unless (ngf_client_get_timeout (client) >= 0);
+
+	for (i = 0; i < 500 && last_state != NGF_EVENT_COMPLETED; i++) {
+		timeout = ngf_client_get_timeout (client);
+		if (timeout < 0 || timeout > 10)
+			timeout = 10;
+
+		epoll_wait (epfd, &ev, 1, timeout);
+		fail_unless (ngf_client_dispatch (client) == 1);
+		backend_stub_iterate (connections, 1, 0);
+
+		ngf_client_get_fd (client, &events);
+		ev.events = events;
+		epoll_ctl (epfd, EPOLL_CTL_MOD, fd, &ev);
+	}
+
+	fail_unless (last_state == NGF_EVENT_COMPLETED);
+	fail_unless (last_state_id == id);
+
+	close (epfd);
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+static int source_callbacks = 0;
+
+static void
+count_state_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	source_callbacks++;
+	state_cb (client, id, state, userdata);
+}
+
+START_TEST (test_glib_source)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	GMainContext *context = NULL;
+	GSource *source = NULL;
+	uint32_t max_pending = 0;
+	int i, before;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, count_state_cb, NULL);
+
+	context = g_main_context_new ();
+	source = ngf_client_source_new (client, G_PRIORITY_LOW, 2);
+	fail_unless (source != NULL);
+	g_source_attach (source, context);
+
+	for (i = 0; i < 3; i++)
+		fail_unless (ngf_client_play_event (client, "sms", NULL) != 0);
+
+	/* Let the whole burst of replies and status updates arrive first. */
+	backend_stub_pump (connections, 1, 100);
+
+	source_callbacks = 0;
+	for (i = 0; i < 200 && source_callbacks < 6; i++) {
+		before = source_callbacks;
+		g_main_context_iteration (context, FALSE);
+		fail_unless (source_callbacks - before <= 2);
+
+		if (ngf_client_get_pending_callbacks (client) > max_pending)
+			max_pending = ngf_client_get_pending_callbacks (client);
+
+		backend_stub_iterate (connections, 1, 10);
+	}
+
+	fail_unless (source_callbacks == 6);
+	fail_unless (max_pending > 0);
+	fail_unless (last_state == NGF_EVENT_COMPLETED);
+
+	g_source_destroy (source);
+	g_source_unref (source);
+	g_main_context_unref (context);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+/* Drive the client through its own loop integration, the backend through
+   the stub, until the client reports state or max_ms has passed. Returns
+   the elapsed time in milliseconds. */
+
+static int
+drive_until (NgfClient *client, DBusConnection *backend, NgfEventState state, int max_ms)
+{
+	struct timespec start, now;
+	struct pollfd pfd;
+	int elapsed = 0, timeout = 0;
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+
+	while (last_state != state && elapsed < max_ms) {
+		timeout = ngf_client_get_timeout (client);
+		if (timeout < 0 || timeout > 10)
+			timeout = 10;
+
+		pfd.fd = ngf_client_get_fd (client, NULL);
+		pfd.events = POLLIN;
+		poll (&pfd, 1, timeout);
+
+		ngf_client_dispatch (client);
+		backend_stub_iterate (&backend, 1, 0);
+
+		clock_gettime (CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+	}
+
+	return elapsed;
+}
+
+/* Drive the client through its own loop, and the stub, for ms. */
+
+static void
+drive_for (NgfClient *client, DBusConnection *backend, int ms)
+{
+	struct timespec start, now;
+	struct pollfd pfd;
+	int elapsed = 0, timeout = 0;
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+
+	while (elapsed < ms) {
+		timeout = ngf_client_get_timeout (client);
+		if (timeout < 0 || timeout > 5)
+			timeout = 5;
+
+		pfd.fd = ngf_client_get_fd (client, NULL);
+		pfd.events = POLLIN;
+		poll (&pfd, 1, timeout);
+
+		ngf_client_dispatch (client);
+		backend_stub_iterate (&backend, 1, 0);
+
+		clock_gettime (CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+	}
+}
+
+START_TEST (test_timeouts)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	uint32_t id = 0;
+	int elapsed = 0, i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_silent (stub, 1);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, state_cb, NULL);
+
+	/* Per call timeout against a backend that never answers. */
+	last_state = -1;
+	id = ngf_client_play_event_with_timeout (client, "sms", NULL, 100);
+	fail_unless (id != 0);
+	elapsed = drive_until (client, connections[0], NGF_EVENT_FAILED, 5000);
+	fail_unless (last_state == NGF_EVENT_FAILED);
+	fail_unless (last_state_id == id);
+	fail_unless (elapsed < 1000);
+
+	/* Client wide timeout. */
+	ngf_client_set_reply_timeout (client, 100);
+	last_state = -1;
+	id = ngf_client_play_event (client, "sms", NULL);
+	elapsed = drive_until (client, connections[0], NGF_EVENT_FAILED, 5000);
+	fail_unless (last_state == NGF_EVENT_FAILED);
+	fail_unless (last_state_id == id);
+	fail_unless (elapsed < 1000);
+
+	/* An event that starts but never finishes is swept. */
+	backend_stub_set_silent (stub, 0);
+	ngf_client_set_event_timeout (client, 200);
+	last_state = -1;
+	id = ngf_client_play_event (client, "ringtone", NULL);
+	drive_until (client, connections[0], NGF_EVENT_PLAYING, 5000);
+	fail_unless (last_state == NGF_EVENT_PLAYING);
+
+	elapsed = drive_until (client, connections[0], NGF_EVENT_FAILED, 5000);
+	fail_unless (last_state == NGF_EVENT_FAILED);
+	fail_unless (last_state_id == id);
+	fail_unless (elapsed >= 100 && elapsed < 2500);
+
+	backend_stub_pump (connections, 1, 50);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+START_TEST (test_backend_presence)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	uint32_t id = 0;
+	int i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, state_cb, NULL);
+	fail_unless (ngf_client_get_backend_present (client) == -1);
+
+	/* No backend yet, plays fail right away. */
+	ngf_client_set_backend_policy (client, NGF_BACKEND_POLICY_FAIL);
+	for (i = 0; i < 100 && ngf_client_get_backend_present (client) != 0; i++)
+		backend_stub_iterate (&connections[1], 1, 10);
+	fail_unless (ngf_client_get_backend_present (client) == 0);
+	fail_unless (ngf_client_play_event (client, "sms", NULL) == 0);
+
+	/* Queued plays go out once the backend shows up, a stopped one
+	   completes without being sent. */
+	ngf_client_set_backend_policy (client, NGF_BACKEND_POLICY_QUEUE);
+	id = ngf_client_play_event (client, "sms", NULL);
+	fail_unless (id != 0);
+	last_state = -1;
+	ngf_client_stop_event (client, id);
+	fail_unless (last_state == NGF_EVENT_COMPLETED && last_state_id == id);
+
+	last_state = -1;
+	id = ngf_client_play_event (client, "ringtone", NULL);
+	fail_unless (id != 0);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	drive_until (client, connections[0], NGF_EVENT_PLAYING, 2000);
+	fail_unless (last_state == NGF_EVENT_PLAYING);
+	fail_unless (last_state_id == id);
+	fail_unless (ngf_client_get_backend_present (client) == 1);
+	fail_unless (backend_stub_num_plays (stub) == 1);
+
+	/* The backend going away fails what it was playing. */
+	backend_stub_free (stub);
+	drive_until (client, connections[0], NGF_EVENT_FAILED, 2000);
+	fail_unless (last_state == NGF_EVENT_FAILED);
+	fail_unless (last_state_id == id);
+	fail_unless (ngf_client_get_backend_present (client) == 0);
+
+	/* So do the ones stopped along with everything else. */
+	id = ngf_client_play_event (client, "sms", NULL);
+	fail_unless (id != 0);
+	ngf_client_stop_all (client);
+	fail_unless (last_state == NGF_EVENT_COMPLETED && last_state_id == id);
+
+	ngf_client_destroy (client);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+#ifdef HAVE_SDBUS
+START_TEST (test_sdbus_transport)
+{
+	DBusConnection *connection = NULL;
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	sd_bus *bus = NULL;
+	uint32_t id = 0;
+	int i;
+
+	connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	stub = backend_stub_new (connection);
+	fail_unless (stub != NULL);
+	backend_stub_set_status_calls (stub, 1);
+
+	fail_unless (sd_bus_new (&bus) >= 0);
+	fail_unless (sd_bus_set_address (bus, getenv ("DBUS_SESSION_BUS_ADDRESS")) >= 0);
+	fail_unless (sd_bus_set_bus_client (bus, 1) >= 0);
+	fail_unless (sd_bus_start (bus) >= 0);
+
+	client = ngf_client_create (NGF_TRANSPORT_SDBUS, bus);
+	fail_unless (client != NULL);
+	ngf_client_set_callback (client, state_cb, NULL);
+
+	/* The owner of the backend name is looked up through the bus. */
+	ngf_client_set_backend_policy (client, NGF_BACKEND_POLICY_FAIL);
+	for (i = 0; i < 100 && ngf_client_get_backend_present (client) != 1; i++)
+		drive_for (client, connection, 10);
+	fail_unless (ngf_client_get_backend_present (client) == 1);
+
+	/* Unicast status arrives as calls the client has to answer. */
+	ngf_client_set_unicast_status (client, 1);
+	last_state = -1;
+	id = ngf_client_play_event (client, "sms", NULL);
+	fail_unless (id != 0);
+	drive_until (client, connection, NGF_EVENT_PLAYING, 2000);
+	fail_unless (last_state == NGF_EVENT_PLAYING);
+	fail_unless (last_state_id == id);
+
+	ngf_client_stop_event (client, id);
+	drive_until (client, connection, NGF_EVENT_COMPLETED, 2000);
+	fail_unless (last_state == NGF_EVENT_COMPLETED);
+	fail_unless (backend_stub_num_plays (stub) == 1);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+	fail_unless (backend_stub_num_status_errors (stub) == 0);
+
+	/* And broadcast ones through the match. */
+	ngf_client_set_unicast_status (client, 0);
+	backend_stub_set_auto_complete (stub, 1);
+	last_state = -1;
+	id = ngf_client_play_event (client, "sms", NULL);
+	fail_unless (id != 0);
+	drive_until (client, connection, NGF_EVENT_COMPLETED, 2000);
+	fail_unless (last_state == NGF_EVENT_COMPLETED);
+	fail_unless (last_state_id == id);
+
+	ngf_client_destroy (client);
+	sd_bus_flush_close_unref (bus);
+
+	backend_stub_free (stub);
+	dbus_connection_close (connection);
+	dbus_connection_unref (connection);
+}
+END_TEST
+#endif
+
+START_TEST (test_event_state)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	uint32_t id = 0;
+	int i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, state_cb, NULL);
+
+	last_state = -1;
+	id = ngf_client_play_event (client, "ringtone", NULL);
+	fail_unless (ngf_client_get_event_state (client, id) == -1);
+	drive_until (client, connections[0], NGF_EVENT_PLAYING, 2000);
+	fail_unless (ngf_client_get_event_state (client, id) == NGF_EVENT_PLAYING);
+
+	/* Resuming a playing event sends nothing, pausing it twice once. */
+	ngf_client_resume_event (client, id);
+	ngf_client_pause_event (client, id);
+	ngf_client_pause_event (client, id);
+	drive_until (client, connections[0], NGF_EVENT_PAUSED, 2000);
+	fail_unless (ngf_client_get_event_state (client, id) == NGF_EVENT_PAUSED);
+	fail_unless (backend_stub_num_pauses (stub) == 1);
+
+	ngf_client_resume_event (client, id);
+	ngf_client_resume_event (client, id);
+	drive_until (client, connections[0], NGF_EVENT_PLAYING, 2000);
+	fail_unless (backend_stub_num_pauses (stub) == 2);
+
+	ngf_client_stop_event (client, id);
+	ngf_client_stop_event (client, id);
+	drive_until (client, connections[0], NGF_EVENT_COMPLETED, 2000);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+	fail_unless (ngf_client_get_event_state (client, id) == -1);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+static int group_counts[4];
+
+static void
+group_state_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	(void) client;
+	(void) id;
+	(void) userdata;
+
+	group_counts[state]++;
+}
+
+static void
+wait_for_state (DBusConnection **connections, NgfEventState state, int count)
+{
+	int i;
+
+	for (i = 0; i < 200 && group_counts[state] < count; i++)
+		backend_stub_iterate (connections, 2, 10);
+
+	backend_stub_pump (connections, 2, 20);
+}
+
+START_TEST (test_groups)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	int i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_bulk (stub, 1);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, group_state_cb, NULL);
+	memset (group_counts, 0, sizeof (group_counts));
+
+	for (i = 0; i < 3; i++)
+		fail_unless (ngf_client_play_event_in_group (client, "alerts", "sms", NULL) != 0);
+	fail_unless (ngf_client_play_event (client, "ringtone", NULL) != 0);
+	wait_for_state (connections, NGF_EVENT_PLAYING, 4);
+	fail_unless (group_counts[NGF_EVENT_PLAYING] == 4);
+
+	/* One message for the whole group, none if there is nothing to do. */
+	ngf_client_pause_group (client, "alerts");
+	wait_for_state (connections, NGF_EVENT_PAUSED, 3);
+	fail_unless (group_counts[NGF_EVENT_PAUSED] == 3);
+	fail_unless (backend_stub_num_pauses (stub) == 1);
+
+	ngf_client_pause_group (client, "alerts");
+	ngf_client_resume_group (client, "unknown");
+	backend_stub_pump (connections, 2, 20);
+	fail_unless (backend_stub_num_pauses (stub) == 1);
+
+	ngf_client_stop_all (client);
+	wait_for_state (connections, NGF_EVENT_COMPLETED, 4);
+	fail_unless (group_counts[NGF_EVENT_COMPLETED] == 4);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+
+	/* Older backends get one Stop per event. */
+	backend_stub_set_bulk (stub, 0);
+	for (i = 0; i < 2; i++)
+		ngf_client_play_event_in_group (client, "alerts", "sms", NULL);
+	wait_for_state (connections, NGF_EVENT_PLAYING, 6);
+
+	ngf_client_stop_group (client, "alerts");
+	wait_for_state (connections, NGF_EVENT_COMPLETED, 6);
+	fail_unless (group_counts[NGF_EVENT_COMPLETED] == 6);
+	fail_unless (backend_stub_num_stops (stub) == 3);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+static int limit_states[16];
+
+static void
+limit_state_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	(void) client;
+	(void) userdata;
+
+	if (id < 16)
+		limit_states[id] = state;
+}
+
+START_TEST (test_group_limits)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	uint32_t id[5];
+	int i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, limit_state_cb, NULL);
+	for (i = 0; i < 16; i++)
+		limit_states[i] = -1;
+
+	/* Plays beyond the limit are refused without touching the bus. */
+	ngf_client_set_group_limit (client, "keyboard", 1, NGF_LIMIT_DROP_NEW);
+	id[0] = ngf_client_play_event_in_group (client, "keyboard", "key", NULL);
+	fail_unless (id[0] != 0);
+	fail_unless (ngf_client_play_event_in_group (client, "keyboard", "key", NULL) == 0);
+	backend_stub_pump (connections, 2, 20);
+	fail_unless (backend_stub_num_plays (stub) == 1);
+	fail_unless (limit_states[id[0]] == NGF_EVENT_PLAYING);
+
+	/* The newest click stops the previous one. */
+	ngf_client_set_group_limit (client, "keyboard", 1, NGF_LIMIT_PREEMPT_OLDEST);
+	id[1] = ngf_client_play_event_in_group (client, "keyboard", "key", NULL);
+	backend_stub_pump (connections, 2, 20);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+	fail_unless (limit_states[id[0]] == NGF_EVENT_COMPLETED);
+	fail_unless (limit_states[id[1]] == NGF_EVENT_PLAYING);
+
+	/* Queued plays wait for a free slot, highest priority first. */
+	ngf_client_set_group_limit (client, "keyboard", 1, NGF_LIMIT_QUEUE);
+	id[2] = ngf_client_play_event_with_priority (client, "keyboard", 0, "key", NULL);
+	id[3] = ngf_client_play_event_with_priority (client, "keyboard", 5, "key", NULL);
+	id[4] = ngf_client_play_event_with_priority (client, "keyboard", 0, "key", NULL);
+	fail_unless (id[2] != 0 && id[3] != 0 && id[4] != 0);
+	ngf_client_stop_event (client, id[4]);
+	fail_unless (limit_states[id[4]] == NGF_EVENT_COMPLETED);
+	backend_stub_pump (connections, 2, 20);
+	fail_unless (backend_stub_num_plays (stub) == 2);
+
+	ngf_client_stop_event (client, id[1]);
+	backend_stub_pump (connections, 2, 20);
+	fail_unless (backend_stub_num_plays (stub) == 3);
+	fail_unless (limit_states[id[3]] == NGF_EVENT_PLAYING);
+	fail_unless (limit_states[id[2]] == -1);
+
+	ngf_client_stop_event (client, id[3]);
+	backend_stub_pump (connections, 2, 20);
+	fail_unless (backend_stub_num_plays (stub) == 4);
+	fail_unless (limit_states[id[2]] == NGF_EVENT_PLAYING);
+	fail_unless (limit_states[id[4]] == NGF_EVENT_COMPLETED);
+
+	/* A play preempted while awaiting its reply still completes. */
+	ngf_client_set_group_limit (client, "touch", 1, NGF_LIMIT_PREEMPT_OLDEST);
+	id[0] = ngf_client_play_event_in_group (client, "touch", "tap", NULL);
+	id[1] = ngf_client_play_event_in_group (client, "touch", "tap", NULL);
+	fail_unless (id[0] != 0 && id[1] != 0);
+	backend_stub_pump (connections, 2, 20);
+	fail_unless (backend_stub_num_plays (stub) == 6);
+	fail_unless (limit_states[id[0]] == NGF_EVENT_COMPLETED);
+	fail_unless (limit_states[id[1]] == NGF_EVENT_PLAYING);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+#define ROUTE_SERVICE   "com.nokia.NonGraphicFeedback1.Haptics"
+#define ROUTE_FALLBACK  "com.nokia.NonGraphicFeedback1.HapticsFallback"
+
+START_TEST (test_routes)
+{
+	DBusConnection *connections[4];
+	BackendStub *stub = NULL, *haptics = NULL, *fallback = NULL;
+	NgfClient *client = NULL;
+	uint32_t id[6];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		connections[i] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[1]);
+	haptics = backend_stub_new_named (connections[2], ROUTE_SERVICE);
+	fail_unless (stub != NULL && haptics != NULL);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[0]);
+	ngf_client_set_callback (client, limit_state_cb, NULL);
+	for (i = 0; i < 16; i++)
+		limit_states[i] = -1;
+
+	fail_unless (ngf_client_add_route (client, "touch_*", ROUTE_SERVICE, ROUTE_FALLBACK));
+	backend_stub_pump (connections, 4, 20);
+
+	/* Both backends number their events from 1. */
+	id[0] = ngf_client_play_event (client, "sms", NULL);
+	id[1] = ngf_client_play_event (client, "touch_press", NULL);
+	backend_stub_pump (connections, 4, 20);
+	fail_unless (backend_stub_num_plays (stub) == 1);
+	fail_unless (backend_stub_num_plays (haptics) == 1);
+	fail_unless (limit_states[id[0]] == NGF_EVENT_PLAYING);
+	fail_unless (limit_states[id[1]] == NGF_EVENT_PLAYING);
+
+	/* Status of one backend does not reach events of the other. */
+	ngf_client_stop_event (client, id[1]);
+	backend_stub_pump (connections, 4, 20);
+	fail_unless (backend_stub_num_stops (haptics) == 1);
+	fail_unless (backend_stub_num_stops (stub) == 0);
+	fail_unless (limit_states[id[1]] == NGF_EVENT_COMPLETED);
+	fail_unless (limit_states[id[0]] == NGF_EVENT_PLAYING);
+
+	/* A routed backend going away takes only its own events along. */
+	id[2] = ngf_client_play_event (client, "touch_hold", NULL);
+	backend_stub_pump (connections, 4, 20);
+	fail_unless (limit_states[id[2]] == NGF_EVENT_PLAYING);
+	backend_stub_free (haptics);
+	backend_stub_pump (connections, 4, 20);
+	fail_unless (limit_states[id[2]] == NGF_EVENT_FAILED);
+	fail_unless (limit_states[id[0]] == NGF_EVENT_PLAYING);
+
+	/* New plays fail over while the service is absent. */
+	fallback = backend_stub_new_named (connections[3], ROUTE_FALLBACK);
+	fail_unless (fallback != NULL);
+	backend_stub_pump (connections, 4, 20);
+
+	id[3] = ngf_client_play_event (client, "touch_press", NULL);
+	backend_stub_pump (connections, 4, 20);
+	fail_unless (backend_stub_num_plays (fallback) == 1);
+	fail_unless (limit_states[id[3]] == NGF_EVENT_PLAYING);
+
+	/* Stopping everything sends one message per backend. */
+	backend_stub_set_bulk (stub, 1);
+	backend_stub_set_bulk (fallback, 1);
+	id[4] = ngf_client_play_event (client, "sms", NULL);
+	id[5] = ngf_client_play_event (client, "touch_press", NULL);
+	backend_stub_pump (connections, 4, 20);
+
+	ngf_client_stop_all (client);
+	backend_stub_pump (connections, 4, 20);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+	fail_unless (backend_stub_num_stops (fallback) == 1);
+	fail_unless (limit_states[id[0]] == NGF_EVENT_COMPLETED);
+	fail_unless (limit_states[id[3]] == NGF_EVENT_COMPLETED);
+	fail_unless (limit_states[id[4]] == NGF_EVENT_COMPLETED);
+	fail_unless (limit_states[id[5]] == NGF_EVENT_COMPLETED);
+
+	ngf_client_destroy (client);
+	backend_stub_free (fallback);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 4; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+static int batch_calls = 0;
+static int batch_changes = 0;
+static int batch_completed = 0;
+
+static void
+batch_state_cb (NgfClient *client, const NgfStateChange *changes, uint32_t num_changes, void *userdata)
+{
+	uint32_t i;
+
+	(void) client;
+	(void) userdata;
+
+	batch_calls++;
+	batch_changes += num_changes;
+
+	for (i = 0; i < num_changes; i++) {
+		if (changes[i].state == NGF_EVENT_COMPLETED)
+			batch_completed++;
+	}
+}
+
+START_TEST (test_batch_callback)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	struct pollfd pfd;
+	int i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, state_cb, NULL);
+	ngf_client_set_batch_callback (client, batch_state_cb, NULL);
+
+	for (i = 0; i < 5; i++)
+		fail_unless (ngf_client_play_event (client, "sms", NULL) != 0);
+
+	/* Let the backend answer everything before the client looks. */
+	backend_stub_pump (&connections[0], 1, 50);
+
+	last_state = -1;
+	for (i = 0; i < 100 && batch_completed < 5; i++) {
+		pfd.fd = ngf_client_get_fd (client, NULL);
+		pfd.events = POLLIN;
+		poll (&pfd, 1, 10);
+		ngf_client_dispatch (client);
+	}
+
+	fail_unless (batch_completed == 5);
+	fail_unless (batch_changes == 10);
+	fail_unless (batch_calls < batch_changes);
+	fail_unless (last_state == -1);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+typedef struct _Listener
+{
+	uint32_t id;
+	int num_states;
+	int states[4];
+} Listener;
+
+static void
+listener_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	Listener *l = (Listener*) userdata;
+
+	(void) client;
+	(void) id;
+
+	if (l->num_states < 4)
+		l->states[l->num_states] = state;
+	l->num_states++;
+}
+
+START_TEST (test_event_callback)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	Listener all, final;
+	int i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, state_cb, NULL);
+
+	memset (&all, 0, sizeof (all));
+	memset (&final, 0, sizeof (final));
+
+	all.id = ngf_client_play_event_full (client, "sms", NULL, listener_cb, &all, 0);
+	final.id = ngf_client_play_event_full (client, "sms", NULL, listener_cb, &final,
+					       NGF_EVENT_STATE_MASK_FINAL);
+	fail_unless (all.id != 0 && final.id != 0);
+
+	last_state = -1;
+	for (i = 0; i < 100 && (all.num_states < 2 || final.num_states < 1); i++)
+		backend_stub_iterate (connections, 2, 10);
+	backend_stub_pump (connections, 2, 50);
+
+	/* Only the per event callbacks, and only for the masked states. */
+	fail_unless (all.num_states == 2);
+	fail_unless (all.states[0] == NGF_EVENT_PLAYING);
+	fail_unless (all.states[1] == NGF_EVENT_COMPLETED);
+	fail_unless (final.num_states == 1);
+	fail_unless (final.states[0] == NGF_EVENT_COMPLETED);
+	fail_unless (last_state == -1);
+
+	/* Plays without a callback still go to the client callback. */
+	fail_unless (ngf_client_play_event_full (client, "sms", NULL, NULL, NULL, 0) != 0);
+	for (i = 0; i < 100 && last_state != NGF_EVENT_COMPLETED; i++)
+		backend_stub_iterate (connections, 2, 10);
+	fail_unless (last_state == NGF_EVENT_COMPLETED);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+START_TEST (test_dedup)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	NgfProplist *p = NULL, *q = NULL;
+	Listener first, second, other;
+	int i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_dedup (client, 1);
+
+	memset (&first, 0, sizeof (first));
+	memset (&second, 0, sizeof (second));
+	memset (&other, 0, sizeof (other));
+
+	p = ngf_proplist_new ();
+	ngf_proplist_sets (p, "sender", "alice");
+	ngf_proplist_set_as_integer (p, "count", 3);
+
+	/* Same properties, set in another order. */
+	q = ngf_proplist_new ();
+	ngf_proplist_set_as_integer (q, "count", 3);
+	ngf_proplist_sets (q, "sender", "alice");
+
+	first.id = ngf_client_play_event_full (client, "sms", p, listener_cb, &first, 0);
+	for (i = 0; i < 100 && first.num_states < 1; i++)
+		backend_stub_iterate (connections, 2, 10);
+	fail_unless (first.num_states == 1 && first.states[0] == NGF_EVENT_PLAYING);
+
+	/* Linked to the first one, and catches up with its state. */
+	second.id = ngf_client_play_event_full (client, "sms", q, listener_cb, &second, 0);
+	fail_unless (second.id != 0 && second.id != first.id);
+	fail_unless (second.num_states == 1 && second.states[0] == NGF_EVENT_PLAYING);
+	fail_unless (ngf_client_get_event_state (client, second.id) == NGF_EVENT_PLAYING);
+
+	other.id = ngf_client_play_event_full (client, "sms", NULL, listener_cb, &other, 0);
+	backend_stub_pump (connections, 2, 50);
+	fail_unless (backend_stub_num_plays (stub) == 2);
+
+	/* The event outlives the id that started it. */
+	ngf_client_stop_event (client, first.id);
+	fail_unless (first.num_states == 2 && first.states[1] == NGF_EVENT_COMPLETED);
+	backend_stub_pump (connections, 2, 50);
+	fail_unless (backend_stub_num_stops (stub) == 0);
+	fail_unless (second.num_states == 1);
+
+	ngf_client_stop_event (client, second.id);
+	for (i = 0; i < 100 && second.num_states < 2; i++)
+		backend_stub_iterate (connections, 2, 10);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+	fail_unless (second.num_states == 2 && second.states[1] == NGF_EVENT_COMPLETED);
+	fail_unless (first.num_states == 2);
+	fail_unless (other.num_states == 1);
+
+	ngf_proplist_free (p);
+	ngf_proplist_free (q);
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+START_TEST (test_rate_limit)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	Listener first, coalesced;
+	uint32_t rejected = 0, num_coalesced = 0;
+	int i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	fail_unless (!ngf_client_get_rate_limit_stats (client, "sms", NULL, NULL));
+
+	/* Two at once, then one a second. */
+	ngf_client_set_rate_limit (client, "sms", 1, 2, NGF_RATE_REJECT);
+	fail_unless (ngf_client_play_event (client, "sms", NULL) != 0);
+	fail_unless (ngf_client_play_event (client, "sms", NULL) != 0);
+	fail_unless (ngf_client_play_event (client, "sms", NULL) == 0);
+	fail_unless (ngf_client_play_event (client, "email", NULL) != 0);
+
+	fail_unless (ngf_client_get_rate_limit_stats (client, "sms", &rejected, &num_coalesced));
+	fail_unless (rejected == 1 && num_coalesced == 0);
+
+	/* Lifting the limit keeps the counters. */
+	ngf_client_set_rate_limit (client, "sms", 0, 0, NGF_RATE_REJECT);
+	fail_unless (ngf_client_play_event (client, "sms", NULL) != 0);
+	fail_unless (ngf_client_get_rate_limit_stats (client, "sms", &rejected, NULL));
+	fail_unless (rejected == 1);
+
+	backend_stub_pump (connections, 2, 50);
+	fail_unless (backend_stub_num_plays (stub) == 4);
+
+	/* A play turned away by its group limit keeps its token. */
+	ngf_client_set_group_limit (client, "alarms", 1, NGF_LIMIT_DROP_NEW);
+	ngf_client_set_rate_limit (client, "alarm", 1, 2, NGF_RATE_REJECT);
+	fail_unless (ngf_client_play_event_in_group (client, "alarms", "alarm", NULL) != 0);
+	fail_unless (ngf_client_play_event_in_group (client, "alarms", "alarm", NULL) == 0);
+	fail_unless (ngf_client_play_event (client, "alarm", NULL) != 0);
+	fail_unless (ngf_client_get_rate_limit_stats (client, "alarm", &rejected, NULL));
+	fail_unless (rejected == 0);
+	ngf_client_stop_group (client, "alarms");
+	ngf_client_set_rate_limit (client, "alarm", 0, 0, NGF_RATE_REJECT);
+
+	backend_stub_pump (connections, 2, 50);
+	fail_unless (backend_stub_num_plays (stub) == 6);
+
+	memset (&first, 0, sizeof (first));
+	memset (&coalesced, 0, sizeof (coalesced));
+
+	ngf_client_set_rate_limit (client, "ring", 1, 1, NGF_RATE_COALESCE);
+	first.id = ngf_client_play_event_full (client, "ring", NULL, listener_cb, &first, 0);
+	coalesced.id = ngf_client_play_event_full (client, "ring", NULL, listener_cb, &coalesced, 0);
+	fail_unless (first.id != 0 && coalesced.id != 0);
+
+	for (i = 0; i < 100 && coalesced.num_states < 1; i++)
+		backend_stub_iterate (connections, 2, 10);
+	backend_stub_pump (connections, 2, 50);
+
+	fail_unless (backend_stub_num_plays (stub) == 7);
+	fail_unless (first.num_states == 1 && first.states[0] == NGF_EVENT_PLAYING);
+	fail_unless (coalesced.num_states == 1 && coalesced.states[0] == NGF_EVENT_PLAYING);
+	fail_unless (ngf_client_get_rate_limit_stats (client, "ring", &rejected, &num_coalesced));
+	fail_unless (rejected == 0 && num_coalesced == 1);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+START_TEST (test_send_window)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	Listener old, restarted;
+	uint32_t ids[3];
+	int i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_bulk (stub, 1);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	fail_unless (ngf_client_get_fd (client, NULL) >= 0);
+	ngf_client_set_send_window (client, 20000);
+
+	for (i = 0; i < 3; i++)
+		ids[i] = ngf_client_play_event (client, "sms", NULL);
+
+	/* Held until the window has passed. */
+	fail_unless (ngf_client_get_timeout (client) <= 20);
+	backend_stub_pump (connections, 2, 5);
+	fail_unless (backend_stub_num_plays (stub) == 0);
+
+	drive_for (client, connections[0], 100);
+	fail_unless (backend_stub_num_plays (stub) == 3);
+	for (i = 0; i < 3; i++)
+		fail_unless (ngf_client_get_event_state (client, ids[i]) == NGF_EVENT_PLAYING);
+
+	/* Pause and resume cancel out, the stops go out as one message. */
+	ngf_client_pause_event (client, ids[0]);
+	ngf_client_resume_event (client, ids[0]);
+	for (i = 0; i < 3; i++)
+		ngf_client_stop_event (client, ids[i]);
+
+	/* A play stopped within the window is never sent. */
+	ngf_client_stop_event (client, ngf_client_play_event (client, "sms", NULL));
+
+	drive_for (client, connections[0], 100);
+	fail_unless (backend_stub_num_plays (stub) == 3);
+	fail_unless (backend_stub_num_pauses (stub) == 0);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+	for (i = 0; i < 3; i++)
+		fail_unless (ngf_client_get_event_state (client, ids[i]) == -1);
+
+	/* Restarting an event keeps it playing. */
+	memset (&old, 0, sizeof (old));
+	memset (&restarted, 0, sizeof (restarted));
+
+	old.id = ngf_client_play_event_full (client, "ringtone", NULL, listener_cb, &old, 0);
+	drive_for (client, connections[0], 100);
+	fail_unless (old.num_states == 1 && old.states[0] == NGF_EVENT_PLAYING);
+
+	ngf_client_stop_event (client, old.id);
+	restarted.id = ngf_client_play_event_full (client, "ringtone", NULL, listener_cb, &restarted, 0);
+	fail_unless (old.num_states == 2 && old.states[1] == NGF_EVENT_COMPLETED);
+	fail_unless (restarted.num_states == 1 && restarted.states[0] == NGF_EVENT_PLAYING);
+
+	drive_for (client, connections[0], 100);
+	fail_unless (backend_stub_num_plays (stub) == 4);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+	fail_unless (ngf_client_get_event_state (client, restarted.id) == NGF_EVENT_PLAYING);
+
+	/* An expired event is stopped on the spot, not within the window. */
+	ngf_client_set_event_timeout (client, 50);
+	ids[0] = ngf_client_play_event (client, "alarm", NULL);
+	drive_for (client, connections[0], 100);
+	fail_unless (backend_stub_num_plays (stub) == 5);
+
+	drive_for (client, connections[0], 200);
+	fail_unless (ngf_client_get_event_state (client, ids[0]) == -1);
+	fail_unless (backend_stub_num_stops (stub) == 2);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+static DBusHandlerResult
+lane_status_cb (DBusConnection *connection, DBusMessage *msg, void *userdata)
+{
+	int *count = (int*) userdata;
+
+	(void) connection;
+
+	if (dbus_message_has_member (msg, "Status"))
+		(*count)++;
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+START_TEST (test_lanes)
+{
+	DBusConnection *connections[3];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	int lane_status[2] = { 0, 0 };
+	int lane = -1, i;
+	uint32_t id = 0;
+
+	for (i = 0; i < 3; i++)
+		connections[i] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, state_cb, NULL);
+	ngf_client_set_unicast_status (client, 1);
+
+	lane = ngf_client_add_lane (client, NGF_TRANSPORT_DBUS, connections[2]);
+	fail_unless (lane == 1);
+	fail_unless (ngf_client_add_lane_rule (client, "click*", lane) == 1);
+	fail_unless (ngf_client_add_lane_rule (client, "bad", 5) == 0);
+
+	dbus_connection_add_filter (connections[1], lane_status_cb, &lane_status[0], NULL);
+	dbus_connection_add_filter (connections[2], lane_status_cb, &lane_status[1], NULL);
+
+	/* Routed by rule, status comes back on the lane it was sent on. */
+	last_state = -1;
+	id = ngf_client_play_event (client, "click_key", NULL);
+	for (i = 0; i < 50 && last_state != NGF_EVENT_COMPLETED; i++)
+		backend_stub_iterate (connections, 3, 100);
+	fail_unless (last_state == NGF_EVENT_COMPLETED);
+	fail_unless (last_state_id == id);
+	fail_unless (lane_status[0] == 0);
+	fail_unless (lane_status[1] == 2);
+
+	/* Default lane when no rule matches. */
+	last_state = -1;
+	ngf_client_play_event (client, "sms", NULL);
+	for (i = 0; i < 50 && last_state != NGF_EVENT_COMPLETED; i++)
+		backend_stub_iterate (connections, 3, 100);
+	fail_unless (lane_status[0] == 2);
+	fail_unless (lane_status[1] == 2);
+
+	/* Explicit lane overrides the rules. */
+	last_state = -1;
+	ngf_client_play_event_on_lane (client, lane, "sms", NULL);
+	for (i = 0; i < 50 && last_state != NGF_EVENT_COMPLETED; i++)
+		backend_stub_iterate (connections, 3, 100);
+	fail_unless (lane_status[0] == 2);
+	fail_unless (lane_status[1] == 4);
+
+	fail_unless (ngf_client_play_event_on_lane (client, 2, "sms", NULL) == 0);
+
+	ngf_client_destroy (client);
+	dbus_connection_remove_filter (connections[1], lane_status_cb, &lane_status[0]);
+	dbus_connection_remove_filter (connections[2], lane_status_cb, &lane_status[1]);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 3; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+#define THREADED_PRODUCERS   4
+#define THREADED_PLAYS       25
+
+static int threaded_completed = 0;
+static uint32_t threaded_first_completed = 0;
+static uint32_t threaded_ids[THREADED_PRODUCERS * THREADED_PLAYS];
+
+static void
+threaded_state_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	uint32_t none = 0;
+
+	(void) client;
+	(void) userdata;
+
+	if (state == NGF_EVENT_COMPLETED) {
+		__atomic_compare_exchange_n (&threaded_first_completed, &none, id, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch (&threaded_completed, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+typedef struct _Producer
+{
+	NgfClient *client;
+	uint32_t *ids;
+} Producer;
+
+static void*
+producer_thread (void *userdata)
+{
+	Producer *p = (Producer*) userdata;
+	int i;
+
+	for (i = 0; i < THREADED_PLAYS; i++)
+		p->ids[i] = ngf_client_play_event (p->client, "sms", NULL);
+
+	return NULL;
+}
+
+START_TEST (test_threaded_client)
+{
+	DBusConnection *connection = NULL;
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	pthread_t threads[THREADED_PRODUCERS];
+	Producer producers[THREADED_PRODUCERS];
+	const int total = THREADED_PRODUCERS * THREADED_PLAYS;
+	uint8_t seen[THREADED_PRODUCERS * THREADED_PLAYS + 1];
+	int i;
+
+	connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	stub = backend_stub_new (connection);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	client = ngf_client_create_threaded (getenv ("DBUS_SESSION_BUS_ADDRESS"));
+	fail_unless (client != NULL);
+	ngf_client_set_callback (client, threaded_state_cb, NULL);
+
+	/* Not driven by the application. */
+	fail_unless (ngf_client_get_fd (client, NULL) == -1);
+
+	threaded_completed = 0;
+	for (i = 0; i < THREADED_PRODUCERS; i++) {
+		producers[i].client = client;
+		producers[i].ids = &threaded_ids[i * THREADED_PLAYS];
+		pthread_create (&threads[i], NULL, producer_thread, &producers[i]);
+	}
+
+	for (i = 0; i < 500 && __atomic_load_n (&threaded_completed, __ATOMIC_SEQ_CST) < total; i++)
+		backend_stub_iterate (&connection, 1, 10);
+
+	for (i = 0; i < THREADED_PRODUCERS; i++)
+		pthread_join (threads[i], NULL);
+
+	fail_unless (threaded_completed == total);
+	fail_unless (backend_stub_num_plays (stub) == (uint32_t) total);
+
+	/* Every producer got its own ids. */
+	memset (seen, 0, sizeof (seen));
+	for (i = 0; i < total; i++) {
+		fail_unless (threaded_ids[i] >= 1 && threaded_ids[i] <= (uint32_t) total);
+		fail_unless (seen[threaded_ids[i]] == 0);
+		seen[threaded_ids[i]] = 1;
+	}
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	dbus_connection_close (connection);
+	dbus_connection_unref (connection);
+}
+END_TEST
+
+static int threaded_playing = 0;
+static int threaded_destroyed = 0;
+static int threaded_destroy_flushed = 0;
+static pthread_t threaded_destroy_thread;
+
+static void
+threaded_playing_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	(void) client;
+	(void) id;
+	(void) userdata;
+
+	if (state == NGF_EVENT_PLAYING)
+		__atomic_add_fetch (&threaded_playing, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+threaded_destroy_cb (int flushed, void *userdata)
+{
+	(void) userdata;
+
+	threaded_destroy_flushed = flushed;
+	threaded_destroy_thread = pthread_self ();
+	__atomic_store_n (&threaded_destroyed, 1, __ATOMIC_SEQ_CST);
+}
+
+START_TEST (test_threaded_destroy_async)
+{
+	DBusConnection *connection = NULL;
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	int i;
+
+	connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	stub = backend_stub_new (connection);
+	fail_unless (stub != NULL);
+
+	client = ngf_client_create_threaded (getenv ("DBUS_SESSION_BUS_ADDRESS"));
+	fail_unless (client != NULL);
+	ngf_client_set_callback (client, threaded_playing_cb, NULL);
+
+	threaded_playing = 0;
+	fail_unless (ngf_client_play_event (client, "ringtone", NULL) != 0);
+	for (i = 0; i < 50 && __atomic_load_n (&threaded_playing, __ATOMIC_SEQ_CST) == 0; i++)
+		backend_stub_iterate (&connection, 1, 100);
+	fail_unless (threaded_playing == 1);
+
+	/* The I/O thread sends the stop and reports back, nothing is joined
+	   on this one. */
+
+	threaded_destroyed = 0;
+	ngf_client_destroy_async (client, threaded_destroy_cb, NULL, 5000);
+
+	for (i = 0; i < 50 && __atomic_load_n (&threaded_destroyed, __ATOMIC_SEQ_CST) == 0; i++)
+		backend_stub_iterate (&connection, 1, 100);
+
+	fail_unless (threaded_destroyed == 1);
+	fail_unless (threaded_destroy_flushed == 1);
+	fail_unless (!pthread_equal (threaded_destroy_thread, pthread_self ()));
+
+	backend_stub_pump (&connection, 1, 50);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+
+	backend_stub_free (stub);
+
+	dbus_connection_close (connection);
+	dbus_connection_unref (connection);
+}
+END_TEST
+
+static int settings_first = 0;
+static int settings_second = 0;
+static int settings_state = -1;
+
+static void
+settings_first_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	(void) userdata;
+
+	if (state == NGF_EVENT_PLAYING)
+		__atomic_store_n (&settings_state, ngf_client_get_event_state (client, id), __ATOMIC_SEQ_CST);
+	if (state == NGF_EVENT_COMPLETED)
+		__atomic_add_fetch (&settings_first, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+settings_second_cb (NgfClient *client, uint32_t id, NgfEventState state, void *userdata)
+{
+	(void) client;
+	(void) id;
+	(void) userdata;
+
+	if (state == NGF_EVENT_COMPLETED)
+		__atomic_add_fetch (&settings_second, 1, __ATOMIC_SEQ_CST);
+}
+
+START_TEST (test_threaded_settings)
+{
+	DBusConnection *connection = NULL;
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	uint32_t id = 0;
+	int i;
+
+	connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	stub = backend_stub_new (connection);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	client = ngf_client_create_threaded (getenv ("DBUS_SESSION_BUS_ADDRESS"));
+	fail_unless (client != NULL);
+
+	/* Settings made on this thread are applied by the I/O thread. */
+
+	settings_first = 0;
+	settings_second = 0;
+	settings_state = -1;
+	ngf_client_set_callback (client, settings_first_cb, NULL);
+	id = ngf_client_play_event (client, "sms", NULL);
+	fail_unless (id != 0);
+
+	for (i = 0; i < 500 && __atomic_load_n (&settings_first, __ATOMIC_SEQ_CST) < 1; i++)
+		backend_stub_iterate (&connection, 1, 10);
+	fail_unless (settings_first == 1);
+
+	ngf_client_set_callback (client, settings_second_cb, NULL);
+	fail_unless (ngf_client_play_event (client, "sms", NULL) != 0);
+
+	for (i = 0; i < 500 && __atomic_load_n (&settings_second, __ATOMIC_SEQ_CST) < 1; i++)
+		backend_stub_iterate (&connection, 1, 10);
+
+	fail_unless (settings_first == 1);
+	fail_unless (settings_second == 1);
+
+	/* Event state is known on the I/O thread only. */
+	fail_unless (settings_state == NGF_EVENT_PLAYING);
+	fail_unless (ngf_client_get_event_state (client, id) == -1);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	dbus_connection_close (connection);
+	dbus_connection_unref (connection);
+}
+END_TEST
+
+static int async_connected = -1;
+
+static void
+async_connect_cb (NgfClient *client, int connected, void *userdata)
+{
+	(void) client;
+	(void) userdata;
+
+	__atomic_store_n (&async_connected, connected, __ATOMIC_SEQ_CST);
+}
+
+START_TEST (test_async_client)
+{
+	DBusConnection *connection = NULL;
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	Listener l;
+	uint32_t id = 0;
+	int i;
+
+	connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	stub = backend_stub_new (connection);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	/* Plays made right away wait for the connection. */
+	async_connected = -1;
+	threaded_completed = 0;
+	client = ngf_client_create_async (getenv ("DBUS_SESSION_BUS_ADDRESS"), async_connect_cb, NULL);
+	fail_unless (client != NULL);
+	ngf_client_set_callback (client, threaded_state_cb, NULL);
+
+	for (i = 0; i < 3; i++)
+		fail_unless (ngf_client_play_event (client, "sms", NULL) != 0);
+
+	for (i = 0; i < 500 && __atomic_load_n (&threaded_completed, __ATOMIC_SEQ_CST) < 3; i++)
+		backend_stub_iterate (&connection, 1, 10);
+
+	fail_unless (async_connected == 1);
+	fail_unless (threaded_completed == 3);
+	fail_unless (backend_stub_num_plays (stub) == 3);
+	ngf_client_destroy (client);
+
+	/* Nothing listening, plays fail once connecting does. */
+	async_connected = -1;
+	memset (&l, 0, sizeof (l));
+	client = ngf_client_create_async ("unix:path=/nonexistent/ngf-test", async_connect_cb, NULL);
+	fail_unless (client != NULL);
+	ngf_client_set_callback (client, listener_cb, &l);
+
+	id = ngf_client_play_event (client, "sms", NULL);
+	fail_unless (id != 0);
+
+	ngf_client_destroy (client);
+	fail_unless (async_connected == 0);
+	fail_unless (l.num_states == 1 && l.states[0] == NGF_EVENT_FAILED);
+	fail_unless (backend_stub_num_plays (stub) == 3);
+
+	backend_stub_free (stub);
+
+	dbus_connection_close (connection);
+	dbus_connection_unref (connection);
+}
+END_TEST
+
+static int scheduled_sent = 0;
+static int64_t scheduled_late = -1;
+
+static void
+schedule_cb (NgfClient *client, uint32_t id, int64_t late_us, void *userdata)
+{
+	(void) client;
+	(void) id;
+	(void) userdata;
+
+	__atomic_store_n (&scheduled_late, late_us, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch (&scheduled_sent, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+deadline_in (struct timespec *at, int ms)
+{
+	clock_gettime (CLOCK_MONOTONIC, at);
+	at->tv_nsec += (long) ms * 1000000;
+	at->tv_sec += at->tv_nsec / 1000000000;
+	at->tv_nsec %= 1000000000;
+}
+
+START_TEST (test_play_at)
+{
+	DBusConnection *connection = NULL;
+	DBusConnection *client_connection = NULL;
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	struct timespec at, now;
+	uint32_t stopped = 0;
+	int i;
+
+	connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	stub = backend_stub_new (connection);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	client = ngf_client_create_threaded (getenv ("DBUS_SESSION_BUS_ADDRESS"));
+	fail_unless (client != NULL);
+	ngf_client_set_callback (client, threaded_state_cb, NULL);
+	ngf_client_set_schedule_callback (client, schedule_cb, NULL);
+
+	/* Nothing goes out before the deadline, a stopped play never does
+	   and completes right away. */
+	threaded_completed = 0;
+	threaded_first_completed = 0;
+	scheduled_sent = 0;
+	deadline_in (&at, 50);
+	fail_unless (ngf_client_play_event_at (client, "sms", NULL, &at) != 0);
+	stopped = ngf_client_play_event_at (client, "sms", NULL, &at);
+	fail_unless (stopped != 0);
+	ngf_client_stop_event (client, stopped);
+
+	backend_stub_iterate (&connection, 1, 10);
+	fail_unless (backend_stub_num_plays (stub) == 0);
+
+	for (i = 0; i < 500 && __atomic_load_n (&threaded_completed, __ATOMIC_SEQ_CST) < 2; i++)
+		backend_stub_iterate (&connection, 1, 10);
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	fail_unless (now.tv_sec > at.tv_sec || (now.tv_sec == at.tv_sec && now.tv_nsec >= at.tv_nsec));
+	fail_unless (threaded_completed == 2);
+	fail_unless (threaded_first_completed == stopped);
+	fail_unless (scheduled_sent == 1 && scheduled_late >= 0);
+
+	backend_stub_iterate (&connection, 1, 20);
+	fail_unless (backend_stub_num_plays (stub) == 1);
+	ngf_client_destroy (client);
+
+	/* Left to dbus-glib alone, nothing would ever send it. */
+	client_connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	dbus_connection_setup_with_g_main (client_connection, NULL);
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, client_connection);
+	deadline_in (&at, 20);
+	fail_unless (ngf_client_play_event_at (client, "sms", NULL, &at) == 0);
+	ngf_client_destroy (client);
+	dbus_connection_close (client_connection);
+	dbus_connection_unref (client_connection);
+
+	/* Without a thread, the play is sent when dispatched. */
+	client_connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, client_connection);
+	ngf_client_set_schedule_callback (client, schedule_cb, NULL);
+	fail_unless (ngf_client_get_fd (client, NULL) >= 0);
+
+	scheduled_sent = 0;
+	deadline_in (&at, 20);
+	fail_unless (ngf_client_play_event_at (client, "sms", NULL, &at) != 0);
+	fail_unless (ngf_client_get_timeout (client) >= 0 && ngf_client_get_timeout (client) <= 20);
+
+	drive_for (client, connection, 10);
+	fail_unless (scheduled_sent == 0);
+
+	drive_for (client, connection, 40);
+	fail_unless (scheduled_sent == 1 && scheduled_late >= 0);
+	fail_unless (backend_stub_num_plays (stub) == 2);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	dbus_connection_close (client_connection);
+	dbus_connection_unref (client_connection);
+	dbus_connection_close (connection);
+	dbus_connection_unref (connection);
+}
+END_TEST
+
+START_TEST (test_max_duration)
+{
+	DBusConnection *connection = NULL;
+	DBusConnection *client_connection = NULL;
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	struct timespec at, now;
+	uint32_t early = 0;
+	int i;
+
+	connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	stub = backend_stub_new (connection);
+	fail_unless (stub != NULL);
+
+	/* Left to dbus-glib alone, nothing would ever stop it. */
+	client_connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	dbus_connection_setup_with_g_main (client_connection, NULL);
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, client_connection);
+	fail_unless (ngf_client_play_event_with_duration (client, "sms", NULL, 40) == 0);
+	ngf_client_destroy (client);
+	dbus_connection_close (client_connection);
+	dbus_connection_unref (client_connection);
+
+	client_connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, client_connection);
+	fail_unless (ngf_client_get_fd (client, NULL) >= 0);
+
+	/* Only the plays with a max duration are stopped by the client, one
+	   stopped early is not stopped again. */
+	fail_unless (ngf_client_play_event_with_duration (client, "sms", NULL, 40) != 0);
+	fail_unless (ngf_client_play_event_with_duration (client, "sms", NULL, 0) != 0);
+	early = ngf_client_play_event_with_duration (client, "sms", NULL, 40);
+	fail_unless (early != 0);
+	fail_unless (ngf_client_get_timeout (client) >= 0 && ngf_client_get_timeout (client) <= 40);
+
+	drive_for (client, connection, 15);
+	fail_unless (backend_stub_num_plays (stub) == 3);
+	fail_unless (backend_stub_num_stops (stub) == 0);
+
+	ngf_client_stop_event (client, early);
+	drive_for (client, connection, 10);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+
+	drive_for (client, connection, 50);
+	fail_unless (backend_stub_num_stops (stub) == 2);
+
+	/* The one without a limit is stopped along with the client. */
+	ngf_client_destroy (client);
+	backend_stub_pump (&connection, 1, 20);
+	fail_unless (backend_stub_num_stops (stub) == 3);
+
+	/* The I/O thread of a threaded client has its timer for them. */
+	client = ngf_client_create_threaded (getenv ("DBUS_SESSION_BUS_ADDRESS"));
+	fail_unless (client != NULL);
+
+	deadline_in (&at, 30);
+	fail_unless (ngf_client_play_event_with_duration (client, "sms", NULL, 30) != 0);
+
+	for (i = 0; i < 500 && backend_stub_num_stops (stub) < 4; i++)
+		backend_stub_iterate (&connection, 1, 10);
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	fail_unless (backend_stub_num_stops (stub) == 4);
+	fail_unless (now.tv_sec > at.tv_sec || (now.tv_sec == at.tv_sec && now.tv_nsec >= at.tv_nsec));
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	dbus_connection_close (client_connection);
+	dbus_connection_unref (client_connection);
+	dbus_connection_close (connection);
+	dbus_connection_unref (connection);
+}
+END_TEST
+
+START_TEST (test_status_ring)
+{
+	DBusConnection *connection = NULL;
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	NgfStateChange changes[3];
+	NgfEventState seen[21];
+	struct pollfd pfd;
+	int completed = 0, fd = -1, i;
+	uint32_t n = 0, j;
+
+	connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	stub = backend_stub_new (connection);
+	fail_unless (stub != NULL);
+	backend_stub_set_auto_complete (stub, 1);
+
+	client = ngf_client_create_threaded (getenv ("DBUS_SESSION_BUS_ADDRESS"));
+	fail_unless (client != NULL);
+	ngf_client_set_callback (client, state_cb, NULL);
+
+	/* Small enough for the I/O thread to spill. */
+	fd = ngf_client_enable_status_ring (client, 4);
+	fail_unless (fd >= 0);
+	fail_unless (ngf_client_enable_status_ring (client, 4) == fd);
+
+	for (i = 0; i <= 20; i++)
+		seen[i] = -1;
+
+	last_state = -1;
+	for (i = 0; i < 20; i++)
+		fail_unless (ngf_client_play_event (client, "sms", NULL) == (uint32_t) (i + 1));
+
+	for (i = 0; i < 1000 && completed < 20; i++) {
+		backend_stub_iterate (&connection, 1, 1);
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll (&pfd, 1, 1) <= 0)
+			continue;
+
+		while ((n = ngf_client_read_states (client, changes, 3)) > 0) {
+			for (j = 0; j < n; j++) {
+				fail_unless (changes[j].id >= 1 && changes[j].id <= 20);
+
+				/* In order per event. */
+				if (changes[j].state == NGF_EVENT_COMPLETED) {
+					fail_unless (seen[changes[j].id] == NGF_EVENT_PLAYING);
+					completed++;
+				}
+
+				seen[changes[j].id] = changes[j].state;
+			}
+		}
+	}
+
+	fail_unless (completed == 20);
+	fail_unless (last_state == -1);
+
+	/* Drained, so no wakeup is left behind. */
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	fail_unless (poll (&pfd, 1, 0) == 0);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	dbus_connection_close (connection);
+	dbus_connection_unref (connection);
+}
+END_TEST
+
+static int window_ready = 0;
+
+static void
+window_ready_cb (NgfClient *client, void *userdata)
+{
+	(void) client;
+	(void) userdata;
+
+	__atomic_add_fetch (&window_ready, 1, __ATOMIC_SEQ_CST);
+}
+
+START_TEST (test_pending_window)
+{
+	DBusConnection *connections[2];
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	pthread_t threads[THREADED_PRODUCERS];
+	Producer producers[THREADED_PRODUCERS];
+	const int total = THREADED_PRODUCERS * THREADED_PLAYS;
+	struct timespec start, now;
+	Listener oldest;
+	int elapsed = 0, i;
+
+	connections[0] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	connections[1] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	/* A hung backend, plays only leave the window by timing out. */
+	stub = backend_stub_new (connections[0]);
+	fail_unless (stub != NULL);
+	backend_stub_set_silent (stub, 1);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[1]);
+	ngf_client_set_callback (client, state_cb, NULL);
+	ngf_client_set_reply_timeout (client, 300);
+	ngf_client_set_max_pending (client, 2, NGF_WINDOW_REJECT, -1);
+	ngf_client_set_ready_callback (client, window_ready_cb, NULL);
+
+	memset (&oldest, 0, sizeof (oldest));
+	oldest.id = ngf_client_play_event_full (client, "sms", NULL, listener_cb, &oldest, 0);
+	fail_unless (oldest.id != 0);
+	fail_unless (ngf_client_play_event (client, "sms", NULL) != 0);
+	fail_unless (ngf_client_play_event (client, "sms", NULL) == 0);
+
+	/* Making room fails the oldest play. */
+	ngf_client_set_max_pending (client, 2, NGF_WINDOW_DROP_OLDEST, -1);
+	fail_unless (ngf_client_play_event (client, "sms", NULL) != 0);
+	fail_unless (oldest.num_states == 1 && oldest.states[0] == NGF_EVENT_FAILED);
+
+	/* A regular client has no thread to wait on, blocking rejects. */
+	ngf_client_set_max_pending (client, 2, NGF_WINDOW_BLOCK, 50);
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	fail_unless (ngf_client_play_event (client, "sms", NULL) == 0);
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+	fail_unless (elapsed < 50);
+	fail_unless (window_ready == 0);
+
+	/* Until the replies time out. */
+	last_state = -1;
+	drive_until (client, connections[0], NGF_EVENT_FAILED, 1000);
+	ngf_client_dispatch (client);
+	fail_unless (window_ready == 1);
+	fail_unless (backend_stub_num_plays (stub) == 3);
+
+	/* The dropped play has had its say already. */
+	fail_unless (oldest.num_states == 1);
+
+	ngf_client_destroy (client);
+
+	/* Callers of a threaded client wait for room on their own thread. */
+	backend_stub_set_silent (stub, 0);
+	backend_stub_set_auto_complete (stub, 1);
+
+	client = ngf_client_create_threaded (getenv ("DBUS_SESSION_BUS_ADDRESS"));
+	fail_unless (client != NULL);
+	ngf_client_set_callback (client, threaded_state_cb, NULL);
+	ngf_client_set_max_pending (client, 2, NGF_WINDOW_BLOCK, -1);
+	ngf_client_set_ready_callback (client, window_ready_cb, NULL);
+
+	threaded_completed = 0;
+	window_ready = 0;
+	for (i = 0; i < THREADED_PRODUCERS; i++) {
+		producers[i].client = client;
+		producers[i].ids = &threaded_ids[i * THREADED_PLAYS];
+		pthread_create (&threads[i], NULL, producer_thread, &producers[i]);
+	}
+
+	for (i = 0; i < 500 && __atomic_load_n (&threaded_completed, __ATOMIC_SEQ_CST) < total; i++)
+		backend_stub_iterate (connections, 1, 10);
+
+	for (i = 0; i < THREADED_PRODUCERS; i++)
+		pthread_join (threads[i], NULL);
+
+	fail_unless (threaded_completed == total);
+	for (i = 0; i < total; i++)
+		fail_unless (threaded_ids[i] != 0);
+
+	/* Waiting producers were told on the I/O thread. */
+	fail_unless (__atomic_load_n (&window_ready, __ATOMIC_SEQ_CST) > 0);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	for (i = 0; i < 2; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+START_TEST (test_window_from_callback)
+{
+	DBusConnection *connections[3];
+	BackendStub *hung = NULL, *alarms = NULL;
+	NgfClient *client = NULL;
+	struct timespec start, now;
+	uint32_t alarm = 0, waiting = 0;
+	int elapsed = 0, i;
+
+	for (i = 0; i < 3; i++)
+		connections[i] = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+
+	hung = backend_stub_new_named (connections[1], ROUTE_SERVICE);
+	alarms = backend_stub_new_named (connections[2], ROUTE_FALLBACK);
+	fail_unless (hung != NULL && alarms != NULL);
+	backend_stub_set_silent (hung, 1);
+
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, connections[0]);
+	ngf_client_set_callback (client, limit_state_cb, NULL);
+	for (i = 0; i < 16; i++)
+		limit_states[i] = -1;
+
+	fail_unless (ngf_client_add_route (client, "touch_*", ROUTE_SERVICE, NULL));
+	fail_unless (ngf_client_add_route (client, "alarm", ROUTE_FALLBACK, NULL));
+	ngf_client_set_group_limit (client, "alarms", 1, NGF_LIMIT_QUEUE);
+	ngf_client_set_max_pending (client, 2, NGF_WINDOW_BLOCK, 500);
+
+	alarm = ngf_client_play_event_in_group (client, "alarms", "alarm", NULL);
+	waiting = ngf_client_play_event_in_group (client, "alarms", "alarm", NULL);
+	fail_unless (alarm != 0 && waiting != 0);
+	backend_stub_pump (connections, 3, 20);
+	fail_unless (limit_states[alarm] == NGF_EVENT_PLAYING);
+
+	/* Two plays to the hung backend fill the window for good. */
+	fail_unless (ngf_client_play_event (client, "touch_a", NULL) != 0);
+	fail_unless (ngf_client_play_event (client, "touch_b", NULL) != 0);
+
+	/* The queued play goes out when its backend is seen leaving, from
+	   within dispatch. A regular client never waits for room, it fails
+	   at once. */
+	backend_stub_free (alarms);
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (i = 0; i < 50 && limit_states[waiting] == -1; i++)
+		backend_stub_iterate (connections, 3, 10);
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+
+	fail_unless (limit_states[alarm] == NGF_EVENT_FAILED);
+	fail_unless (limit_states[waiting] == NGF_EVENT_FAILED);
+	fail_unless (elapsed < 250);
+
+	ngf_client_destroy (client);
+	backend_stub_free (hung);
+
+	for (i = 0; i < 3; i++) {
+		dbus_connection_close (connections[i]);
+		dbus_connection_unref (connections[i]);
+	}
+}
+END_TEST
+
+START_TEST (test_play_options)
+{
+	DBusConnection *connection = NULL;
+	DBusConnection *client_connection = NULL;
+	BackendStub *stub = NULL;
+	NgfClient *client = NULL;
+	NgfPlayOptions options = NGF_PLAY_OPTIONS_INIT;
+	struct timespec at;
+	Listener mine;
+
+	connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	stub = backend_stub_new (connection);
+	fail_unless (stub != NULL);
+
+	client_connection = dbus_bus_get_private (DBUS_BUS_SESSION, NULL);
+	client = ngf_client_create (NGF_TRANSPORT_DBUS, client_connection);
+	fail_unless (ngf_client_get_fd (client, NULL) >= 0);
+
+	/* No options at all plays like ngf_client_play_event. */
+	fail_unless (ngf_client_play_event_with_options (client, "sms", NULL, NULL) != 0);
+
+	/* A group, a max duration and a callback of its own in one play. */
+	memset (&mine, 0, sizeof (mine));
+	options.group = "alerts";
+	options.max_duration_ms = 40;
+	options.callback = listener_cb;
+	options.userdata = &mine;
+	options.state_mask = NGF_EVENT_STATE_MASK_FINAL;
+	mine.id = ngf_client_play_event_with_options (client, "ringtone", NULL, &options);
+	fail_unless (mine.id != 0);
+
+	drive_for (client, connection, 15);
+	fail_unless (backend_stub_num_plays (stub) == 2);
+	fail_unless (mine.num_states == 0);
+
+	drive_for (client, connection, 60);
+	fail_unless (backend_stub_num_stops (stub) == 1);
+	fail_unless (mine.num_states == 1 && mine.states[0] == NGF_EVENT_COMPLETED);
+
+	/* A scheduled play takes no other option. */
+	deadline_in (&at, 10);
+	options.deadline = &at;
+	fail_unless (ngf_client_play_event_with_options (client, "sms", NULL, &options) == 0);
+
+	options = (NgfPlayOptions) NGF_PLAY_OPTIONS_INIT;
+	options.lane = -2;
+	fail_unless (ngf_client_play_event_with_options (client, "sms", NULL, &options) == 0);
+
+	ngf_client_destroy (client);
+	backend_stub_free (stub);
+
+	dbus_connection_close (client_connection);
+	dbus_connection_unref (client_connection);
+	dbus_connection_close (connection);
+	dbus_connection_unref (connection);
+}
+END_TEST
+
+int
+main (int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+
+	int num_failed = 0;
+
+	Suite *s = NULL;
+	TCase *tc = NULL;
+	SRunner *sr = NULL;
+
+	g_type_init ();
+
+	s = suite_create ("Client interface");
+
+	tc = tcase_create ("Create client");
+	tcase_add_test (tc, test_create_client);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Failed creation of client");
+	tcase_add_test (tc, test_failed_create_client);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Play with NULL event");
+	tcase_add_test (tc, test_play_event_NULL);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Play with NULL client");
+	tcase_add_test (tc, test_play_client_NULL);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Play sms");
+	tcase_add_test (tc, test_play);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Callback");
+	tcase_add_test (tc, test_callback);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Unicast status");
+	tcase_add_test (tc, test_unicast_status);
+	tcase_add_test (tc, test_unicast_status_call);
+	tcase_add_test (tc, test_unicast_status_fallback);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Shared connection");
+	tcase_add_test (tc, test_shared_connection);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Lazy subscription");
+	tcase_add_test (tc, test_lazy_subscription);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Asynchronous destroy");
+	tcase_add_test (tc, test_destroy_async);
+	tcase_add_test (tc, test_destroy_async_dispatched);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Epoll dispatch");
+	tcase_add_test (tc, test_epoll_dispatch);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("GLib source");
+	tcase_add_test (tc, test_glib_source);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Lanes");
+	tcase_add_test (tc, test_lanes);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Timeouts");
+	tcase_add_test (tc, test_timeouts);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Backend presence");
+	tcase_add_test (tc, test_backend_presence);
+	suite_add_tcase (s, tc);
+
+#ifdef HAVE_SDBUS
+	tc = tcase_create ("sd-bus transport");
+	tcase_add_test (tc, test_sdbus_transport);
+	suite_add_tcase (s, tc);
+#endif
+
+	tc = tcase_create ("Event state");
+	tcase_add_test (tc, test_event_state);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Groups");
+	tcase_add_test (tc, test_groups);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Group limits");
+	tcase_add_test (tc, test_group_limits);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Batch callback");
+	tcase_add_test (tc, test_batch_callback);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Event callback");
+	tcase_add_test (tc, test_event_callback);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Deduplication");
+	tcase_add_test (tc, test_dedup);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Rate limits");
+	tcase_add_test (tc, test_rate_limit);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Routes");
+	tcase_add_test (tc, test_routes);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Send window");
+	tcase_add_test (tc, test_send_window);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Threaded client");
+	tcase_add_test (tc, test_threaded_client);
+	tcase_add_test (tc, test_threaded_destroy_async);
+	tcase_add_test (tc, test_threaded_settings);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Async client");
+	tcase_add_test (tc, test_async_client);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Scheduled plays");
+	tcase_add_test (tc, test_play_at);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Play options");
+	tcase_add_test (tc, test_play_options);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Max duration");
+	tcase_add_test (tc, test_max_duration);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Status ring");
+	tcase_add_test (tc, test_status_ring);
+	suite_add_tcase (s, tc);
+
+	tc = tcase_create ("Pending window");
+	tcase_add_test (tc, test_pending_window);
+	tcase_add_test (tc, test_window_from_callback);
 	suite_add_tcase (s, tc);
 
 	sr = srunner_create (s);
@@ -334,6 +334,41 @@ START_TEST (test_copy)
 }
 END_TEST
 
+START_TEST (test_hash_equal)
+{
+    NgfProplist *a = NULL;
+    NgfProplist *b = NULL;
+    uint32_t hash;
+
+    a = ngf_proplist_new ();
+    b = ngf_proplist_new ();
+
+    fail_unless (ngf_proplist_equal (a, NULL));
+    fail_unless (ngf_proplist_hash (a) == ngf_proplist_hash (NULL));
+
+    ngf_proplist_sets (a, TEST_STR, TEST_STR_VALUE);
+    ngf_proplist_set_as_integer (a, TEST_INT, TEST_INT_VALUE);
+
+    /* Same entries in another order */
+    ngf_proplist_set_as_integer (b, TEST_INT, TEST_INT_VALUE);
+    ngf_proplist_sets (b, TEST_STR, TEST_STR_VALUE);
+
+    hash = ngf_proplist_hash (a);
+    fail_unless (hash == ngf_proplist_hash (b));
+    fail_unless (ngf_proplist_equal (a, b));
+
+    /* Same value with another type */
+    ngf_proplist_set_as_unsigned (a, TEST_UINT, 1);
+    ngf_proplist_set_as_boolean (b, TEST_UINT, 1);
+    fail_unless (ngf_proplist_hash (a) != hash);
+    fail_unless (!ngf_proplist_equal (a, b));
+    fail_unless (!ngf_proplist_equal (a, NULL));
+
+    ngf_proplist_free (a);
+    ngf_proplist_free (b);
+}
+END_TEST
+
 START_TEST (test_get_keys)
 {
     NgfProplist *proplist = NULL;
@@ -403,6 +438,10 @@ main (int argc, char *argv[])
     tcase_add_test (tc, test_get_keys);
     suite_add_tcase (s, tc);
 
+    tc = tcase_create ("Hash and equality");
+    tcase_add_test (tc, test_hash_equal);
+    suite_add_tcase (s, tc);
+
     tc = tcase_create ("Test copy");
     tcase_add_test (tc, test_copy);
     suite_add_tcase (s, tc);